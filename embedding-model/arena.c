@@ -0,0 +1,40 @@
+#include "arena.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+int init_arena(Arena* arena, size_t size) {
+    size = arena_size(size);
+    arena->base = size ? aligned_alloc(ARENA_ALIGNMENT, size) : NULL;
+    arena->size = arena->base ? size : 0;
+    arena->used = 0;
+    if (size && !arena->base) {
+        fprintf(stderr, "Failed to allocate %zu byte arena\n", size);
+        return -1;
+    }
+    return 0;
+}
+
+void* arena_alloc(Arena* arena, size_t bytes) {
+    size_t size = arena_size(bytes);
+    if (size > arena->size - arena->used) return NULL;
+    void* ptr = arena->base + arena->used;
+    arena->used += size;
+    return ptr;
+}
+
+void arena_reset(Arena* arena) {
+    arena->used = 0;
+}
+
+int arena_reserve(Arena* arena, size_t size) {
+    if (size <= arena->size) return 0;
+    free_arena(arena);
+    return init_arena(arena, size);
+}
+
+void free_arena(Arena* arena) {
+    free(arena->base);
+    arena->base = NULL;
+    arena->size = 0;
+    arena->used = 0;
+}
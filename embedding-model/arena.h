@@ -0,0 +1,31 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Every arena allocation starts on this boundary, so SIMD kernels can use aligned loads
+#define ARENA_ALIGNMENT 64
+
+// Bump allocator for per-call scratch: allocations are carved from one block
+// and released all at once by arena_reset.
+typedef struct {
+    char* base;
+    size_t size;
+    size_t used;
+} Arena;
+
+int init_arena(Arena* arena, size_t size);
+// Returns NULL when the arena cannot fit bytes more
+void* arena_alloc(Arena* arena, size_t bytes);
+void arena_reset(Arena* arena);
+// Makes room for at least size bytes. Only valid right after arena_reset:
+// growing replaces the block.
+int arena_reserve(Arena* arena, size_t size);
+void free_arena(Arena* arena);
+
+// Bytes arena_alloc consumes for a request of bytes
+static inline size_t arena_size(size_t bytes) {
+    return (bytes + ARENA_ALIGNMENT - 1) / ARENA_ALIGNMENT * ARENA_ALIGNMENT;
+}
+
+#endif // ARENA_H
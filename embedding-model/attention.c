@@ -0,0 +1,153 @@
+#include "attention.h"
+#include <stddef.h>
+#include <math.h>
+
+// Queries handled together: their K/V tiles are shared
+#define ATTENTION_QUERY_BLOCK 32
+// Keys scored per online softmax step
+#define ATTENTION_KEY_BLOCK 64
+
+typedef struct AttentionJob AttentionJob;
+typedef void (*AttentionBlock)(const AttentionJob* job, int b, int h, int q0, int qn);
+
+struct AttentionJob {
+    AttentionBlock block;
+    const float* qkv;
+    const float* mask;
+    float* context;
+    int seq_len;
+    int num_heads;
+    int head_dim;
+    int query_blocks;
+};
+
+// One head of one sequence for queries [q0, q0 + qn). Inlined into copies
+// with a constant hd for the head sizes of the common BERT shapes.
+static inline __attribute__((always_inline))
+void attention_block_body(const AttentionJob* job, int b, int h, int q0, int qn, int hd) {
+    int width = job->num_heads * hd;
+    int stride = 3 * width;
+    int seq_len = job->seq_len;
+    const float* rows = job->qkv + (size_t)b * seq_len * stride;
+    const float* mask = job->mask + (size_t)b * seq_len;
+    float scale = 1.0f / sqrtf((float)hd);
+
+    float q[ATTENTION_QUERY_BLOCK][ATTENTION_MAX_HEAD_DIM];
+    float acc[ATTENTION_QUERY_BLOCK][ATTENTION_MAX_HEAD_DIM];
+    float row_max[ATTENTION_QUERY_BLOCK];
+    float row_sum[ATTENTION_QUERY_BLOCK];
+    float key_t[ATTENTION_MAX_HEAD_DIM][ATTENTION_KEY_BLOCK];
+    float scores[ATTENTION_KEY_BLOCK];
+
+    for (int i = 0; i < qn; i++) {
+        const float* query = rows + (size_t)(q0 + i) * stride + h * hd;
+        for (int d = 0; d < hd; d++) {
+            q[i][d] = query[d] * scale;
+            acc[i][d] = 0.0f;
+        }
+        row_max[i] = -INFINITY;
+        row_sum[i] = 0.0f;
+    }
+
+    for (int k0 = 0; k0 < seq_len; k0 += ATTENTION_KEY_BLOCK) {
+        int kn = seq_len - k0 < ATTENTION_KEY_BLOCK ? seq_len - k0 : ATTENTION_KEY_BLOCK;
+
+        // Padding sits at the end of each sequence, so whole tiles are often masked
+        int live = 0;
+        for (int j = 0; j < kn; j++) {
+            live |= mask[k0 + j] != 0.0f;
+        }
+        if (!live) continue;
+
+        // Transposed so each query's scores are a contiguous axpy over keys
+        for (int j = 0; j < kn; j++) {
+            const float* key = rows + (size_t)(k0 + j) * stride + width + h * hd;
+            for (int d = 0; d < hd; d++) {
+                key_t[d][j] = key[d];
+            }
+        }
+
+        for (int i = 0; i < qn; i++) {
+            for (int j = 0; j < kn; j++) {
+                scores[j] = 0.0f;
+            }
+            for (int d = 0; d < hd; d++) {
+                float qd = q[i][d];
+                for (int j = 0; j < kn; j++) {
+                    scores[j] += qd * key_t[d][j];
+                }
+            }
+
+            float block_max = -INFINITY;
+            for (int j = 0; j < kn; j++) {
+                if (mask[k0 + j] == 0.0f) scores[j] = -INFINITY;
+                block_max = fmaxf(block_max, scores[j]);
+            }
+
+            // Rescale what was accumulated against the previous running max
+            float new_max = fmaxf(row_max[i], block_max);
+            float correction = expf(row_max[i] - new_max);
+            row_sum[i] *= correction;
+            for (int d = 0; d < hd; d++) {
+                acc[i][d] *= correction;
+            }
+
+            for (int j = 0; j < kn; j++) {
+                float p = expf(scores[j] - new_max);
+                if (p == 0.0f) continue;
+                row_sum[i] += p;
+                const float* value = rows + (size_t)(k0 + j) * stride + 2 * width + h * hd;
+                for (int d = 0; d < hd; d++) {
+                    acc[i][d] += p * value[d];
+                }
+            }
+            row_max[i] = new_max;
+        }
+    }
+
+    for (int i = 0; i < qn; i++) {
+        float* out = job->context + (size_t)(b * seq_len + q0 + i) * width + h * hd;
+        float inverse = row_sum[i] > 0.0f ? 1.0f / row_sum[i] : 0.0f;
+        for (int d = 0; d < hd; d++) {
+            out[d] = acc[i][d] * inverse;
+        }
+    }
+}
+
+static void attention_block(const AttentionJob* job, int b, int h, int q0, int qn) {
+    attention_block_body(job, b, h, q0, qn, job->head_dim);
+}
+
+// 384 / 12 heads (MiniLM, BERT-small)
+static void attention_block_32(const AttentionJob* job, int b, int h, int q0, int qn) {
+    attention_block_body(job, b, h, q0, qn, 32);
+}
+
+// 768 / 12 heads (BERT-base)
+static void attention_block_64(const AttentionJob* job, int b, int h, int q0, int qn) {
+    attention_block_body(job, b, h, q0, qn, 64);
+}
+
+// Units are numbered (sequence, head, query block), query block fastest
+static void attention_range(void* arg, int begin, int end) {
+    AttentionJob* job = arg;
+    for (int unit = begin; unit < end; unit++) {
+        int block = unit % job->query_blocks;
+        int head = unit / job->query_blocks % job->num_heads;
+        int b = unit / job->query_blocks / job->num_heads;
+
+        int q0 = block * ATTENTION_QUERY_BLOCK;
+        int qn = job->seq_len - q0 < ATTENTION_QUERY_BLOCK ? job->seq_len - q0 : ATTENTION_QUERY_BLOCK;
+        job->block(job, b, head, q0, qn);
+    }
+}
+
+void multi_head_attention(const float* qkv, const float* mask, int batch, int seq_len, int num_heads, int head_dim,
+                         float* context, ThreadPool* pool) {
+    AttentionJob job = {
+        head_dim == 32 ? attention_block_32 : head_dim == 64 ? attention_block_64 : attention_block,
+        qkv, mask, context, seq_len, num_heads, head_dim,
+        (seq_len + ATTENTION_QUERY_BLOCK - 1) / ATTENTION_QUERY_BLOCK
+    };
+    parallel_for(pool, batch * num_heads * job.query_blocks, attention_range, &job);
+}
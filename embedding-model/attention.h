@@ -0,0 +1,21 @@
+#ifndef ATTENTION_H
+#define ATTENTION_H
+
+#include "thread_pool.h"
+
+// Largest head dimension the attention kernel keeps in its register/L1 tiles
+#define ATTENTION_MAX_HEAD_DIM 64
+
+// Multi-head scaled dot-product attention over a padded batch.
+//
+// qkv holds batch x seq_len rows of [Q | K | V], each num_heads * head_dim wide,
+// as produced by the fused QKV projection. mask is batch x seq_len, 0 for
+// padding keys. context receives batch x seq_len rows of num_heads * head_dim.
+//
+// Scores are computed a tile of keys at a time with an online softmax, so the
+// seq_len x seq_len matrix is never stored. (sequence, head, query block)
+// units are spread over pool; pool may be NULL.
+void multi_head_attention(const float* qkv, const float* mask, int batch, int seq_len, int num_heads, int head_dim,
+                         float* context, ThreadPool* pool);
+
+#endif // ATTENTION_H
@@ -0,0 +1,339 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "embedding_model.h"
+#include "profile.h"
+
+#define MAX_SWEEP 16
+#define MIN_ITERATIONS 3
+
+// Benchmarks the embedding model over a sweep of sequence lengths, batch sizes
+// and thread counts. Every configuration reports sentences/s, tokens/s, p50/p99
+// latency of one embed call and the model GFLOP/s it reached; each dense
+// projection is also timed on its own against the in-cache GEMM kernel peak.
+// Results are printed as a table and optionally written as JSON.
+//
+// Usage: bench-embedding [options]
+//   --model PATH --vocab PATH    model files (default ./embedding-model/...)
+//   --type f32|q8|f16            weight type (default f32)
+//   --seq 8,16,...  --batch 1,8,32  --threads 1,N   sweep values
+//   --max-tokens N               skip batches of more than N tokens (default 4096)
+//   --min-time S                 seconds to measure per configuration (default 0.5)
+//   --peak-gflops X              per-thread peak to compare against instead of measuring it
+//   --json PATH                  write results as JSON
+//   --trace PATH                 with EMBED_PROFILE: print the operator table and
+//                                write a Chrome trace of the last configuration
+
+typedef struct {
+    const char* name;
+    const PackedMatrix* weight;
+    const float* bias;
+    GemmActivation activation;
+} Projection;
+
+typedef struct {
+    const char* name;
+    int m, k, n;
+    double gflop;
+    double gflops;
+} ProjectionResult;
+
+typedef struct {
+    int threads, batch, seq_len, iterations;
+    double sentences_per_sec, tokens_per_sec;
+    double p50_ms, p99_ms, mean_ms;
+    double gflops;
+    ProjectionResult projections[5];
+} BenchResult;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int parse_list(const char* text, int* values) {
+    int count = 0;
+    while (*text && count < MAX_SWEEP) {
+        values[count++] = atoi(text);
+        const char* comma = strchr(text, ',');
+        if (!comma) break;
+        text = comma + 1;
+    }
+    return count;
+}
+
+static int compare_doubles(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile of sorted values
+static double percentile(const double* sorted, int n, double p) {
+    int rank = (int)(p * n + 0.999999);
+    return sorted[rank < 1 ? 0 : rank > n ? n - 1 : rank - 1];
+}
+
+// FLOPs of one forward pass over batch sequences of seq_len tokens: the dense
+// projections, the two attention matmuls and the pooler
+static double forward_flops(const ModelConfig* c, int batch, int seq_len) {
+    double rows = (double)batch * seq_len;
+    double dim = c->embedding_dim;
+    double dense = 2.0 * rows * dim * (3 * dim + dim + 2.0 * c->intermediate_size);
+    double attention = 4.0 * batch * (double)seq_len * seq_len * dim;
+    return c->num_hidden_layers * (dense + attention) + 2.0 * batch * dim * dim;
+}
+
+static void random_fill(float* data, size_t count) {
+    for (size_t i = 0; i < count; i++) data[i] = (float)rand() / RAND_MAX * 2.0f - 1.0f;
+}
+
+// Runs gemm on input until min_time passes; returns GFLOP/s
+static double time_gemm(const Projection* p, const float* input, int m, float* output, void* workspace, ThreadPool* pool,
+                        double min_time) {
+    GemmEpilogue epilogue = { p->bias, p->activation };
+    gemm(input, m, p->weight, output, &epilogue, workspace, pool);  // warm up
+    int iterations = 0;
+    double start = now_seconds(), elapsed;
+    do {
+        gemm(input, m, p->weight, output, &epilogue, workspace, pool);
+        iterations++;
+        elapsed = now_seconds() - start;
+    } while (elapsed < min_time);
+    return 2.0 * m * p->weight->k * p->weight->n * iterations / elapsed * 1e-9;
+}
+
+// Best single-thread GEMM rate over a few runs on a problem that stays in L2:
+// the ceiling the projections are compared against
+static double measure_kernel_peak(const PackedMatrix* weight, double min_time) {
+    int m = 168;  // a multiple of every kernel's tile height
+    Projection p = { "peak", weight, NULL, GEMM_IDENTITY };
+    float* input = malloc((size_t)m * weight->k * sizeof(float));
+    float* output = malloc((size_t)m * weight->n * sizeof(float));
+    void* workspace = malloc(gemm_workspace_size(m, weight) + 1);
+    random_fill(input, (size_t)m * weight->k);
+
+    double best = 0.0;
+    for (int run = 0; run < 5; run++) {
+        double gflops = time_gemm(&p, input, m, output, workspace, NULL, min_time / 5);
+        if (gflops > best) best = gflops;
+    }
+    free(input);
+    free(output);
+    free(workspace);
+    return best;
+}
+
+static void bench_projections(EmbeddingSession* session, int batch, int seq_len, double min_time, BenchResult* result) {
+    const Model* model = session->ctx->model;
+    const AttentionWeights* attention = &model->layers[0].attention;
+    const FFNWeights* ffn = &model->layers[0].ffn;
+    Projection projections[5] = {
+        { "qkv", &attention->qkv, attention->qkv_bias, GEMM_IDENTITY },
+        { "attention_output", &attention->output, attention->output_bias, GEMM_IDENTITY },
+        { "ffn_intermediate", &ffn->intermediate, ffn->intermediate_bias, model->config.hidden_act },
+        { "ffn_output", &ffn->output, ffn->output_bias, GEMM_IDENTITY },
+        { "pooler", &model->pooler_weight, model->pooler_bias, GEMM_TANH },
+    };
+
+    int rows = batch * seq_len;
+    size_t width = model->config.intermediate_size > 3 * model->config.embedding_dim ? model->config.intermediate_size
+                                                                                     : 3 * model->config.embedding_dim;
+    size_t workspace_size = gemm_workspace_size(rows, &ffn->output) + 1;
+    float* input = malloc((size_t)rows * width * sizeof(float));
+    float* output = malloc((size_t)rows * width * sizeof(float));
+    void* workspace = malloc(workspace_size);
+    random_fill(input, (size_t)rows * width);
+
+    for (int i = 0; i < 5; i++) {
+        const Projection* p = &projections[i];
+        int m = i == 4 ? batch : rows;  // the pooler only sees one row per sequence
+        ProjectionResult* r = &result->projections[i];
+        r->name = p->name;
+        r->m = m;
+        r->k = p->weight->k;
+        r->n = p->weight->n;
+        r->gflop = 2.0 * m * r->k * r->n * 1e-9;
+        r->gflops = time_gemm(p, input, m, output, workspace, session->pool, min_time / 5);
+    }
+    free(input);
+    free(output);
+    free(workspace);
+}
+
+static void bench_config(EmbeddingSession* session, int batch, int seq_len, double min_time, BenchResult* result) {
+    const Tokenizer* tokenizer = session->ctx->tokenizer;
+    int* tokens = malloc((size_t)batch * seq_len * sizeof(int));
+    const int** sequences = malloc(batch * sizeof(int*));
+    int* lengths = malloc(batch * sizeof(int));
+    float* out = malloc((size_t)batch * embedding_dim(session->ctx) * sizeof(float));
+
+    // Random word pieces framed by [CLS] and [SEP], exactly seq_len ids each
+    for (int b = 0; b < batch; b++) {
+        int* sequence = tokens + (size_t)b * seq_len;
+        for (int i = 0; i < seq_len; i++) {
+            sequence[i] = 1000 + rand() % (tokenizer->vocab_size - 1000);
+        }
+        sequence[0] = tokenizer->cls_id;
+        if (seq_len > 1) sequence[seq_len - 1] = tokenizer->sep_id;
+        sequences[b] = sequence;
+        lengths[b] = seq_len;
+    }
+
+    embed_tokenized(session, sequences, lengths, batch, out);  // warm up
+
+    int capacity = 64, iterations = 0;
+    double* latencies = malloc(capacity * sizeof(double));
+    double start = now_seconds(), elapsed;
+    do {
+        double call_start = now_seconds();
+        embed_tokenized(session, sequences, lengths, batch, out);
+        if (iterations == capacity) latencies = realloc(latencies, (capacity *= 2) * sizeof(double));
+        latencies[iterations++] = now_seconds() - call_start;
+        elapsed = now_seconds() - start;
+    } while (elapsed < min_time || iterations < MIN_ITERATIONS);
+
+    qsort(latencies, iterations, sizeof(double), compare_doubles);
+    double total = 0.0;
+    for (int i = 0; i < iterations; i++) total += latencies[i];
+
+    result->batch = batch;
+    result->seq_len = seq_len;
+    result->iterations = iterations;
+    result->sentences_per_sec = (double)batch * iterations / total;
+    result->tokens_per_sec = (double)batch * seq_len * iterations / total;
+    result->p50_ms = percentile(latencies, iterations, 0.50) * 1e3;
+    result->p99_ms = percentile(latencies, iterations, 0.99) * 1e3;
+    result->mean_ms = total / iterations * 1e3;
+    result->gflops = forward_flops(&session->ctx->model->config, batch, seq_len) * iterations / total * 1e-9;
+
+    free(latencies);
+    free(tokens);
+    free(sequences);
+    free(lengths);
+    free(out);
+}
+
+static void write_json(const char* path, const ModelConfig* config, const char* type, double peak,
+                       const BenchResult* results, int count) {
+    FILE* f = fopen(path, "w");
+    if (!f) {
+        fprintf(stderr, "Failed to open %s\n", path);
+        return;
+    }
+    fprintf(f, "{\n  \"model\": {\"hidden_size\": %d, \"num_hidden_layers\": %d, \"num_attention_heads\": %d, "
+               "\"intermediate_size\": %d},\n",
+            config->embedding_dim, config->num_hidden_layers, config->num_attention_heads, config->intermediate_size);
+    fprintf(f, "  \"kernel\": \"%s\",\n  \"weights\": \"%s\",\n  \"peak_gflops_per_thread\": %.3f,\n  \"results\": [\n",
+            gemm_kernel_name(), type, peak);
+    for (int i = 0; i < count; i++) {
+        const BenchResult* r = &results[i];
+        fprintf(f, "    {\"threads\": %d, \"batch\": %d, \"seq_len\": %d, \"iterations\": %d, "
+                   "\"sentences_per_sec\": %.3f, \"tokens_per_sec\": %.3f, "
+                   "\"latency_ms\": {\"p50\": %.4f, \"p99\": %.4f, \"mean\": %.4f}, \"gflops\": %.3f,\n"
+                   "     \"projections\": [",
+                r->threads, r->batch, r->seq_len, r->iterations, r->sentences_per_sec, r->tokens_per_sec,
+                r->p50_ms, r->p99_ms, r->mean_ms, r->gflops);
+        for (int p = 0; p < 5; p++) {
+            const ProjectionResult* pr = &r->projections[p];
+            fprintf(f, "%s\n       {\"name\": \"%s\", \"m\": %d, \"k\": %d, \"n\": %d, \"gflop\": %.6f, \"gflops\": %.3f, "
+                       "\"efficiency\": %.4f}",
+                    p ? "," : "", pr->name, pr->m, pr->k, pr->n, pr->gflop, pr->gflops, pr->gflops / (peak * r->threads));
+        }
+        fprintf(f, "]}%s\n", i < count - 1 ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    fclose(f);
+}
+
+int main(int argc, char* argv[]) {
+    const char* model_file = "./embedding-model/model.bin";
+    const char* vocab_file = "./embedding-model/vocab.txt";
+    const char* json_file = NULL;
+    const char* trace_file = NULL;
+    const char* type_name = "f32";
+    int seq_lens[MAX_SWEEP] = { 8, 16, 32, 64, 128, 256, 512 }, num_seq_lens = 7;
+    int batches[MAX_SWEEP] = { 1, 8, 32 }, num_batches = 3;
+    int threads[MAX_SWEEP] = { 1, (int)sysconf(_SC_NPROCESSORS_ONLN) }, num_threads = threads[1] > 1 ? 2 : 1;
+    int max_tokens = 4096;
+    double min_time = 0.5, peak = 0.0;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--model") == 0) model_file = argv[i + 1];
+        else if (strcmp(argv[i], "--vocab") == 0) vocab_file = argv[i + 1];
+        else if (strcmp(argv[i], "--type") == 0) type_name = argv[i + 1];
+        else if (strcmp(argv[i], "--seq") == 0) num_seq_lens = parse_list(argv[i + 1], seq_lens);
+        else if (strcmp(argv[i], "--batch") == 0) num_batches = parse_list(argv[i + 1], batches);
+        else if (strcmp(argv[i], "--threads") == 0) num_threads = parse_list(argv[i + 1], threads);
+        else if (strcmp(argv[i], "--max-tokens") == 0) max_tokens = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "--min-time") == 0) min_time = atof(argv[i + 1]);
+        else if (strcmp(argv[i], "--peak-gflops") == 0) peak = atof(argv[i + 1]);
+        else if (strcmp(argv[i], "--json") == 0) json_file = argv[i + 1];
+        else if (strcmp(argv[i], "--trace") == 0) trace_file = argv[i + 1];
+        else {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    GemmType type = strcmp(type_name, "q8") == 0 ? GEMM_Q8 : strcmp(type_name, "f16") == 0 ? GEMM_F16 : GEMM_F32;
+    EmbeddingContext* ctx = load_embedding_context(vocab_file, model_file, type);
+    if (!ctx) {
+        fprintf(stderr, "Failed to load embedding model\n");
+        return 1;
+    }
+    EmbeddingSession* session = create_embedding_session(ctx);
+    srand(1);
+
+    if (peak <= 0.0) peak = measure_kernel_peak(&ctx->model->layers[0].attention.output, min_time);
+    const ModelConfig* config = &ctx->model->config;
+    printf("Model: %d layers, hidden size %d, %d heads, intermediate size %d\n", config->num_hidden_layers,
+           config->embedding_dim, config->num_attention_heads, config->intermediate_size);
+    printf("GEMM kernel %s, %s weights, in-cache peak %.1f GFLOP/s per thread\n\n", gemm_kernel_name(), type_name, peak);
+    printf("%7s %5s %7s %12s %12s %10s %10s %8s   %s\n", "threads", "batch", "seq_len", "sentences/s", "tokens/s",
+           "p50 ms", "p99 ms", "GFLOP/s", "projection GFLOP/s (% of peak): qkv, attn out, ffn in, ffn out, pooler");
+
+    BenchResult* results = calloc((size_t)num_threads * num_batches * num_seq_lens, sizeof(BenchResult));
+    int count = 0;
+    for (int t = 0; t < num_threads; t++) {
+        set_embedding_threads(session, threads[t]);
+        for (int b = 0; b < num_batches; b++) {
+            for (int s = 0; s < num_seq_lens; s++) {
+                if (seq_lens[s] < 2 || seq_lens[s] > max_sequence_length(ctx) || batches[b] < 1 ||
+                    batches[b] * seq_lens[s] > max_tokens) continue;
+                BenchResult* r = &results[count++];
+                r->threads = threads[t];
+                profile_reset();
+                bench_config(session, batches[b], seq_lens[s], min_time, r);
+                bench_projections(session, batches[b], seq_lens[s], min_time, r);
+
+                printf("%7d %5d %7d %12.1f %12.0f %10.3f %10.3f %8.1f  ", r->threads, r->batch, r->seq_len,
+                       r->sentences_per_sec, r->tokens_per_sec, r->p50_ms, r->p99_ms, r->gflops);
+                for (int p = 0; p < 5; p++) {
+                    printf(" %6.1f (%3.0f%%)", r->projections[p].gflops,
+                           100.0 * r->projections[p].gflops / (peak * r->threads));
+                }
+                printf("\n");
+                fflush(stdout);
+            }
+        }
+    }
+
+    if (trace_file) {
+        printf("\nOperators of the last configuration:\n");
+        profile_dump(stdout);
+        if (profile_write_trace(trace_file) == 0) printf("Wrote %s\n", trace_file);
+    }
+
+    if (json_file) {
+        write_json(json_file, config, type_name, peak, results, count);
+        printf("\nWrote %s\n", json_file);
+    }
+
+    free(results);
+    free_embedding_session(session);
+    free_embedding_context(ctx);
+    return 0;
+}
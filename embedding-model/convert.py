@@ -2,6 +2,12 @@ import torch
 from transformers import AutoConfig
 import numpy as np
 import os
+import struct
+import sys
+
+# --f16 stores the weight matrices and word embeddings as IEEE half floats,
+# which load_model uses in place with GEMM_F16
+half = "--f16" in sys.argv[1:]
 
 # Load the model weights from the local file
 model_path = "pytorch_model.bin"
@@ -52,40 +58,85 @@ for i in range(config.num_hidden_layers):
 
 weights["pooler"] = get_weights("pooler.dense")
 
-# Save the weights in binary format
+# Model container layout; keep in sync with model_file.h
+MODEL_FILE_MAGIC = 0x4C444D45  # "EMDL"
+MODEL_FILE_VERSION = 1
+MODEL_FILE_ALIGNMENT = 64
+MODEL_TENSOR_NAME_LENGTH = 48
+TENSOR_F32 = 0
+TENSOR_F16 = 1
+TENSOR_ROW_MAJOR = 0
+TENSOR_PACKED_PANELS = 1
+GEMM_NR = 16  # columns per panel, gemm.h
+HEADER_FORMAT = "<10IQ"
+TENSOR_ENTRY_FORMAT = f"<{MODEL_TENSOR_NAME_LENGTH}s4I2Q"
+
+def pack_panels(matrix):
+    """Reorders a [k, n] weight matrix into the zero-padded column panels gemm reads."""
+    k, n = matrix.shape
+    padded = np.pad(matrix, ((0, 0), (0, -n % GEMM_NR)))
+    return padded.reshape(k, -1, GEMM_NR).transpose(1, 0, 2)
+
+# (name, data, dtype, layout, rows, cols)
+tensors = []
+
+def add_vector(name, array, half=False):
+    array = np.ascontiguousarray(array, dtype=np.float16 if half else np.float32)
+    rows, cols = (1, array.shape[0]) if array.ndim == 1 else array.shape
+    tensors.append((name, array, TENSOR_F16 if half else TENSOR_F32, TENSOR_ROW_MAJOR, rows, cols))
+
+def add_linear(name, weight_and_bias):
+    weight, bias = weight_and_bias
+    rows, cols = weight.shape
+    dtype, tensor_dtype = (np.float16, TENSOR_F16) if half else (np.float32, TENSOR_F32)
+    tensors.append((f"{name}.weight", np.ascontiguousarray(pack_panels(weight.astype(dtype))), tensor_dtype, TENSOR_PACKED_PANELS, rows, cols))
+    add_vector(f"{name}.bias", bias)
+
+add_vector("embeddings.word_embeddings", weights["token_embeddings"], half)
+add_vector("embeddings.position_embeddings", weights["position_embeddings"])
+add_vector("embeddings.token_type_embeddings", weights["token_type_embeddings"])
+add_vector("embeddings.layer_norm.weight", weights["embeddings_layer_norm_weight"])
+add_vector("embeddings.layer_norm.bias", weights["embeddings_layer_norm_bias"])
+
+for i in range(config.num_hidden_layers):
+    layer = weights[f"layer_{i}"]
+    for name in ("query", "key", "value", "output"):
+        add_linear(f"layer.{i}.attention.{name}", layer["attention"][name])
+    add_vector(f"layer.{i}.attention.layer_norm.weight", layer["attention_layer_norm_weight"])
+    add_vector(f"layer.{i}.attention.layer_norm.bias", layer["attention_layer_norm_bias"])
+    add_linear(f"layer.{i}.ffn.intermediate", layer["ffn"]["intermediate"])
+    add_linear(f"layer.{i}.ffn.output", layer["ffn"]["output"])
+    add_vector(f"layer.{i}.ffn.layer_norm.weight", layer["ffn_layer_norm_weight"])
+    add_vector(f"layer.{i}.ffn.layer_norm.bias", layer["ffn_layer_norm_bias"])
+
+add_linear("pooler", weights["pooler"])
+
+def align(offset):
+    return (offset + MODEL_FILE_ALIGNMENT - 1) // MODEL_FILE_ALIGNMENT * MODEL_FILE_ALIGNMENT
+
+# Assign aligned offsets after the header and tensor table
+offset = align(struct.calcsize(HEADER_FORMAT) + len(tensors) * struct.calcsize(TENSOR_ENTRY_FORMAT))
+entries = []
+for name, data, dtype, layout, rows, cols in tensors:
+    entries.append(struct.pack(TENSOR_ENTRY_FORMAT, name.encode(), dtype, layout, rows, cols, offset, data.nbytes))
+    offset = align(offset + data.nbytes)
+file_size = offset
+
+header = struct.pack(HEADER_FORMAT, MODEL_FILE_MAGIC, MODEL_FILE_VERSION,
+                     config.hidden_size, config.vocab_size, config.max_position_embeddings,
+                     config.num_hidden_layers, config.num_attention_heads, config.intermediate_size,
+                     config.type_vocab_size, len(tensors), file_size)
+
 with open('model.bin', 'wb') as f:
-    # Embeddings
-    weights["token_embeddings"].tofile(f)
-    weights["position_embeddings"].tofile(f)
-    weights["token_type_embeddings"].tofile(f)
-    weights["embeddings_layer_norm_weight"].tofile(f)
-    weights["embeddings_layer_norm_bias"].tofile(f)
-
-    # Layers
-    for i in range(config.num_hidden_layers):
-        layer = weights[f"layer_{i}"]
-        layer["attention"]["query"][0].tofile(f)
-        layer["attention"]["query"][1].tofile(f)
-        layer["attention"]["key"][0].tofile(f)
-        layer["attention"]["key"][1].tofile(f)
-        layer["attention"]["value"][0].tofile(f)
-        layer["attention"]["value"][1].tofile(f)
-        layer["attention"]["output"][0].tofile(f)
-        layer["attention"]["output"][1].tofile(f)
-        layer["attention_layer_norm_weight"].tofile(f)
-        layer["attention_layer_norm_bias"].tofile(f)
-        layer["ffn"]["intermediate"][0].tofile(f)
-        layer["ffn"]["intermediate"][1].tofile(f)
-        layer["ffn"]["output"][0].tofile(f)
-        layer["ffn"]["output"][1].tofile(f)
-        layer["ffn_layer_norm_weight"].tofile(f)
-        layer["ffn_layer_norm_bias"].tofile(f)
-
-    # Pooler
-    weights["pooler"][0].tofile(f)
-    weights["pooler"][1].tofile(f)
-
-print(f"Model saved to model.bin")
+    f.write(header)
+    for entry in entries:
+        f.write(entry)
+    for _, data, _, _, _, _ in tensors:
+        f.write(b"\0" * (align(f.tell()) - f.tell()))
+        data.tofile(f)
+    f.write(b"\0" * (file_size - f.tell()))
+
+print(f"Model saved to model.bin ({'f16' if half else 'f32'} weights)")
 
 # Print some information about the model
 print(f"Embedding dimension: {config.hidden_size}")
@@ -0,0 +1,378 @@
+#include "embedding_cache.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CACHE_FILE_MAGIC "EMBC"
+#define CACHE_FILE_VERSION 2
+// Records read per call while indexing an existing disk file
+#define CACHE_SCAN_RECORDS 256
+
+// Disk file: this header, then fixed-size records of an EmbeddingKey followed
+// by dim floats, in insertion order
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t dim;
+    uint32_t reserved;
+    uint64_t fingerprint;  // embedding_fingerprint of the sessions that wrote it
+} CacheFileHeader;
+
+struct EmbeddingCache {
+    pthread_mutex_t lock;
+    int dim;
+    uint64_t fingerprint;
+
+    // Memory tier: capacity slots chained into a power of two bucket array.
+    // A set referenced bit gives a slot a second chance when the clock hand passes.
+    int capacity;
+    int used;
+    int hand;
+    EmbeddingKey* keys;
+    float* vectors;
+    unsigned char* referenced;
+    int* next;     // next slot in the same bucket, -1 ends the chain
+    int* buckets;  // first slot of each bucket, -1 if empty
+    unsigned int bucket_mask;
+
+    // Disk tier: open-addressing table of record numbers + 1 (0 = empty slot)
+    int fd;
+    size_t record_size;
+    int num_records;     // whole records in the file, repeated keys included
+    char* record;        // record_size bytes to assemble an append in
+    bool append_failed;  // a failed append could not be undone; later ones are skipped
+    int disk_entries;
+    EmbeddingKey* disk_keys;
+    int* disk_records;
+    unsigned int disk_mask;
+
+    EmbeddingCacheStats stats;
+};
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+// MurmurHash3 finalizer
+static inline uint64_t fmix64(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+EmbeddingKey embedding_key(const int* tokens, int count) {
+    // Two independently seeded lanes, crossed at the end as in MurmurHash3_x64_128
+    uint64_t lo = 0x9e3779b97f4a7c15ULL ^ (uint64_t)count;
+    uint64_t hi = 0xc2b2ae3d27d4eb4fULL ^ ((uint64_t)count << 32);
+    for (int i = 0; i < count; i++) {
+        uint64_t t = (uint32_t)tokens[i];
+        lo = rotl64(lo ^ (t * 0x87c37b91114253d5ULL), 31) * 0x4cf5ad432745937fULL;
+        hi = rotl64(hi ^ (t * 0x4cf5ad432745937fULL), 33) * 0x87c37b91114253d5ULL + lo;
+    }
+    lo += hi;
+    hi += lo;
+    lo = fmix64(lo);
+    hi = fmix64(hi);
+    lo += hi;
+    hi += lo;
+    return (EmbeddingKey){ lo, hi };
+}
+
+// Four independent lanes over 32-byte blocks, so the multiplies overlap
+uint64_t embedding_hash(const void* data, size_t size, uint64_t seed) {
+    const unsigned char* bytes = data;
+    uint64_t lanes[4] = { seed ^ 0x9e3779b97f4a7c15ULL, seed ^ 0xc2b2ae3d27d4eb4fULL, seed ^ 0x165667b19e3779f9ULL,
+                          seed ^ 0x27d4eb2f165667c5ULL };
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        for (int l = 0; l < 4; l++) {
+            uint64_t word;
+            memcpy(&word, bytes + i + 8 * l, 8);
+            lanes[l] = rotl64(lanes[l] ^ (word * 0x87c37b91114253d5ULL), 31) * 0x4cf5ad432745937fULL;
+        }
+    }
+    uint64_t h = rotl64(lanes[0], 1) + rotl64(lanes[1], 7) + rotl64(lanes[2], 12) + rotl64(lanes[3], 18);
+    for (; i < size; i += 8) {
+        uint64_t word = 0;
+        memcpy(&word, bytes + i, size - i < 8 ? size - i : 8);
+        h = rotl64(h ^ (word * 0x87c37b91114253d5ULL), 31) * 0x4cf5ad432745937fULL;
+    }
+    return fmix64(h ^ size);
+}
+
+static inline bool same_key(EmbeddingKey a, EmbeddingKey b) {
+    return a.lo == b.lo && a.hi == b.hi;
+}
+
+static int find_slot(const EmbeddingCache* cache, EmbeddingKey key) {
+    for (int slot = cache->buckets[key.lo & cache->bucket_mask]; slot >= 0; slot = cache->next[slot]) {
+        if (same_key(cache->keys[slot], key)) return slot;
+    }
+    return -1;
+}
+
+static void unlink_slot(EmbeddingCache* cache, int slot) {
+    int* link = &cache->buckets[cache->keys[slot].lo & cache->bucket_mask];
+    while (*link != slot) link = &cache->next[*link];
+    *link = cache->next[slot];
+}
+
+// Stores vector in memory, evicting the first unreferenced slot the clock hand finds
+static void insert_memory(EmbeddingCache* cache, EmbeddingKey key, const float* vector) {
+    int slot = find_slot(cache, key);
+    if (slot < 0) {
+        if (cache->used < cache->capacity) {
+            slot = cache->used++;
+        } else {
+            while (cache->referenced[cache->hand]) {
+                cache->referenced[cache->hand] = 0;
+                cache->hand = (cache->hand + 1) % cache->capacity;
+            }
+            slot = cache->hand;
+            cache->hand = (cache->hand + 1) % cache->capacity;
+            unlink_slot(cache, slot);
+            cache->stats.evictions++;
+        }
+        cache->keys[slot] = key;
+        cache->referenced[slot] = 0;
+        unsigned int bucket = key.lo & cache->bucket_mask;
+        cache->next[slot] = cache->buckets[bucket];
+        cache->buckets[bucket] = slot;
+    }
+    memcpy(cache->vectors + (size_t)slot * cache->dim, vector, cache->dim * sizeof(float));
+}
+
+// Returns the record number of key in the disk file, or -1
+static int find_disk_record(const EmbeddingCache* cache, EmbeddingKey key) {
+    if (!cache->disk_records) return -1;
+    for (unsigned int i = key.hi & cache->disk_mask;; i = (i + 1) & cache->disk_mask) {
+        if (cache->disk_records[i] == 0) return -1;
+        if (same_key(cache->disk_keys[i], key)) return cache->disk_records[i] - 1;
+    }
+}
+
+// Adds key -> record to the disk index, doubling it past half load
+static int index_disk_record(EmbeddingCache* cache, EmbeddingKey key, int record) {
+    if (!cache->disk_records || (unsigned int)(cache->disk_entries + 1) * 2 > cache->disk_mask + 1) {
+        unsigned int size = cache->disk_records ? (cache->disk_mask + 1) * 2 : 1024;
+        EmbeddingKey* keys = malloc(size * sizeof(EmbeddingKey));
+        int* records = calloc(size, sizeof(int));
+        if (!keys || !records) {
+            free(keys);
+            free(records);
+            return -1;
+        }
+        for (unsigned int i = 0; cache->disk_records && i <= cache->disk_mask; i++) {
+            if (cache->disk_records[i] == 0) continue;
+            unsigned int j = cache->disk_keys[i].hi & (size - 1);
+            while (records[j]) j = (j + 1) & (size - 1);
+            keys[j] = cache->disk_keys[i];
+            records[j] = cache->disk_records[i];
+        }
+        free(cache->disk_keys);
+        free(cache->disk_records);
+        cache->disk_keys = keys;
+        cache->disk_records = records;
+        cache->disk_mask = size - 1;
+    }
+
+    unsigned int i = key.hi & cache->disk_mask;
+    while (cache->disk_records[i] && !same_key(cache->disk_keys[i], key)) i = (i + 1) & cache->disk_mask;
+    if (!cache->disk_records[i]) cache->disk_entries++;
+    cache->disk_keys[i] = key;
+    cache->disk_records[i] = record + 1;  // a key appended twice resolves to its latest record
+    return 0;
+}
+
+// Opens or creates the disk file and indexes the keys of its complete records
+static int open_disk_file(EmbeddingCache* cache, const char* path) {
+    cache->fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (cache->fd < 0) {
+        fprintf(stderr, "Failed to open embedding cache file: %s\n", path);
+        return -1;
+    }
+    cache->record_size = sizeof(EmbeddingKey) + cache->dim * sizeof(float);
+    cache->record = malloc(cache->record_size);
+    if (!cache->record) return -1;
+
+    struct stat st;
+    if (fstat(cache->fd, &st) != 0) return -1;
+    CacheFileHeader header;
+    if (st.st_size == 0) {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, CACHE_FILE_MAGIC, 4);
+        header.version = CACHE_FILE_VERSION;
+        header.dim = cache->dim;
+        header.fingerprint = cache->fingerprint;
+        if (write(cache->fd, &header, sizeof(header)) != sizeof(header)) {
+            fprintf(stderr, "Failed to write embedding cache file: %s\n", path);
+            return -1;
+        }
+        return 0;
+    }
+
+    if (pread(cache->fd, &header, sizeof(header), 0) != sizeof(header) ||
+        memcmp(header.magic, CACHE_FILE_MAGIC, 4) != 0 || header.version != CACHE_FILE_VERSION) {
+        fprintf(stderr, "Not an embedding cache file: %s\n", path);
+        return -1;
+    }
+    if (header.dim != (uint32_t)cache->dim) {
+        fprintf(stderr, "Embedding cache file %s holds %u-dim vectors, expected %d\n", path, header.dim, cache->dim);
+        return -1;
+    }
+    if (header.fingerprint != cache->fingerprint) {
+        fprintf(stderr, "Embedding cache file %s was written by another model, weight type or projection\n", path);
+        return -1;
+    }
+
+    // A record cut short by an interrupted append is dropped
+    size_t records = ((size_t)st.st_size - sizeof(header)) / cache->record_size;
+    off_t end = (off_t)(sizeof(header) + records * cache->record_size);
+    if (end != st.st_size && ftruncate(cache->fd, end) != 0) {
+        fprintf(stderr, "Failed to truncate partial record in %s\n", path);
+        return -1;
+    }
+
+    char* buffer = malloc(CACHE_SCAN_RECORDS * cache->record_size);
+    if (!buffer) return -1;
+    for (size_t first = 0; first < records; first += CACHE_SCAN_RECORDS) {
+        size_t count = records - first < CACHE_SCAN_RECORDS ? records - first : CACHE_SCAN_RECORDS;
+        size_t bytes = count * cache->record_size;
+        if (pread(cache->fd, buffer, bytes, (off_t)(sizeof(header) + first * cache->record_size)) != (ssize_t)bytes) {
+            free(buffer);
+            fprintf(stderr, "Failed to read embedding cache file: %s\n", path);
+            return -1;
+        }
+        for (size_t r = 0; r < count; r++) {
+            EmbeddingKey key;
+            memcpy(&key, buffer + r * cache->record_size, sizeof(key));
+            if (index_disk_record(cache, key, (int)(first + r)) != 0) {
+                free(buffer);
+                return -1;
+            }
+        }
+    }
+    free(buffer);
+    cache->num_records = (int)records;
+    return 0;
+}
+
+EmbeddingCache* create_embedding_cache(int capacity, int dim, uint64_t fingerprint, const char* disk_file) {
+    EmbeddingCache* cache = calloc(1, sizeof(EmbeddingCache));
+    if (!cache) return NULL;
+    pthread_mutex_init(&cache->lock, NULL);
+    cache->dim = dim;
+    cache->fingerprint = fingerprint;
+    cache->capacity = capacity > 0 ? capacity : 1;
+    cache->fd = -1;
+
+    unsigned int buckets = 1;
+    while (buckets < (unsigned int)cache->capacity) buckets <<= 1;
+    cache->bucket_mask = buckets - 1;
+
+    cache->keys = malloc(cache->capacity * sizeof(EmbeddingKey));
+    cache->vectors = malloc((size_t)cache->capacity * dim * sizeof(float));
+    cache->referenced = calloc(cache->capacity, 1);
+    cache->next = malloc(cache->capacity * sizeof(int));
+    cache->buckets = malloc(buckets * sizeof(int));
+    if (!cache->keys || !cache->vectors || !cache->referenced || !cache->next || !cache->buckets) {
+        fprintf(stderr, "Failed to allocate embedding cache of %d entries\n", cache->capacity);
+        free_embedding_cache(cache);
+        return NULL;
+    }
+    memset(cache->buckets, 0xff, buckets * sizeof(int));
+
+    if (disk_file && open_disk_file(cache, disk_file) != 0) {
+        free_embedding_cache(cache);
+        return NULL;
+    }
+    return cache;
+}
+
+int embedding_cache_dim(const EmbeddingCache* cache) {
+    return cache->dim;
+}
+
+uint64_t embedding_cache_fingerprint(const EmbeddingCache* cache) {
+    return cache->fingerprint;
+}
+
+int embedding_cache_lookup(EmbeddingCache* cache, EmbeddingKey key, float* out) {
+    pthread_mutex_lock(&cache->lock);
+    int slot = find_slot(cache, key);
+    if (slot >= 0) {
+        cache->referenced[slot] = 1;
+        memcpy(out, cache->vectors + (size_t)slot * cache->dim, cache->dim * sizeof(float));
+        cache->stats.hits++;
+        pthread_mutex_unlock(&cache->lock);
+        return 1;
+    }
+
+    int record = find_disk_record(cache, key);
+    size_t bytes = cache->dim * sizeof(float);
+    if (record >= 0 && pread(cache->fd, out, bytes,
+                             (off_t)(sizeof(CacheFileHeader) + (size_t)record * cache->record_size + sizeof(EmbeddingKey))) == (ssize_t)bytes) {
+        insert_memory(cache, key, out);
+        cache->stats.disk_hits++;
+        pthread_mutex_unlock(&cache->lock);
+        return 1;
+    }
+
+    cache->stats.misses++;
+    pthread_mutex_unlock(&cache->lock);
+    return 0;
+}
+
+void embedding_cache_insert(EmbeddingCache* cache, EmbeddingKey key, const float* vector) {
+    pthread_mutex_lock(&cache->lock);
+    insert_memory(cache, key, vector);
+
+    if (cache->fd >= 0 && !cache->append_failed && find_disk_record(cache, key) < 0) {
+        // Written in one call; a short write is cut off again so every record
+        // stays at sizeof(header) + number * record_size
+        off_t end = (off_t)(sizeof(CacheFileHeader) + (size_t)cache->num_records * cache->record_size);
+        memcpy(cache->record, &key, sizeof(key));
+        memcpy(cache->record + sizeof(key), vector, cache->dim * sizeof(float));
+        if (write(cache->fd, cache->record, cache->record_size) == (ssize_t)cache->record_size) {
+            index_disk_record(cache, key, cache->num_records++);
+        } else if (ftruncate(cache->fd, end) == 0) {
+            fprintf(stderr, "Failed to append to embedding cache file\n");
+        } else {
+            fprintf(stderr, "Failed to append to embedding cache file, no longer appending\n");
+            cache->append_failed = true;
+        }
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+EmbeddingCacheStats embedding_cache_stats(EmbeddingCache* cache) {
+    pthread_mutex_lock(&cache->lock);
+    EmbeddingCacheStats stats = cache->stats;
+    stats.entries = cache->used;
+    stats.disk_entries = cache->disk_entries;
+    pthread_mutex_unlock(&cache->lock);
+    return stats;
+}
+
+void free_embedding_cache(EmbeddingCache* cache) {
+    if (!cache) return;
+    if (cache->fd >= 0) close(cache->fd);
+    free(cache->keys);
+    free(cache->vectors);
+    free(cache->referenced);
+    free(cache->next);
+    free(cache->buckets);
+    free(cache->disk_keys);
+    free(cache->disk_records);
+    free(cache->record);
+    pthread_mutex_destroy(&cache->lock);
+    free(cache);
+}
@@ -0,0 +1,51 @@
+#ifndef EMBEDDING_CACHE_H
+#define EMBEDDING_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// 128-bit content hash of a token id sequence
+typedef struct {
+    uint64_t lo;
+    uint64_t hi;
+} EmbeddingKey;
+
+typedef struct {
+    uint64_t hits;       // served from memory
+    uint64_t disk_hits;  // served from the disk file, then kept in memory
+    uint64_t misses;
+    uint64_t evictions;
+    int entries;         // vectors held in memory
+    int disk_entries;    // vectors stored in the disk file
+} EmbeddingCacheStats;
+
+// Maps token sequences to finished embeddings of dim floats. A bounded
+// in-memory tier replaces entries with the CLOCK policy; an optional disk
+// file keeps every inserted vector across runs. One cache may be shared by
+// any number of sessions of the same model: all calls take an internal lock.
+typedef struct EmbeddingCache EmbeddingCache;
+
+// Hashes the ids the tokenizer produced, so texts that only differ in case,
+// accents or whitespace share an entry.
+EmbeddingKey embedding_key(const int* tokens, int count);
+
+// 64-bit hash of size bytes, chained through seed so data can be hashed in pieces
+uint64_t embedding_hash(const void* data, size_t size, uint64_t seed);
+
+// Holds up to capacity vectors in memory. fingerprint identifies what produces
+// the vectors (embedding_fingerprint of the session): set_embedding_cache
+// refuses a session with another one. disk_file may be NULL; otherwise it is
+// opened (or created) as an append-only file of key -> vector records and its
+// keys are indexed up front. A file written under another fingerprint or dim
+// is refused and NULL returned.
+EmbeddingCache* create_embedding_cache(int capacity, int dim, uint64_t fingerprint, const char* disk_file);
+int embedding_cache_dim(const EmbeddingCache* cache);
+uint64_t embedding_cache_fingerprint(const EmbeddingCache* cache);
+// Copies the cached vector into out and returns 1, or returns 0 on a miss
+int embedding_cache_lookup(EmbeddingCache* cache, EmbeddingKey key, float* out);
+// Adds a vector, evicting from memory if full and appending it to the disk file
+void embedding_cache_insert(EmbeddingCache* cache, EmbeddingKey key, const float* vector);
+EmbeddingCacheStats embedding_cache_stats(EmbeddingCache* cache);
+void free_embedding_cache(EmbeddingCache* cache);
+
+#endif // EMBEDDING_CACHE_H
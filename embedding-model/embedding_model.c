@@ -3,321 +3,975 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "model_file.h"
+#include "attention.h"
+#include "layer_norm.h"
+#include "half.h"
+#include "profile.h"
+
+#define PAD_TOKEN_ID 0
+#define MODEL_CONFIG_FILE "config.json"
+#define MAX_CONFIG_FILE_SIZE (1 << 20)
+// Room for a tensor name prefix such as "layer.11.ffn.intermediate" plus ".weight"
+#define TENSOR_PREFIX_LENGTH (MODEL_TENSOR_NAME_LENGTH - 8)
+
+// nreimers/MiniLM-L6-H384-uncased, the shape raw weight dumps had before it was configurable
+static const ModelConfig DEFAULT_CONFIG = { 384, 30522, 512, 6, 12, 1536, 2, 1e-12f, GEMM_GELU_ERF };
+
+// Size of the headerless weight dump written by older convert.py versions
+static size_t linear_floats(size_t k, size_t n) {
+    return k * n + n;
+}
 
-#define EMBEDDING_DIM 384  // Update this to match your model's embedding dimension
-#define VOCAB_SIZE 30522  // Update this to match your model's vocabulary size
-#define MAX_SEQ_LENGTH 512  // Update this if your model uses a different max sequence length
-#define LAYER_NORM_EPS 1e-12f
-#define MAX_EMBEDDINGS 100
-
-static Tokenizer* tokenizer = NULL;
-static Model* model = NULL;
-static float embedding_buffers[MAX_EMBEDDINGS][EMBEDDING_DIM];
-static int current_buffer = 0;
-
-Tokenizer* load_tokenizer(const char* vocab_file) {
-    Tokenizer* t = malloc(sizeof(Tokenizer));
-    t->vocab = malloc(VOCAB_SIZE * sizeof(char*));
-    t->vocab_size = VOCAB_SIZE;
-
-    FILE* file = fopen(vocab_file, "r");
-    if (!file) {
-        fprintf(stderr, "Failed to open vocab file\n");
-        return NULL;
+static size_t legacy_model_floats(const ModelConfig* c) {
+    size_t d = c->embedding_dim;
+    size_t layer = 4 * linear_floats(d, d) + 2 * d + linear_floats(d, c->intermediate_size) +
+                   linear_floats(c->intermediate_size, d) + 2 * d;
+    return (size_t)(c->vocab_size + c->max_seq_length + c->type_vocab_size + 2) * d +
+           c->num_hidden_layers * layer + linear_floats(d, d);
+}
+
+// Where load_model takes tensors from: a mapped container file, or the raw
+// float stream written by older versions of convert.py, read in order.
+typedef struct {
+    const char* mapping;
+    size_t size;
+    const TensorEntry* tensors;
+    int num_tensors;
+
+    FILE* legacy;
+    float* staging;
+
+    const ModelConfig* config;
+    GemmType weight_type;
+    bool failed;
+} ModelSource;
+
+// Finds a tensor by name and checks it has the expected shape and lies inside the file
+static const TensorEntry* find_tensor(ModelSource* src, const char* name, int rows, int cols) {
+    for (int i = 0; i < src->num_tensors; i++) {
+        const TensorEntry* t = &src->tensors[i];
+        if (strncmp(t->name, name, MODEL_TENSOR_NAME_LENGTH) != 0) continue;
+
+        uint64_t stored_cols = t->layout == TENSOR_PACKED_PANELS ? (uint64_t)(cols + GEMM_NR - 1) / GEMM_NR * GEMM_NR : (uint64_t)cols;
+        uint64_t element_size = t->dtype == TENSOR_F16 ? sizeof(uint16_t) : sizeof(float);
+        if (t->dtype > TENSOR_F16 || t->layout > TENSOR_PACKED_PANELS ||
+            t->rows != (uint32_t)rows || t->cols != (uint32_t)cols || t->size != stored_cols * rows * element_size ||
+            t->offset % MODEL_FILE_ALIGNMENT != 0 || t->offset > src->size || t->size > src->size - t->offset) {
+            fprintf(stderr, "Model tensor %s has an unexpected shape or offset\n", name);
+            return NULL;
+        }
+        return t;
     }
+    fprintf(stderr, "Model tensor %s is missing\n", name);
+    return NULL;
+}
+
+static float* load_vector(ModelSource* src, const char* name, int rows, int cols) {
+    if (src->failed) return NULL;
 
-    char line[256];
-    int i = 0;
-    while (fgets(line, sizeof(line), file) && i < VOCAB_SIZE) {
-        line[strcspn(line, "\n")] = 0;  // Remove newline
-        t->vocab[i] = strdup(line);
-        i++;
+    if (src->mapping) {
+        const TensorEntry* t = find_tensor(src, name, rows, cols);
+        if (!t || t->layout != TENSOR_ROW_MAJOR || t->dtype != TENSOR_F32) {
+            if (t) fprintf(stderr, "Model tensor %s must be a row-major f32 vector\n", name);
+            src->failed = true;
+            return NULL;
+        }
+        return (float*)(src->mapping + t->offset);
     }
 
-    fclose(file);
-    return t;
+    float* data = malloc((size_t)rows * cols * sizeof(float));
+    if (!data || fread(data, sizeof(float), (size_t)rows * cols, src->legacy) != (size_t)rows * cols) {
+        fprintf(stderr, "Failed to read model tensor %s\n", name);
+        free(data);
+        src->failed = true;
+        return NULL;
+    }
+    return data;
 }
 
-Model* load_model(const char* model_file) {
-    Model* m = malloc(sizeof(Model));
-    
-    FILE* file = fopen(model_file, "rb");
-    if (!file) {
-        fprintf(stderr, "Failed to open model file\n");
-        return NULL;
+// Drops this process's pages of a mapped tensor that was copied or converted,
+// so only the private copy counts towards its resident memory
+static void release_mapped(const ModelSource* src, const void* data, size_t bytes) {
+    if (!src->mapping || (const char*)data < src->mapping || (const char*)data >= src->mapping + src->size) return;
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t begin = ((uintptr_t)data + page - 1) / page * page;
+    uintptr_t end = ((uintptr_t)data + bytes) / page * page;
+    if (end > begin) madvise((void*)begin, end - begin, MADV_DONTNEED);
+}
+
+// Replaces a matrix by its weight_type form
+static void convert_matrix(ModelSource* src, PackedMatrix* packed) {
+    if (src->failed || packed->type == src->weight_type) return;
+
+    PackedMatrix converted;
+    if (convert_packed_matrix(&converted, packed, src->weight_type) != 0) {
+        src->failed = true;
+        return;
     }
+    if (!packed->owned) release_mapped(src, packed->data, packed_matrix_bytes(packed));
+    free_packed_matrix(packed);
+    *packed = converted;
+}
 
-    // Read embeddings
-    m->token_embeddings = malloc(VOCAB_SIZE * EMBEDDING_DIM * sizeof(float));
-    fread(m->token_embeddings, sizeof(float), VOCAB_SIZE * EMBEDDING_DIM, file);
+// Loads a k x n weight matrix for gemm. Pre-packed tensors (f32 or f16) are
+// used straight from the mapping; row-major f32 ones are packed into a private copy.
+static void load_matrix(ModelSource* src, PackedMatrix* packed, const char* name, int k, int n) {
+    if (src->failed) return;
+
+    if (src->mapping) {
+        const TensorEntry* t = find_tensor(src, name, k, n);
+        if (!t) {
+            src->failed = true;
+        } else if (t->layout == TENSOR_PACKED_PANELS) {
+            wrap_packed_matrix(packed, (void*)(src->mapping + t->offset), k, n, t->dtype == TENSOR_F16 ? GEMM_F16 : GEMM_F32);
+        } else if (t->dtype != TENSOR_F32) {
+            fprintf(stderr, "Model tensor %s: f16 matrices must be stored pre-packed\n", name);
+            src->failed = true;
+        } else if (pack_matrix(packed, (const float*)(src->mapping + t->offset), k, n) != 0) {
+            src->failed = true;
+        }
+        return;
+    }
 
-    m->position_embeddings = malloc(MAX_SEQ_LENGTH * EMBEDDING_DIM * sizeof(float));
-    fread(m->position_embeddings, sizeof(float), MAX_SEQ_LENGTH * EMBEDDING_DIM, file);
+    if (fread(src->staging, sizeof(float), (size_t)k * n, src->legacy) != (size_t)k * n) {
+        fprintf(stderr, "Failed to read model tensor %s\n", name);
+        src->failed = true;
+        return;
+    }
+    if (pack_matrix(packed, src->staging, k, n) != 0) {
+        src->failed = true;
+    }
+}
 
-    m->token_type_embeddings = malloc(2 * EMBEDDING_DIM * sizeof(float));
-    fread(m->token_type_embeddings, sizeof(float), 2 * EMBEDDING_DIM, file);
+// Weight matrix plus bias of one dense layer, e.g. "layer.0.attention.output"
+static void load_linear(ModelSource* src, const char* prefix, PackedMatrix* weight, float** bias, int k, int n) {
+    char name[MODEL_TENSOR_NAME_LENGTH];
+    snprintf(name, sizeof(name), "%s.weight", prefix);
+    load_matrix(src, weight, name, k, n);
+    convert_matrix(src, weight);
+    snprintf(name, sizeof(name), "%s.bias", prefix);
+    *bias = load_vector(src, name, 1, n);
+}
 
-    m->embeddings_layer_norm_weight = malloc(EMBEDDING_DIM * sizeof(float));
-    fread(m->embeddings_layer_norm_weight, sizeof(float), EMBEDDING_DIM, file);
+// Query, key and value projections of one layer fused into a single linear
+static void load_qkv(ModelSource* src, int layer, AttentionWeights* attention) {
+    static const char* parts[3] = { "query", "key", "value" };
+    int dim = src->config->embedding_dim;
+    PackedMatrix weights[3] = { 0 };
+    float* biases[3] = { NULL };
+
+    for (int p = 0; p < 3; p++) {
+        char prefix[TENSOR_PREFIX_LENGTH];
+        snprintf(prefix, sizeof(prefix), "layer.%d.attention.%s", layer, parts[p]);
+        char name[MODEL_TENSOR_NAME_LENGTH];
+        snprintf(name, sizeof(name), "%s.weight", prefix);
+        load_matrix(src, &weights[p], name, dim, dim);
+        snprintf(name, sizeof(name), "%s.bias", prefix);
+        biases[p] = load_vector(src, name, 1, dim);
+    }
 
-    m->embeddings_layer_norm_bias = malloc(EMBEDDING_DIM * sizeof(float));
-    fread(m->embeddings_layer_norm_bias, sizeof(float), EMBEDDING_DIM, file);
+    if (!src->failed) {
+        attention->qkv_bias = malloc(3 * dim * sizeof(float));
+        if (!attention->qkv_bias || concat_packed_matrices(&attention->qkv, weights, 3) != 0) {
+            src->failed = true;
+        } else {
+            for (int p = 0; p < 3; p++) {
+                memcpy(attention->qkv_bias + p * dim, biases[p], dim * sizeof(float));
+            }
+            convert_matrix(src, &attention->qkv);
+        }
+    }
 
-    // Read layers
-    for (int i = 0; i < NUM_HIDDEN_LAYERS; i++) {
-        // Attention weights
-        m->layers[i].attention.query = malloc(EMBEDDING_DIM * EMBEDDING_DIM * sizeof(float));
-        fread(m->layers[i].attention.query, sizeof(float), EMBEDDING_DIM * EMBEDDING_DIM, file);
+    for (int p = 0; p < 3; p++) {
+        if (!weights[p].owned && weights[p].data) release_mapped(src, weights[p].data, packed_matrix_bytes(&weights[p]));
+        free_packed_matrix(&weights[p]);
+        if (!src->mapping) free(biases[p]);
+    }
+}
 
-        m->layers[i].attention.key = malloc(EMBEDDING_DIM * EMBEDDING_DIM * sizeof(float));
-        fread(m->layers[i].attention.key, sizeof(float), EMBEDDING_DIM * EMBEDDING_DIM, file);
+// Word embedding table in the form forward reads: half floats for GEMM_F16
+// models, f32 otherwise. Used from the mapping when the file stores it that way.
+static void load_token_embeddings(Model* m, ModelSource* src) {
+    const char* name = "embeddings.word_embeddings";
+    const ModelConfig* c = src->config;
+    size_t count = (size_t)c->vocab_size * c->embedding_dim;
+    bool half = src->weight_type == GEMM_F16;
+    if (src->failed) return;
+
+    const void* data;
+    bool stored_half = false;
+    if (src->mapping) {
+        const TensorEntry* t = find_tensor(src, name, c->vocab_size, c->embedding_dim);
+        if (!t || t->layout != TENSOR_ROW_MAJOR) {
+            src->failed = true;
+            return;
+        }
+        data = src->mapping + t->offset;
+        stored_half = t->dtype == TENSOR_F16;
+    } else {
+        data = load_vector(src, name, c->vocab_size, c->embedding_dim);
+        if (!data) return;
+    }
 
-        m->layers[i].attention.value = malloc(EMBEDDING_DIM * EMBEDDING_DIM * sizeof(float));
-        fread(m->layers[i].attention.value, sizeof(float), EMBEDDING_DIM * EMBEDDING_DIM, file);
+    if (stored_half == half) {
+        if (half) {
+            m->token_embeddings_f16 = (uint16_t*)data;
+        } else {
+            m->token_embeddings = (float*)data;
+        }
+        return;
+    }
 
-        m->layers[i].attention.output = malloc(EMBEDDING_DIM * EMBEDDING_DIM * sizeof(float));
-        fread(m->layers[i].attention.output, sizeof(float), EMBEDDING_DIM * EMBEDDING_DIM, file);
+    m->owns_token_embeddings = true;
+    if (half) {
+        m->token_embeddings_f16 = malloc(count * sizeof(uint16_t));
+        for (size_t i = 0; m->token_embeddings_f16 && i < count; i++) {
+            m->token_embeddings_f16[i] = float_to_half(((const float*)data)[i]);
+        }
+    } else {
+        m->token_embeddings = malloc(count * sizeof(float));
+        for (size_t i = 0; m->token_embeddings && i < count; i++) {
+            m->token_embeddings[i] = half_to_float(((const uint16_t*)data)[i]);
+        }
+    }
+    if (!m->token_embeddings && !m->token_embeddings_f16) {
+        fprintf(stderr, "Failed to allocate the word embedding table\n");
+        src->failed = true;
+    }
 
-        // Attention layer norm
-        m->layers[i].attention_layer_norm_weight = malloc(EMBEDDING_DIM * sizeof(float));
-        fread(m->layers[i].attention_layer_norm_weight, sizeof(float), EMBEDDING_DIM, file);
+    if (src->mapping) {
+        release_mapped(src, data, count * (stored_half ? sizeof(uint16_t) : sizeof(float)));
+    } else {
+        free((void*)data);
+    }
+}
 
-        m->layers[i].attention_layer_norm_bias = malloc(EMBEDDING_DIM * sizeof(float));
-        fread(m->layers[i].attention_layer_norm_bias, sizeof(float), EMBEDDING_DIM, file);
+// Tensors are requested in the order older convert.py versions wrote them
+static void load_tensors(Model* m, ModelSource* src) {
+    const ModelConfig* c = src->config;
+    int dim = c->embedding_dim;
+    load_token_embeddings(m, src);
+    m->position_embeddings = load_vector(src, "embeddings.position_embeddings", c->max_seq_length, dim);
+    m->token_type_embeddings = load_vector(src, "embeddings.token_type_embeddings", c->type_vocab_size, dim);
+    m->embeddings_layer_norm_weight = load_vector(src, "embeddings.layer_norm.weight", 1, dim);
+    m->embeddings_layer_norm_bias = load_vector(src, "embeddings.layer_norm.bias", 1, dim);
+
+    for (int i = 0; i < c->num_hidden_layers; i++) {
+        char prefix[TENSOR_PREFIX_LENGTH];
+        char name[MODEL_TENSOR_NAME_LENGTH];
+        AttentionWeights* attention = &m->layers[i].attention;
+        FFNWeights* ffn = &m->layers[i].ffn;
 
-        // FFN weights
-        m->layers[i].ffn.intermediate = malloc(EMBEDDING_DIM * INTERMEDIATE_SIZE * sizeof(float));
-        fread(m->layers[i].ffn.intermediate, sizeof(float), EMBEDDING_DIM * INTERMEDIATE_SIZE, file);
+        // Attention weights
+        load_qkv(src, i, attention);
+        snprintf(prefix, sizeof(prefix), "layer.%d.attention.output", i);
+        load_linear(src, prefix, &attention->output, &attention->output_bias, dim, dim);
 
-        m->layers[i].ffn.output = malloc(INTERMEDIATE_SIZE * EMBEDDING_DIM * sizeof(float));
-        fread(m->layers[i].ffn.output, sizeof(float), INTERMEDIATE_SIZE * EMBEDDING_DIM, file);
+        // Attention layer norm
+        snprintf(name, sizeof(name), "layer.%d.attention.layer_norm.weight", i);
+        m->layers[i].attention_layer_norm_weight = load_vector(src, name, 1, dim);
+        snprintf(name, sizeof(name), "layer.%d.attention.layer_norm.bias", i);
+        m->layers[i].attention_layer_norm_bias = load_vector(src, name, 1, dim);
 
-        // FFN layer norm
-        m->layers[i].ffn_layer_norm_weight = malloc(EMBEDDING_DIM * sizeof(float));
-        fread(m->layers[i].ffn_layer_norm_weight, sizeof(float), EMBEDDING_DIM, file);
+        // FFN weights
+        snprintf(prefix, sizeof(prefix), "layer.%d.ffn.intermediate", i);
+        load_linear(src, prefix, &ffn->intermediate, &ffn->intermediate_bias, dim, c->intermediate_size);
+        snprintf(prefix, sizeof(prefix), "layer.%d.ffn.output", i);
+        load_linear(src, prefix, &ffn->output, &ffn->output_bias, c->intermediate_size, dim);
 
-        m->layers[i].ffn_layer_norm_bias = malloc(EMBEDDING_DIM * sizeof(float));
-        fread(m->layers[i].ffn_layer_norm_bias, sizeof(float), EMBEDDING_DIM, file);
+        // FFN layer norm
+        snprintf(name, sizeof(name), "layer.%d.ffn.layer_norm.weight", i);
+        m->layers[i].ffn_layer_norm_weight = load_vector(src, name, 1, dim);
+        snprintf(name, sizeof(name), "layer.%d.ffn.layer_norm.bias", i);
+        m->layers[i].ffn_layer_norm_bias = load_vector(src, name, 1, dim);
     }
 
     // Pooler
-    m->pooler_weight = malloc(EMBEDDING_DIM * EMBEDDING_DIM * sizeof(float));
-    fread(m->pooler_weight, sizeof(float), EMBEDDING_DIM * EMBEDDING_DIM, file);
+    load_linear(src, "pooler", &m->pooler_weight, &m->pooler_bias, dim, dim);
+}
+
+// Reads the number after "key": in a config.json. Returns false if the key is absent.
+static bool json_number(const char* json, const char* key, double* value) {
+    char quoted[64];
+    snprintf(quoted, sizeof(quoted), "\"%s\"", key);
+    for (const char* p = strstr(json, quoted); p; p = strstr(p + 1, quoted)) {
+        const char* q = p + strlen(quoted);
+        while (*q == ' ' || *q == '\t' || *q == '\n' || *q == '\r') q++;
+        if (*q != ':') continue;
+        char* end;
+        *value = strtod(q + 1, &end);
+        if (end != q + 1) return true;
+    }
+    return false;
+}
 
-    m->pooler_bias = malloc(EMBEDDING_DIM * sizeof(float));
-    fread(m->pooler_bias, sizeof(float), EMBEDDING_DIM, file);
+// Copies the string after "key": in a config.json to value. Returns false if the key is absent.
+static bool json_string(const char* json, const char* key, char* value, size_t size) {
+    char quoted[64];
+    snprintf(quoted, sizeof(quoted), "\"%s\"", key);
+    for (const char* p = strstr(json, quoted); p; p = strstr(p + 1, quoted)) {
+        const char* q = p + strlen(quoted);
+        while (*q == ' ' || *q == '\t' || *q == '\n' || *q == '\r') q++;
+        if (*q != ':') continue;
+        q++;
+        while (*q == ' ' || *q == '\t' || *q == '\n' || *q == '\r') q++;
+        const char* end = *q == '"' ? strchr(q + 1, '"') : NULL;
+        if (!end) continue;
+        snprintf(value, size, "%.*s", (int)(end - q - 1), q + 1);
+        return true;
+    }
+    return false;
+}
 
+// Fills the fields config.json sets (Hugging Face BertConfig names). Returns
+// 1 if the file was read, 0 if there is none and -1 if it is unreadable.
+static int read_model_config(const char* path, ModelConfig* config) {
+    FILE* file = fopen(path, "r");
+    if (!file) return 0;
+    char* json = malloc(MAX_CONFIG_FILE_SIZE + 1);
+    size_t length = json ? fread(json, 1, MAX_CONFIG_FILE_SIZE, file) : 0;
     fclose(file);
-    return m;
+    if (!json || length == 0) {
+        fprintf(stderr, "Failed to read %s\n", path);
+        free(json);
+        return -1;
+    }
+    json[length] = '\0';
+
+    static const struct { const char* key; size_t offset; } fields[] = {
+        { "hidden_size", offsetof(ModelConfig, embedding_dim) },
+        { "vocab_size", offsetof(ModelConfig, vocab_size) },
+        { "max_position_embeddings", offsetof(ModelConfig, max_seq_length) },
+        { "num_hidden_layers", offsetof(ModelConfig, num_hidden_layers) },
+        { "num_attention_heads", offsetof(ModelConfig, num_attention_heads) },
+        { "intermediate_size", offsetof(ModelConfig, intermediate_size) },
+        { "type_vocab_size", offsetof(ModelConfig, type_vocab_size) },
+    };
+    double value;
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+        if (json_number(json, fields[i].key, &value)) *(int*)((char*)config + fields[i].offset) = (int)value;
+    }
+    if (json_number(json, "layer_norm_eps", &value)) config->layer_norm_eps = (float)value;
+
+    char activation[32];
+    if (json_string(json, "hidden_act", activation, sizeof(activation))) {
+        if (strcmp(activation, "gelu") == 0) {
+            config->hidden_act = GEMM_GELU_ERF;
+        } else if (strcmp(activation, "gelu_new") == 0 || strcmp(activation, "gelu_pytorch_tanh") == 0) {
+            config->hidden_act = GEMM_GELU;
+        } else {
+            fprintf(stderr, "Unsupported hidden_act \"%s\" in %s\n", activation, path);
+            free(json);
+            return -1;
+        }
+    }
+    free(json);
+    return 1;
 }
 
-int* tokenize(Tokenizer* tokenizer, const char* text, int* num_tokens) {
-    int* tokens = malloc(MAX_SEQ_LENGTH * sizeof(int));
-    *num_tokens = 0;
+// config.json in the same directory as model_file
+static void config_path(const char* model_file, char* path, size_t size) {
+    const char* slash = strrchr(model_file, '/');
+    int dir_length = slash ? (int)(slash - model_file + 1) : 0;
+    snprintf(path, size, "%.*s%s", dir_length, model_file, MODEL_CONFIG_FILE);
+}
 
-    char* text_copy = strdup(text);
-    char* token = strtok(text_copy, " ");
-    while (token != NULL && *num_tokens < MAX_SEQ_LENGTH) {
-        for (int i = 0; i < tokenizer->vocab_size; i++) {
-            if (strcmp(token, tokenizer->vocab[i]) == 0) {
-                tokens[(*num_tokens)++] = i;
-                break;
-            }
-        }
-        token = strtok(NULL, " ");
+static bool check_config(const ModelConfig* c) {
+    if (c->embedding_dim <= 0 || c->vocab_size <= 0 || c->max_seq_length <= 0 || c->num_hidden_layers <= 0 ||
+        c->num_attention_heads <= 0 || c->intermediate_size <= 0 || c->type_vocab_size <= 0 ||
+        !(c->layer_norm_eps > 0.0f)) {
+        fprintf(stderr, "Model configuration has a zero or negative dimension\n");
+        return false;
+    }
+    if (c->embedding_dim % c->num_attention_heads != 0 ||
+        c->embedding_dim / c->num_attention_heads > ATTENTION_MAX_HEAD_DIM) {
+        fprintf(stderr, "%d attention heads do not split %d dimensions into heads of at most %d\n",
+                c->num_attention_heads, c->embedding_dim, ATTENTION_MAX_HEAD_DIM);
+        return false;
+    }
+    if (c->num_hidden_layers > PROFILE_MAX_LAYERS) {
+        fprintf(stderr, "Models with more than %d layers are not supported\n", PROFILE_MAX_LAYERS);
+        return false;
     }
+    return true;
+}
 
-    // print tokens
-    for (int i = 0; i < *num_tokens; i++) {
-        printf("%d ", tokens[i]);
+// Takes the model shape from the header. A config.json that was read must agree with it.
+static bool check_header(const ModelFileHeader* header, size_t size, ModelConfig* config, bool has_config) {
+    if (header->version != MODEL_FILE_VERSION) {
+        fprintf(stderr, "Unsupported model file version %u (expected %d)\n", header->version, MODEL_FILE_VERSION);
+        return false;
+    }
+    if (header->file_size != size ||
+        header->num_tensors > (size - sizeof(ModelFileHeader)) / sizeof(TensorEntry)) {
+        fprintf(stderr, "Model file is truncated or corrupt\n");
+        return false;
     }
-    printf("\n");
+    ModelConfig from_header = {
+        (int)header->embedding_dim, (int)header->vocab_size, (int)header->max_seq_length,
+        (int)header->num_hidden_layers, (int)header->num_attention_heads, (int)header->intermediate_size,
+        (int)header->type_vocab_size, config->layer_norm_eps, config->hidden_act
+    };
+    if (has_config && memcmp(&from_header, config, sizeof(ModelConfig)) != 0) {
+        fprintf(stderr, "Model file header and %s describe different model shapes\n", MODEL_CONFIG_FILE);
+        return false;
+    }
+    *config = from_header;
+    return true;
+}
 
-    free(text_copy);
-    return tokens;
+// Hashes the model file, read in chunks so a mapped model is not faulted into this process
+static int hash_model_file(int fd, size_t size, uint64_t* hash) {
+    const size_t chunk = 1 << 20;
+    char* buffer = malloc(chunk);
+    if (!buffer) return -1;
+    for (size_t offset = 0; offset < size;) {
+        ssize_t n = pread(fd, buffer, chunk, (off_t)offset);
+        if (n <= 0) {
+            free(buffer);
+            return -1;
+        }
+        *hash = embedding_hash(buffer, (size_t)n, *hash);
+        offset += (size_t)n;
+    }
+    free(buffer);
+    return 0;
 }
 
-void layer_norm(float* input, float* output, float* weight, float* bias, int size) {
-    float mean = 0.0f, var = 0.0f;
-    for (int i = 0; i < size; i++) {
-        mean += input[i];
+Model* load_model(const char* model_file, GemmType weight_type) {
+    gemm_init();
+
+    int fd = open(model_file, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        fprintf(stderr, "Failed to open model file\n");
+        if (fd >= 0) close(fd);
+        return NULL;
+    }
+    size_t size = (size_t)st.st_size;
+
+    Model* m = calloc(1, sizeof(Model));
+    ModelSource src = { 0 };
+    src.weight_type = weight_type;
+    src.config = &m->config;
+
+    char path[4096];
+    config_path(model_file, path, sizeof(path));
+    m->config = DEFAULT_CONFIG;
+    int has_config = read_model_config(path, &m->config);
+    src.failed = has_config < 0;
+
+    uint32_t magic = 0;
+    if (size >= sizeof(ModelFileHeader) && pread(fd, &magic, sizeof(magic), 0) != sizeof(magic)) {
+        magic = 0;
     }
-    mean /= size;
 
-    for (int i = 0; i < size; i++) {
-        float diff = input[i] - mean;
-        var += diff * diff;
+    if (magic == MODEL_FILE_MAGIC) {
+        // Weights are used in place: the mapping is shared with every other
+        // process that loads the same file and pages in on first use
+        void* mapping = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+        if (mapping == MAP_FAILED) {
+            fprintf(stderr, "Failed to map model file\n");
+            src.failed = true;
+        } else {
+            m->mapping = mapping;
+            m->mapping_size = size;
+            src.mapping = mapping;
+            src.size = size;
+            src.tensors = (const TensorEntry*)(src.mapping + sizeof(ModelFileHeader));
+            src.num_tensors = ((const ModelFileHeader*)mapping)->num_tensors;
+            src.failed |= !check_header(mapping, size, &m->config, has_config > 0);
+        }
+    } else if (size != legacy_model_floats(&m->config) * sizeof(float)) {
+        fprintf(stderr, "Model file is neither a model container nor a raw %zu-byte weight dump\n",
+                legacy_model_floats(&m->config) * sizeof(float));
+        src.failed = true;
+    } else {
+        src.legacy = fdopen(dup(fd), "rb");
+        src.staging = malloc((size_t)m->config.embedding_dim * m->config.intermediate_size * sizeof(float));
+        src.failed |= !src.legacy || !src.staging;
+    }
+    m->fingerprint = embedding_hash(&weight_type, sizeof(weight_type), size);
+    if (!src.failed && hash_model_file(fd, size, &m->fingerprint) != 0) {
+        fprintf(stderr, "Failed to read model file\n");
+        src.failed = true;
     }
-    var /= size;
+    close(fd);
+    m->fingerprint = embedding_hash(&m->config, sizeof(m->config), m->fingerprint);
+
+    if (!src.failed && check_config(&m->config)) {
+        m->layers = calloc(m->config.num_hidden_layers, sizeof(ModelLayer));
+        src.failed = !m->layers;
+    } else {
+        src.failed = true;
+    }
+
+    if (!src.failed) load_tensors(m, &src);
 
-    float std = sqrt(var + LAYER_NORM_EPS);
-    for (int i = 0; i < size; i++) {
-        output[i] = (input[i] - mean) / std * weight[i] + bias[i];
+    if (src.legacy) fclose(src.legacy);
+    free(src.staging);
+
+    if (src.failed) {
+        fprintf(stderr, "Failed to load model from %s\n", model_file);
+        free_model(m);
+        return NULL;
     }
+    return m;
+}
+
+// Row-parallel wrappers: each pool thread handles a contiguous block of token rows
+
+typedef struct {
+    const float* input;
+    const float* residual;
+    float* output;
+    const float* weight;
+    const float* bias;
+    int size;
+    float eps;
+} NormJob;
+
+static void add_layer_norm_rows(void* arg, int begin, int end) {
+    NormJob* job = arg;
+    size_t offset = (size_t)begin * job->size;
+    add_layer_norm(job->input + offset, job->residual ? job->residual + offset : NULL, job->output + offset,
+                   job->weight, job->bias, end - begin, job->size, job->eps);
 }
 
-void gelu(float* input, int size) {
-    for (int i = 0; i < size; i++) {
-        input[i] = 0.5f * input[i] * (1.0f + tanhf(0.797884f * (input[i] + 0.044715f * input[i] * input[i] * input[i])));
+typedef struct {
+    const Model* model;
+    const int* tokens;
+    float* output;
+    int seq_len;
+} EmbeddingJob;
+
+static void embedding_rows(void* arg, int begin, int end) {
+    EmbeddingJob* job = arg;
+    const Model* model = job->model;
+    int dim = model->config.embedding_dim;
+    for (int r = begin; r < end; r++) {
+        int position = r % job->seq_len;
+        size_t token = (size_t)job->tokens[r] * dim;
+        for (int j = 0; j < dim; j++) {
+            float word = model->token_embeddings ? model->token_embeddings[token + j]
+                                                 : half_to_float(model->token_embeddings_f16[token + j]);
+            job->output[(size_t)r * dim + j] = word +
+                                               model->position_embeddings[position * dim + j] +
+                                               model->token_type_embeddings[0 * dim + j];  // Assuming token_type_id = 0
+        }
     }
 }
 
-void matrix_multiply(float* a, float* b, float* c, int m, int n, int k) {
-    for (int i = 0; i < m; i++) {
-        for (int j = 0; j < k; j++) {
-            c[i * k + j] = 0.0f;
-            for (int l = 0; l < n; l++) {
-                c[i * k + j] += a[i * n + l] * b[l * k + j];
+// output = LayerNorm(input + residual); residual may be NULL
+static void parallel_add_layer_norm(ThreadPool* pool, const ModelConfig* config, const float* input, const float* residual,
+                                    float* output, const float* weight, const float* bias, int rows, int layer) {
+    PROFILE_BEGIN(mark);
+    NormJob job = { input, residual, output, weight, bias, config->embedding_dim, config->layer_norm_eps };
+    parallel_for(pool, rows, add_layer_norm_rows, &job);
+    // Sum, mean, variance and scale/shift: about 8 FLOPs per element
+    PROFILE_END(mark, PROFILE_LAYER_NORM, layer, (size_t)rows * job.size * sizeof(float) * (residual ? 3 : 2),
+                (size_t)rows * job.size * 8);
+}
+
+// Dense layer: output = activation(input * weight + bias), fused into the GEMM.
+// forward always passes the arena workspace, so gemm cannot fail here.
+static void linear(ThreadPool* pool, const float* input, int rows, const PackedMatrix* weight, const float* bias,
+                   GemmActivation activation, float* output, void* workspace, ProfileOp op, int layer) {
+    PROFILE_BEGIN(mark);
+    GemmEpilogue epilogue = { bias, activation };
+    gemm(input, rows, weight, output, &epilogue, workspace, pool);
+    PROFILE_END(mark, op, layer,
+                (size_t)rows * (weight->k + weight->n) * sizeof(float) + packed_matrix_bytes(weight),
+                2.0 * rows * weight->k * weight->n);
+}
+
+// Arena bytes one forward pass over rows token rows in batch sequences uses
+static size_t forward_scratch_bytes(const Model* model, int rows, int batch) {
+    size_t dim = model->config.embedding_dim;
+    return arena_size((size_t)rows * sizeof(int)) +                                     // tokens
+           arena_size((size_t)rows * sizeof(float)) +                                   // mask
+           3 * arena_size((size_t)rows * dim * sizeof(float)) +                         // layer input/output, attention output
+           arena_size((size_t)rows * 3 * dim * sizeof(float)) +                         // qkv
+           arena_size((size_t)rows * model->config.intermediate_size * sizeof(float)) + // ffn intermediate
+           arena_size((size_t)batch * dim * sizeof(float)) +                            // pooler
+           arena_size(gemm_workspace_size(rows, &model->layers[0].ffn.output));  // widest gemm input
+}
+
+// Runs the encoder over a padded [batch x seq_len] block of token ids.
+// mask is 1 for real tokens and 0 for padding; out receives batch x embedding_dim.
+// Activations are carved from the session arena, which the caller has reserved.
+static void forward(EmbeddingSession* session, const int* tokens, const float* mask, int batch, int seq_len, float* out) {
+    const Model* model = session->ctx->model;
+    const ModelConfig* config = &model->config;
+    int dim = config->embedding_dim;
+    ThreadPool* pool = session->pool;
+    Arena* arena = &session->arena;
+    int rows = batch * seq_len;
+
+    float* layer_input = arena_alloc(arena, (size_t)rows * dim * sizeof(float));
+    float* layer_output = arena_alloc(arena, (size_t)rows * dim * sizeof(float));
+    float* attention_output = arena_alloc(arena, (size_t)rows * dim * sizeof(float));
+    float* qkv = arena_alloc(arena, (size_t)rows * 3 * dim * sizeof(float));
+    float* ffn_intermediate = arena_alloc(arena, (size_t)rows * config->intermediate_size * sizeof(float));
+    void* workspace = arena_alloc(arena, gemm_workspace_size(rows, &model->layers[0].ffn.output));
+
+    // Embedding layer
+    PROFILE_BEGIN(embedding_mark);
+    EmbeddingJob embedding_job = { model, tokens, layer_input, seq_len };
+    parallel_for(pool, rows, embedding_rows, &embedding_job);
+    PROFILE_END(embedding_mark, PROFILE_EMBEDDINGS, PROFILE_NO_LAYER, (size_t)rows * dim * sizeof(float) * 4,
+                (size_t)rows * dim * 2);
+
+    parallel_add_layer_norm(pool, config, layer_input, NULL, layer_output, model->embeddings_layer_norm_weight, model->embeddings_layer_norm_bias, rows, PROFILE_NO_LAYER);
+
+    // Transformer layers: every projection is one GEMM over all rows of the batch
+    for (int layer = 0; layer < config->num_hidden_layers; layer++) {
+        // Self-attention
+        const AttentionWeights* attention = &model->layers[layer].attention;
+        linear(pool, layer_output, rows, &attention->qkv, attention->qkv_bias, GEMM_IDENTITY, qkv, workspace, PROFILE_QKV, layer);
+        PROFILE_BEGIN(attention_mark);
+        multi_head_attention(qkv, mask, batch, seq_len, config->num_attention_heads, dim / config->num_attention_heads,
+                             attention_output, pool);
+        // QK^T and PV; K and V are reread from cache for every query block
+        PROFILE_END(attention_mark, PROFILE_ATTENTION, layer, (size_t)rows * 4 * dim * sizeof(float),
+                    4.0 * batch * seq_len * seq_len * dim);
+        linear(pool, attention_output, rows, &attention->output, attention->output_bias, GEMM_IDENTITY, layer_input, workspace,
+               PROFILE_ATTENTION_OUTPUT, layer);
+
+        // Add & Norm
+        parallel_add_layer_norm(pool, config, layer_input, layer_output, attention_output, model->layers[layer].attention_layer_norm_weight, model->layers[layer].attention_layer_norm_bias, rows, layer);
+
+        // Feed-forward network, GELU applied in the GEMM epilogue
+        const FFNWeights* ffn = &model->layers[layer].ffn;
+        linear(pool, attention_output, rows, &ffn->intermediate, ffn->intermediate_bias, config->hidden_act, ffn_intermediate, workspace,
+               PROFILE_FFN_INTERMEDIATE, layer);
+        linear(pool, ffn_intermediate, rows, &ffn->output, ffn->output_bias, GEMM_IDENTITY, layer_input, workspace,
+               PROFILE_FFN_OUTPUT, layer);
+
+        // Add & Norm. The normalized result lands in layer_output, the next layer's input
+        parallel_add_layer_norm(pool, config, layer_input, attention_output, layer_output, model->layers[layer].ffn_layer_norm_weight, model->layers[layer].ffn_layer_norm_bias, rows, layer);
+    }
+
+    // Pooler (more comprehensive version)
+    PROFILE_BEGIN(pooling_mark);
+    float* pooled_output = arena_alloc(arena, (size_t)batch * dim * sizeof(float));
+    memset(pooled_output, 0, (size_t)batch * dim * sizeof(float));
+
+    // Average pooling over the unmasked tokens of each sequence
+    for (int b = 0; b < batch; b++) {
+        float* pooled = pooled_output + (size_t)b * dim;
+        float count = 0.0f;
+        for (int i = 0; i < seq_len; i++) {
+            float weight = mask[b * seq_len + i];
+            if (weight == 0.0f) continue;
+            for (int j = 0; j < dim; j++) {
+                pooled[j] += weight * layer_output[(size_t)(b * seq_len + i) * dim + j];
             }
+            count += weight;
+        }
+        for (int j = 0; j < dim && count > 0.0f; j++) {
+            pooled[j] /= count;
         }
     }
+
+    PROFILE_END(pooling_mark, PROFILE_POOLING, PROFILE_NO_LAYER, (size_t)rows * dim * sizeof(float),
+                (size_t)rows * dim * 2);
+
+    // Apply linear transformation and tanh activation
+    linear(pool, pooled_output, batch, &model->pooler_weight, model->pooler_bias, GEMM_TANH, out, workspace,
+           PROFILE_POOLER, PROFILE_NO_LAYER);
 }
 
-float* embed_text(const char* text, const char* vocab_file, const char* model_file) {
-    if (!tokenizer) tokenizer = load_tokenizer(vocab_file);
-    if (!model) model = load_model(model_file);
+EmbeddingContext* load_embedding_context(const char* vocab_file, const char* model_file, GemmType weight_type) {
+    EmbeddingContext* ctx = calloc(1, sizeof(EmbeddingContext));
+    ctx->tokenizer = load_tokenizer(vocab_file);
+    ctx->model = load_model(model_file, weight_type);
 
-    if (!tokenizer || !model) {
+    if (!ctx->tokenizer || !ctx->model) {
         fprintf(stderr, "Failed to load tokenizer or model\n");
+        free_embedding_context(ctx);
+        return NULL;
+    }
+    if (ctx->tokenizer->vocab_size > ctx->model->config.vocab_size) {
+        fprintf(stderr, "Vocab has %d entries but the model only embeds %d\n", ctx->tokenizer->vocab_size, ctx->model->config.vocab_size);
+        free_embedding_context(ctx);
         return NULL;
     }
+    return ctx;
+}
 
-    int num_tokens;
-    int* tokens = tokenize(tokenizer, text, &num_tokens);
+void free_embedding_context(EmbeddingContext* ctx) {
+    if (!ctx) return;
+    if (ctx->tokenizer) free_tokenizer(ctx->tokenizer);
+    if (ctx->model) free_model(ctx->model);
+    free(ctx);
+}
 
-    float* embedding = embedding_buffers[current_buffer];
-    current_buffer = (current_buffer + 1) % MAX_EMBEDDINGS;
+int embedding_dim(const EmbeddingContext* ctx) {
+    return ctx->model->config.embedding_dim;
+}
 
-    float* layer_input = calloc(num_tokens * EMBEDDING_DIM, sizeof(float));
-    float* layer_output = calloc(num_tokens * EMBEDDING_DIM, sizeof(float));
-    float* attention_output = calloc(num_tokens * EMBEDDING_DIM, sizeof(float));
-    float* ffn_intermediate = calloc(num_tokens * INTERMEDIATE_SIZE, sizeof(float));
+int max_sequence_length(const EmbeddingContext* ctx) {
+    int length = ctx->model->config.max_seq_length;
+    return length < MAX_SEQ_LENGTH ? length : MAX_SEQ_LENGTH;
+}
 
-    // Embedding layer
-    for (int i = 0; i < num_tokens; i++) {
-        for (int j = 0; j < EMBEDDING_DIM; j++) {
-            layer_input[i * EMBEDDING_DIM + j] = model->token_embeddings[tokens[i] * EMBEDDING_DIM + j] +
-                                                 model->position_embeddings[i * EMBEDDING_DIM + j] +
-                                                 model->token_type_embeddings[0 * EMBEDDING_DIM + j];  // Assuming token_type_id = 0
-        }
-    }
+EmbeddingSession* create_embedding_session(const EmbeddingContext* ctx) {
+    EmbeddingSession* session = calloc(1, sizeof(EmbeddingSession));
+    session->ctx = ctx;
 
-    layer_norm(layer_input, layer_output, model->embeddings_layer_norm_weight, model->embeddings_layer_norm_bias, num_tokens * EMBEDDING_DIM);
+    const char* threads = getenv("EMBED_NUM_THREADS");
+    session->pool = create_thread_pool(threads ? atoi(threads) : 1);
 
-    // Transformer layers
-    for (int layer = 0; layer < NUM_HIDDEN_LAYERS; layer++) {
-        // Self-attention
-        matrix_multiply(layer_output, model->layers[layer].attention.query, attention_output, num_tokens, EMBEDDING_DIM, EMBEDDING_DIM);
-        matrix_multiply(layer_output, model->layers[layer].attention.key, layer_input, num_tokens, EMBEDDING_DIM, EMBEDDING_DIM);
-        matrix_multiply(layer_output, model->layers[layer].attention.value, embedding, num_tokens, EMBEDDING_DIM, EMBEDDING_DIM);
-
-        // Simplified attention calculation (this should be more complex in a full implementation)
-        for (int i = 0; i < num_tokens * EMBEDDING_DIM; i++) {
-            attention_output[i] *= layer_input[i];
-            attention_output[i] *= embedding[i];
-        }
+    // Enough for one full-length sequence; batches grow it on first use
+    session->sequences = malloc(MAX_BATCH_SIZE * MAX_SEQ_LENGTH * sizeof(int));
+    if (!session->sequences || init_arena(&session->arena, forward_scratch_bytes(ctx->model, max_sequence_length(ctx), 1)) != 0) {
+        fprintf(stderr, "Failed to allocate embedding session\n");
+        free_embedding_session(session);
+        return NULL;
+    }
+    return session;
+}
 
-        matrix_multiply(attention_output, model->layers[layer].attention.output, layer_input, num_tokens, EMBEDDING_DIM, EMBEDDING_DIM);
+// Pads the batch tokenized sequences into one forward pass, scatters the
+// embeddings to out[targets] and adds them to the session cache
+static int embed_sequences(EmbeddingSession* session, const int* lengths, const int* targets,
+                           const EmbeddingKey* keys, int batch, float* out) {
+    const int* sequences = session->sequences;
+    int dim = embedding_dim(session->ctx);
+    int seq_len = 1;
+    for (int b = 0; b < batch; b++) {
+        if (lengths[b] > seq_len) seq_len = lengths[b];
+    }
 
-        // Add & Norm
-        for (int i = 0; i < num_tokens * EMBEDDING_DIM; i++) {
-            layer_input[i] += layer_output[i];
+    // Scratch for the previous batch is dropped wholesale
+    const EmbeddingProjection* projection = session->projection;
+    int output_dim = embedding_output_dim(session);
+    int rows = batch * seq_len;
+    size_t output_bytes = (size_t)batch * dim * sizeof(float);
+    size_t projected_bytes = projection ? (size_t)batch * output_dim * sizeof(float) : 0;
+    arena_reset(&session->arena);
+    if (arena_reserve(&session->arena, forward_scratch_bytes(session->ctx->model, rows, batch) + arena_size(output_bytes) +
+                                           arena_size(projected_bytes)) != 0) {
+        return -1;
+    }
+    float* output = arena_alloc(&session->arena, output_bytes);
+    float* projected = projection ? arena_alloc(&session->arena, projected_bytes) : output;
+    int* tokens = arena_alloc(&session->arena, (size_t)rows * sizeof(int));
+    float* mask = arena_alloc(&session->arena, (size_t)rows * sizeof(float));
+
+    // Pad every sequence to the longest one in the batch
+    for (int b = 0; b < batch; b++) {
+        for (int i = 0; i < seq_len; i++) {
+            bool real = i < lengths[b];
+            tokens[b * seq_len + i] = real ? sequences[b * MAX_SEQ_LENGTH + i] : PAD_TOKEN_ID;
+            mask[b * seq_len + i] = real ? 1.0f : 0.0f;
         }
-        layer_norm(layer_input, attention_output, model->layers[layer].attention_layer_norm_weight, model->layers[layer].attention_layer_norm_bias, num_tokens * EMBEDDING_DIM);
+    }
+
+    forward(session, tokens, mask, batch, seq_len, output);
+    if (projection) {
+        PROFILE_BEGIN(projection_mark);
+        project_embeddings(projection, output, batch, projected, session->pool);
+        PROFILE_END(projection_mark, PROFILE_PROJECTION, PROFILE_NO_LAYER,
+                    output_bytes + projected_bytes + packed_matrix_bytes(&projection->packed),
+                    2.0 * batch * dim * output_dim);
+    }
 
-        // Feed-forward network
-        matrix_multiply(attention_output, model->layers[layer].ffn.intermediate, ffn_intermediate, num_tokens, EMBEDDING_DIM, INTERMEDIATE_SIZE);
-        gelu(ffn_intermediate, num_tokens * INTERMEDIATE_SIZE);
-        matrix_multiply(ffn_intermediate, model->layers[layer].ffn.output, layer_input, num_tokens, INTERMEDIATE_SIZE, EMBEDDING_DIM);
+    for (int b = 0; b < batch; b++) {
+        memcpy(out + (size_t)targets[b] * output_dim, projected + (size_t)b * output_dim, output_dim * sizeof(float));
+        if (session->cache) embedding_cache_insert(session->cache, keys[b], projected + (size_t)b * output_dim);
+    }
+    return 0;
+}
 
-        // Add & Norm
-        for (int i = 0; i < num_tokens * EMBEDDING_DIM; i++) {
-            layer_input[i] += attention_output[i];
+// Shared by embed_batch and embed_tokenized: input i is either texts[i], or
+// the pre-tokenized sequences[i] of lengths[i] ids when texts is NULL
+static int embed_inputs(EmbeddingSession* session, const char** texts, const int** sequences,
+                        const int* input_lengths, int n, float* out) {
+    const Tokenizer* tokenizer = session->ctx->tokenizer;
+    int output_dim = embedding_output_dim(session);
+    int max_length = max_sequence_length(session->ctx);
+    int lengths[MAX_BATCH_SIZE];
+    int targets[MAX_BATCH_SIZE];
+    EmbeddingKey keys[MAX_BATCH_SIZE];
+
+    // Cache hits are answered as the inputs are tokenized; misses are gathered
+    // into batches of up to MAX_BATCH_SIZE sequences
+    int batch = 0;
+    for (int i = 0; i < n; i++) {
+        int* sequence = session->sequences + batch * MAX_SEQ_LENGTH;
+        if (texts) {
+            PROFILE_BEGIN(tokenize_mark);
+            lengths[batch] = tokenize(tokenizer, texts[i], sequence, max_length);
+            PROFILE_END(tokenize_mark, PROFILE_TOKENIZE, PROFILE_NO_LAYER, strlen(texts[i]) + lengths[batch] * sizeof(int), 0);
+        } else {
+            lengths[batch] = input_lengths[i] < max_length ? input_lengths[i] : max_length;
+            memcpy(sequence, sequences[i], lengths[batch] * sizeof(int));
+        }
+        if (session->cache) {
+            keys[batch] = embedding_key(sequence, lengths[batch]);
+            if (embedding_cache_lookup(session->cache, keys[batch], out + (size_t)i * output_dim)) continue;
         }
-        layer_norm(layer_input, layer_output, model->layers[layer].ffn_layer_norm_weight, model->layers[layer].ffn_layer_norm_bias, num_tokens * EMBEDDING_DIM);
+        targets[batch++] = i;
 
-        // Swap layer_input and layer_output for the next iteration
-        float* temp = layer_input;
-        layer_input = layer_output;
-        layer_output = temp;
+        if (batch == MAX_BATCH_SIZE) {
+            if (embed_sequences(session, lengths, targets, keys, batch, out) != 0) return -1;
+            batch = 0;
+        }
     }
+    if (batch > 0 && embed_sequences(session, lengths, targets, keys, batch, out) != 0) return -1;
+    return 0;
+}
 
-    // Pooler (more comprehensive version)
-    float* pooled_output = calloc(EMBEDDING_DIM, sizeof(float));
-    float* temp_output = calloc(EMBEDDING_DIM, sizeof(float));
+int embed_batch(EmbeddingSession* session, const char** texts, int n, float* out) {
+    return embed_inputs(session, texts, NULL, NULL, n, out);
+}
 
-    // Average pooling over all tokens
-    for (int i = 0; i < num_tokens; i++) {
-        for (int j = 0; j < EMBEDDING_DIM; j++) {
-            pooled_output[j] += layer_input[i * EMBEDDING_DIM + j];
+int embed_tokenized(EmbeddingSession* session, const int** sequences, const int* lengths, int n, float* out) {
+    // Ids index the embedding tables, so bad input is refused before any of it runs
+    int vocab_size = session->ctx->model->config.vocab_size;
+    for (int i = 0; i < n; i++) {
+        if (lengths[i] < 1) {
+            fprintf(stderr, "Sequence %d has length %d\n", i, lengths[i]);
+            return -1;
+        }
+        for (int j = 0; j < lengths[i]; j++) {
+            if (sequences[i][j] < 0 || sequences[i][j] >= vocab_size) {
+                fprintf(stderr, "Sequence %d has token id %d outside the %d-entry vocabulary\n", i, sequences[i][j], vocab_size);
+                return -1;
+            }
         }
     }
-    for (int j = 0; j < EMBEDDING_DIM; j++) {
-        pooled_output[j] /= num_tokens;
-    }
+    return embed_inputs(session, NULL, sequences, lengths, n, out);
+}
 
-    // Apply linear transformation and tanh activation
-    matrix_multiply(pooled_output, model->pooler_weight, temp_output, 1, EMBEDDING_DIM, EMBEDDING_DIM);
-    for (int i = 0; i < EMBEDDING_DIM; i++) {
-        embedding[i] = tanhf(temp_output[i] + model->pooler_bias[i]);
-    }
+int embed_text(EmbeddingSession* session, const char* text, float* out) {
+    return embed_batch(session, &text, 1, out);
+}
 
-    free(pooled_output);
-    free(temp_output);
-    free(tokens);
-    free(layer_input);
-    free(layer_output);
-    free(attention_output);
-    free(ffn_intermediate);
+void set_embedding_threads(EmbeddingSession* session, int num_threads) {
+    if (num_threads == thread_pool_size(session->pool)) return;
+    free_thread_pool(session->pool);
+    session->pool = create_thread_pool(num_threads);
+}
 
-    return embedding;
+uint64_t embedding_fingerprint(const EmbeddingSession* session) {
+    uint64_t hash = session->ctx->model->fingerprint;
+    const EmbeddingProjection* p = session->projection;
+    if (!p) return hash;
+    int shape[3] = { p->type, p->input_dim, p->output_dim };
+    hash = embedding_hash(shape, sizeof(shape), hash);
+    hash = embedding_hash(p->mean, (size_t)p->input_dim * sizeof(float), hash);
+    return embedding_hash(p->components, (size_t)p->input_dim * p->output_dim * sizeof(float), hash);
+}
+
+int set_embedding_cache(EmbeddingSession* session, EmbeddingCache* cache) {
+    if (cache && embedding_cache_dim(cache) != embedding_output_dim(session)) {
+        fprintf(stderr, "Embedding cache holds %d-dim vectors, the session produces %d\n", embedding_cache_dim(cache), embedding_output_dim(session));
+        return -1;
+    }
+    if (cache && embedding_cache_fingerprint(cache) != embedding_fingerprint(session)) {
+        fprintf(stderr, "Embedding cache holds vectors of another model, weight type or projection\n");
+        return -1;
+    }
+    session->cache = cache;
+    return 0;
 }
 
-void free_tokenizer(Tokenizer* tokenizer) {
-    for (int i = 0; i < tokenizer->vocab_size; i++) {
-        free(tokenizer->vocab[i]);
+int set_embedding_projection(EmbeddingSession* session, const EmbeddingProjection* projection) {
+    if (projection && projection->input_dim != embedding_dim(session->ctx)) {
+        fprintf(stderr, "Projection takes %d-dim vectors, the model produces %d\n", projection->input_dim, embedding_dim(session->ctx));
+        return -1;
+    }
+    int output_dim = projection ? projection->output_dim : embedding_dim(session->ctx);
+    if (session->cache && embedding_cache_dim(session->cache) != output_dim) {
+        fprintf(stderr, "Detach the %d-dim embedding cache before switching to %d-dim output\n", embedding_cache_dim(session->cache), output_dim);
+        return -1;
+    }
+    const EmbeddingProjection* previous = session->projection;
+    session->projection = projection;
+    if (session->cache && embedding_cache_fingerprint(session->cache) != embedding_fingerprint(session)) {
+        fprintf(stderr, "Detach the embedding cache before changing the projection it was filled with\n");
+        session->projection = previous;
+        return -1;
     }
-    free(tokenizer->vocab);
-    free(tokenizer);
+    return 0;
+}
+
+int embedding_output_dim(const EmbeddingSession* session) {
+    return session->projection ? session->projection->output_dim : embedding_dim(session->ctx);
+}
+
+void free_embedding_session(EmbeddingSession* session) {
+    if (!session) return;
+    free_thread_pool(session->pool);
+    free(session->sequences);
+    free_arena(&session->arena);
+    free(session);
 }
 
 void free_model(Model* model) {
-    free(model->token_embeddings);
+    int num_layers = model->layers ? model->config.num_hidden_layers : 0;
+    for (int i = 0; i < num_layers; i++) {
+        free_packed_matrix(&model->layers[i].attention.qkv);
+        free_packed_matrix(&model->layers[i].attention.output);
+        free(model->layers[i].attention.qkv_bias);
+        free_packed_matrix(&model->layers[i].ffn.intermediate);
+        free_packed_matrix(&model->layers[i].ffn.output);
+    }
+    free_packed_matrix(&model->pooler_weight);
+
+    if (model->owns_token_embeddings || !model->mapping) {
+        free(model->token_embeddings);
+        free(model->token_embeddings_f16);
+    }
+
+    // Everything else points into the mapping
+    if (model->mapping) {
+        munmap(model->mapping, model->mapping_size);
+        free(model->layers);
+        free(model);
+        return;
+    }
+
     free(model->position_embeddings);
     free(model->token_type_embeddings);
     free(model->embeddings_layer_norm_weight);
     free(model->embeddings_layer_norm_bias);
 
-    for (int i = 0; i < NUM_HIDDEN_LAYERS; i++) {
-        free(model->layers[i].attention.query);
-        free(model->layers[i].attention.key);
-        free(model->layers[i].attention.value);
-        free(model->layers[i].attention.output);
+    for (int i = 0; i < num_layers; i++) {
+        free(model->layers[i].attention.output_bias);
         free(model->layers[i].attention_layer_norm_weight);
         free(model->layers[i].attention_layer_norm_bias);
-        free(model->layers[i].ffn.intermediate);
-        free(model->layers[i].ffn.output);
+        free(model->layers[i].ffn.intermediate_bias);
+        free(model->layers[i].ffn.output_bias);
         free(model->layers[i].ffn_layer_norm_weight);
         free(model->layers[i].ffn_layer_norm_bias);
     }
 
-    free(model->pooler_weight);
     free(model->pooler_bias);
+    free(model->layers);
     free(model);
 }
 
 // int main() {
 //     const char* text = "Hello, world!";
-//     const char* vocab_file = "path/to/vocab.txt";
-//     const char* model_file = "path/to/model.bin";
-//     
-//     float* embedding = embed_text(text, vocab_file, model_file);
-//     
-//     if (embedding) {
+//     EmbeddingContext* ctx = load_embedding_context("path/to/vocab.txt", "path/to/model.bin", GEMM_F32);
+//     EmbeddingSession* session = create_embedding_session(ctx);
+//
+//     float embedding[384];  // embedding_dim(ctx)
+//     if (embed_text(session, text, embedding) == 0) {
 //         // ... (print or use the embedding)
-//         free(embedding);
 //     }
-//     
+//
+//     free_embedding_session(session);
+//     free_embedding_context(ctx);
 //     return 0;
 // }
-
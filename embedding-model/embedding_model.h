@@ -1,62 +1,155 @@
 #ifndef EMBEDDING_MODEL_H
 #define EMBEDDING_MODEL_H
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
+#include "arena.h"
+#include "embedding_cache.h"
+#include "gemm.h"
+#include "projection.h"
+#include "thread_pool.h"
+#include "tokenizer.h"
 
-#define EMBEDDING_DIM 384
-#define VOCAB_SIZE 30522
+// Longest sequence any model may use; sizes the per-session token buffers
 #define MAX_SEQ_LENGTH 512
-#define NUM_HIDDEN_LAYERS 6
-#define NUM_ATTENTION_HEADS 12
-#define INTERMEDIATE_SIZE 1536
+#define MAX_BATCH_SIZE 32
 
-// Tokenizer structure
+// Shape of the BERT encoder, taken from the model file header (or, for raw
+// weight dumps, from the config.json beside the model file) when it loads
 typedef struct {
-    char** vocab;
+    int embedding_dim;  // hidden_size
     int vocab_size;
-} Tokenizer;
+    int max_seq_length;  // max_position_embeddings
+    int num_hidden_layers;
+    int num_attention_heads;
+    int intermediate_size;
+    int type_vocab_size;
+    float layer_norm_eps;
+    GemmActivation hidden_act;  // GEMM_GELU_ERF for "gelu", GEMM_GELU for the tanh forms
+} ModelConfig;
 
-// Attention weights structure
+// Attention weights structure. The query, key and value projections are
+// concatenated at load time into one embedding_dim x 3 * embedding_dim GEMM.
 typedef struct {
-    float* query;
-    float* key;
-    float* value;
-    float* output;
+    PackedMatrix qkv;
+    PackedMatrix output;
+    float* qkv_bias;
+    float* output_bias;
 } AttentionWeights;
 
 // FFN weights structure
 typedef struct {
-    float* intermediate;
-    float* output;
+    PackedMatrix intermediate;
+    PackedMatrix output;
+    float* intermediate_bias;
+    float* output_bias;
 } FFNWeights;
 
+// One transformer layer
+typedef struct {
+    AttentionWeights attention;
+    float* attention_layer_norm_weight;
+    float* attention_layer_norm_bias;
+    FFNWeights ffn;
+    float* ffn_layer_norm_weight;
+    float* ffn_layer_norm_bias;
+} ModelLayer;
+
 // Model structure
 typedef struct {
+    ModelConfig config;
+
+    // Word embeddings: token_embeddings_f16 for GEMM_F16 models, token_embeddings otherwise
     float* token_embeddings;
+    uint16_t* token_embeddings_f16;
     float* position_embeddings;
     float* token_type_embeddings;
     float* embeddings_layer_norm_weight;
     float* embeddings_layer_norm_bias;
     
-    struct {
-        AttentionWeights attention;
-        float* attention_layer_norm_weight;
-        float* attention_layer_norm_bias;
-        FFNWeights ffn;
-        float* ffn_layer_norm_weight;
-        float* ffn_layer_norm_bias;
-    } layers[NUM_HIDDEN_LAYERS];
-
-    float* pooler_weight;
+    ModelLayer* layers;  // config.num_hidden_layers
+
+    PackedMatrix pooler_weight;
     float* pooler_bias;
+
+    // Set when the weights live in a read-only mapping of the model file
+    void* mapping;
+    size_t mapping_size;
+    bool owns_token_embeddings;  // converted at load rather than used from the mapping
+    // Hash of the model file contents, the config and the weight type
+    uint64_t fingerprint;
 } Model;
 
+// Tokenizer and weights loaded once and shared read-only by every session
+typedef struct {
+    Tokenizer* tokenizer;
+    Model* model;
+} EmbeddingContext;
+
+// Per-thread state for running the model: a thread pool that splits each
+// forward pass (EMBED_NUM_THREADS, default 1) and the scratch it uses.
+// Any number of sessions may share one context; a session must not be used
+// by two threads at once.
+typedef struct {
+    const EmbeddingContext* ctx;
+    ThreadPool* pool;
+
+    // Token ids of one batch before padding, MAX_BATCH_SIZE x MAX_SEQ_LENGTH
+    int* sequences;
+
+    // Padded ids, mask and activations of the current batch. Reset for every
+    // batch and grown to the largest batch seen, so steady-state calls do not allocate.
+    Arena arena;
+
+    // Optional, not owned: consulted before texts are run through the model
+    EmbeddingCache* cache;
+    // Optional, not owned: maps each pooled embedding to a compact vector
+    const EmbeddingProjection* projection;
+} EmbeddingSession;
+
 // Function declarations
-Tokenizer* load_tokenizer(const char* vocab_file);
-Model* load_model(const char* model_file);
-int* tokenize(Tokenizer* tokenizer, const char* text, int* num_tokens);
-float* embed_text(const char* text, const char* vocab_file, const char* model_file);
-void free_tokenizer(Tokenizer* tokenizer);
+// The model shape comes from the file header; raw weight dumps take it from
+// config.json in the model file's directory, or default to MiniLM-L6-H384.
+// weight_type GEMM_Q8 quantizes every weight matrix to int8 at load time;
+// GEMM_F16 keeps the weight matrices and word embeddings as half floats,
+// converting them at load unless the file already stores them that way
+Model* load_model(const char* model_file, GemmType weight_type);
 void free_model(Model* model);
 
+EmbeddingContext* load_embedding_context(const char* vocab_file, const char* model_file, GemmType weight_type);
+void free_embedding_context(EmbeddingContext* ctx);
+
+// Width of the vectors the context's model produces
+int embedding_dim(const EmbeddingContext* ctx);
+// Longest token sequence, [CLS] and [SEP] included, the model embeds; longer texts are truncated
+int max_sequence_length(const EmbeddingContext* ctx);
+
+EmbeddingSession* create_embedding_session(const EmbeddingContext* ctx);
+// Embeds n texts, padded into batches of up to MAX_BATCH_SIZE sequences that share
+// one forward pass. out receives n x embedding_output_dim floats. Returns 0 on success.
+int embed_batch(EmbeddingSession* session, const char** texts, int n, float* out);
+// Same as embed_batch for sequences the tokenizer already produced, each
+// lengths[i] >= 1 ids long including [CLS] and [SEP], every id in
+// [0, vocab_size). Returns -1, embedding nothing, if any input breaks that.
+int embed_tokenized(EmbeddingSession* session, const int** sequences, const int* lengths, int n, float* out);
+// Embeds one text into out (embedding_output_dim floats). Returns 0 on success.
+int embed_text(EmbeddingSession* session, const char* text, float* out);
+void set_embedding_threads(EmbeddingSession* session, int num_threads);
+// Routes the session's embeddings through cache (NULL detaches it). Texts whose
+// token sequence is cached skip the forward pass. Returns -1 if the cache
+// holds vectors of another size or embedding_fingerprint.
+int set_embedding_cache(EmbeddingSession* session, EmbeddingCache* cache);
+// Applies projection to every embedding the session produces (NULL removes it),
+// so embed_* write projection->output_dim floats per text. Returns -1 if the
+// projection does not take embedding_dim inputs, or a cache is attached that
+// the projection would invalidate.
+int set_embedding_projection(EmbeddingSession* session, const EmbeddingProjection* projection);
+// Identifies the vectors the session produces: the model's fingerprint combined
+// with the projection's type, size and matrix. Equal fingerprints give equal embeddings.
+uint64_t embedding_fingerprint(const EmbeddingSession* session);
+// Floats per embedding the session writes: the projection's output size if set
+int embedding_output_dim(const EmbeddingSession* session);
+void free_embedding_session(EmbeddingSession* session);
+
 #endif // EMBEDDING_MODEL_H
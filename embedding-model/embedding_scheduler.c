@@ -0,0 +1,255 @@
+#include "embedding_scheduler.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "profile.h"
+
+// Shortest padded length bucket; shorter texts are batched together
+#define MIN_BUCKET_LENGTH 8
+
+typedef struct EmbeddingRequest {
+    struct EmbeddingRequest* next;
+    float* out;
+    EmbeddingCallback done;
+    void* arg;
+    struct timespec queued_at;
+    int length;
+    int tokens[];
+} EmbeddingRequest;
+
+struct EmbeddingScheduler {
+    EmbeddingSession* session;
+    int max_batch;
+    long max_delay_ns;
+    pthread_t thread;
+
+    pthread_mutex_t lock;
+    pthread_cond_t ready;  // waits on CLOCK_MONOTONIC
+    EmbeddingRequest* head;
+    EmbeddingRequest** tail;
+    int queued;
+    bool shutdown;
+    EmbeddingSchedulerStats stats;
+
+    // Scheduler thread scratch, max_batch entries each
+    EmbeddingRequest** batch;
+    const int** sequences;
+    int* lengths;
+    float* outputs;
+};
+
+static int bucket_length(int length) {
+    int bucket = MIN_BUCKET_LENGTH;
+    while (bucket < length) bucket <<= 1;
+    return bucket;
+}
+
+static int compare_lengths(const void* a, const void* b) {
+    const EmbeddingRequest* x = *(EmbeddingRequest* const*)a;
+    const EmbeddingRequest* y = *(EmbeddingRequest* const*)b;
+    return x->length - y->length;
+}
+
+// Sorts a collected batch by length and runs one embed call per bucket
+static void run_batch(EmbeddingScheduler* scheduler, EmbeddingRequest** batch, int count) {
+    qsort(batch, count, sizeof(EmbeddingRequest*), compare_lengths);
+
+    for (int start = 0, end; start < count; start = end) {
+        int bucket = bucket_length(batch[start]->length);
+        for (end = start; end < count && bucket_length(batch[end]->length) == bucket; end++) {
+            scheduler->sequences[end - start] = batch[end]->tokens;
+            scheduler->lengths[end - start] = batch[end]->length;
+        }
+
+        int status = embed_tokenized(scheduler->session, scheduler->sequences, scheduler->lengths, end - start,
+                                     scheduler->outputs);
+        int dim = embedding_output_dim(scheduler->session);
+        for (int i = start; i < end; i++) {
+            EmbeddingRequest* request = batch[i];
+            if (status == 0) {
+                memcpy(request->out, scheduler->outputs + (size_t)(i - start) * dim, dim * sizeof(float));
+            }
+            request->done(request->arg, request->out, status);
+            free(request);
+        }
+
+        pthread_mutex_lock(&scheduler->lock);
+        scheduler->stats.batches++;
+        pthread_mutex_unlock(&scheduler->lock);
+    }
+}
+
+static void* scheduler_main(void* data) {
+    EmbeddingScheduler* scheduler = data;
+
+    pthread_mutex_lock(&scheduler->lock);
+    for (;;) {
+        while (scheduler->queued == 0 && !scheduler->shutdown) {
+            pthread_cond_wait(&scheduler->ready, &scheduler->lock);
+        }
+        if (scheduler->queued == 0) break;
+
+        // Wait for a full batch, but no longer than the oldest request's deadline
+        struct timespec deadline = scheduler->head->queued_at;
+        deadline.tv_nsec += scheduler->max_delay_ns;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+        while (scheduler->queued < scheduler->max_batch && !scheduler->shutdown) {
+            if (pthread_cond_timedwait(&scheduler->ready, &scheduler->lock, &deadline) == ETIMEDOUT) break;
+        }
+
+        int count = 0;
+        while (scheduler->head && count < scheduler->max_batch) {
+            scheduler->batch[count++] = scheduler->head;
+            scheduler->head = scheduler->head->next;
+        }
+        if (!scheduler->head) scheduler->tail = &scheduler->head;
+        scheduler->queued -= count;
+        pthread_mutex_unlock(&scheduler->lock);
+
+        run_batch(scheduler, scheduler->batch, count);
+
+        pthread_mutex_lock(&scheduler->lock);
+    }
+    pthread_mutex_unlock(&scheduler->lock);
+    return NULL;
+}
+
+EmbeddingScheduler* create_embedding_scheduler(EmbeddingSession* session, int max_batch, int max_delay_us) {
+    EmbeddingScheduler* scheduler = calloc(1, sizeof(EmbeddingScheduler));
+    if (!scheduler) return NULL;
+    scheduler->session = session;
+    scheduler->max_batch = max_batch > 0 ? max_batch : 1;
+    scheduler->max_delay_ns = (max_delay_us > 0 ? max_delay_us : 0) * 1000L;
+    scheduler->tail = &scheduler->head;
+
+    scheduler->batch = malloc(scheduler->max_batch * sizeof(EmbeddingRequest*));
+    scheduler->sequences = malloc(scheduler->max_batch * sizeof(int*));
+    scheduler->lengths = malloc(scheduler->max_batch * sizeof(int));
+    // A projection never widens the embeddings, so this fits any output size
+    scheduler->outputs = malloc((size_t)scheduler->max_batch * embedding_dim(session->ctx) * sizeof(float));
+    if (!scheduler->batch || !scheduler->sequences || !scheduler->lengths || !scheduler->outputs) {
+        fprintf(stderr, "Failed to allocate embedding scheduler\n");
+        free(scheduler->batch);
+        free(scheduler->sequences);
+        free(scheduler->lengths);
+        free(scheduler->outputs);
+        free(scheduler);
+        return NULL;
+    }
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&scheduler->ready, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&scheduler->lock, NULL);
+
+    if (pthread_create(&scheduler->thread, NULL, scheduler_main, scheduler) != 0) {
+        fprintf(stderr, "Failed to start embedding scheduler thread\n");
+        scheduler->shutdown = true;
+        scheduler->thread = 0;
+        free_embedding_scheduler(scheduler);
+        return NULL;
+    }
+    return scheduler;
+}
+
+int schedule_embedding(EmbeddingScheduler* scheduler, const char* text, float* out, EmbeddingCallback done, void* arg) {
+    // Tokenized on the calling thread, so the scheduler can bucket by length
+    int tokens[MAX_SEQ_LENGTH];
+    PROFILE_BEGIN(tokenize_mark);
+    const EmbeddingContext* ctx = scheduler->session->ctx;
+    int length = tokenize(ctx->tokenizer, text, tokens, max_sequence_length(ctx));
+    PROFILE_END(tokenize_mark, PROFILE_TOKENIZE, PROFILE_NO_LAYER, strlen(text) + length * sizeof(int), 0);
+
+    EmbeddingRequest* request = malloc(sizeof(EmbeddingRequest) + length * sizeof(int));
+    if (!request) return -1;
+    request->next = NULL;
+    request->out = out;
+    request->done = done;
+    request->arg = arg;
+    request->length = length;
+    memcpy(request->tokens, tokens, length * sizeof(int));
+    clock_gettime(CLOCK_MONOTONIC, &request->queued_at);
+
+    pthread_mutex_lock(&scheduler->lock);
+    if (scheduler->shutdown) {
+        pthread_mutex_unlock(&scheduler->lock);
+        free(request);
+        return -1;
+    }
+    *scheduler->tail = request;
+    scheduler->tail = &request->next;
+    scheduler->stats.requests++;
+    // The scheduler only needs waking for the first request and a full batch
+    if (++scheduler->queued == 1 || scheduler->queued >= scheduler->max_batch) {
+        pthread_cond_signal(&scheduler->ready);
+    }
+    pthread_mutex_unlock(&scheduler->lock);
+    return 0;
+}
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+    bool finished;
+    int status;
+} EmbeddingFuture;
+
+static void complete_future(void* arg, float* out, int status) {
+    (void)out;
+    EmbeddingFuture* future = arg;
+    pthread_mutex_lock(&future->lock);
+    future->finished = true;
+    future->status = status;
+    pthread_cond_signal(&future->done);
+    pthread_mutex_unlock(&future->lock);
+}
+
+int scheduled_embed_text(EmbeddingScheduler* scheduler, const char* text, float* out) {
+    EmbeddingFuture future = { .finished = false, .status = -1 };
+    pthread_mutex_init(&future.lock, NULL);
+    pthread_cond_init(&future.done, NULL);
+
+    int status = schedule_embedding(scheduler, text, out, complete_future, &future);
+    if (status == 0) {
+        pthread_mutex_lock(&future.lock);
+        while (!future.finished) pthread_cond_wait(&future.done, &future.lock);
+        status = future.status;
+        pthread_mutex_unlock(&future.lock);
+    }
+
+    pthread_mutex_destroy(&future.lock);
+    pthread_cond_destroy(&future.done);
+    return status;
+}
+
+EmbeddingSchedulerStats embedding_scheduler_stats(EmbeddingScheduler* scheduler) {
+    pthread_mutex_lock(&scheduler->lock);
+    EmbeddingSchedulerStats stats = scheduler->stats;
+    pthread_mutex_unlock(&scheduler->lock);
+    return stats;
+}
+
+void free_embedding_scheduler(EmbeddingScheduler* scheduler) {
+    if (!scheduler) return;
+
+    pthread_mutex_lock(&scheduler->lock);
+    scheduler->shutdown = true;
+    pthread_cond_signal(&scheduler->ready);
+    pthread_mutex_unlock(&scheduler->lock);
+    if (scheduler->thread) pthread_join(scheduler->thread, NULL);
+
+    pthread_mutex_destroy(&scheduler->lock);
+    pthread_cond_destroy(&scheduler->ready);
+    free(scheduler->batch);
+    free(scheduler->sequences);
+    free(scheduler->lengths);
+    free(scheduler->outputs);
+    free(scheduler);
+}
@@ -0,0 +1,34 @@
+#ifndef EMBEDDING_SCHEDULER_H
+#define EMBEDDING_SCHEDULER_H
+
+#include <stdint.h>
+#include "embedding_model.h"
+
+// Called once per request, on the scheduler thread. status is 0 when out
+// holds the embedding.
+typedef void (*EmbeddingCallback)(void* arg, float* out, int status);
+
+typedef struct {
+    uint64_t requests;
+    uint64_t batches;  // embed calls, one per length bucket of each collected batch
+} EmbeddingSchedulerStats;
+
+// Collects single-text requests from any number of threads into batched
+// forward passes. A batch is dispatched once it holds max_batch requests or
+// its oldest request has waited max_delay_us; its requests are then grouped
+// by padded length (powers of two) so short texts are not padded to long ones.
+typedef struct EmbeddingScheduler EmbeddingScheduler;
+
+// Runs every batch on session, which the scheduler uses exclusively until it
+// is freed; its thread count and cache apply to scheduled requests.
+EmbeddingScheduler* create_embedding_scheduler(EmbeddingSession* session, int max_batch, int max_delay_us);
+// Queues text and returns immediately; done(arg, out, status) runs when out
+// (embedding_output_dim floats) is filled. Returns -1 if the request was not queued.
+int schedule_embedding(EmbeddingScheduler* scheduler, const char* text, float* out, EmbeddingCallback done, void* arg);
+// Blocking wrapper around schedule_embedding. Returns 0 on success.
+int scheduled_embed_text(EmbeddingScheduler* scheduler, const char* text, float* out);
+EmbeddingSchedulerStats embedding_scheduler_stats(EmbeddingScheduler* scheduler);
+// Finishes the queued requests, then stops the scheduler thread
+void free_embedding_scheduler(EmbeddingScheduler* scheduler);
+
+#endif // EMBEDDING_SCHEDULER_H
@@ -0,0 +1,192 @@
+#ifndef FAST_MATH_H
+#define FAST_MATH_H
+
+// Branch-free tanh, erf and the two GELU forms for the GEMM epilogues, in
+// scalar, AVX2 and AVX-512 flavours that all compute the same rational
+// approximations.
+//
+// tanh(x) ~ x * P(x^2) / Q(x^2) with x clamped to +-7.9053 (where tanhf rounds
+// to +-1); P has degree 6 and Q degree 3 in x^2. erf has the same shape with
+// x clamped to +-4 and Q of degree 4. Max abs errors vs tanhf and erff are a
+// few float ulps, checked by test-kernels.
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#define FAST_TANH_CLAMP 7.90531110763549805f
+#define FAST_TANH_A1 4.89352455891786e-03f
+#define FAST_TANH_A3 6.37261928875436e-04f
+#define FAST_TANH_A5 1.48572235717979e-05f
+#define FAST_TANH_A7 5.12229709037114e-08f
+#define FAST_TANH_A9 -8.60467152213735e-11f
+#define FAST_TANH_A11 2.00018790482477e-13f
+#define FAST_TANH_A13 -2.76076847742355e-16f
+#define FAST_TANH_B0 4.89352518554385e-03f
+#define FAST_TANH_B2 2.26843463243900e-03f
+#define FAST_TANH_B4 1.18534705686654e-04f
+#define FAST_TANH_B6 1.19825839466702e-06f
+
+#define FAST_ERF_CLAMP 4.0f
+#define FAST_ERF_A1 -1.60960333262415e-02f
+#define FAST_ERF_A3 -2.95459980854025e-03f
+#define FAST_ERF_A5 -7.34990630326855e-04f
+#define FAST_ERF_A7 -5.69250639462346e-05f
+#define FAST_ERF_A9 -2.10102402082508e-06f
+#define FAST_ERF_A11 2.77068142495902e-08f
+#define FAST_ERF_A13 -2.72614225801306e-10f
+#define FAST_ERF_B0 -1.42647390514189e-02f
+#define FAST_ERF_B2 -7.37332916720468e-03f
+#define FAST_ERF_B4 -1.68282697438203e-03f
+#define FAST_ERF_B6 -2.13374055278905e-04f
+#define FAST_ERF_B8 -1.45660718464996e-05f
+
+// Tanh-form GELU ("gelu_new" in Hugging Face configs), which the C code used
+// before GEMM_GELU_ERF: 0.5 x (1 + tanh(sqrt(2 / pi) (x + 0.044715 x^3)))
+#define GELU_SCALE 0.797884f
+#define GELU_CUBIC 0.044715f
+// Exact GELU ("gelu", as BERT and MiniLM were trained): 0.5 x (1 + erf(x / sqrt(2)))
+#define GELU_ERF_SCALE 0.70710678f
+
+static inline float fast_tanhf(float x) {
+    x = x > FAST_TANH_CLAMP ? FAST_TANH_CLAMP : x < -FAST_TANH_CLAMP ? -FAST_TANH_CLAMP : x;
+    float x2 = x * x;
+    float p = FAST_TANH_A13;
+    p = p * x2 + FAST_TANH_A11;
+    p = p * x2 + FAST_TANH_A9;
+    p = p * x2 + FAST_TANH_A7;
+    p = p * x2 + FAST_TANH_A5;
+    p = p * x2 + FAST_TANH_A3;
+    p = p * x2 + FAST_TANH_A1;
+    float q = FAST_TANH_B6;
+    q = q * x2 + FAST_TANH_B4;
+    q = q * x2 + FAST_TANH_B2;
+    q = q * x2 + FAST_TANH_B0;
+    return x * p / q;
+}
+
+static inline float fast_geluf(float x) {
+    return 0.5f * x * (1.0f + fast_tanhf(GELU_SCALE * (x + GELU_CUBIC * x * x * x)));
+}
+
+static inline float fast_erff(float x) {
+    x = x > FAST_ERF_CLAMP ? FAST_ERF_CLAMP : x < -FAST_ERF_CLAMP ? -FAST_ERF_CLAMP : x;
+    float x2 = x * x;
+    float p = FAST_ERF_A13;
+    p = p * x2 + FAST_ERF_A11;
+    p = p * x2 + FAST_ERF_A9;
+    p = p * x2 + FAST_ERF_A7;
+    p = p * x2 + FAST_ERF_A5;
+    p = p * x2 + FAST_ERF_A3;
+    p = p * x2 + FAST_ERF_A1;
+    float q = FAST_ERF_B8;
+    q = q * x2 + FAST_ERF_B6;
+    q = q * x2 + FAST_ERF_B4;
+    q = q * x2 + FAST_ERF_B2;
+    q = q * x2 + FAST_ERF_B0;
+    return x * p / q;
+}
+
+static inline float fast_gelu_erff(float x) {
+    return 0.5f * x * (1.0f + fast_erff(GELU_ERF_SCALE * x));
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+static inline __attribute__((always_inline, target("avx2,fma")))
+__m256 fast_tanh_avx2(__m256 x) {
+    x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(-FAST_TANH_CLAMP)), _mm256_set1_ps(FAST_TANH_CLAMP));
+    __m256 x2 = _mm256_mul_ps(x, x);
+    __m256 p = _mm256_fmadd_ps(_mm256_set1_ps(FAST_TANH_A13), x2, _mm256_set1_ps(FAST_TANH_A11));
+    p = _mm256_fmadd_ps(p, x2, _mm256_set1_ps(FAST_TANH_A9));
+    p = _mm256_fmadd_ps(p, x2, _mm256_set1_ps(FAST_TANH_A7));
+    p = _mm256_fmadd_ps(p, x2, _mm256_set1_ps(FAST_TANH_A5));
+    p = _mm256_fmadd_ps(p, x2, _mm256_set1_ps(FAST_TANH_A3));
+    p = _mm256_fmadd_ps(p, x2, _mm256_set1_ps(FAST_TANH_A1));
+    __m256 q = _mm256_fmadd_ps(_mm256_set1_ps(FAST_TANH_B6), x2, _mm256_set1_ps(FAST_TANH_B4));
+    q = _mm256_fmadd_ps(q, x2, _mm256_set1_ps(FAST_TANH_B2));
+    q = _mm256_fmadd_ps(q, x2, _mm256_set1_ps(FAST_TANH_B0));
+    return _mm256_div_ps(_mm256_mul_ps(x, p), q);
+}
+
+static inline __attribute__((always_inline, target("avx2,fma")))
+__m256 fast_gelu_avx2(__m256 x) {
+    __m256 x3 = _mm256_mul_ps(_mm256_mul_ps(x, x), x);
+    __m256 inner = _mm256_mul_ps(_mm256_set1_ps(GELU_SCALE), _mm256_fmadd_ps(_mm256_set1_ps(GELU_CUBIC), x3, x));
+    __m256 half_x = _mm256_mul_ps(_mm256_set1_ps(0.5f), x);
+    return _mm256_fmadd_ps(half_x, fast_tanh_avx2(inner), half_x);
+}
+
+static inline __attribute__((always_inline, target("avx2,fma")))
+__m256 fast_erf_avx2(__m256 x) {
+    x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(-FAST_ERF_CLAMP)), _mm256_set1_ps(FAST_ERF_CLAMP));
+    __m256 x2 = _mm256_mul_ps(x, x);
+    __m256 p = _mm256_fmadd_ps(_mm256_set1_ps(FAST_ERF_A13), x2, _mm256_set1_ps(FAST_ERF_A11));
+    p = _mm256_fmadd_ps(p, x2, _mm256_set1_ps(FAST_ERF_A9));
+    p = _mm256_fmadd_ps(p, x2, _mm256_set1_ps(FAST_ERF_A7));
+    p = _mm256_fmadd_ps(p, x2, _mm256_set1_ps(FAST_ERF_A5));
+    p = _mm256_fmadd_ps(p, x2, _mm256_set1_ps(FAST_ERF_A3));
+    p = _mm256_fmadd_ps(p, x2, _mm256_set1_ps(FAST_ERF_A1));
+    __m256 q = _mm256_fmadd_ps(_mm256_set1_ps(FAST_ERF_B8), x2, _mm256_set1_ps(FAST_ERF_B6));
+    q = _mm256_fmadd_ps(q, x2, _mm256_set1_ps(FAST_ERF_B4));
+    q = _mm256_fmadd_ps(q, x2, _mm256_set1_ps(FAST_ERF_B2));
+    q = _mm256_fmadd_ps(q, x2, _mm256_set1_ps(FAST_ERF_B0));
+    return _mm256_div_ps(_mm256_mul_ps(x, p), q);
+}
+
+static inline __attribute__((always_inline, target("avx2,fma")))
+__m256 fast_gelu_erf_avx2(__m256 x) {
+    __m256 half_x = _mm256_mul_ps(_mm256_set1_ps(0.5f), x);
+    return _mm256_fmadd_ps(half_x, fast_erf_avx2(_mm256_mul_ps(_mm256_set1_ps(GELU_ERF_SCALE), x)), half_x);
+}
+
+static inline __attribute__((always_inline, target("avx512f")))
+__m512 fast_tanh_avx512(__m512 x) {
+    x = _mm512_min_ps(_mm512_max_ps(x, _mm512_set1_ps(-FAST_TANH_CLAMP)), _mm512_set1_ps(FAST_TANH_CLAMP));
+    __m512 x2 = _mm512_mul_ps(x, x);
+    __m512 p = _mm512_fmadd_ps(_mm512_set1_ps(FAST_TANH_A13), x2, _mm512_set1_ps(FAST_TANH_A11));
+    p = _mm512_fmadd_ps(p, x2, _mm512_set1_ps(FAST_TANH_A9));
+    p = _mm512_fmadd_ps(p, x2, _mm512_set1_ps(FAST_TANH_A7));
+    p = _mm512_fmadd_ps(p, x2, _mm512_set1_ps(FAST_TANH_A5));
+    p = _mm512_fmadd_ps(p, x2, _mm512_set1_ps(FAST_TANH_A3));
+    p = _mm512_fmadd_ps(p, x2, _mm512_set1_ps(FAST_TANH_A1));
+    __m512 q = _mm512_fmadd_ps(_mm512_set1_ps(FAST_TANH_B6), x2, _mm512_set1_ps(FAST_TANH_B4));
+    q = _mm512_fmadd_ps(q, x2, _mm512_set1_ps(FAST_TANH_B2));
+    q = _mm512_fmadd_ps(q, x2, _mm512_set1_ps(FAST_TANH_B0));
+    return _mm512_div_ps(_mm512_mul_ps(x, p), q);
+}
+
+static inline __attribute__((always_inline, target("avx512f")))
+__m512 fast_gelu_avx512(__m512 x) {
+    __m512 x3 = _mm512_mul_ps(_mm512_mul_ps(x, x), x);
+    __m512 inner = _mm512_mul_ps(_mm512_set1_ps(GELU_SCALE), _mm512_fmadd_ps(_mm512_set1_ps(GELU_CUBIC), x3, x));
+    __m512 half_x = _mm512_mul_ps(_mm512_set1_ps(0.5f), x);
+    return _mm512_fmadd_ps(half_x, fast_tanh_avx512(inner), half_x);
+}
+
+static inline __attribute__((always_inline, target("avx512f")))
+__m512 fast_erf_avx512(__m512 x) {
+    x = _mm512_min_ps(_mm512_max_ps(x, _mm512_set1_ps(-FAST_ERF_CLAMP)), _mm512_set1_ps(FAST_ERF_CLAMP));
+    __m512 x2 = _mm512_mul_ps(x, x);
+    __m512 p = _mm512_fmadd_ps(_mm512_set1_ps(FAST_ERF_A13), x2, _mm512_set1_ps(FAST_ERF_A11));
+    p = _mm512_fmadd_ps(p, x2, _mm512_set1_ps(FAST_ERF_A9));
+    p = _mm512_fmadd_ps(p, x2, _mm512_set1_ps(FAST_ERF_A7));
+    p = _mm512_fmadd_ps(p, x2, _mm512_set1_ps(FAST_ERF_A5));
+    p = _mm512_fmadd_ps(p, x2, _mm512_set1_ps(FAST_ERF_A3));
+    p = _mm512_fmadd_ps(p, x2, _mm512_set1_ps(FAST_ERF_A1));
+    __m512 q = _mm512_fmadd_ps(_mm512_set1_ps(FAST_ERF_B8), x2, _mm512_set1_ps(FAST_ERF_B6));
+    q = _mm512_fmadd_ps(q, x2, _mm512_set1_ps(FAST_ERF_B4));
+    q = _mm512_fmadd_ps(q, x2, _mm512_set1_ps(FAST_ERF_B2));
+    q = _mm512_fmadd_ps(q, x2, _mm512_set1_ps(FAST_ERF_B0));
+    return _mm512_div_ps(_mm512_mul_ps(x, p), q);
+}
+
+static inline __attribute__((always_inline, target("avx512f")))
+__m512 fast_gelu_erf_avx512(__m512 x) {
+    __m512 half_x = _mm512_mul_ps(_mm512_set1_ps(0.5f), x);
+    return _mm512_fmadd_ps(half_x, fast_erf_avx512(_mm512_mul_ps(_mm512_set1_ps(GELU_ERF_SCALE), x)), half_x);
+}
+
+#endif
+
+#endif // FAST_MATH_H
@@ -0,0 +1,202 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include "embedding_model.h"
+#include "projection.h"
+
+#define MAX_DIMS 16
+#define MAX_K 100
+
+// Fits PCA projections of the model's embeddings to a few output sizes and
+// reports how well each keeps nearest neighbours. The corpus is embedded at
+// full width; for every text its exact k nearest others (Euclidean, full
+// width) are compared with the k nearest after projecting, for PCA and for a
+// random projection of the same size.
+//
+// Usage: fit-projection [options]
+//   --model PATH --vocab PATH    model files (default ./embedding-model/...)
+//   --corpus PATH                one text per line (default sentences.txt)
+//   --dims 64,128,256            output sizes to fit
+//   --k N                        neighbours compared per text (default 10)
+//   --seed N                     random projection seed (default 1)
+//   --out PREFIX                 save each PCA fit as PREFIX-<dim>.bin, for
+//                                set_embedding_projection / EMBED_PROJECTION_FILE
+
+static int parse_list(const char* text, int* values) {
+    int count = 0;
+    while (*text && count < MAX_DIMS) {
+        values[count++] = atoi(text);
+        const char* comma = strchr(text, ',');
+        if (!comma) break;
+        text = comma + 1;
+    }
+    return count;
+}
+
+static char** read_lines(const char* path, int* count) {
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "Failed to open %s\n", path);
+        return NULL;
+    }
+    int capacity = 64;
+    char** lines = malloc(capacity * sizeof(char*));
+    char* line = NULL;
+    size_t size = 0;
+    *count = 0;
+    while (getline(&line, &size, f) != -1) {
+        line[strcspn(line, "\r\n")] = 0;
+        if (!line[0]) continue;
+        if (*count == capacity) {
+            capacity *= 2;
+            lines = realloc(lines, capacity * sizeof(char*));
+        }
+        lines[(*count)++] = strdup(line);
+    }
+    free(line);
+    fclose(f);
+    return lines;
+}
+
+static float squared_distance(const float* a, const float* b, int dim) {
+    float sum = 0.0f;
+    for (int i = 0; i < dim; i++) {
+        float d = a[i] - b[i];
+        sum += d * d;
+    }
+    return sum;
+}
+
+// neighbours[i * k ...] = the k vectors closest to vector i, itself excluded
+static void nearest_neighbours(const float* vectors, int n, int dim, int k, int* neighbours) {
+    float best[MAX_K];
+    for (int i = 0; i < n; i++) {
+        int* ids = neighbours + (size_t)i * k;
+        int found = 0;
+        for (int j = 0; j < n; j++) {
+            if (j == i) continue;
+            float d = squared_distance(vectors + (size_t)i * dim, vectors + (size_t)j * dim, dim);
+            if (found == k && d >= best[k - 1]) continue;
+            int pos = found < k ? found++ : k - 1;
+            while (pos > 0 && best[pos - 1] > d) {
+                best[pos] = best[pos - 1];
+                ids[pos] = ids[pos - 1];
+                pos--;
+            }
+            best[pos] = d;
+            ids[pos] = j;
+        }
+    }
+}
+
+// Mean fraction of the exact neighbours found by the projected search
+static double recall(const EmbeddingProjection* projection, const float* vectors, int n, int k, const int* exact) {
+    float* projected = malloc((size_t)n * projection->output_dim * sizeof(float));
+    int* approximate = malloc((size_t)n * k * sizeof(int));
+    project_embeddings(projection, vectors, n, projected, NULL);
+    nearest_neighbours(projected, n, projection->output_dim, k, approximate);
+
+    long hits = 0;
+    for (int i = 0; i < n; i++) {
+        for (int a = 0; a < k; a++) {
+            for (int e = 0; e < k; e++) {
+                if (approximate[(size_t)i * k + a] == exact[(size_t)i * k + e]) {
+                    hits++;
+                    break;
+                }
+            }
+        }
+    }
+    free(projected);
+    free(approximate);
+    return (double)hits / ((double)n * k);
+}
+
+int main(int argc, char* argv[]) {
+    const char* model_file = "./embedding-model/model.bin";
+    const char* vocab_file = "./embedding-model/vocab.txt";
+    const char* corpus_file = "sentences.txt";
+    const char* out_prefix = NULL;
+    int dims[MAX_DIMS] = { 64, 128, 256 }, num_dims = 3;
+    int k = 10;
+    uint64_t seed = 1;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--model") == 0) model_file = argv[i + 1];
+        else if (strcmp(argv[i], "--vocab") == 0) vocab_file = argv[i + 1];
+        else if (strcmp(argv[i], "--corpus") == 0) corpus_file = argv[i + 1];
+        else if (strcmp(argv[i], "--dims") == 0) num_dims = parse_list(argv[i + 1], dims);
+        else if (strcmp(argv[i], "--k") == 0) k = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "--seed") == 0) seed = strtoull(argv[i + 1], NULL, 10);
+        else if (strcmp(argv[i], "--out") == 0) out_prefix = argv[i + 1];
+        else {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    int n;
+    char** texts = read_lines(corpus_file, &n);
+    if (!texts) return 1;
+    if (k > n - 1) k = n - 1;
+    if (k > MAX_K) k = MAX_K;
+    if (k < 1) {
+        fprintf(stderr, "%s needs at least two texts\n", corpus_file);
+        return 1;
+    }
+
+    EmbeddingContext* ctx = load_embedding_context(vocab_file, model_file, GEMM_F32);
+    if (!ctx) {
+        fprintf(stderr, "Failed to load embedding model\n");
+        return 1;
+    }
+    EmbeddingSession* session = create_embedding_session(ctx);
+    int dim = embedding_dim(ctx);
+    float* vectors = malloc((size_t)n * dim * sizeof(float));
+    if (embed_batch(session, (const char**)texts, n, vectors) != 0) {
+        fprintf(stderr, "Failed to embed %s\n", corpus_file);
+        return 1;
+    }
+
+    int* exact = malloc((size_t)n * k * sizeof(int));
+    nearest_neighbours(vectors, n, dim, k, exact);
+
+    printf("%d texts from %s, %d-dim embeddings, recall@%d against exact full-width neighbours\n", n, corpus_file, dim, k);
+    if (n <= dim) printf("(only %d samples: PCA axes past the first %d carry no sample variance)\n", n, n - 1);
+    printf("%6s %8s %12s %10s %10s %10s\n", "dims", "bytes", "explained", "pca", "random", "saved");
+    printf("%6d %8d %11.1f%% %10.3f %10.3f\n", dim, dim * (int)sizeof(float), 100.0, 1.0, 1.0);
+    int status = 0;
+    for (int d = 0; d < num_dims; d++) {
+        int output_dim = dims[d];
+        if (output_dim < 1 || output_dim > dim) {
+            printf("%6d (skipped: the model produces %d dims)\n", output_dim, dim);
+            continue;
+        }
+        EmbeddingProjection* pca = fit_pca_projection(vectors, n, dim, output_dim);
+        EmbeddingProjection* random = create_random_projection(dim, output_dim, seed);
+        if (!pca || !random) {
+            fprintf(stderr, "Failed to create %d-dim projections\n", output_dim);
+            return 1;
+        }
+
+        char path[1024] = "-";
+        if (out_prefix) {
+            snprintf(path, sizeof(path), "%s-%d.bin", out_prefix, output_dim);
+            if (save_projection(pca, path) != 0) status = 1;
+        }
+        printf("%6d %8d %11.1f%% %10.3f %10.3f %10s\n", output_dim, output_dim * (int)sizeof(float),
+               100.0 * projection_explained_variance(pca), recall(pca, vectors, n, k, exact),
+               recall(random, vectors, n, k, exact), path);
+        free_projection(pca);
+        free_projection(random);
+    }
+
+    free(exact);
+    free(vectors);
+    free_embedding_session(session);
+    free_embedding_context(ctx);
+    for (int i = 0; i < n; i++) free(texts[i]);
+    free(texts);
+    return status;
+}
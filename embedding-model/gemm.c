@@ -0,0 +1,796 @@
+#include "gemm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "fast_math.h"
+#include "half.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define GEMM_X86 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#define GEMM_MAX_MR 14
+#define GEMM_ALIGNMENT 64
+
+// Computes an mr x GEMM_NR tile of c from mr rows of a and one packed panel slice
+// (float, or uint16_t half for the f16 tiles). With accumulate set the tile is added
+// to c instead of overwriting it. A non-NULL bias (GEMM_NR values) marks the last
+// depth block: bias and activation are applied before the tile leaves registers.
+typedef void (*GemmTile)(int kc, const float* a, int lda, const void* b, float* c, int ldc, int accumulate,
+                         const float* bias, GemmActivation activation);
+
+// Integer tile: int32 dot products of mr int16 activation rows with one int8
+// panel, written to c as mr x GEMM_NR contiguous values.
+typedef void (*Q8Tile)(int pairs, const int16_t* a, int lda, const int8_t* b, int32_t* c);
+
+typedef struct {
+    const char* name;
+    int mr;
+    GemmTile tiles[GEMM_MAX_MR + 1];  // tiles[r] handles exactly r rows
+    GemmTile f16_tiles[GEMM_MAX_MR + 1];
+    Q8Tile q8_tiles[GEMM_MAX_MR + 1];
+} GemmKernel;
+
+// Epilogue activation of one value, for the scalar tiles and the int8 path
+static inline float activate(float x, GemmActivation activation) {
+    switch (activation) {
+    case GEMM_GELU: return fast_geluf(x);
+    case GEMM_TANH: return fast_tanhf(x);
+    case GEMM_GELU_ERF: return fast_gelu_erff(x);
+    default: return x;
+    }
+}
+
+// Scalar fallback: 4 x 16 tile, plain C the compiler can still vectorize.
+
+// half is a constant in every instantiation, so each tile keeps one load path
+static inline __attribute__((always_inline))
+void scalar_tile(int mr, int half, int kc, const float* a, int lda, const void* b, float* c, int ldc, int accumulate,
+                 const float* bias, GemmActivation activation) {
+    float acc[4][GEMM_NR];
+    for (int r = 0; r < mr; r++) {
+        for (int j = 0; j < GEMM_NR; j++) {
+            acc[r][j] = accumulate ? c[r * ldc + j] : 0.0f;
+        }
+    }
+    for (int p = 0; p < kc; p++) {
+        float bp[GEMM_NR];
+        for (int j = 0; j < GEMM_NR; j++) {
+            bp[j] = half ? half_to_float(((const uint16_t*)b)[p * GEMM_NR + j]) : ((const float*)b)[p * GEMM_NR + j];
+        }
+        for (int r = 0; r < mr; r++) {
+            float ar = a[r * lda + p];
+            for (int j = 0; j < GEMM_NR; j++) {
+                acc[r][j] += ar * bp[j];
+            }
+        }
+    }
+    if (bias) {
+        for (int r = 0; r < mr; r++) {
+            for (int j = 0; j < GEMM_NR; j++) {
+                float x = acc[r][j] + bias[j];
+                acc[r][j] = activate(x, activation);
+            }
+        }
+    }
+    for (int r = 0; r < mr; r++) {
+        memcpy(c + r * ldc, acc[r], GEMM_NR * sizeof(float));
+    }
+}
+
+static inline __attribute__((always_inline))
+void scalar_q8_tile(int mr, int pairs, const int16_t* a, int lda, const int8_t* b, int32_t* c) {
+    int32_t acc[4][GEMM_NR] = { { 0 } };
+    for (int q = 0; q < pairs; q++) {
+        const int8_t* bq = b + q * 2 * GEMM_NR;
+        for (int r = 0; r < mr; r++) {
+            int32_t a0 = a[r * lda + 2 * q];
+            int32_t a1 = a[r * lda + 2 * q + 1];
+            for (int j = 0; j < GEMM_NR; j++) {
+                acc[r][j] += a0 * bq[2 * j] + a1 * bq[2 * j + 1];
+            }
+        }
+    }
+    memcpy(c, acc, mr * GEMM_NR * sizeof(int32_t));
+}
+
+#define SCALAR_TILE(R) \
+    static void scalar_tile_##R(int kc, const float* a, int lda, const void* b, float* c, int ldc, int accumulate, \
+                                const float* bias, GemmActivation activation) { \
+        scalar_tile(R, 0, kc, a, lda, b, c, ldc, accumulate, bias, activation); \
+    } \
+    static void scalar_f16_tile_##R(int kc, const float* a, int lda, const void* b, float* c, int ldc, int accumulate, \
+                                    const float* bias, GemmActivation activation) { \
+        scalar_tile(R, 1, kc, a, lda, b, c, ldc, accumulate, bias, activation); \
+    } \
+    static void scalar_q8_tile_##R(int pairs, const int16_t* a, int lda, const int8_t* b, int32_t* c) { \
+        scalar_q8_tile(R, pairs, a, lda, b, c); \
+    }
+SCALAR_TILE(1) SCALAR_TILE(2) SCALAR_TILE(3) SCALAR_TILE(4)
+
+static const GemmKernel scalar_kernel = {
+    "scalar", 4,
+    { NULL, scalar_tile_1, scalar_tile_2, scalar_tile_3, scalar_tile_4 },
+    { NULL, scalar_f16_tile_1, scalar_f16_tile_2, scalar_f16_tile_3, scalar_f16_tile_4 },
+    { NULL, scalar_q8_tile_1, scalar_q8_tile_2, scalar_q8_tile_3, scalar_q8_tile_4 }
+};
+
+#ifdef GEMM_X86
+
+// AVX2/FMA: 6 x 16 tile, two ymm accumulators per row (12 of 16 registers).
+// Half weights are widened with F16C, which every AVX2 CPU has.
+
+static inline __attribute__((always_inline, target("avx2,fma,f16c")))
+void avx2_tile(int mr, int half, int kc, const float* a, int lda, const void* b, float* c, int ldc, int accumulate,
+               const float* bias, GemmActivation activation) {
+    __m256 acc[6][2];
+    #pragma GCC unroll 6
+    for (int r = 0; r < mr; r++) {
+        acc[r][0] = accumulate ? _mm256_loadu_ps(c + r * ldc) : _mm256_setzero_ps();
+        acc[r][1] = accumulate ? _mm256_loadu_ps(c + r * ldc + 8) : _mm256_setzero_ps();
+    }
+    for (int p = 0; p < kc; p++) {
+        __m256 b0, b1;
+        if (half) {
+            const uint16_t* bp = (const uint16_t*)b + p * GEMM_NR;
+            b0 = _mm256_cvtph_ps(_mm_load_si128((const __m128i*)bp));
+            b1 = _mm256_cvtph_ps(_mm_load_si128((const __m128i*)(bp + 8)));
+        } else {
+            b0 = _mm256_load_ps((const float*)b + p * GEMM_NR);
+            b1 = _mm256_load_ps((const float*)b + p * GEMM_NR + 8);
+        }
+        #pragma GCC unroll 6
+        for (int r = 0; r < mr; r++) {
+            __m256 ar = _mm256_broadcast_ss(a + r * lda + p);
+            acc[r][0] = _mm256_fmadd_ps(ar, b0, acc[r][0]);
+            acc[r][1] = _mm256_fmadd_ps(ar, b1, acc[r][1]);
+        }
+    }
+    if (bias) {
+        __m256 bias0 = _mm256_loadu_ps(bias);
+        __m256 bias1 = _mm256_loadu_ps(bias + 8);
+        #pragma GCC unroll 6
+        for (int r = 0; r < mr; r++) {
+            acc[r][0] = _mm256_add_ps(acc[r][0], bias0);
+            acc[r][1] = _mm256_add_ps(acc[r][1], bias1);
+        }
+        if (activation == GEMM_GELU) {
+            #pragma GCC unroll 6
+            for (int r = 0; r < mr; r++) {
+                acc[r][0] = fast_gelu_avx2(acc[r][0]);
+                acc[r][1] = fast_gelu_avx2(acc[r][1]);
+            }
+        } else if (activation == GEMM_TANH) {
+            #pragma GCC unroll 6
+            for (int r = 0; r < mr; r++) {
+                acc[r][0] = fast_tanh_avx2(acc[r][0]);
+                acc[r][1] = fast_tanh_avx2(acc[r][1]);
+            }
+        } else if (activation == GEMM_GELU_ERF) {
+            #pragma GCC unroll 6
+            for (int r = 0; r < mr; r++) {
+                acc[r][0] = fast_gelu_erf_avx2(acc[r][0]);
+                acc[r][1] = fast_gelu_erf_avx2(acc[r][1]);
+            }
+        }
+    }
+    #pragma GCC unroll 6
+    for (int r = 0; r < mr; r++) {
+        _mm256_storeu_ps(c + r * ldc, acc[r][0]);
+        _mm256_storeu_ps(c + r * ldc + 8, acc[r][1]);
+    }
+}
+
+// Each 32-byte pair block widens to two vectors of 8 columns x 2 rows; vpmaddwd
+// multiplies them by a broadcast activation pair and adds the two products.
+static inline __attribute__((always_inline, target("avx2,fma")))
+void avx2_q8_tile(int mr, int pairs, const int16_t* a, int lda, const int8_t* b, int32_t* c) {
+    __m256i acc[6][2];
+    #pragma GCC unroll 6
+    for (int r = 0; r < mr; r++) {
+        acc[r][0] = _mm256_setzero_si256();
+        acc[r][1] = _mm256_setzero_si256();
+    }
+    for (int q = 0; q < pairs; q++) {
+        __m256i w = _mm256_load_si256((const __m256i*)(b + q * 2 * GEMM_NR));
+        __m256i w0 = _mm256_cvtepi8_epi16(_mm256_castsi256_si128(w));
+        __m256i w1 = _mm256_cvtepi8_epi16(_mm256_extracti128_si256(w, 1));
+        #pragma GCC unroll 6
+        for (int r = 0; r < mr; r++) {
+            int32_t pair;
+            memcpy(&pair, a + r * lda + 2 * q, sizeof(pair));
+            __m256i ar = _mm256_set1_epi32(pair);
+            acc[r][0] = _mm256_add_epi32(acc[r][0], _mm256_madd_epi16(w0, ar));
+            acc[r][1] = _mm256_add_epi32(acc[r][1], _mm256_madd_epi16(w1, ar));
+        }
+    }
+    #pragma GCC unroll 6
+    for (int r = 0; r < mr; r++) {
+        _mm256_storeu_si256((__m256i*)(c + r * GEMM_NR), acc[r][0]);
+        _mm256_storeu_si256((__m256i*)(c + r * GEMM_NR + 8), acc[r][1]);
+    }
+}
+
+#define AVX2_TILE(R) \
+    static __attribute__((target("avx2,fma,f16c"))) \
+    void avx2_tile_##R(int kc, const float* a, int lda, const void* b, float* c, int ldc, int accumulate, \
+                       const float* bias, GemmActivation activation) { \
+        avx2_tile(R, 0, kc, a, lda, b, c, ldc, accumulate, bias, activation); \
+    } \
+    static __attribute__((target("avx2,fma,f16c"))) \
+    void avx2_f16_tile_##R(int kc, const float* a, int lda, const void* b, float* c, int ldc, int accumulate, \
+                           const float* bias, GemmActivation activation) { \
+        avx2_tile(R, 1, kc, a, lda, b, c, ldc, accumulate, bias, activation); \
+    } \
+    static __attribute__((target("avx2,fma"))) \
+    void avx2_q8_tile_##R(int pairs, const int16_t* a, int lda, const int8_t* b, int32_t* c) { \
+        avx2_q8_tile(R, pairs, a, lda, b, c); \
+    }
+AVX2_TILE(1) AVX2_TILE(2) AVX2_TILE(3) AVX2_TILE(4) AVX2_TILE(5) AVX2_TILE(6)
+
+static const GemmKernel avx2_kernel = {
+    "avx2", 6,
+    { NULL, avx2_tile_1, avx2_tile_2, avx2_tile_3, avx2_tile_4, avx2_tile_5, avx2_tile_6 },
+    { NULL, avx2_f16_tile_1, avx2_f16_tile_2, avx2_f16_tile_3, avx2_f16_tile_4, avx2_f16_tile_5, avx2_f16_tile_6 },
+    { NULL, avx2_q8_tile_1, avx2_q8_tile_2, avx2_q8_tile_3, avx2_q8_tile_4, avx2_q8_tile_5, avx2_q8_tile_6 }
+};
+
+// AVX-512 (F + BW): 14 x 16 tile, one zmm accumulator per row.
+
+static inline __attribute__((always_inline, target("avx512f")))
+void avx512_tile(int mr, int half, int kc, const float* a, int lda, const void* b, float* c, int ldc, int accumulate,
+                 const float* bias, GemmActivation activation) {
+    __m512 acc[GEMM_MAX_MR];
+    #pragma GCC unroll 14
+    for (int r = 0; r < mr; r++) {
+        acc[r] = accumulate ? _mm512_loadu_ps(c + r * ldc) : _mm512_setzero_ps();
+    }
+    for (int p = 0; p < kc; p++) {
+        __m512 bp = half ? _mm512_cvtph_ps(_mm256_load_si256((const __m256i*)((const uint16_t*)b + p * GEMM_NR)))
+                         : _mm512_load_ps((const float*)b + p * GEMM_NR);
+        #pragma GCC unroll 14
+        for (int r = 0; r < mr; r++) {
+            acc[r] = _mm512_fmadd_ps(_mm512_set1_ps(a[r * lda + p]), bp, acc[r]);
+        }
+    }
+    if (bias) {
+        __m512 bias_vector = _mm512_loadu_ps(bias);
+        #pragma GCC unroll 14
+        for (int r = 0; r < mr; r++) {
+            acc[r] = _mm512_add_ps(acc[r], bias_vector);
+        }
+        if (activation == GEMM_GELU) {
+            #pragma GCC unroll 14
+            for (int r = 0; r < mr; r++) {
+                acc[r] = fast_gelu_avx512(acc[r]);
+            }
+        } else if (activation == GEMM_TANH) {
+            #pragma GCC unroll 14
+            for (int r = 0; r < mr; r++) {
+                acc[r] = fast_tanh_avx512(acc[r]);
+            }
+        } else if (activation == GEMM_GELU_ERF) {
+            #pragma GCC unroll 14
+            for (int r = 0; r < mr; r++) {
+                acc[r] = fast_gelu_erf_avx512(acc[r]);
+            }
+        }
+    }
+    #pragma GCC unroll 14
+    for (int r = 0; r < mr; r++) {
+        _mm512_storeu_ps(c + r * ldc, acc[r]);
+    }
+}
+
+static inline __attribute__((always_inline, target("avx512f,avx512bw")))
+void avx512_q8_tile(int mr, int pairs, const int16_t* a, int lda, const int8_t* b, int32_t* c) {
+    __m512i acc[GEMM_MAX_MR];
+    #pragma GCC unroll 14
+    for (int r = 0; r < mr; r++) {
+        acc[r] = _mm512_setzero_si512();
+    }
+    for (int q = 0; q < pairs; q++) {
+        __m512i w = _mm512_cvtepi8_epi16(_mm256_load_si256((const __m256i*)(b + q * 2 * GEMM_NR)));
+        #pragma GCC unroll 14
+        for (int r = 0; r < mr; r++) {
+            int32_t pair;
+            memcpy(&pair, a + r * lda + 2 * q, sizeof(pair));
+            acc[r] = _mm512_add_epi32(acc[r], _mm512_madd_epi16(w, _mm512_set1_epi32(pair)));
+        }
+    }
+    #pragma GCC unroll 14
+    for (int r = 0; r < mr; r++) {
+        _mm512_storeu_si512(c + r * GEMM_NR, acc[r]);
+    }
+}
+
+// Same tile with VNNI: vpdpwssd fuses the pair multiply and the accumulate
+static inline __attribute__((always_inline, target("avx512f,avx512bw,avx512vnni")))
+void avx512_vnni_q8_tile(int mr, int pairs, const int16_t* a, int lda, const int8_t* b, int32_t* c) {
+    __m512i acc[GEMM_MAX_MR];
+    #pragma GCC unroll 14
+    for (int r = 0; r < mr; r++) {
+        acc[r] = _mm512_setzero_si512();
+    }
+    for (int q = 0; q < pairs; q++) {
+        __m512i w = _mm512_cvtepi8_epi16(_mm256_load_si256((const __m256i*)(b + q * 2 * GEMM_NR)));
+        #pragma GCC unroll 14
+        for (int r = 0; r < mr; r++) {
+            int32_t pair;
+            memcpy(&pair, a + r * lda + 2 * q, sizeof(pair));
+            acc[r] = _mm512_dpwssd_epi32(acc[r], w, _mm512_set1_epi32(pair));
+        }
+    }
+    #pragma GCC unroll 14
+    for (int r = 0; r < mr; r++) {
+        _mm512_storeu_si512(c + r * GEMM_NR, acc[r]);
+    }
+}
+
+#define AVX512_TILE(R) \
+    static __attribute__((target("avx512f,avx512bw"))) \
+    void avx512_tile_##R(int kc, const float* a, int lda, const void* b, float* c, int ldc, int accumulate, \
+                         const float* bias, GemmActivation activation) { \
+        avx512_tile(R, 0, kc, a, lda, b, c, ldc, accumulate, bias, activation); \
+    } \
+    static __attribute__((target("avx512f,avx512bw"))) \
+    void avx512_f16_tile_##R(int kc, const float* a, int lda, const void* b, float* c, int ldc, int accumulate, \
+                             const float* bias, GemmActivation activation) { \
+        avx512_tile(R, 1, kc, a, lda, b, c, ldc, accumulate, bias, activation); \
+    } \
+    static __attribute__((target("avx512f,avx512bw"))) \
+    void avx512_q8_tile_##R(int pairs, const int16_t* a, int lda, const int8_t* b, int32_t* c) { \
+        avx512_q8_tile(R, pairs, a, lda, b, c); \
+    } \
+    static __attribute__((target("avx512f,avx512bw,avx512vnni"))) \
+    void avx512_vnni_q8_tile_##R(int pairs, const int16_t* a, int lda, const int8_t* b, int32_t* c) { \
+        avx512_vnni_q8_tile(R, pairs, a, lda, b, c); \
+    }
+AVX512_TILE(1) AVX512_TILE(2) AVX512_TILE(3) AVX512_TILE(4) AVX512_TILE(5) AVX512_TILE(6) AVX512_TILE(7)
+AVX512_TILE(8) AVX512_TILE(9) AVX512_TILE(10) AVX512_TILE(11) AVX512_TILE(12) AVX512_TILE(13) AVX512_TILE(14)
+
+static const GemmKernel avx512_kernel = {
+    "avx512", 14,
+    { NULL, avx512_tile_1, avx512_tile_2, avx512_tile_3, avx512_tile_4, avx512_tile_5, avx512_tile_6, avx512_tile_7,
+      avx512_tile_8, avx512_tile_9, avx512_tile_10, avx512_tile_11, avx512_tile_12, avx512_tile_13, avx512_tile_14 },
+    { NULL, avx512_f16_tile_1, avx512_f16_tile_2, avx512_f16_tile_3, avx512_f16_tile_4, avx512_f16_tile_5,
+      avx512_f16_tile_6, avx512_f16_tile_7, avx512_f16_tile_8, avx512_f16_tile_9, avx512_f16_tile_10,
+      avx512_f16_tile_11, avx512_f16_tile_12, avx512_f16_tile_13, avx512_f16_tile_14 },
+    { NULL, avx512_q8_tile_1, avx512_q8_tile_2, avx512_q8_tile_3, avx512_q8_tile_4, avx512_q8_tile_5, avx512_q8_tile_6,
+      avx512_q8_tile_7, avx512_q8_tile_8, avx512_q8_tile_9, avx512_q8_tile_10, avx512_q8_tile_11, avx512_q8_tile_12,
+      avx512_q8_tile_13, avx512_q8_tile_14 }
+};
+
+static const GemmKernel avx512_vnni_kernel = {
+    "avx512-vnni", 14,
+    { NULL, avx512_tile_1, avx512_tile_2, avx512_tile_3, avx512_tile_4, avx512_tile_5, avx512_tile_6, avx512_tile_7,
+      avx512_tile_8, avx512_tile_9, avx512_tile_10, avx512_tile_11, avx512_tile_12, avx512_tile_13, avx512_tile_14 },
+    { NULL, avx512_f16_tile_1, avx512_f16_tile_2, avx512_f16_tile_3, avx512_f16_tile_4, avx512_f16_tile_5,
+      avx512_f16_tile_6, avx512_f16_tile_7, avx512_f16_tile_8, avx512_f16_tile_9, avx512_f16_tile_10,
+      avx512_f16_tile_11, avx512_f16_tile_12, avx512_f16_tile_13, avx512_f16_tile_14 },
+    { NULL, avx512_vnni_q8_tile_1, avx512_vnni_q8_tile_2, avx512_vnni_q8_tile_3, avx512_vnni_q8_tile_4,
+      avx512_vnni_q8_tile_5, avx512_vnni_q8_tile_6, avx512_vnni_q8_tile_7, avx512_vnni_q8_tile_8,
+      avx512_vnni_q8_tile_9, avx512_vnni_q8_tile_10, avx512_vnni_q8_tile_11, avx512_vnni_q8_tile_12,
+      avx512_vnni_q8_tile_13, avx512_vnni_q8_tile_14 }
+};
+
+#endif // GEMM_X86
+
+static const GemmKernel* kernel = NULL;
+
+#ifdef GEMM_X86
+// Checked through cpuid: not every compiler's __builtin_cpu_supports knows "f16c"
+static int cpu_has_avx2(void) {
+    unsigned int eax, ebx, ecx, edx;
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") &&
+           __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_F16C);
+}
+#endif
+
+void gemm_init(void) {
+    const GemmKernel* chosen = &scalar_kernel;
+#ifdef GEMM_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+        chosen = __builtin_cpu_supports("avx512vnni") ? &avx512_vnni_kernel : &avx512_kernel;
+    } else if (cpu_has_avx2()) {
+        chosen = &avx2_kernel;
+    }
+#endif
+
+    const char* requested = getenv("EMBED_GEMM_KERNEL");
+    if (requested) {
+        if (strcmp(requested, "scalar") == 0) {
+            chosen = &scalar_kernel;
+        }
+#ifdef GEMM_X86
+        else if (strcmp(requested, "avx2") == 0 && cpu_has_avx2()) {
+            chosen = &avx2_kernel;
+        } else if (strcmp(requested, "avx512") == 0 && __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+            chosen = &avx512_kernel;
+        } else if (strcmp(requested, "avx512-vnni") == 0 && __builtin_cpu_supports("avx512f") &&
+                   __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vnni")) {
+            chosen = &avx512_vnni_kernel;
+        }
+#endif
+        else {
+            fprintf(stderr, "EMBED_GEMM_KERNEL=%s not available, using %s\n", requested, chosen->name);
+        }
+    }
+    kernel = chosen;
+}
+
+const char* gemm_kernel_name(void) {
+    if (!kernel) gemm_init();
+    return kernel->name;
+}
+
+// Bytes of one panel element for the float layouts
+static size_t element_size(GemmType type) {
+    return type == GEMM_F16 ? sizeof(uint16_t) : sizeof(float);
+}
+
+static void* alloc_panels(size_t bytes) {
+    return aligned_alloc(GEMM_ALIGNMENT, (bytes + GEMM_ALIGNMENT - 1) / GEMM_ALIGNMENT * GEMM_ALIGNMENT);
+}
+
+int pack_matrix(PackedMatrix* packed, const float* b, int k, int n) {
+    packed->k = k;
+    packed->n = n;
+    packed->num_panels = (n + GEMM_NR - 1) / GEMM_NR;
+
+    packed->data = alloc_panels((size_t)packed->num_panels * k * GEMM_NR * sizeof(float));
+    if (!packed->data) {
+        fprintf(stderr, "Failed to allocate packed matrix (%d x %d)\n", k, n);
+        return -1;
+    }
+    packed->type = GEMM_F32;
+    packed->scales = NULL;
+    packed->owned = 1;
+
+    for (int p = 0; p < packed->num_panels; p++) {
+        float* panel = (float*)packed->data + (size_t)p * k * GEMM_NR;
+        int j0 = p * GEMM_NR;
+        int nr = n - j0 < GEMM_NR ? n - j0 : GEMM_NR;
+        for (int l = 0; l < k; l++) {
+            memcpy(panel + l * GEMM_NR, b + (size_t)l * n + j0, nr * sizeof(float));
+            memset(panel + l * GEMM_NR + nr, 0, (GEMM_NR - nr) * sizeof(float));
+        }
+    }
+    return 0;
+}
+
+void wrap_packed_matrix(PackedMatrix* packed, void* data, int k, int n, GemmType type) {
+    packed->data = data;
+    packed->scales = NULL;
+    packed->k = k;
+    packed->n = n;
+    packed->num_panels = (n + GEMM_NR - 1) / GEMM_NR;
+    packed->type = type;
+    packed->owned = 0;
+}
+
+
+int concat_packed_matrices(PackedMatrix* packed, const PackedMatrix* parts, int count) {
+    int k = parts[0].k;
+    int n = 0;
+    GemmType type = parts[0].type;
+    for (int i = 0; i < count; i++) {
+        if (parts[i].type != type || type == GEMM_Q8 || parts[i].k != k || (i < count - 1 && parts[i].n % GEMM_NR != 0)) {
+            fprintf(stderr, "Cannot concatenate packed matrices of different depth, type or partial panels\n");
+            return -1;
+        }
+        n += parts[i].n;
+    }
+
+    packed->k = k;
+    packed->n = n;
+    packed->num_panels = (n + GEMM_NR - 1) / GEMM_NR;
+    packed->data = alloc_panels((size_t)packed->num_panels * k * GEMM_NR * element_size(type));
+    if (!packed->data) {
+        fprintf(stderr, "Failed to allocate packed matrix (%d x %d)\n", k, n);
+        return -1;
+    }
+    packed->type = type;
+    packed->scales = NULL;
+    packed->owned = 1;
+
+    // Whole panels line up, so the parts are copied back to back
+    char* out = packed->data;
+    for (int i = 0; i < count; i++) {
+        size_t part_bytes = (size_t)parts[i].num_panels * k * GEMM_NR * element_size(type);
+        memcpy(out, parts[i].data, part_bytes);
+        out += part_bytes;
+    }
+    return 0;
+}
+
+int quantize_packed_matrix(PackedMatrix* quantized, const PackedMatrix* packed) {
+    int k = packed->k;
+    int n = packed->n;
+    int pairs = (k + 1) / 2;
+    const float* src = packed->data;
+
+    quantized->k = k;
+    quantized->n = n;
+    quantized->num_panels = packed->num_panels;
+    quantized->type = GEMM_Q8;
+    quantized->owned = 1;
+    quantized->data = alloc_panels((size_t)packed->num_panels * pairs * 2 * GEMM_NR);
+    quantized->scales = calloc(packed->num_panels * GEMM_NR, sizeof(float));
+    if (!quantized->data || !quantized->scales) {
+        fprintf(stderr, "Failed to allocate quantized matrix (%d x %d)\n", k, n);
+        free_packed_matrix(quantized);
+        return -1;
+    }
+
+    for (int p = 0; p < packed->num_panels; p++) {
+        const float* panel = src + (size_t)p * k * GEMM_NR;
+        int8_t* out = (int8_t*)quantized->data + (size_t)p * pairs * 2 * GEMM_NR;
+        float* scales = quantized->scales + p * GEMM_NR;
+
+        // Symmetric per-output-column scale
+        for (int j = 0; j < GEMM_NR; j++) {
+            float max_abs = 0.0f;
+            for (int l = 0; l < k; l++) {
+                max_abs = fmaxf(max_abs, fabsf(panel[l * GEMM_NR + j]));
+            }
+            scales[j] = max_abs / 127.0f;
+        }
+
+        for (int q = 0; q < pairs; q++) {
+            for (int j = 0; j < GEMM_NR; j++) {
+                for (int h = 0; h < 2; h++) {
+                    int l = 2 * q + h;
+                    float w = l < k && scales[j] > 0.0f ? panel[l * GEMM_NR + j] / scales[j] : 0.0f;
+                    out[(q * GEMM_NR + j) * 2 + h] = (int8_t)lrintf(w);
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+int convert_packed_matrix(PackedMatrix* converted, const PackedMatrix* packed, GemmType type) {
+    size_t count = (size_t)packed->num_panels * packed->k * GEMM_NR;
+    if (packed->type == GEMM_Q8) {
+        fprintf(stderr, "Cannot convert an int8 packed matrix\n");
+        return -1;
+    }
+
+    // f16 -> int8 goes through a temporary f32 copy
+    if (type == GEMM_Q8 && packed->type == GEMM_F16) {
+        PackedMatrix widened;
+        if (convert_packed_matrix(&widened, packed, GEMM_F32) != 0) return -1;
+        int status = quantize_packed_matrix(converted, &widened);
+        free_packed_matrix(&widened);
+        return status;
+    }
+    if (type == GEMM_Q8) return quantize_packed_matrix(converted, packed);
+
+    *converted = *packed;
+    converted->type = type;
+    converted->owned = 1;
+    converted->data = alloc_panels(count * element_size(type));
+    if (!converted->data) {
+        fprintf(stderr, "Failed to allocate packed matrix (%d x %d)\n", packed->k, packed->n);
+        converted->owned = 0;
+        return -1;
+    }
+
+    if (type == packed->type) {
+        memcpy(converted->data, packed->data, count * element_size(type));
+    } else if (type == GEMM_F16) {
+        const float* src = packed->data;
+        uint16_t* dst = converted->data;
+        for (size_t i = 0; i < count; i++) dst[i] = float_to_half(src[i]);
+    } else {
+        const uint16_t* src = packed->data;
+        float* dst = converted->data;
+        for (size_t i = 0; i < count; i++) dst[i] = half_to_float(src[i]);
+    }
+    return 0;
+}
+
+void free_packed_matrix(PackedMatrix* packed) {
+    if (packed->owned) {
+        free(packed->data);
+        free(packed->scales);
+    }
+    packed->data = NULL;
+    packed->scales = NULL;
+    packed->owned = 0;
+}
+
+size_t packed_matrix_bytes(const PackedMatrix* packed) {
+    if (packed->type == GEMM_Q8) return (size_t)packed->num_panels * ((packed->k + 1) / 2) * 2 * GEMM_NR;
+    return (size_t)packed->num_panels * packed->k * GEMM_NR * element_size(packed->type);
+}
+
+typedef struct {
+    const float* a;
+    int m;
+    const PackedMatrix* b;
+    float* c;
+    const float* bias;  // NULL: plain product
+    GemmActivation activation;
+    int rows_per_block;
+
+    // GEMM_Q8: a quantized to int16 rows of padded length qk, one scale per row
+    int16_t* qa;
+    float* qa_scales;
+    int qk;
+} GemmJob;
+
+// Computes one unit of work: a single column panel over one block of rows
+static void gemm_unit(const GemmJob* job, int panel, int row_begin, int row_end) {
+    const PackedMatrix* b = job->b;
+    int k = b->k;
+    int n = b->n;
+    int mr = kernel->mr;
+    int j0 = panel * GEMM_NR;
+    int nr = n - j0 < GEMM_NR ? n - j0 : GEMM_NR;
+    const GemmTile* tiles = b->type == GEMM_F16 ? kernel->f16_tiles : kernel->tiles;
+    float tail[GEMM_MAX_MR * GEMM_NR];
+
+    // Bias for this panel, zero padded when the panel is narrower than the tile
+    float tail_bias[GEMM_NR] = { 0 };
+    const float* bias = NULL;
+    if (job->bias && nr == GEMM_NR) {
+        bias = job->bias + j0;
+    } else if (job->bias || job->activation != GEMM_IDENTITY) {
+        if (job->bias) memcpy(tail_bias, job->bias + j0, nr * sizeof(float));
+        bias = tail_bias;
+    }
+
+    for (int k0 = 0; k0 < k; k0 += GEMM_KC) {
+        int kc = k - k0 < GEMM_KC ? k - k0 : GEMM_KC;
+        int accumulate = k0 > 0;
+        // The epilogue runs with the last depth block
+        const float* block_bias = k0 + kc == k ? bias : NULL;
+        const void* slice = (const char*)b->data + ((size_t)panel * k + k0) * GEMM_NR * element_size(b->type);
+
+        for (int i0 = row_begin; i0 < row_end; i0 += mr) {
+            int rows = row_end - i0 < mr ? row_end - i0 : mr;
+            const float* a_block = job->a + (size_t)i0 * k + k0;
+            float* c_block = job->c + (size_t)i0 * n + j0;
+
+            if (nr == GEMM_NR) {
+                tiles[rows](kc, a_block, k, slice, c_block, n, accumulate, block_bias, job->activation);
+                continue;
+            }
+
+            // Last panel is narrower than the tile: go through a scratch tile
+            for (int r = 0; r < rows && accumulate; r++) {
+                memcpy(tail + r * GEMM_NR, c_block + (size_t)r * n, nr * sizeof(float));
+            }
+            tiles[rows](kc, a_block, k, slice, tail, GEMM_NR, accumulate, block_bias, job->activation);
+            for (int r = 0; r < rows; r++) {
+                memcpy(c_block + (size_t)r * n, tail + r * GEMM_NR, nr * sizeof(float));
+            }
+        }
+    }
+}
+
+// Integer path: the whole depth accumulates in int32, then both scales are applied
+static void gemm_unit_q8(const GemmJob* job, int panel, int row_begin, int row_end) {
+    const PackedMatrix* b = job->b;
+    int n = b->n;
+    int mr = kernel->mr;
+    int pairs = job->qk / 2;
+    int j0 = panel * GEMM_NR;
+    int nr = n - j0 < GEMM_NR ? n - j0 : GEMM_NR;
+    const int8_t* slice = (const int8_t*)b->data + (size_t)panel * pairs * 2 * GEMM_NR;
+    const float* scales = b->scales + j0;
+    int32_t tile[GEMM_MAX_MR * GEMM_NR];
+
+    for (int i0 = row_begin; i0 < row_end; i0 += mr) {
+        int rows = row_end - i0 < mr ? row_end - i0 : mr;
+        kernel->q8_tiles[rows](pairs, job->qa + (size_t)i0 * job->qk, job->qk, slice, tile);
+        for (int r = 0; r < rows; r++) {
+            float row_scale = job->qa_scales[i0 + r];
+            float* c_row = job->c + (size_t)(i0 + r) * n + j0;
+            for (int j = 0; j < nr; j++) {
+                float x = (float)tile[r * GEMM_NR + j] * row_scale * scales[j];
+                if (job->bias) x += job->bias[j0 + j];
+                c_row[j] = activate(x, job->activation);
+            }
+        }
+    }
+}
+
+// Dynamic per-row activation quantization: symmetric int8 range stored as int16
+static void quantize_rows(void* arg, int begin, int end) {
+    GemmJob* job = arg;
+    int k = job->b->k;
+    for (int i = begin; i < end; i++) {
+        const float* row = job->a + (size_t)i * k;
+        int16_t* out = job->qa + (size_t)i * job->qk;
+
+        float max_abs = 0.0f;
+        for (int l = 0; l < k; l++) {
+            max_abs = fmaxf(max_abs, fabsf(row[l]));
+        }
+        float scale = max_abs / 127.0f;
+        float inverse = scale > 0.0f ? 1.0f / scale : 0.0f;
+        for (int l = 0; l < k; l++) {
+            out[l] = (int16_t)lrintf(row[l] * inverse);
+        }
+        for (int l = k; l < job->qk; l++) {
+            out[l] = 0;
+        }
+        job->qa_scales[i] = scale;
+    }
+}
+
+// Units are numbered row block major, so a chunk of units walks neighbouring
+// panels against the same rows of a
+static void gemm_range(void* arg, int begin, int end) {
+    const GemmJob* job = arg;
+    int num_panels = job->b->num_panels;
+    for (int unit = begin; unit < end; unit++) {
+        int row_begin = (unit / num_panels) * job->rows_per_block;
+        int row_end = row_begin + job->rows_per_block < job->m ? row_begin + job->rows_per_block : job->m;
+        if (job->b->type == GEMM_Q8) {
+            gemm_unit_q8(job, unit % num_panels, row_begin, row_end);
+        } else {
+            gemm_unit(job, unit % num_panels, row_begin, row_end);
+        }
+    }
+}
+
+// Quantized activations, then their row scales
+static size_t q8_activation_bytes(int m, const PackedMatrix* b) {
+    size_t qk = (size_t)(b->k + 1) / 2 * 2;
+    return ((size_t)m * qk * sizeof(int16_t) + GEMM_ALIGNMENT - 1) / GEMM_ALIGNMENT * GEMM_ALIGNMENT;
+}
+
+size_t gemm_workspace_size(int m, const PackedMatrix* b) {
+    if (b->type != GEMM_Q8) return 0;
+    return q8_activation_bytes(m, b) + (size_t)m * sizeof(float);
+}
+
+int gemm(const float* a, int m, const PackedMatrix* b, float* c, const GemmEpilogue* epilogue, void* workspace,
+         ThreadPool* pool) {
+    if (!kernel) gemm_init();
+    if (m <= 0) return 0;
+
+    GemmJob job = { a, m, b, c, NULL, GEMM_IDENTITY, m, NULL, NULL, 0 };
+    if (epilogue) {
+        job.bias = epilogue->bias;
+        job.activation = epilogue->activation;
+    }
+
+    // Split rows as well as columns when there are too few panels to keep every thread busy
+    int threads = thread_pool_size(pool);
+    if (b->num_panels < 2 * threads) {
+        int row_blocks = (2 * threads + b->num_panels - 1) / b->num_panels;
+        int mr = kernel->mr;
+        int rows_per_block = ((m + row_blocks - 1) / row_blocks + mr - 1) / mr * mr;
+        job.rows_per_block = rows_per_block;
+    }
+
+    void* allocated = NULL;
+    if (b->type == GEMM_Q8) {
+        if (!workspace) {
+            workspace = allocated = malloc(gemm_workspace_size(m, b));
+            if (!workspace) {
+                fprintf(stderr, "Failed to allocate %zu bytes of gemm workspace\n", gemm_workspace_size(m, b));
+                return -1;
+            }
+        }
+        job.qk = (b->k + 1) / 2 * 2;
+        job.qa = workspace;
+        job.qa_scales = (float*)((char*)workspace + q8_activation_bytes(m, b));
+        parallel_for(pool, m, quantize_rows, &job);
+    }
+
+    int row_blocks = (m + job.rows_per_block - 1) / job.rows_per_block;
+    parallel_for(pool, row_blocks * b->num_panels, gemm_range, &job);
+
+    free(allocated);
+    return 0;
+}
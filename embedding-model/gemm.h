@@ -0,0 +1,79 @@
+#ifndef GEMM_H
+#define GEMM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "thread_pool.h"
+
+// Columns per packed weight panel. Every micro-kernel reads the same layout.
+#define GEMM_NR 16
+// Depth of one cache block: a GEMM_KC x GEMM_NR panel slice (16 KB) stays in L1.
+#define GEMM_KC 256
+
+typedef enum {
+    GEMM_F32 = 0,
+    GEMM_Q8 = 1,  // int8 weights with per-column scales; activations are quantized per row
+    GEMM_F16 = 2,  // IEEE half weights, widened to f32 in registers
+} GemmType;
+
+// A k x n weight matrix repacked into column panels of GEMM_NR.
+// GEMM_F32: panel p stores rows 0..k-1 of columns [p * GEMM_NR, p * GEMM_NR + GEMM_NR)
+// contiguously; columns past n are zero padded.
+// GEMM_F16: the GEMM_F32 layout with 16-bit elements.
+// GEMM_Q8: panel p stores ceil(k / 2) row pairs; each pair holds, for every column,
+// the int8 weights of rows 2q and 2q + 1 side by side (32 bytes per pair).
+typedef struct {
+    void* data;
+    float* scales;  // GEMM_Q8: dequantization scale per output column
+    int k;
+    int n;
+    int num_panels;
+    GemmType type;
+    int owned;  // data was allocated by pack_matrix / convert_packed_matrix
+} PackedMatrix;
+
+typedef enum {
+    GEMM_IDENTITY = 0,
+    GEMM_GELU = 1,  // tanh-form GELU ("gelu_new")
+    GEMM_TANH = 2,
+    GEMM_GELU_ERF = 3,  // exact GELU ("gelu"), with erf
+} GemmActivation;
+
+// Applied to each output tile while it is still in registers:
+// c = activation(a * b + bias). bias (n values) may be NULL.
+typedef struct {
+    const float* bias;
+    GemmActivation activation;
+} GemmEpilogue;
+
+// Picks the micro-kernel for this CPU. Called by load_model; safe to call again.
+// EMBED_GEMM_KERNEL=scalar|avx2|avx512|avx512-vnni overrides the choice.
+void gemm_init(void);
+const char* gemm_kernel_name(void);
+
+int pack_matrix(PackedMatrix* packed, const float* b, int k, int n);
+// Places the columns of count f32 or f16 matrices side by side, e.g. to fuse the
+// Q/K/V projections into one GEMM. Every part but the last must fill whole panels.
+int concat_packed_matrices(PackedMatrix* packed, const PackedMatrix* parts, int count);
+// Builds the GEMM_Q8 form of an f32 packed matrix
+int quantize_packed_matrix(PackedMatrix* quantized, const PackedMatrix* packed);
+// Builds the type form of an f32 or f16 packed matrix (always a new copy)
+int convert_packed_matrix(PackedMatrix* converted, const PackedMatrix* packed, GemmType type);
+// Uses data that is already in panel layout (f32 or f16), e.g. inside a mapped model file
+void wrap_packed_matrix(PackedMatrix* packed, void* data, int k, int n, GemmType type);
+void free_packed_matrix(PackedMatrix* packed);
+// Bytes of weight data (not counting Q8 scales)
+size_t packed_matrix_bytes(const PackedMatrix* packed);
+
+// Scratch bytes gemm needs for m rows against b (0 for f32 and f16 weights)
+size_t gemm_workspace_size(int m, const PackedMatrix* b);
+
+// c[m x n] = a[m x k] * b, all row-major, followed by the optional epilogue.
+// Column panels (and row blocks, for narrow matrices) are spread over pool;
+// pool may be NULL. workspace holds gemm_workspace_size(m, b) bytes, or is
+// NULL to let gemm allocate its own. Returns 0, or -1 with c untouched if that
+// allocation fails; with a workspace, or f32 / f16 weights, it cannot fail.
+int gemm(const float* a, int m, const PackedMatrix* b, float* c, const GemmEpilogue* epilogue, void* workspace,
+          ThreadPool* pool);
+
+#endif // GEMM_H
@@ -0,0 +1,48 @@
+#ifndef HALF_H
+#define HALF_H
+
+#include <stdint.h>
+#include <string.h>
+
+// IEEE 754 binary16 <-> binary32 in portable C, for loading and converting
+// half-precision weights. The GEMM kernels widen with F16C instead.
+
+static inline float half_to_float(uint16_t h) {
+    // Shifting the exponent and mantissa into place and scaling by 2^112 rebiases
+    // the exponent; half subnormals come out as correctly scaled floats
+    uint32_t bits = (uint32_t)(h & 0x7fff) << 13;
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    f *= 0x1p112f;
+    memcpy(&bits, &f, sizeof(bits));
+    if ((h & 0x7c00) == 0x7c00) bits |= 0x7f800000;  // inf / nan
+    bits |= (uint32_t)(h & 0x8000) << 16;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+// Rounds to nearest even; out of range values become inf
+static inline uint16_t float_to_half(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint16_t sign = (bits >> 16) & 0x8000;
+    bits &= 0x7fffffff;
+
+    if (bits >= 0x47800000) {  // 2^16 and above: inf, or nan kept quiet
+        return sign | (bits > 0x7f800000 ? 0x7e00 : 0x7c00);
+    }
+    if (bits < 0x38800000) {  // below 2^-14: half subnormal or zero
+        // Adding 0.5 lines the value up with the 2^-24 half subnormal step
+        float f;
+        memcpy(&f, &bits, sizeof(f));
+        f += 0.5f;
+        memcpy(&bits, &f, sizeof(bits));
+        return sign | (uint16_t)(bits - 0x3f000000);
+    }
+    // Rebias the exponent and round the 13 dropped mantissa bits to even
+    uint32_t odd = (bits >> 13) & 1;
+    bits += 0xc8000fffu + odd;
+    return sign | (uint16_t)(bits >> 13);
+}
+
+#endif // HALF_H
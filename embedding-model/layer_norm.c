@@ -0,0 +1,188 @@
+#include "layer_norm.h"
+#include <math.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define LAYER_NORM_X86 1
+#include <immintrin.h>
+#endif
+
+// Normalizes one row of size features given x = input + residual
+typedef void (*LayerNormRow)(const float* input, const float* residual, float* output, const float* weight,
+                             const float* bias, int size, float eps);
+
+// Each instruction set has a generic row kernel plus copies compiled for the
+// hidden sizes of the common BERT shapes, whose loops have constant trip counts
+typedef struct {
+    const char* name;
+    LayerNormRow generic;
+    LayerNormRow size_384;
+    LayerNormRow size_768;
+} LayerNormKernels;
+
+// Instantiates the kernels of one instruction set from its always_inline row body
+#define LAYER_NORM_KERNELS(isa, attributes)                                                               \
+    static attributes void isa##_row(const float* input, const float* residual, float* output,            \
+                                     const float* weight, const float* bias, int size, float eps) {       \
+        isa##_row_body(input, residual, output, weight, bias, size, eps);                                 \
+    }                                                                                                     \
+    static attributes void isa##_row_384(const float* input, const float* residual, float* output,        \
+                                         const float* weight, const float* bias, int size, float eps) {   \
+        (void)size;                                                                                       \
+        isa##_row_body(input, residual, output, weight, bias, 384, eps);                                  \
+    }                                                                                                     \
+    static attributes void isa##_row_768(const float* input, const float* residual, float* output,        \
+                                         const float* weight, const float* bias, int size, float eps) {   \
+        (void)size;                                                                                       \
+        isa##_row_body(input, residual, output, weight, bias, 768, eps);                                  \
+    }                                                                                                     \
+    static const LayerNormKernels isa##_kernels = { #isa, isa##_row, isa##_row_384, isa##_row_768 };
+
+// Statistics are accumulated relative to the row's first value, which keeps
+// the single-pass variance accurate when the mean is large against the spread.
+static inline float row_rstd(float s1, float s2, int size, float eps, float shift, float* mean) {
+    float m = s1 / size;
+    float var = s2 / size - m * m;
+    *mean = shift + m;
+    return 1.0f / sqrtf((var > 0.0f ? var : 0.0f) + eps);
+}
+
+static inline __attribute__((always_inline))
+void scalar_row_body(const float* input, const float* residual, float* output, const float* weight,
+                     const float* bias, int size, float eps) {
+    float shift = input[0] + (residual ? residual[0] : 0.0f);
+    float s1 = 0.0f, s2 = 0.0f;
+    for (int i = 0; i < size; i++) {
+        float x = input[i] + (residual ? residual[i] : 0.0f);
+        output[i] = x;
+        float d = x - shift;
+        s1 += d;
+        s2 += d * d;
+    }
+
+    float mean;
+    float rstd = row_rstd(s1, s2, size, eps, shift, &mean);
+    for (int i = 0; i < size; i++) {
+        output[i] = (output[i] - mean) * rstd * weight[i] + bias[i];
+    }
+}
+
+LAYER_NORM_KERNELS(scalar, )
+
+#ifdef LAYER_NORM_X86
+
+static inline __attribute__((always_inline, target("avx2,fma")))
+float hsum_avx2(__m256 v) {
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_movehdup_ps(s));
+    return _mm_cvtss_f32(s);
+}
+
+static inline __attribute__((always_inline, target("avx2,fma")))
+void avx2_row_body(const float* input, const float* residual, float* output, const float* weight,
+                   const float* bias, int size, float eps) {
+    float shift_value = input[0] + (residual ? residual[0] : 0.0f);
+    __m256 shift = _mm256_set1_ps(shift_value);
+    __m256 s1 = _mm256_setzero_ps(), s2 = _mm256_setzero_ps();
+    int vector_end = size / 8 * 8;
+    for (int i = 0; i < vector_end; i += 8) {
+        __m256 x = _mm256_loadu_ps(input + i);
+        if (residual) x = _mm256_add_ps(x, _mm256_loadu_ps(residual + i));
+        _mm256_storeu_ps(output + i, x);
+        __m256 d = _mm256_sub_ps(x, shift);
+        s1 = _mm256_add_ps(s1, d);
+        s2 = _mm256_fmadd_ps(d, d, s2);
+    }
+    float t1 = hsum_avx2(s1), t2 = hsum_avx2(s2);
+    for (int i = vector_end; i < size; i++) {
+        float x = input[i] + (residual ? residual[i] : 0.0f);
+        output[i] = x;
+        t1 += x - shift_value;
+        t2 += (x - shift_value) * (x - shift_value);
+    }
+
+    float mean_value;
+    float rstd_value = row_rstd(t1, t2, size, eps, shift_value, &mean_value);
+    __m256 mean = _mm256_set1_ps(mean_value);
+    __m256 rstd = _mm256_set1_ps(rstd_value);
+    for (int i = 0; i < vector_end; i += 8) {
+        __m256 x = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(output + i), mean), rstd);
+        _mm256_storeu_ps(output + i, _mm256_fmadd_ps(x, _mm256_loadu_ps(weight + i), _mm256_loadu_ps(bias + i)));
+    }
+    for (int i = vector_end; i < size; i++) {
+        output[i] = (output[i] - mean_value) * rstd_value * weight[i] + bias[i];
+    }
+}
+
+LAYER_NORM_KERNELS(avx2, __attribute__((target("avx2,fma"))))
+
+static inline __attribute__((always_inline, target("avx512f")))
+void avx512_row_body(const float* input, const float* residual, float* output, const float* weight,
+                     const float* bias, int size, float eps) {
+    float shift_value = input[0] + (residual ? residual[0] : 0.0f);
+    __m512 shift = _mm512_set1_ps(shift_value);
+    __m512 s1 = _mm512_setzero_ps(), s2 = _mm512_setzero_ps();
+    for (int i = 0; i < size; i += 16) {
+        // The last block is masked: inactive lanes load 0 and contribute nothing
+        __mmask16 mask = size - i >= 16 ? 0xFFFF : (__mmask16)((1u << (size - i)) - 1);
+        __m512 x = _mm512_maskz_loadu_ps(mask, input + i);
+        if (residual) x = _mm512_add_ps(x, _mm512_maskz_loadu_ps(mask, residual + i));
+        _mm512_mask_storeu_ps(output + i, mask, x);
+        __m512 d = _mm512_maskz_sub_ps(mask, x, shift);
+        s1 = _mm512_add_ps(s1, d);
+        s2 = _mm512_fmadd_ps(d, d, s2);
+    }
+
+    float mean_value;
+    float rstd_value = row_rstd(_mm512_reduce_add_ps(s1), _mm512_reduce_add_ps(s2), size, eps, shift_value, &mean_value);
+    __m512 mean = _mm512_set1_ps(mean_value);
+    __m512 rstd = _mm512_set1_ps(rstd_value);
+    for (int i = 0; i < size; i += 16) {
+        __mmask16 mask = size - i >= 16 ? 0xFFFF : (__mmask16)((1u << (size - i)) - 1);
+        __m512 x = _mm512_mul_ps(_mm512_sub_ps(_mm512_maskz_loadu_ps(mask, output + i), mean), rstd);
+        x = _mm512_fmadd_ps(x, _mm512_maskz_loadu_ps(mask, weight + i), _mm512_maskz_loadu_ps(mask, bias + i));
+        _mm512_mask_storeu_ps(output + i, mask, x);
+    }
+}
+
+LAYER_NORM_KERNELS(avx512, __attribute__((target("avx512f"))))
+
+#endif // LAYER_NORM_X86
+
+static const LayerNormKernels* row_kernels = &scalar_kernels;
+static pthread_once_t row_kernel_once = PTHREAD_ONCE_INIT;
+
+// Follows the GEMM kernel choice, including an EMBED_GEMM_KERNEL override
+static void select_row_kernel(void) {
+#ifdef LAYER_NORM_X86
+    const char* requested = getenv("EMBED_GEMM_KERNEL");
+    int allow_avx512 = !requested || strncmp(requested, "avx512", 6) == 0;
+    int allow_avx2 = allow_avx512 || strcmp(requested, "avx2") == 0;
+
+    __builtin_cpu_init();
+    if (allow_avx512 && __builtin_cpu_supports("avx512f")) {
+        row_kernels = &avx512_kernels;
+    } else if (allow_avx2 && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        row_kernels = &avx2_kernels;
+    }
+#endif
+}
+
+void add_layer_norm(const float* input, const float* residual, float* output, const float* weight, const float* bias,
+                    int rows, int size, float eps) {
+    pthread_once(&row_kernel_once, select_row_kernel);
+    LayerNormRow row_kernel = size == 384 ? row_kernels->size_384 : size == 768 ? row_kernels->size_768 : row_kernels->generic;
+    for (int r = 0; r < rows; r++) {
+        size_t offset = (size_t)r * size;
+        row_kernel(input + offset, residual ? residual + offset : NULL, output + offset, weight, bias, size, eps);
+    }
+}
+
+const char* layer_norm_kernel_name(void) {
+    pthread_once(&row_kernel_once, select_row_kernel);
+    return row_kernels->name;
+}
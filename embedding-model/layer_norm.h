@@ -0,0 +1,11 @@
+#ifndef LAYER_NORM_H
+#define LAYER_NORM_H
+
+// output = LayerNorm(input + residual) over each of rows rows of size features.
+// residual may be NULL; output may alias input. Each row takes two passes: the
+// first forms the sum and its statistics, the second normalizes in place.
+void add_layer_norm(const float* input, const float* residual, float* output, const float* weight, const float* bias,
+                    int rows, int size, float eps);
+const char* layer_norm_kernel_name(void);
+
+#endif // LAYER_NORM_H
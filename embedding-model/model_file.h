@@ -0,0 +1,53 @@
+#ifndef MODEL_FILE_H
+#define MODEL_FILE_H
+
+#include <stdint.h>
+
+// On-disk model container written by convert.py and mapped read-only by load_model.
+//
+// [ModelFileHeader][TensorEntry x num_tensors][padding][tensor data ...]
+//
+// All integers are little-endian. Every tensor starts at a multiple of
+// MODEL_FILE_ALIGNMENT from the start of the file, so mapped weights can be
+// used in place by the SIMD kernels.
+
+#define MODEL_FILE_MAGIC 0x4C444D45u  // "EMDL"
+#define MODEL_FILE_VERSION 1
+#define MODEL_FILE_ALIGNMENT 64
+#define MODEL_TENSOR_NAME_LENGTH 48
+
+enum {
+    TENSOR_F32 = 0,
+    TENSOR_F16 = 1,  // IEEE half; written for weight matrices and the word embeddings
+};
+
+enum {
+    TENSOR_ROW_MAJOR = 0,
+    TENSOR_PACKED_PANELS = 1,  // PackedMatrix layout with GEMM_NR columns per panel
+};
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t embedding_dim;
+    uint32_t vocab_size;
+    uint32_t max_seq_length;
+    uint32_t num_hidden_layers;
+    uint32_t num_attention_heads;
+    uint32_t intermediate_size;
+    uint32_t type_vocab_size;
+    uint32_t num_tensors;
+    uint64_t file_size;
+} ModelFileHeader;
+
+typedef struct {
+    char name[MODEL_TENSOR_NAME_LENGTH];  // NUL terminated, e.g. "layer.3.attention.query.weight"
+    uint32_t dtype;
+    uint32_t layout;
+    uint32_t rows;  // logical shape; weight matrices are stored as [in x out]
+    uint32_t cols;
+    uint64_t offset;
+    uint64_t size;  // bytes
+} TensorEntry;
+
+#endif // MODEL_FILE_H
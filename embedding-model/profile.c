@@ -0,0 +1,205 @@
+#include "profile.h"
+
+static const char* op_names[PROFILE_OP_COUNT] = {
+    "tokenize", "embeddings", "layer_norm", "qkv", "attention", "attention_output",
+    "ffn_intermediate", "ffn_output", "pooling", "pooler", "projection",
+};
+
+const char* profile_op_name(ProfileOp op) {
+    return op >= 0 && op < PROFILE_OP_COUNT ? op_names[op] : "unknown";
+}
+
+#ifdef EMBED_PROFILE
+
+#include <stdlib.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+typedef struct {
+    uint64_t start_ns;
+    uint64_t ns;
+    uint64_t bytes;
+    uint64_t flops;
+    int16_t op;
+    int16_t layer;
+    int32_t thread;
+} ProfileEvent;
+
+// Slot 0 holds PROFILE_NO_LAYER, slot l + 1 layer l
+static ProfileCounter counters[PROFILE_OP_COUNT][PROFILE_MAX_LAYERS + 1];
+static ProfileEvent events[PROFILE_MAX_EVENTS];
+static uint64_t num_events;
+static int next_thread_id;
+static _Thread_local int thread_id;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static uint64_t now_cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+int profile_enabled(void) {
+    return 1;
+}
+
+ProfileMark profile_begin(void) {
+    ProfileMark mark = { now_ns(), now_cycles() };
+    return mark;
+}
+
+void profile_end(const ProfileMark* mark, ProfileOp op, int layer, uint64_t bytes, uint64_t flops) {
+    uint64_t cycles = now_cycles() - mark->start_cycles;
+    uint64_t ns = now_ns() - mark->start_ns;
+    if (layer < PROFILE_NO_LAYER || layer >= PROFILE_MAX_LAYERS) return;
+
+    // Sessions on different threads update the same counters
+    ProfileCounter* counter = &counters[op][layer + 1];
+    __atomic_fetch_add(&counter->calls, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&counter->ns, ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&counter->cycles, cycles, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&counter->bytes, bytes, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&counter->flops, flops, __ATOMIC_RELAXED);
+
+    if (thread_id == 0) thread_id = __atomic_add_fetch(&next_thread_id, 1, __ATOMIC_RELAXED);
+    uint64_t slot = __atomic_fetch_add(&num_events, 1, __ATOMIC_RELAXED);
+    if (slot < PROFILE_MAX_EVENTS) {
+        events[slot] = (ProfileEvent){ mark->start_ns, ns, bytes, flops, (int16_t)op, (int16_t)layer, thread_id };
+    }
+}
+
+void profile_reset(void) {
+    __atomic_store_n(&num_events, 0, __ATOMIC_RELAXED);
+    for (int op = 0; op < PROFILE_OP_COUNT; op++) {
+        for (int l = 0; l <= PROFILE_MAX_LAYERS; l++) {
+            counters[op][l] = (ProfileCounter){ 0 };
+        }
+    }
+}
+
+ProfileCounter profile_counter(ProfileOp op, int layer) {
+    ProfileCounter counter = { 0 };
+    if (op < 0 || op >= PROFILE_OP_COUNT || layer < PROFILE_NO_LAYER || layer >= PROFILE_MAX_LAYERS) return counter;
+    const ProfileCounter* c = &counters[op][layer + 1];
+    counter.calls = __atomic_load_n(&c->calls, __ATOMIC_RELAXED);
+    counter.ns = __atomic_load_n(&c->ns, __ATOMIC_RELAXED);
+    counter.cycles = __atomic_load_n(&c->cycles, __ATOMIC_RELAXED);
+    counter.bytes = __atomic_load_n(&c->bytes, __ATOMIC_RELAXED);
+    counter.flops = __atomic_load_n(&c->flops, __ATOMIC_RELAXED);
+    return counter;
+}
+
+static void print_row(FILE* out, const char* name, const char* layer, const ProfileCounter* c, uint64_t total_ns) {
+    double seconds = c->ns * 1e-9;
+    fprintf(out, "%-18s %5s %8llu %10.3f %6.1f%% %10.2f %10.2f %9.2f %9.2f\n", name, layer,
+            (unsigned long long)c->calls, c->ns * 1e-6, total_ns ? 100.0 * c->ns / total_ns : 0.0,
+            c->calls ? c->ns * 1e-3 / c->calls : 0.0, c->cycles * 1e-6,
+            seconds > 0.0 ? c->flops / seconds * 1e-9 : 0.0, seconds > 0.0 ? c->bytes / seconds * 1e-9 : 0.0);
+}
+
+void profile_dump(FILE* out) {
+    ProfileCounter totals[PROFILE_OP_COUNT] = { { 0 } };
+    uint64_t total_ns = 0;
+    for (int op = 0; op < PROFILE_OP_COUNT; op++) {
+        for (int l = PROFILE_NO_LAYER; l < PROFILE_MAX_LAYERS; l++) {
+            ProfileCounter c = profile_counter(op, l);
+            totals[op].calls += c.calls;
+            totals[op].ns += c.ns;
+            totals[op].cycles += c.cycles;
+            totals[op].bytes += c.bytes;
+            totals[op].flops += c.flops;
+        }
+        total_ns += totals[op].ns;
+    }
+
+    const char* header = "%-18s %5s %8s %10s %7s %10s %10s %9s %9s\n";
+    fprintf(out, header, "operator", "layer", "calls", "total ms", "time", "mean us", "Mcycles", "GFLOP/s", "GB/s");
+    for (int l = PROFILE_NO_LAYER; l < PROFILE_MAX_LAYERS; l++) {
+        char layer[16];
+        snprintf(layer, sizeof(layer), l == PROFILE_NO_LAYER ? "-" : "%d", l);
+        for (int op = 0; op < PROFILE_OP_COUNT; op++) {
+            ProfileCounter c = profile_counter(op, l);
+            if (c.calls) print_row(out, op_names[op], layer, &c, total_ns);
+        }
+    }
+
+    fprintf(out, "\n");
+    fprintf(out, header, "operator", "", "calls", "total ms", "time", "mean us", "Mcycles", "GFLOP/s", "GB/s");
+    for (int op = 0; op < PROFILE_OP_COUNT; op++) {
+        if (totals[op].calls) print_row(out, op_names[op], "all", &totals[op], total_ns);
+    }
+    uint64_t dropped = __atomic_load_n(&num_events, __ATOMIC_RELAXED);
+    if (dropped > PROFILE_MAX_EVENTS) {
+        fprintf(out, "(%llu trace events past the first %d were not kept)\n",
+                (unsigned long long)(dropped - PROFILE_MAX_EVENTS), PROFILE_MAX_EVENTS);
+    }
+}
+
+int profile_write_trace(const char* path) {
+    FILE* f = fopen(path, "w");
+    if (!f) {
+        fprintf(stderr, "Failed to open %s\n", path);
+        return -1;
+    }
+    uint64_t count = __atomic_load_n(&num_events, __ATOMIC_RELAXED);
+    if (count > PROFILE_MAX_EVENTS) count = PROFILE_MAX_EVENTS;
+
+    // Timestamps are microseconds from the first event
+    uint64_t base = UINT64_MAX;
+    for (uint64_t i = 0; i < count; i++) {
+        if (events[i].start_ns < base) base = events[i].start_ns;
+    }
+
+    fprintf(f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    for (uint64_t i = 0; i < count; i++) {
+        const ProfileEvent* e = &events[i];
+        fprintf(f, "{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f, "
+                   "\"args\": {\"layer\": %d, \"bytes\": %llu, \"flops\": %llu}}%s\n",
+                op_names[e->op], e->layer == PROFILE_NO_LAYER ? "model" : "layer", e->thread,
+                (e->start_ns - base) * 1e-3, e->ns * 1e-3, e->layer, (unsigned long long)e->bytes,
+                (unsigned long long)e->flops, i + 1 < count ? "," : "");
+    }
+    fprintf(f, "]}\n");
+    if (fclose(f) != 0) {
+        fprintf(stderr, "Failed to write %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+#else
+
+int profile_enabled(void) {
+    return 0;
+}
+
+void profile_reset(void) {
+}
+
+ProfileCounter profile_counter(ProfileOp op, int layer) {
+    (void)op;
+    (void)layer;
+    ProfileCounter counter = { 0 };
+    return counter;
+}
+
+void profile_dump(FILE* out) {
+    fprintf(out, "Profiling is not compiled in (build with -DEMBED_PROFILE, e.g. make PROFILE=1)\n");
+}
+
+int profile_write_trace(const char* path) {
+    (void)path;
+    fprintf(stderr, "Profiling is not compiled in (build with -DEMBED_PROFILE, e.g. make PROFILE=1)\n");
+    return -1;
+}
+
+#endif // EMBED_PROFILE
@@ -0,0 +1,76 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Operator timing for the embedding pipeline, compiled in with -DEMBED_PROFILE
+// (make PROFILE=1). Each PROFILE_BEGIN / PROFILE_END pair adds its wall time,
+// TSC cycles, bytes touched and FLOPs to a per (operator, layer) counter shared
+// by every session, and records a trace event. Without EMBED_PROFILE the macros
+// expand to nothing and their byte / FLOP arguments are never evaluated.
+
+// Counters for operators outside the transformer layers
+#define PROFILE_NO_LAYER -1
+#define PROFILE_MAX_LAYERS 32
+// Trace events kept between resets; later ones are counted but not stored
+#define PROFILE_MAX_EVENTS 65536
+
+typedef enum {
+    PROFILE_TOKENIZE,
+    PROFILE_EMBEDDINGS,
+    PROFILE_LAYER_NORM,
+    PROFILE_QKV,
+    PROFILE_ATTENTION,
+    PROFILE_ATTENTION_OUTPUT,
+    PROFILE_FFN_INTERMEDIATE,  // GEMM with the GELU epilogue
+    PROFILE_FFN_OUTPUT,
+    PROFILE_POOLING,
+    PROFILE_POOLER,  // GEMM with the tanh epilogue
+    PROFILE_PROJECTION,  // optional PCA / random projection of the pooled output
+    PROFILE_OP_COUNT
+} ProfileOp;
+
+typedef struct {
+    uint64_t calls;
+    uint64_t ns;
+    uint64_t cycles;
+    uint64_t bytes;
+    uint64_t flops;
+} ProfileCounter;
+
+typedef struct {
+    uint64_t start_ns;
+    uint64_t start_cycles;
+} ProfileMark;
+
+const char* profile_op_name(ProfileOp op);
+// 1 when built with EMBED_PROFILE
+int profile_enabled(void);
+// Clears every counter and the trace
+void profile_reset(void);
+// Totals for op at layer (PROFILE_NO_LAYER for the embedding stage, pooler and tokenizer)
+ProfileCounter profile_counter(ProfileOp op, int layer);
+// Writes a table of every counter that ran, per layer and per operator
+void profile_dump(FILE* out);
+// Writes the recorded events in Chrome trace format (chrome://tracing, Perfetto).
+// Returns 0 on success.
+int profile_write_trace(const char* path);
+
+#ifdef EMBED_PROFILE
+
+ProfileMark profile_begin(void);
+void profile_end(const ProfileMark* mark, ProfileOp op, int layer, uint64_t bytes, uint64_t flops);
+
+#define PROFILE_BEGIN(mark) ProfileMark mark = profile_begin()
+#define PROFILE_END(mark, op, layer, bytes, flops) \
+    profile_end(&(mark), (op), (layer), (uint64_t)(bytes), (uint64_t)(flops))
+
+#else
+
+#define PROFILE_BEGIN(mark)
+#define PROFILE_END(mark, op, layer, bytes, flops) ((void)(op), (void)(layer))
+
+#endif // EMBED_PROFILE
+
+#endif // PROFILE_H
@@ -0,0 +1,402 @@
+#include "projection.h"
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PROJECTION_FILE_MAGIC "EMPJ"
+#define PROJECTION_FILE_VERSION 1
+
+// File: this header, then mean (input_dim floats), variance (output_dim floats)
+// and components (input_dim x output_dim floats, row-major)
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t type;
+    uint32_t input_dim;
+    uint32_t output_dim;
+    uint32_t reserved;
+    double total_variance;
+} ProjectionFileHeader;
+
+static EmbeddingProjection* alloc_projection(ProjectionType type, int input_dim, int output_dim) {
+    if (input_dim <= 0 || output_dim <= 0 || output_dim > input_dim) {
+        fprintf(stderr, "Cannot project %d dimensions to %d\n", input_dim, output_dim);
+        return NULL;
+    }
+    EmbeddingProjection* projection = calloc(1, sizeof(EmbeddingProjection));
+    if (!projection) return NULL;
+    projection->type = type;
+    projection->input_dim = input_dim;
+    projection->output_dim = output_dim;
+    projection->mean = calloc(input_dim, sizeof(float));
+    projection->components = calloc((size_t)input_dim * output_dim, sizeof(float));
+    projection->variance = calloc(output_dim, sizeof(float));
+    projection->bias = calloc(output_dim, sizeof(float));
+    if (!projection->mean || !projection->components || !projection->variance || !projection->bias) {
+        fprintf(stderr, "Failed to allocate projection\n");
+        free_projection(projection);
+        return NULL;
+    }
+    return projection;
+}
+
+// Packs the components and folds the mean into the GEMM bias
+static EmbeddingProjection* finish_projection(EmbeddingProjection* projection) {
+    int k = projection->input_dim, n = projection->output_dim;
+    for (int j = 0; j < n; j++) {
+        double sum = 0.0;
+        for (int i = 0; i < k; i++) sum += (double)projection->mean[i] * projection->components[(size_t)i * n + j];
+        projection->bias[j] = (float)-sum;
+    }
+    if (pack_matrix(&projection->packed, projection->components, k, n) != 0) {
+        free_projection(projection);
+        return NULL;
+    }
+    return projection;
+}
+
+// Householder reduction of the symmetric n x n matrix v to tridiagonal form
+// (diagonal d, subdiagonal e), leaving the accumulated transform in v.
+// After the EISPACK tred2 routine, as in the public domain JAMA library.
+static void tridiagonalize(double* v, double* d, double* e, int n) {
+    for (int j = 0; j < n; j++) d[j] = v[(size_t)(n - 1) * n + j];
+
+    for (int i = n - 1; i > 0; i--) {
+        double scale = 0.0, h = 0.0;
+        for (int k = 0; k < i; k++) scale += fabs(d[k]);
+        if (scale == 0.0) {
+            e[i] = d[i - 1];
+            for (int j = 0; j < i; j++) {
+                d[j] = v[(size_t)(i - 1) * n + j];
+                v[(size_t)i * n + j] = 0.0;
+                v[(size_t)j * n + i] = 0.0;
+            }
+        } else {
+            for (int k = 0; k < i; k++) {
+                d[k] /= scale;
+                h += d[k] * d[k];
+            }
+            double f = d[i - 1];
+            double g = f > 0 ? -sqrt(h) : sqrt(h);
+            e[i] = scale * g;
+            h -= f * g;
+            d[i - 1] = f - g;
+            for (int j = 0; j < i; j++) e[j] = 0.0;
+
+            for (int j = 0; j < i; j++) {
+                f = d[j];
+                v[(size_t)j * n + i] = f;
+                g = e[j] + v[(size_t)j * n + j] * f;
+                for (int k = j + 1; k <= i - 1; k++) {
+                    g += v[(size_t)k * n + j] * d[k];
+                    e[k] += v[(size_t)k * n + j] * f;
+                }
+                e[j] = g;
+            }
+            f = 0.0;
+            for (int j = 0; j < i; j++) {
+                e[j] /= h;
+                f += e[j] * d[j];
+            }
+            double hh = f / (h + h);
+            for (int j = 0; j < i; j++) e[j] -= hh * d[j];
+            for (int j = 0; j < i; j++) {
+                f = d[j];
+                g = e[j];
+                for (int k = j; k <= i - 1; k++) v[(size_t)k * n + j] -= f * e[k] + g * d[k];
+                d[j] = v[(size_t)(i - 1) * n + j];
+                v[(size_t)i * n + j] = 0.0;
+            }
+        }
+        d[i] = h;
+    }
+
+    // Accumulate the transformations
+    for (int i = 0; i < n - 1; i++) {
+        v[(size_t)(n - 1) * n + i] = v[(size_t)i * n + i];
+        v[(size_t)i * n + i] = 1.0;
+        double h = d[i + 1];
+        if (h != 0.0) {
+            for (int k = 0; k <= i; k++) d[k] = v[(size_t)k * n + i + 1] / h;
+            for (int j = 0; j <= i; j++) {
+                double g = 0.0;
+                for (int k = 0; k <= i; k++) g += v[(size_t)k * n + i + 1] * v[(size_t)k * n + j];
+                for (int k = 0; k <= i; k++) v[(size_t)k * n + j] -= g * d[k];
+            }
+        }
+        for (int k = 0; k <= i; k++) v[(size_t)k * n + i + 1] = 0.0;
+    }
+    for (int j = 0; j < n; j++) {
+        d[j] = v[(size_t)(n - 1) * n + j];
+        v[(size_t)(n - 1) * n + j] = 0.0;
+    }
+    v[(size_t)(n - 1) * n + n - 1] = 1.0;
+    e[0] = 0.0;
+}
+
+// Implicit QL iterations on the tridiagonal form (EISPACK tql2). On return d
+// holds the eigenvalues and column j of v the eigenvector of d[j].
+static void tridiagonal_eigen(double* v, double* d, double* e, int n) {
+    for (int i = 1; i < n; i++) e[i - 1] = e[i];
+    e[n - 1] = 0.0;
+
+    double f = 0.0, tst1 = 0.0;
+    const double eps = 0x1p-52;
+    for (int l = 0; l < n; l++) {
+        // Find a small subdiagonal element
+        tst1 = fmax(tst1, fabs(d[l]) + fabs(e[l]));
+        int m = l;
+        while (m < n - 1 && fabs(e[m]) > eps * tst1) m++;
+
+        if (m > l) {
+            do {
+                // Compute the implicit shift
+                double g = d[l];
+                double p = (d[l + 1] - g) / (2.0 * e[l]);
+                double r = hypot(p, 1.0);
+                if (p < 0) r = -r;
+                d[l] = e[l] / (p + r);
+                d[l + 1] = e[l] * (p + r);
+                double dl1 = d[l + 1];
+                double h = g - d[l];
+                for (int i = l + 2; i < n; i++) d[i] -= h;
+                f += h;
+
+                // Implicit QL transformation
+                p = d[m];
+                double c = 1.0, c2 = c, c3 = c;
+                double el1 = e[l + 1];
+                double s = 0.0, s2 = 0.0;
+                for (int i = m - 1; i >= l; i--) {
+                    c3 = c2;
+                    c2 = c;
+                    s2 = s;
+                    g = c * e[i];
+                    h = c * p;
+                    r = hypot(p, e[i]);
+                    e[i + 1] = s * r;
+                    s = e[i] / r;
+                    c = p / r;
+                    p = c * d[i] - s * g;
+                    d[i + 1] = h + s * (c * g + s * d[i]);
+                    for (int k = 0; k < n; k++) {
+                        h = v[(size_t)k * n + i + 1];
+                        v[(size_t)k * n + i + 1] = s * v[(size_t)k * n + i] + c * h;
+                        v[(size_t)k * n + i] = c * v[(size_t)k * n + i] - s * h;
+                    }
+                }
+                p = -s * s2 * c3 * el1 * e[l] / dl1;
+                e[l] = s * p;
+                d[l] = c * p;
+            } while (fabs(e[l]) > eps * tst1);
+        }
+        d[l] += f;
+        e[l] = 0.0;
+    }
+}
+
+EmbeddingProjection* fit_pca_projection(const float* samples, int n, int input_dim, int output_dim) {
+    if (n < 2) {
+        fprintf(stderr, "PCA needs at least 2 samples\n");
+        return NULL;
+    }
+    EmbeddingProjection* projection = alloc_projection(PROJECTION_PCA, input_dim, output_dim);
+    if (!projection) return NULL;
+    int d = input_dim;
+
+    double* mean = calloc(d, sizeof(double));
+    float* centered_t = malloc((size_t)d * n * sizeof(float));  // d x n
+    float* centered = malloc((size_t)n * d * sizeof(float));    // n x d
+    float* covariance = malloc((size_t)d * d * sizeof(float));
+    double* v = malloc((size_t)d * d * sizeof(double));
+    double* values = malloc(d * sizeof(double));
+    double* off_diagonal = malloc(d * sizeof(double));
+    int* order = malloc(d * sizeof(int));
+    PackedMatrix packed = { 0 };
+    if (!mean || !centered_t || !centered || !covariance || !v || !values || !off_diagonal || !order) {
+        fprintf(stderr, "Failed to allocate PCA scratch\n");
+        free_projection(projection);
+        projection = NULL;
+        goto done;
+    }
+
+    for (int s = 0; s < n; s++) {
+        for (int i = 0; i < d; i++) mean[i] += samples[(size_t)s * d + i];
+    }
+    for (int i = 0; i < d; i++) {
+        mean[i] /= n;
+        projection->mean[i] = (float)mean[i];
+    }
+    for (int s = 0; s < n; s++) {
+        for (int i = 0; i < d; i++) {
+            float x = (float)(samples[(size_t)s * d + i] - mean[i]);
+            centered[(size_t)s * d + i] = x;
+            centered_t[(size_t)i * n + s] = x;
+        }
+    }
+
+    // Covariance = centered^T * centered / (n - 1), one GEMM
+    if (pack_matrix(&packed, centered, n, d) != 0) {
+        free_projection(projection);
+        projection = NULL;
+        goto done;
+    }
+    gemm(centered_t, d, &packed, covariance, NULL, NULL, NULL);
+    for (int i = 0; i < d; i++) {
+        for (int j = 0; j <= i; j++) {
+            double c = 0.5 * ((double)covariance[(size_t)i * d + j] + covariance[(size_t)j * d + i]) / (n - 1);
+            v[(size_t)i * d + j] = v[(size_t)j * d + i] = c;
+        }
+        projection->total_variance += v[(size_t)i * d + i];
+    }
+
+    tridiagonalize(v, values, off_diagonal, d);
+    tridiagonal_eigen(v, values, off_diagonal, d);
+
+    // Largest eigenvalues first
+    for (int i = 0; i < d; i++) order[i] = i;
+    for (int i = 1; i < d; i++) {
+        int key = order[i], j = i - 1;
+        while (j >= 0 && values[order[j]] < values[key]) {
+            order[j + 1] = order[j];
+            j--;
+        }
+        order[j + 1] = key;
+    }
+
+    for (int j = 0; j < output_dim; j++) {
+        int axis = order[j];
+        projection->variance[j] = (float)fmax(values[axis], 0.0);
+
+        // Fix the sign so the largest entry is positive, for reproducible fits
+        double largest = 0.0;
+        for (int i = 0; i < d; i++) {
+            if (fabs(v[(size_t)i * d + axis]) > fabs(largest)) largest = v[(size_t)i * d + axis];
+        }
+        double sign = largest < 0.0 ? -1.0 : 1.0;
+        for (int i = 0; i < d; i++) {
+            projection->components[(size_t)i * output_dim + j] = (float)(sign * v[(size_t)i * d + axis]);
+        }
+    }
+    projection = finish_projection(projection);
+
+done:
+    free_packed_matrix(&packed);
+    free(mean);
+    free(centered_t);
+    free(centered);
+    free(covariance);
+    free(v);
+    free(values);
+    free(off_diagonal);
+    free(order);
+    return projection;
+}
+
+// SplitMix64, for a platform independent random matrix
+static uint64_t next_random(uint64_t* state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+EmbeddingProjection* create_random_projection(int input_dim, int output_dim, uint64_t seed) {
+    EmbeddingProjection* projection = alloc_projection(PROJECTION_RANDOM, input_dim, output_dim);
+    if (!projection) return NULL;
+
+    // Box-Muller pairs of standard normals
+    uint64_t state = seed;
+    double scale = 1.0 / sqrt((double)output_dim);
+    size_t count = (size_t)input_dim * output_dim;
+    for (size_t i = 0; i < count; i += 2) {
+        double u1 = ((next_random(&state) >> 11) + 1.0) * 0x1p-53;
+        double u2 = (next_random(&state) >> 11) * 0x1p-53;
+        double radius = sqrt(-2.0 * log(u1)) * scale;
+        projection->components[i] = (float)(radius * cos(2.0 * M_PI * u2));
+        if (i + 1 < count) projection->components[i + 1] = (float)(radius * sin(2.0 * M_PI * u2));
+    }
+    return finish_projection(projection);
+}
+
+double projection_explained_variance(const EmbeddingProjection* projection) {
+    if (projection->type != PROJECTION_PCA || projection->total_variance <= 0.0) return 0.0;
+    double kept = 0.0;
+    for (int j = 0; j < projection->output_dim; j++) kept += projection->variance[j];
+    return kept / projection->total_variance;
+}
+
+void project_embeddings(const EmbeddingProjection* projection, const float* input, int n, float* output,
+                        ThreadPool* pool) {
+    GemmEpilogue epilogue = { projection->bias, GEMM_IDENTITY };
+    // Components are packed f32, which needs no workspace, so this cannot fail
+    gemm(input, n, &projection->packed, output, &epilogue, NULL, pool);
+}
+
+int save_projection(const EmbeddingProjection* projection, const char* path) {
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        fprintf(stderr, "Failed to create projection file %s\n", path);
+        return -1;
+    }
+    ProjectionFileHeader header = { { 0 }, PROJECTION_FILE_VERSION, projection->type, projection->input_dim,
+                                    projection->output_dim, 0, projection->total_variance };
+    memcpy(header.magic, PROJECTION_FILE_MAGIC, 4);
+    size_t components = (size_t)projection->input_dim * projection->output_dim;
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+              fwrite(projection->mean, sizeof(float), projection->input_dim, file) == (size_t)projection->input_dim &&
+              fwrite(projection->variance, sizeof(float), projection->output_dim, file) == (size_t)projection->output_dim &&
+              fwrite(projection->components, sizeof(float), components, file) == components;
+    if (fclose(file) != 0 || !ok) {
+        fprintf(stderr, "Failed to write projection file %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+EmbeddingProjection* load_projection(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "Failed to open projection file %s\n", path);
+        return NULL;
+    }
+    ProjectionFileHeader header;
+    EmbeddingProjection* projection = NULL;
+    if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, PROJECTION_FILE_MAGIC, 4) != 0 ||
+        header.version != PROJECTION_FILE_VERSION || header.type > PROJECTION_RANDOM) {
+        fprintf(stderr, "%s is not a projection file\n", path);
+        fclose(file);
+        return NULL;
+    }
+
+    projection = alloc_projection(header.type, (int)header.input_dim, (int)header.output_dim);
+    if (projection) {
+        size_t components = (size_t)header.input_dim * header.output_dim;
+        char extra;
+        projection->total_variance = header.total_variance;
+        if (fread(projection->mean, sizeof(float), header.input_dim, file) != header.input_dim ||
+            fread(projection->variance, sizeof(float), header.output_dim, file) != header.output_dim ||
+            fread(projection->components, sizeof(float), components, file) != components ||
+            fread(&extra, 1, 1, file) != 0) {
+            fprintf(stderr, "Projection file %s is truncated or corrupt\n", path);
+            free_projection(projection);
+            projection = NULL;
+        } else {
+            projection = finish_projection(projection);
+        }
+    }
+    fclose(file);
+    return projection;
+}
+
+void free_projection(EmbeddingProjection* projection) {
+    if (!projection) return;
+    free(projection->mean);
+    free(projection->components);
+    free(projection->variance);
+    free(projection->bias);
+    free_packed_matrix(&projection->packed);
+    free(projection);
+}
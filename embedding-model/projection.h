@@ -0,0 +1,45 @@
+#ifndef PROJECTION_H
+#define PROJECTION_H
+
+#include "gemm.h"
+#include "thread_pool.h"
+
+// Linear map from pooled embeddings to compact vectors:
+// y = (x - mean) * components, components input_dim x output_dim.
+// Applied as one GEMM with -mean * components folded into the bias.
+typedef enum {
+    PROJECTION_PCA = 0,     // the output_dim principal axes of a fitted sample
+    PROJECTION_RANDOM = 1,  // Gaussian Johnson-Lindenstrauss matrix, zero mean
+} ProjectionType;
+
+typedef struct {
+    ProjectionType type;
+    int input_dim;
+    int output_dim;
+    float* mean;          // input_dim
+    float* components;    // input_dim x output_dim, row-major
+    float* variance;      // output_dim: sample variance along each axis, descending (PCA)
+    double total_variance;  // summed over every input dimension (PCA)
+    float* bias;          // output_dim: -mean * components
+    PackedMatrix packed;  // components in GEMM panels
+} EmbeddingProjection;
+
+// Fits PCA on n samples of input_dim floats (row-major) and keeps the
+// output_dim axes of largest variance. output_dim must not exceed input_dim.
+EmbeddingProjection* fit_pca_projection(const float* samples, int n, int input_dim, int output_dim);
+// Random projection scaled by 1 / sqrt(output_dim); the same seed gives the same matrix
+EmbeddingProjection* create_random_projection(int input_dim, int output_dim, uint64_t seed);
+
+// Fraction of the sample variance the kept PCA axes explain
+double projection_explained_variance(const EmbeddingProjection* projection);
+
+// output[n x output_dim] = projection of input[n x input_dim]; pool may be NULL
+void project_embeddings(const EmbeddingProjection* projection, const float* input, int n, float* output,
+                        ThreadPool* pool);
+
+// Writes / reads the projection as a small binary file. Returns 0 / NULL on failure.
+int save_projection(const EmbeddingProjection* projection, const char* path);
+EmbeddingProjection* load_projection(const char* path);
+void free_projection(EmbeddingProjection* projection);
+
+#endif // PROJECTION_H
@@ -0,0 +1,517 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <ctype.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include "embedding_model.h"
+#include "embedding_scheduler.h"
+#include "profile.h"
+
+#define MAX_SENTENCES 30
+#define MAX_TEXT_LENGTH 1000
+// Lowest cosine similarity accepted between int8 and fp32 embeddings
+#define MIN_Q8_COSINE 0.99f
+// Lowest cosine similarity accepted between fp16 and fp32 embeddings
+#define MIN_F16_COSINE 0.9999f
+
+// Width of the model's embeddings, set once the model is loaded
+static int vector_dim;
+
+static char** read_sentences(const char* filename, int* num_sentences) {
+    FILE* file = fopen(filename, "r");
+    if (!file) {
+        fprintf(stderr, "Failed to open file: %s\n", filename);
+        return NULL;
+    }
+
+    char** sentences = malloc(MAX_SENTENCES * sizeof(char*));
+    char buffer[MAX_TEXT_LENGTH];
+    int count = 0;
+
+    while (fgets(buffer, MAX_TEXT_LENGTH, file) && count < MAX_SENTENCES) {
+        buffer[strcspn(buffer, "\n")] = 0;
+        sentences[count] = strdup(buffer);
+        count++;
+    }
+
+    fclose(file);
+    *num_sentences = count;
+    return sentences;
+}
+
+static float cosine_similarity(const float* a, const float* b, int size) {
+    double dot = 0.0, norm_a = 0.0, norm_b = 0.0;
+    for (int i = 0; i < size; i++) {
+        dot += (double)a[i] * b[i];
+        norm_a += (double)a[i] * a[i];
+        norm_b += (double)b[i] * b[i];
+    }
+    return (float)(dot / (sqrt(norm_a) * sqrt(norm_b) + 1e-30));
+}
+
+typedef struct {
+    EmbeddingSession* session;
+    const char** texts;
+    int n;
+    float* out;
+} EmbedWorker;
+
+static void* embed_worker(void* arg) {
+    EmbedWorker* worker = arg;
+    for (int i = 0; i < worker->n; i++) {
+        embed_text(worker->session, worker->texts[i], worker->out + i * vector_dim);
+    }
+    return NULL;
+}
+
+static int same_vectors(const float* a, const float* b, int n) {
+    return memcmp(a, b, (size_t)n * vector_dim * sizeof(float)) == 0;
+}
+
+// Embeds the texts through a cache too small to hold them all, backed by a
+// disk file, then again through the same cache and through a fresh cache
+// opened on the file. Every pass must reproduce the uncached vectors exactly,
+// and the file must be refused under another fingerprint.
+static int check_cache(const EmbeddingContext* ctx, const char** texts, int n, const float* expected) {
+    char path[] = "/tmp/test-embedding-cacheXXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) return 1;
+    close(fd);
+    unlink(path);
+
+    int failures = 0;
+    int capacity = n / 4 > 1 ? n / 4 : 1;
+    EmbeddingSession* session = create_embedding_session(ctx);
+    float* vectors = malloc(n * vector_dim * sizeof(float));
+
+    uint64_t fingerprint = embedding_fingerprint(session);
+    EmbeddingCache* cache = create_embedding_cache(capacity, vector_dim, fingerprint, path);
+    set_embedding_cache(session, cache);
+    embed_batch(session, texts, n, vectors);
+    EmbeddingCacheStats stats = embedding_cache_stats(cache);
+    if (!same_vectors(vectors, expected, n) || stats.misses != (uint64_t)n || stats.disk_entries != n) {
+        printf("FAIL cold cache: %llu misses, %d on disk\n", (unsigned long long)stats.misses, stats.disk_entries);
+        failures++;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    embed_batch(session, texts, n, vectors);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    stats = embedding_cache_stats(cache);
+    if (!same_vectors(vectors, expected, n) || stats.misses != (uint64_t)n || stats.hits + stats.disk_hits != (uint64_t)n ||
+        stats.entries != capacity) {
+        printf("FAIL warm cache: %llu hits, %llu disk hits, %llu misses\n", (unsigned long long)stats.hits,
+               (unsigned long long)stats.disk_hits, (unsigned long long)stats.misses);
+        failures++;
+    }
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+    printf("cache: %d texts served in %.1f us each (%llu memory, %llu disk)\n", n, seconds * 1e6 / n,
+           (unsigned long long)stats.hits, (unsigned long long)stats.disk_hits);
+
+    // Keys come from the token ids, so case does not matter
+    char upper[MAX_TEXT_LENGTH];
+    snprintf(upper, sizeof(upper), "%s", texts[0]);
+    for (char* c = upper; *c; c++) *c = toupper((unsigned char)*c);
+    embed_text(session, upper, vectors);
+    if (!same_vectors(vectors, expected, 1) || embedding_cache_stats(cache).misses != (uint64_t)n) {
+        printf("FAIL cache missed the upper-cased text \"%s\"\n", upper);
+        failures++;
+    }
+    free_embedding_cache(cache);
+
+    cache = create_embedding_cache(n, vector_dim, fingerprint, path);
+    set_embedding_cache(session, cache);
+    embed_batch(session, texts, n, vectors);
+    stats = embedding_cache_stats(cache);
+    if (!same_vectors(vectors, expected, n) || stats.disk_hits != (uint64_t)n || stats.misses != 0) {
+        printf("FAIL reopened cache: %llu disk hits, %llu misses\n", (unsigned long long)stats.disk_hits,
+               (unsigned long long)stats.misses);
+        failures++;
+    }
+    free_embedding_cache(cache);
+
+    // Another model, weight type or projection changes the fingerprint
+    cache = create_embedding_cache(n, vector_dim, fingerprint ^ 1, path);
+    if (cache) {
+        printf("FAIL cache file opened under another fingerprint\n");
+        failures++;
+        free_embedding_cache(cache);
+    }
+    cache = create_embedding_cache(n, vector_dim, fingerprint ^ 1, NULL);
+    if (set_embedding_cache(session, cache) == 0) {
+        printf("FAIL session attached a cache of another fingerprint\n");
+        failures++;
+    }
+    set_embedding_cache(session, NULL);
+    free_embedding_cache(cache);
+
+    free(vectors);
+    free_embedding_session(session);
+    unlink(path);
+    return failures;
+}
+
+// embed_tokenized must match embed_text on the tokenizer's ids and refuse
+// ids outside the vocabulary and negative lengths
+static int check_tokenized(const EmbeddingContext* ctx, const char* text, const float* expected) {
+    int failures = 0;
+    EmbeddingSession* session = create_embedding_session(ctx);
+    float* vector = malloc(vector_dim * sizeof(float));
+    int ids[MAX_SEQ_LENGTH];
+    int length = tokenize(ctx->tokenizer, text, ids, max_sequence_length(ctx));
+    const int* sequence = ids;
+    if (embed_tokenized(session, &sequence, &length, 1, vector) != 0 || !same_vectors(vector, expected, 1)) {
+        printf("FAIL embed_tokenized differs from embed_text for \"%s\"\n", text);
+        failures++;
+    }
+
+    int bad_ids[3][2] = { { ids[0], ctx->model->config.vocab_size }, { ids[0], -1 }, { ids[0], ids[1] } };
+    int bad_lengths[3] = { 2, 2, -1 };
+    for (int b = 0; b < 3; b++) {
+        sequence = bad_ids[b];
+        if (embed_tokenized(session, &sequence, &bad_lengths[b], 1, vector) != -1) {
+            printf("FAIL embed_tokenized accepted ids {%d, %d} of length %d\n", bad_ids[b][0], bad_ids[b][1], bad_lengths[b]);
+            failures++;
+        }
+    }
+    free(vector);
+    free_embedding_session(session);
+    return failures;
+}
+
+// A file size limit cuts one append short. The partial record must be cut off
+// again, so the appends after it, and the file reopened, still read back the
+// vectors written under each key.
+static int check_cache_short_write(void) {
+    char path[] = "/tmp/test-embedding-cacheXXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) return 1;
+    close(fd);
+    unlink(path);
+
+    enum { DIM = 8, RECORDS = 4 };
+    float vectors[RECORDS][DIM];
+    for (int r = 0; r < RECORDS; r++) {
+        for (int d = 0; d < DIM; d++) vectors[r][d] = (float)(r * DIM + d);
+    }
+    EmbeddingKey keys[RECORDS];
+    for (int r = 0; r < RECORDS; r++) keys[r] = embedding_key(&r, 1);
+
+    EmbeddingCache* cache = create_embedding_cache(1, DIM, 1, path);
+    embedding_cache_insert(cache, keys[0], vectors[0]);
+
+    // The second record only half fits under the limit
+    struct rlimit limit, saved;
+    getrlimit(RLIMIT_FSIZE, &saved);
+    struct stat st;
+    stat(path, &st);
+    limit = saved;
+    limit.rlim_cur = (rlim_t)st.st_size + (sizeof(EmbeddingKey) + DIM * sizeof(float)) / 2;
+    signal(SIGXFSZ, SIG_IGN);
+    setrlimit(RLIMIT_FSIZE, &limit);
+    embedding_cache_insert(cache, keys[1], vectors[1]);
+    setrlimit(RLIMIT_FSIZE, &saved);
+    signal(SIGXFSZ, SIG_DFL);
+
+    embedding_cache_insert(cache, keys[2], vectors[2]);
+    embedding_cache_insert(cache, keys[3], vectors[3]);
+    free_embedding_cache(cache);
+
+    int failures = 0;
+    cache = create_embedding_cache(1, DIM, 1, path);
+    float out[DIM];
+    for (int r = 0; r < RECORDS; r++) {
+        int found = cache && embedding_cache_lookup(cache, keys[r], out);
+        if (r == 1 ? found : !found || memcmp(out, vectors[r], sizeof(out)) != 0) {
+            printf("FAIL record %d after a short append: %s\n", r, found ? "wrong vector" : "missing");
+            failures++;
+        }
+    }
+    free_embedding_cache(cache);
+    unlink(path);
+    return failures;
+}
+
+typedef struct {
+    EmbeddingScheduler* scheduler;
+    const char** texts;
+    int n;
+    float* out;
+} ScheduleWorker;
+
+// Fits PCA to the f32 embeddings and attaches it to a session: the session's
+// output must match projecting the full vectors by hand, a cache of the wrong
+// width must be refused, and detaching restores the full embeddings.
+static int check_projection(const EmbeddingContext* ctx, const char** texts, int n, const float* expected) {
+    int output_dim = vector_dim / 4;
+    EmbeddingProjection* projection = fit_pca_projection(expected, n, vector_dim, output_dim);
+    if (!projection) {
+        printf("FAIL fit_pca_projection on %d embeddings\n", n);
+        return 1;
+    }
+    int failures = 0;
+    EmbeddingSession* session = create_embedding_session(ctx);
+    float* vectors = malloc((size_t)n * vector_dim * sizeof(float));
+    float* reference = malloc((size_t)n * output_dim * sizeof(float));
+    project_embeddings(projection, expected, n, reference, NULL);
+
+    EmbeddingCache* full_cache = create_embedding_cache(n, vector_dim, embedding_fingerprint(session), NULL);
+    set_embedding_cache(session, full_cache);
+    if (set_embedding_projection(session, projection) == 0) {
+        printf("FAIL projection attached over a %d-dim cache\n", vector_dim);
+        failures++;
+    }
+    set_embedding_cache(session, NULL);
+    if (set_embedding_projection(session, projection) != 0 || embedding_output_dim(session) != output_dim) {
+        printf("FAIL session output dim %d after attaching a %d-dim projection\n", embedding_output_dim(session), output_dim);
+        failures++;
+    }
+
+    embed_batch(session, texts, n, vectors);
+    double error = 0.0;
+    for (int i = 0; i < n * output_dim; i++) error = fmax(error, fabs(vectors[i] - reference[i]));
+    if (!(error < 1e-4)) {
+        printf("FAIL projected session output differs from manual projection by %.3g\n", error);
+        failures++;
+    }
+    printf("projection: %d -> %d dims keeps %.1f%% of the variance\n", vector_dim, output_dim,
+           100.0 * projection_explained_variance(projection));
+
+    set_embedding_projection(session, NULL);
+    embed_batch(session, texts, n, vectors);
+    if (!same_vectors(vectors, expected, n)) {
+        printf("FAIL embeddings changed after detaching the projection\n");
+        failures++;
+    }
+
+    free_embedding_cache(full_cache);
+    free(reference);
+    free(vectors);
+    free_embedding_session(session);
+    free_projection(projection);
+    return failures;
+}
+
+static void* schedule_worker(void* arg) {
+    ScheduleWorker* worker = arg;
+    for (int i = 0; i < worker->n; i++) {
+        scheduled_embed_text(worker->scheduler, worker->texts[i], worker->out + i * vector_dim);
+    }
+    return NULL;
+}
+
+static void count_completion(void* arg, float* out, int status) {
+    (void)out;
+    (void)status;  // a failed request shows up in the vector comparison
+    __atomic_add_fetch((int*)arg, 1, __ATOMIC_RELEASE);
+}
+
+// Sends the texts through a scheduler, once from three blocking callers and
+// once as callbacks queued from one thread, and compares with expected.
+// Queued at once, the texts must share forward passes.
+static int check_scheduler(const EmbeddingContext* ctx, const char** texts, int n, const float* expected) {
+    int failures = 0;
+    EmbeddingSession* session = create_embedding_session(ctx);
+    EmbeddingScheduler* scheduler = create_embedding_scheduler(session, MAX_BATCH_SIZE, 2000);
+    float* vectors = calloc(n * vector_dim, sizeof(float));
+    float* queued_vectors = calloc(n * vector_dim, sizeof(float));
+
+    ScheduleWorker workers[3];
+    pthread_t threads[3];
+    for (int w = 0; w < 3; w++) {
+        int begin = n * w / 3, end = n * (w + 1) / 3;
+        workers[w] = (ScheduleWorker){ scheduler, texts + begin, end - begin, vectors + begin * vector_dim };
+        pthread_create(&threads[w], NULL, schedule_worker, &workers[w]);
+    }
+    for (int w = 0; w < 3; w++) pthread_join(threads[w], NULL);
+
+    EmbeddingSchedulerStats before = embedding_scheduler_stats(scheduler);
+    int completed = 0;
+    for (int i = 0; i < n; i++) {
+        schedule_embedding(scheduler, texts[i], queued_vectors + i * vector_dim, count_completion, &completed);
+    }
+    while (__atomic_load_n(&completed, __ATOMIC_ACQUIRE) < n) {
+        nanosleep(&(struct timespec){ 0, 100000 }, NULL);
+    }
+    EmbeddingSchedulerStats after = embedding_scheduler_stats(scheduler);
+    free_embedding_scheduler(scheduler);
+
+    for (int i = 0; i < n; i++) {
+        float blocking = cosine_similarity(expected + i * vector_dim, vectors + i * vector_dim, vector_dim);
+        float queued = cosine_similarity(expected + i * vector_dim, queued_vectors + i * vector_dim, vector_dim);
+        if (!(blocking > 0.99999f) || !(queued > 0.99999f)) {
+            printf("FAIL scheduled cosine %.6f / %.6f for \"%s\"\n", blocking, queued, texts[i]);
+            failures++;
+        }
+    }
+    uint64_t queued_batches = after.batches - before.batches;
+    printf("scheduler: %d blocking requests in %llu batches, %d queued requests in %llu batches\n", n,
+           (unsigned long long)before.batches, n, (unsigned long long)queued_batches);
+    if (n > 1 && !(queued_batches < (uint64_t)n)) {
+        printf("FAIL queued requests were not batched\n");
+        failures++;
+    }
+
+    free(vectors);
+    free(queued_vectors);
+    free_embedding_session(session);
+    return failures;
+}
+
+// Lowest cosine similarity of reduced precision embeddings to the fp32 ones
+static int compare_to_f32(const char* label, const char** texts, int n, const float* f32_vectors,
+                          const float* vectors, float threshold) {
+    int failures = 0;
+    float worst = 1.0f;
+    for (int i = 0; i < n; i++) {
+        float cosine = cosine_similarity(f32_vectors + i * vector_dim, vectors + i * vector_dim, vector_dim);
+        if (cosine < worst) worst = cosine;
+        if (!(cosine >= threshold)) {
+            printf("FAIL %s vs fp32 cosine %.5f for \"%s\"\n", label, cosine, texts[i]);
+            failures++;
+        }
+    }
+    printf("%s vs fp32: %d sentences, lowest cosine %.5f (threshold %g)\n", label, n, worst, threshold);
+    return failures;
+}
+
+// With EMBED_PROFILE, one batch must record every operator once per layer
+static int check_profile(const EmbeddingContext* ctx, const char** texts, int n) {
+    if (!profile_enabled()) return 0;
+    int failures = 0;
+    EmbeddingSession* session = create_embedding_session(ctx);
+    float* out = malloc(n * vector_dim * sizeof(float));
+    int batches = (n + MAX_BATCH_SIZE - 1) / MAX_BATCH_SIZE;
+
+    profile_reset();
+    embed_batch(session, texts, n, out);
+    for (int layer = 0; layer < ctx->model->config.num_hidden_layers; layer++) {
+        for (int op = PROFILE_LAYER_NORM; op <= PROFILE_FFN_OUTPUT; op++) {
+            ProfileCounter c = profile_counter(op, layer);
+            uint64_t expected = op == PROFILE_LAYER_NORM ? 2 * batches : batches;
+            if (c.calls != expected || c.ns == 0 || c.bytes == 0 || (op != PROFILE_LAYER_NORM && c.flops == 0)) {
+                printf("FAIL profile %s layer %d: %llu calls\n", profile_op_name(op), layer, (unsigned long long)c.calls);
+                failures++;
+            }
+        }
+    }
+    if (profile_counter(PROFILE_TOKENIZE, PROFILE_NO_LAYER).calls != (uint64_t)n ||
+        profile_counter(PROFILE_POOLER, PROFILE_NO_LAYER).calls != (uint64_t)batches) {
+        printf("FAIL profile tokenizer or pooler counts\n");
+        failures++;
+    }
+
+    char trace_file[] = "/tmp/embedding-trace-XXXXXX";
+    int fd = mkstemp(trace_file);
+    if (fd < 0 || profile_write_trace(trace_file) != 0) {
+        printf("FAIL profile trace\n");
+        failures++;
+    }
+    if (fd >= 0) {
+        close(fd);
+        unlink(trace_file);
+    }
+    profile_dump(stdout);
+    printf("profile: %s\n", failures ? "counts wrong" : "every operator recorded");
+
+    free(out);
+    free_embedding_session(session);
+    return failures;
+}
+
+// Embeds the sentences with fp32, int8 and fp16 weights and checks the reduced
+// precision embeddings stay close to the fp32 ones, that sessions sharing one context
+// can run concurrently without changing the results, and that the embedding
+// cache and the batching scheduler return the same vectors. Profiling builds
+// also check the operator counters.
+// Usage: test-embedding [model.bin] [vocab.txt] [sentences.txt]
+int main(int argc, char* argv[]) {
+    const char* model_file = argc > 1 ? argv[1] : "./embedding-model/model.bin";
+    const char* vocab_file = argc > 2 ? argv[2] : "./embedding-model/vocab.txt";
+    const char* sentences_file = argc > 3 ? argv[3] : "sentences.txt";
+
+    int num_sentences;
+    char** sentences = read_sentences(sentences_file, &num_sentences);
+    if (!sentences) return 1;
+
+    EmbeddingContext* f32_ctx = load_embedding_context(vocab_file, model_file, GEMM_F32);
+    EmbeddingContext* q8_ctx = load_embedding_context(vocab_file, model_file, GEMM_Q8);
+    EmbeddingContext* f16_ctx = load_embedding_context(vocab_file, model_file, GEMM_F16);
+    if (!f32_ctx || !q8_ctx || !f16_ctx) {
+        fprintf(stderr, "Failed to load embedding model\n");
+        return 1;
+    }
+    vector_dim = embedding_dim(f32_ctx);
+    printf("GEMM kernel: %s\n", gemm_kernel_name());
+
+    EmbeddingSession* f32_session = create_embedding_session(f32_ctx);
+    EmbeddingSession* q8_session = create_embedding_session(q8_ctx);
+    EmbeddingSession* f16_session = create_embedding_session(f16_ctx);
+
+    float* f32_vectors = malloc(num_sentences * vector_dim * sizeof(float));
+    float* q8_vectors = malloc(num_sentences * vector_dim * sizeof(float));
+    float* f16_vectors = malloc(num_sentences * vector_dim * sizeof(float));
+    embed_batch(f32_session, (const char**)sentences, num_sentences, f32_vectors);
+    embed_batch(q8_session, (const char**)sentences, num_sentences, q8_vectors);
+    embed_batch(f16_session, (const char**)sentences, num_sentences, f16_vectors);
+
+    int failures = 0;
+
+    // Two more sessions on the fp32 context, one text at a time on two threads
+    float* worker_vectors = malloc(2 * num_sentences * vector_dim * sizeof(float));
+    EmbedWorker workers[2];
+    pthread_t threads[2];
+    for (int w = 0; w < 2; w++) {
+        workers[w] = (EmbedWorker){ create_embedding_session(f32_ctx), (const char**)sentences, num_sentences,
+                                    worker_vectors + w * num_sentences * vector_dim };
+        pthread_create(&threads[w], NULL, embed_worker, &workers[w]);
+    }
+    for (int w = 0; w < 2; w++) {
+        pthread_join(threads[w], NULL);
+        free_embedding_session(workers[w].session);
+        for (int i = 0; i < num_sentences; i++) {
+            float cosine = cosine_similarity(f32_vectors + i * vector_dim, workers[w].out + i * vector_dim, vector_dim);
+            if (!(cosine > 0.99999f)) {
+                printf("FAIL concurrent session %d cosine %.6f for \"%s\"\n", w, cosine, sentences[i]);
+                failures++;
+            }
+        }
+    }
+    free(worker_vectors);
+
+    failures += check_tokenized(f32_ctx, sentences[0], f32_vectors);
+    failures += check_cache_short_write();
+    failures += check_cache(f32_ctx, (const char**)sentences, num_sentences, f32_vectors);
+    failures += check_scheduler(f32_ctx, (const char**)sentences, num_sentences, f32_vectors);
+    failures += check_projection(f32_ctx, (const char**)sentences, num_sentences, f32_vectors);
+    failures += check_profile(f32_ctx, (const char**)sentences, num_sentences);
+
+    failures += compare_to_f32("int8", (const char**)sentences, num_sentences, f32_vectors, q8_vectors, MIN_Q8_COSINE);
+    failures += compare_to_f32("fp16", (const char**)sentences, num_sentences, f32_vectors, f16_vectors, MIN_F16_COSINE);
+
+    for (int i = 0; i < num_sentences; i++) free(sentences[i]);
+    free(sentences);
+    free(f32_vectors);
+    free(q8_vectors);
+    free(f16_vectors);
+    free_embedding_session(f32_session);
+    free_embedding_session(q8_session);
+    free_embedding_session(f16_session);
+    free_embedding_context(f32_ctx);
+    free_embedding_context(q8_ctx);
+    free_embedding_context(f16_ctx);
+
+    if (failures) {
+        printf("%d embedding checks failed\n", failures);
+        return 1;
+    }
+    printf("PASS\n");
+    return 0;
+}
@@ -0,0 +1,369 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include "gemm.h"
+#include "fast_math.h"
+#include "layer_norm.h"
+#include "half.h"
+#include "projection.h"
+#include "tokenizer.h"
+
+#define VOCAB_FILE "./embedding-model/vocab.txt"
+
+// Largest accepted difference from libm / double precision references
+#define MAX_TANH_ERROR 2e-6
+#define MAX_GEMM_ERROR 1e-4
+#define MAX_LAYER_NORM_ERROR 1e-4
+#define MAX_PROJECTION_ERROR 1e-3
+
+static int failures = 0;
+
+static void check(const char* what, double error, double limit) {
+    int ok = error <= limit;
+    printf("%-4s %-44s max error %.3g (limit %.0e)\n", ok ? "ok" : "FAIL", what, error, limit);
+    if (!ok) failures++;
+}
+
+static float random_float(float scale) {
+    return ((float)rand() / (float)RAND_MAX * 2.0f - 1.0f) * scale;
+}
+
+static double reference_gelu(double x) {
+    return 0.5 * x * (1.0 + tanh(0.797884 * (x + 0.044715 * x * x * x)));
+}
+
+static double reference_gelu_erf(double x) {
+    return 0.5 * x * (1.0 + erf(x / sqrt(2.0)));
+}
+
+// Sweeps the scalar approximations against libm
+static void test_fast_math(void) {
+    double tanh_error = 0.0, gelu_error = 0.0, erf_error = 0.0, gelu_erf_error = 0.0;
+    for (float x = -20.0f; x <= 20.0f; x += 1.0f / 1024.0f) {
+        tanh_error = fmax(tanh_error, fabs((double)fast_tanhf(x) - tanhf(x)));
+        gelu_error = fmax(gelu_error, fabs((double)fast_geluf(x) - reference_gelu(x)) / fmax(1.0, fabs(x)));
+        erf_error = fmax(erf_error, fabs((double)fast_erff(x) - erff(x)));
+        gelu_erf_error = fmax(gelu_erf_error, fabs((double)fast_gelu_erff(x) - reference_gelu_erf(x)) / fmax(1.0, fabs(x)));
+    }
+    check("fast_tanhf vs tanhf on [-20, 20]", tanh_error, MAX_TANH_ERROR);
+    check("fast_geluf vs tanh GELU (relative for |x| > 1)", gelu_error, MAX_TANH_ERROR);
+    check("fast_erff vs erff on [-20, 20]", erf_error, MAX_TANH_ERROR);
+    check("fast_gelu_erff vs erf GELU (relative for |x| > 1)", gelu_erf_error, MAX_TANH_ERROR);
+}
+
+// Runs gemm with every epilogue against a double precision product. Shapes
+// cover narrow tail panels and more than one GEMM_KC depth block.
+static void test_gemm(GemmType type, double limit) {
+    static const int shapes[][3] = { { 1, 384, 384 }, { 13, 600, 100 }, { 7, 5, 17 }, { 29, 384, 1536 } };
+    static const GemmActivation activations[] = { GEMM_IDENTITY, GEMM_GELU, GEMM_TANH, GEMM_GELU_ERF };
+    static const char* activation_names[] = { "identity", "gelu", "tanh", "gelu_erf" };
+    static const char* type_names[] = { "f32", "q8", "f16" };
+
+    for (size_t s = 0; s < sizeof(shapes) / sizeof(shapes[0]); s++) {
+        int m = shapes[s][0], k = shapes[s][1], n = shapes[s][2];
+        float* a = malloc((size_t)m * k * sizeof(float));
+        float* b = malloc((size_t)k * n * sizeof(float));
+        float* bias = malloc(n * sizeof(float));
+        float* c = malloc((size_t)m * n * sizeof(float));
+        double* product = malloc((size_t)m * n * sizeof(double));
+        for (int i = 0; i < m * k; i++) a[i] = random_float(1.0f);
+        for (int i = 0; i < k * n; i++) b[i] = random_float(1.0f / sqrtf((float)k));
+        // Half weights are compared against the product with the same rounded weights
+        for (int i = 0; type == GEMM_F16 && i < k * n; i++) b[i] = half_to_float(float_to_half(b[i]));
+        for (int i = 0; i < n; i++) bias[i] = random_float(1.0f);
+
+        for (int i = 0; i < m; i++) {
+            for (int j = 0; j < n; j++) {
+                double sum = 0.0;
+                for (int l = 0; l < k; l++) sum += (double)a[i * k + l] * b[l * n + j];
+                product[i * n + j] = sum;
+            }
+        }
+
+        PackedMatrix packed;
+        pack_matrix(&packed, b, k, n);
+        if (type != GEMM_F32) {
+            PackedMatrix converted;
+            convert_packed_matrix(&converted, &packed, type);
+            free_packed_matrix(&packed);
+            packed = converted;
+        }
+
+        for (int e = 0; e < 4; e++) {
+            GemmEpilogue epilogue = { e == 0 && s % 2 ? NULL : bias, activations[e] };
+            double error = gemm(a, m, &packed, c, &epilogue, NULL, NULL) == 0 ? 0.0 : INFINITY;
+            for (int i = 0; i < m; i++) {
+                for (int j = 0; j < n; j++) {
+                    double x = product[i * n + j] + (epilogue.bias ? bias[j] : 0.0);
+                    double expected = e == 1 ? reference_gelu(x) : e == 2 ? tanh(x) : e == 3 ? reference_gelu_erf(x) : x;
+                    error = fmax(error, fabs(c[i * n + j] - expected) / fmax(1.0, fabs(expected)));
+                }
+            }
+            char what[96];
+            snprintf(what, sizeof(what), "gemm %s %s %dx%dx%d %s", gemm_kernel_name(), type_names[type],
+                     m, k, n, activation_names[e]);
+            check(what, error, limit);
+        }
+
+        free_packed_matrix(&packed);
+        free(a);
+        free(b);
+        free(bias);
+        free(c);
+        free(product);
+    }
+}
+
+// Every finite half must survive a round trip through float, and values halfway
+// between neighbouring halves must round to the one with an even mantissa
+static void test_half(void) {
+    double error = 0.0;
+    for (uint32_t h = 0; h < 0x10000; h++) {
+        if ((h & 0x7c00) == 0x7c00 && (h & 0x3ff)) continue;  // nan
+        float f = half_to_float((uint16_t)h);
+        int exponent = (h >> 10) & 0x1f;
+        double magnitude = exponent ? ldexp(1.0 + (h & 0x3ff) / 1024.0, exponent - 15) : ldexp((h & 0x3ff) / 1024.0, -14);
+        double expected = exponent == 0x1f ? INFINITY : magnitude;
+        if (h & 0x8000) expected = -expected;
+        if (f != expected || float_to_half(f) != h) error = 1.0;
+
+        uint32_t next = h + 1;
+        if ((h & 0x7fff) < 0x7bff) {
+            float midpoint = (float)(((double)f + half_to_float((uint16_t)next)) / 2.0);
+            uint16_t rounded = float_to_half(midpoint);
+            if (rounded != ((h & 1) ? next : h)) error = 1.0;
+        }
+    }
+    check("half <-> float round trip and ties to even", error, 0.0);
+}
+
+static void test_layer_norm(int size) {
+    int rows = 5;
+    float* input = malloc(rows * size * sizeof(float));
+    float* residual = malloc(rows * size * sizeof(float));
+    float* output = malloc(rows * size * sizeof(float));
+    float* weight = malloc(size * sizeof(float));
+    float* bias = malloc(size * sizeof(float));
+    for (int i = 0; i < rows * size; i++) {
+        // Large row offsets check the shifted statistics
+        input[i] = random_float(2.0f) + 100.0f * (i / size);
+        residual[i] = random_float(2.0f);
+    }
+    for (int i = 0; i < size; i++) {
+        weight[i] = random_float(1.0f);
+        bias[i] = random_float(1.0f);
+    }
+
+    add_layer_norm(input, residual, output, weight, bias, rows, size, 1e-12f);
+
+    double error = 0.0;
+    for (int r = 0; r < rows; r++) {
+        double mean = 0.0, var = 0.0;
+        for (int i = 0; i < size; i++) mean += (double)input[r * size + i] + residual[r * size + i];
+        mean /= size;
+        for (int i = 0; i < size; i++) {
+            double d = (double)input[r * size + i] + residual[r * size + i] - mean;
+            var += d * d;
+        }
+        var /= size;
+        for (int i = 0; i < size; i++) {
+            double x = (double)input[r * size + i] + residual[r * size + i];
+            double expected = (x - mean) / sqrt(var + 1e-12) * weight[i] + bias[i];
+            error = fmax(error, fabs(output[r * size + i] - expected));
+        }
+    }
+    char what[96];
+    snprintf(what, sizeof(what), "add_layer_norm %s size %d", layer_norm_kernel_name(), size);
+    check(what, error, MAX_LAYER_NORM_ERROR);
+
+    free(input);
+    free(residual);
+    free(output);
+    free(weight);
+    free(bias);
+}
+
+// Fits PCA to samples near a rank-6 subspace: the components must be orthonormal,
+// ordered by variance and reconstruct the samples, the GEMM must match a double
+// precision projection, and a saved projection must load back bit for bit.
+static void test_projection(void) {
+    int n = 500, input_dim = 48, rank = 6, output_dim = 8;
+    float* basis = malloc((size_t)rank * input_dim * sizeof(float));
+    float* samples = malloc((size_t)n * input_dim * sizeof(float));
+    float* projected = malloc((size_t)n * output_dim * sizeof(float));
+    float* reloaded = malloc((size_t)n * output_dim * sizeof(float));
+    for (int i = 0; i < rank * input_dim; i++) basis[i] = random_float(1.0f);
+    for (int s = 0; s < n; s++) {
+        float* x = samples + (size_t)s * input_dim;
+        for (int i = 0; i < input_dim; i++) x[i] = 3.0f + random_float(0.01f);
+        for (int r = 0; r < rank; r++) {
+            float weight = random_float((float)(rank - r));
+            for (int i = 0; i < input_dim; i++) x[i] += weight * basis[r * input_dim + i];
+        }
+    }
+
+    EmbeddingProjection* pca = fit_pca_projection(samples, n, input_dim, output_dim);
+    if (!pca) {
+        check("fit_pca_projection", INFINITY, 0.0);
+        goto done;
+    }
+    double orthonormal = 0.0, ordered = 0.0;
+    for (int a = 0; a < output_dim; a++) {
+        for (int b = 0; b < output_dim; b++) {
+            double dot = 0.0;
+            for (int i = 0; i < input_dim; i++) dot += (double)pca->components[i * output_dim + a] * pca->components[i * output_dim + b];
+            orthonormal = fmax(orthonormal, fabs(dot - (a == b)));
+        }
+        if (a > 0) ordered = fmax(ordered, pca->variance[a] - pca->variance[a - 1]);
+    }
+    check("pca components orthonormal", orthonormal, MAX_PROJECTION_ERROR);
+    check("pca variance descending", ordered, 0.0);
+    check("pca unexplained variance of rank-6 data", 1.0 - projection_explained_variance(pca), MAX_PROJECTION_ERROR);
+
+    project_embeddings(pca, samples, n, projected, NULL);
+    double projection_error = 0.0, reconstruction_error = 0.0;
+    for (int s = 0; s < n; s++) {
+        const float* x = samples + (size_t)s * input_dim;
+        const float* y = projected + (size_t)s * output_dim;
+        for (int o = 0; o < output_dim; o++) {
+            double expected = 0.0;
+            for (int i = 0; i < input_dim; i++) expected += ((double)x[i] - pca->mean[i]) * pca->components[i * output_dim + o];
+            projection_error = fmax(projection_error, fabs(y[o] - expected));
+        }
+        for (int i = 0; i < input_dim; i++) {
+            double restored = pca->mean[i];
+            for (int o = 0; o < output_dim; o++) restored += (double)y[o] * pca->components[i * output_dim + o];
+            reconstruction_error = fmax(reconstruction_error, fabs(restored - x[i]));
+        }
+    }
+    check("project_embeddings vs double", projection_error, MAX_PROJECTION_ERROR);
+    // The isotropic noise of +-0.01 is all that is lost
+    check("pca reconstruction", reconstruction_error, 0.05);
+
+    char path[] = "/tmp/test-projection-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd >= 0) close(fd);
+    EmbeddingProjection* loaded = fd >= 0 && save_projection(pca, path) == 0 ? load_projection(path) : NULL;
+    if (fd >= 0) unlink(path);
+    double reload_error = INFINITY;
+    if (loaded) {
+        project_embeddings(loaded, samples, n, reloaded, NULL);
+        reload_error = memcmp(projected, reloaded, (size_t)n * output_dim * sizeof(float)) ? 1.0 : 0.0;
+        free_projection(loaded);
+    }
+    check("saved projection reloads identically", reload_error, 0.0);
+    free_projection(pca);
+
+    // A random projection preserves squared norms of centered data on average
+    EmbeddingProjection* random = create_random_projection(input_dim, 32, 7);
+    double input_norm = 0.0, output_norm = 0.0;
+    float* wide = realloc(projected, (size_t)n * 32 * sizeof(float));
+    if (random && wide) {
+        projected = wide;
+        for (int i = 0; i < n * input_dim; i++) samples[i] -= 3.0f;
+        project_embeddings(random, samples, n, projected, NULL);
+        for (int i = 0; i < n * input_dim; i++) input_norm += (double)samples[i] * samples[i];
+        for (int i = 0; i < n * 32; i++) output_norm += (double)projected[i] * projected[i];
+    }
+    check("random projection norm ratio", fabs(output_norm / input_norm - 1.0), 0.3);
+    free_projection(random);
+
+done:
+    free(basis);
+    free(samples);
+    free(projected);
+    free(reloaded);
+}
+
+// Tokenizes text into at most max_tokens ids and compares them with the ids of
+// expected, a space-separated list of vocab entries
+static void check_tokens(const Tokenizer* tokenizer, const char* text, int max_tokens, const char* expected) {
+    int ids[64], expected_ids[64], count = 0;
+    char pieces[512];
+    snprintf(pieces, sizeof(pieces), "%s", expected);
+    for (char* piece = strtok(pieces, " "); piece && count < 64; piece = strtok(NULL, " ")) {
+        expected_ids[count] = -1;
+        for (int id = 0; id < tokenizer->vocab_size; id++) {
+            if (strcmp(tokenizer->vocab[id], piece) == 0) {
+                expected_ids[count] = id;
+                break;
+            }
+        }
+        count++;
+    }
+    int n = tokenize(tokenizer, text, ids, max_tokens);
+    int ok = n == count && memcmp(ids, expected_ids, n * sizeof(int)) == 0;
+    printf("%-4s tokenize \"%.30s\" -> %s\n", ok ? "ok" : "FAIL", text, expected);
+    if (!ok) {
+        printf("     got");
+        for (int i = 0; i < n; i++) printf(" %s", tokenizer->vocab[ids[i]]);
+        printf("\n");
+        failures++;
+    }
+}
+
+// BERT uncased normalization and WordPiece on the model's vocab
+static void test_tokenizer(void) {
+    Tokenizer* tokenizer = load_tokenizer(VOCAB_FILE);
+    if (!tokenizer) {
+        printf("FAIL load_tokenizer(%s)\n", VOCAB_FILE);
+        failures++;
+        return;
+    }
+    check_tokens(tokenizer, "Hello WORLD", 64, "[CLS] hello world [SEP]");
+    check_tokens(tokenizer, "It happened 5 times.", 64, "[CLS] it happened 5 times . [SEP]");
+    check_tokens(tokenizer, "embeddings", 64, "[CLS] em ##bed ##ding ##s [SEP]");
+    check_tokens(tokenizer, "Café  au\tlait", 64, "[CLS] cafe au lai ##t [SEP]");
+    check_tokens(tokenizer, "北京", 64, "[CLS] 北 京 [SEP]");
+    check_tokens(tokenizer, "ΑΘΗΝΑ Москва", 64, "[CLS] α ##θ ##η ##ν ##α м ##о ##с ##к ##в ##а [SEP]");
+    check_tokens(tokenizer, "ΟΔΥΣΣΕΑΣ", 64, "[CLS] ο ##δ ##υ ##σ ##σ ##ε ##α ##ς [SEP]");
+    check_tokens(tokenizer, "Ёлка йод", 64, "[CLS] е ##л ##ка и ##о ##д [SEP]");
+    check_tokens(tokenizer, "です", 64, "[CLS] て ##す [SEP]");
+    check_tokens(tokenizer, "one two three four", 4, "[CLS] one two [SEP]");
+
+    // Words over 100 characters are unknown; 100 is still split into pieces
+    char word[128];
+    memset(word, 'a', 101);
+    word[101] = '\0';
+    check_tokens(tokenizer, word, 64, "[CLS] [UNK] [SEP]");
+    word[100] = '\0';
+    int ids[64];
+    int n = tokenize(tokenizer, word, ids, 64);
+    int known = n > 2;
+    for (int i = 1; i < n - 1; i++) known &= ids[i] != tokenizer->unk_id;
+    printf("%-4s tokenize 100-character word into pieces (%d ids)\n", known ? "ok" : "FAIL", n);
+    if (!known) failures++;
+    free_tokenizer(tokenizer);
+}
+
+// Checks the fused GEMM epilogues (f32, int8 and f16 weights), the fast tanh/erf/GELU
+// approximations, the half conversions, the residual + LayerNorm kernel and
+// the PCA / random projection against libm / double precision references, and
+// the tokenizer against BERT's ids.
+// Runs with whatever kernels EMBED_GEMM_KERNEL selects.
+int main(void) {
+    srand(1);
+    gemm_init();
+
+    test_fast_math();
+    test_gemm(GEMM_F32, MAX_GEMM_ERROR);
+    // Int8 error is dominated by quantization, not by the epilogue
+    test_gemm(GEMM_Q8, 3e-2);
+    test_half();
+    test_gemm(GEMM_F16, MAX_GEMM_ERROR);
+    // The specialized hidden sizes, and one that is not a multiple of any vector width
+    test_layer_norm(384);
+    test_layer_norm(768);
+    test_layer_norm(389);
+    test_projection();
+    test_tokenizer();
+
+    if (failures) {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    printf("PASS\n");
+    return 0;
+}
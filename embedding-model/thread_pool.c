@@ -0,0 +1,136 @@
+#include "thread_pool.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+struct ThreadPool {
+    pthread_t* workers;
+    int num_threads;  // workers plus the calling thread
+
+    pthread_mutex_t lock;
+    pthread_cond_t work_ready;
+    pthread_cond_t work_done;
+    unsigned long generation;  // bumped once per parallel_for
+    int busy_workers;
+    bool shutdown;
+
+    // Current loop
+    RangeTask task;
+    void* arg;
+    int n;
+    int num_chunks;
+    atomic_int next_chunk;
+};
+
+static void run_chunks(ThreadPool* pool) {
+    int chunk;
+    while ((chunk = atomic_fetch_add(&pool->next_chunk, 1)) < pool->num_chunks) {
+        int begin = (int)((long)pool->n * chunk / pool->num_chunks);
+        int end = (int)((long)pool->n * (chunk + 1) / pool->num_chunks);
+        pool->task(pool->arg, begin, end);
+    }
+}
+
+static void* worker_main(void* data) {
+    ThreadPool* pool = data;
+    unsigned long seen = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (pool->generation == seen && !pool->shutdown) {
+            pthread_cond_wait(&pool->work_ready, &pool->lock);
+        }
+        if (pool->shutdown) break;
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        run_chunks(pool);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->busy_workers == 0) {
+            pthread_cond_signal(&pool->work_done);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+ThreadPool* create_thread_pool(int num_threads) {
+    if (num_threads < 1) num_threads = 1;
+
+    ThreadPool* pool = calloc(1, sizeof(ThreadPool));
+    if (!pool) {
+        fprintf(stderr, "Failed to allocate thread pool\n");
+        return NULL;
+    }
+    pool->num_threads = num_threads;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_ready, NULL);
+    pthread_cond_init(&pool->work_done, NULL);
+
+    pool->workers = malloc((num_threads - 1) * sizeof(pthread_t));
+    if (num_threads > 1 && !pool->workers) {
+        // Runs every task on the calling thread, as when no worker starts
+        fprintf(stderr, "Failed to allocate %d thread pool workers\n", num_threads - 1);
+        pool->num_threads = 1;
+    }
+    for (int i = 0; i < pool->num_threads - 1; i++) {
+        if (pthread_create(&pool->workers[i], NULL, worker_main, pool) != 0) {
+            fprintf(stderr, "Failed to start thread pool worker %d\n", i);
+            pool->num_threads = i + 1;
+            break;
+        }
+    }
+    return pool;
+}
+
+int thread_pool_size(const ThreadPool* pool) {
+    return pool ? pool->num_threads : 1;
+}
+
+void parallel_for(ThreadPool* pool, int n, RangeTask task, void* arg) {
+    if (n <= 0) return;
+    if (!pool || pool->num_threads == 1 || n == 1) {
+        task(arg, 0, n);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->task = task;
+    pool->arg = arg;
+    pool->n = n;
+    pool->num_chunks = n < pool->num_threads ? n : pool->num_threads;
+    atomic_store(&pool->next_chunk, 0);
+    pool->busy_workers = pool->num_threads - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    run_chunks(pool);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->busy_workers > 0) {
+        pthread_cond_wait(&pool->work_done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void free_thread_pool(ThreadPool* pool) {
+    if (!pool) return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = true;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->num_threads - 1; i++) {
+        pthread_join(pool->workers[i], NULL);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work_ready);
+    pthread_cond_destroy(&pool->work_done);
+    free(pool->workers);
+    free(pool);
+}
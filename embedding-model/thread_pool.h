@@ -0,0 +1,18 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+// Processes items [begin, end) of a parallel_for range
+typedef void (*RangeTask)(void* arg, int begin, int end);
+
+// Persistent workers that run data-parallel loops. The thread calling
+// parallel_for takes part in the work, so a pool of size 1 has no workers.
+typedef struct ThreadPool ThreadPool;
+
+ThreadPool* create_thread_pool(int num_threads);
+int thread_pool_size(const ThreadPool* pool);
+// Splits [0, n) into one contiguous chunk per thread and blocks until all chunks ran.
+// A NULL pool runs the whole range on the calling thread.
+void parallel_for(ThreadPool* pool, int n, RangeTask task, void* arg);
+void free_thread_pool(ThreadPool* pool);
+
+#endif // THREAD_POOL_H
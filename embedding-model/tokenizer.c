@@ -0,0 +1,339 @@
+#include "tokenizer.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_WORD_CHARS 100  // longer words become [UNK], as in BERT
+#define MAX_WORD_BYTES ((MAX_WORD_CHARS + 1) * 4)
+#define FNV_OFFSET 2166136261u
+#define FNV_PRIME 16777619u
+
+// Lowercased, accent-stripped form of U+00C0..U+017F (Latin-1 Supplement and
+// Latin Extended-A), i.e. NFD with combining marks removed
+static const uint16_t latin_fold[0x180 - 0xC0] = {
+    0x0061, 0x0061, 0x0061, 0x0061, 0x0061, 0x0061, 0x00E6, 0x0063, 0x0065, 0x0065, 0x0065, 0x0065,
+    0x0069, 0x0069, 0x0069, 0x0069, 0x00F0, 0x006E, 0x006F, 0x006F, 0x006F, 0x006F, 0x006F, 0x00D7,
+    0x00F8, 0x0075, 0x0075, 0x0075, 0x0075, 0x0079, 0x00FE, 0x00DF, 0x0061, 0x0061, 0x0061, 0x0061,
+    0x0061, 0x0061, 0x00E6, 0x0063, 0x0065, 0x0065, 0x0065, 0x0065, 0x0069, 0x0069, 0x0069, 0x0069,
+    0x00F0, 0x006E, 0x006F, 0x006F, 0x006F, 0x006F, 0x006F, 0x00F7, 0x00F8, 0x0075, 0x0075, 0x0075,
+    0x0075, 0x0079, 0x00FE, 0x0079, 0x0061, 0x0061, 0x0061, 0x0061, 0x0061, 0x0061, 0x0063, 0x0063,
+    0x0063, 0x0063, 0x0063, 0x0063, 0x0063, 0x0063, 0x0064, 0x0064, 0x0111, 0x0111, 0x0065, 0x0065,
+    0x0065, 0x0065, 0x0065, 0x0065, 0x0065, 0x0065, 0x0065, 0x0065, 0x0067, 0x0067, 0x0067, 0x0067,
+    0x0067, 0x0067, 0x0067, 0x0067, 0x0068, 0x0068, 0x0127, 0x0127, 0x0069, 0x0069, 0x0069, 0x0069,
+    0x0069, 0x0069, 0x0069, 0x0069, 0x0069, 0x0131, 0x0133, 0x0133, 0x006A, 0x006A, 0x006B, 0x006B,
+    0x0138, 0x006C, 0x006C, 0x006C, 0x006C, 0x006C, 0x006C, 0x0140, 0x0140, 0x0142, 0x0142, 0x006E,
+    0x006E, 0x006E, 0x006E, 0x006E, 0x006E, 0x0149, 0x014B, 0x014B, 0x006F, 0x006F, 0x006F, 0x006F,
+    0x006F, 0x006F, 0x0153, 0x0153, 0x0072, 0x0072, 0x0072, 0x0072, 0x0072, 0x0072, 0x0073, 0x0073,
+    0x0073, 0x0073, 0x0073, 0x0073, 0x0073, 0x0073, 0x0074, 0x0074, 0x0074, 0x0074, 0x0167, 0x0167,
+    0x0075, 0x0075, 0x0075, 0x0075, 0x0075, 0x0075, 0x0075, 0x0075, 0x0075, 0x0075, 0x0075, 0x0075,
+    0x0077, 0x0077, 0x0079, 0x0079, 0x0079, 0x007A, 0x007A, 0x007A, 0x007A, 0x007A, 0x007A, 0x017F,
+};
+
+// The same for Greek U+0386..U+03CE: tonos and dialytika dropped, capitals
+// lowered, ano teleia to the middle dot it decomposes to
+static const uint16_t greek_fold[0x3CF - 0x386] = {
+    0x03B1, 0x00B7, 0x03B5, 0x03B7, 0x03B9, 0x038B, 0x03BF, 0x038D, 0x03C5, 0x03C9, 0x03B9, 0x03B1,
+    0x03B2, 0x03B3, 0x03B4, 0x03B5, 0x03B6, 0x03B7, 0x03B8, 0x03B9, 0x03BA, 0x03BB, 0x03BC, 0x03BD,
+    0x03BE, 0x03BF, 0x03C0, 0x03C1, 0x03A2, 0x03C3, 0x03C4, 0x03C5, 0x03C6, 0x03C7, 0x03C8, 0x03C9,
+    0x03B9, 0x03C5, 0x03B1, 0x03B5, 0x03B7, 0x03B9, 0x03C5, 0x03B1, 0x03B2, 0x03B3, 0x03B4, 0x03B5,
+    0x03B6, 0x03B7, 0x03B8, 0x03B9, 0x03BA, 0x03BB, 0x03BC, 0x03BD, 0x03BE, 0x03BF, 0x03C0, 0x03C1,
+    0x03C2, 0x03C3, 0x03C4, 0x03C5, 0x03C6, 0x03C7, 0x03C8, 0x03C9, 0x03B9, 0x03C5, 0x03BF, 0x03C5,
+    0x03C9,
+};
+
+// And for Cyrillic U+0400..U+045F: capitals lowered, and letters NFD splits
+// into a base and a mark (Ѐ Ё Ѓ Ї Ќ Ѝ Ў Й and their lower case) reduced to the base
+static const uint16_t cyrillic_fold[0x460 - 0x400] = {
+    0x0435, 0x0435, 0x0452, 0x0433, 0x0454, 0x0455, 0x0456, 0x0456, 0x0458, 0x0459, 0x045A, 0x045B,
+    0x043A, 0x0438, 0x0443, 0x045F, 0x0430, 0x0431, 0x0432, 0x0433, 0x0434, 0x0435, 0x0436, 0x0437,
+    0x0438, 0x0438, 0x043A, 0x043B, 0x043C, 0x043D, 0x043E, 0x043F, 0x0440, 0x0441, 0x0442, 0x0443,
+    0x0444, 0x0445, 0x0446, 0x0447, 0x0448, 0x0449, 0x044A, 0x044B, 0x044C, 0x044D, 0x044E, 0x044F,
+    0x0430, 0x0431, 0x0432, 0x0433, 0x0434, 0x0435, 0x0436, 0x0437, 0x0438, 0x0438, 0x043A, 0x043B,
+    0x043C, 0x043D, 0x043E, 0x043F, 0x0440, 0x0441, 0x0442, 0x0443, 0x0444, 0x0445, 0x0446, 0x0447,
+    0x0448, 0x0449, 0x044A, 0x044B, 0x044C, 0x044D, 0x044E, 0x044F, 0x0435, 0x0435, 0x0452, 0x0433,
+    0x0454, 0x0455, 0x0456, 0x0456, 0x0458, 0x0459, 0x045A, 0x045B, 0x043A, 0x0438, 0x0443, 0x045F,
+};
+
+static uint32_t hash_bytes(uint32_t hash, const char* bytes, int length) {
+    for (int i = 0; i < length; i++) {
+        hash = (hash ^ (unsigned char)bytes[i]) * FNV_PRIME;
+    }
+    return hash;
+}
+
+// Returns the id of piece (prefixed with "##" for continuations), or -1
+static int lookup(const Tokenizer* t, bool continuation, const char* piece, int length) {
+    uint32_t hash = FNV_OFFSET;
+    int prefix = continuation ? 2 : 0;
+    if (continuation) hash = hash_bytes(hash, "##", 2);
+    hash = hash_bytes(hash, piece, length);
+
+    for (unsigned int slot = hash & t->table_mask; t->table[slot] >= 0; slot = (slot + 1) & t->table_mask) {
+        int id = t->table[slot];
+        const char* entry = t->vocab[id];
+        if (t->vocab_lengths[id] == length + prefix &&
+            (!continuation || (entry[0] == '#' && entry[1] == '#')) &&
+            memcmp(entry + prefix, piece, length) == 0) {
+            return id;
+        }
+    }
+    return -1;
+}
+
+static int lookup_string(const Tokenizer* t, const char* s) {
+    return lookup(t, false, s, (int)strlen(s));
+}
+
+Tokenizer* load_tokenizer(const char* vocab_file) {
+    FILE* file = fopen(vocab_file, "r");
+    if (!file) {
+        fprintf(stderr, "Failed to open vocab file\n");
+        return NULL;
+    }
+
+    Tokenizer* t = calloc(1, sizeof(Tokenizer));
+    int capacity = 32768;
+    t->vocab = malloc(capacity * sizeof(char*));
+    t->vocab_lengths = malloc(capacity * sizeof(int));
+
+    char line[256];
+    while (fgets(line, sizeof(line), file)) {
+        line[strcspn(line, "\r\n")] = 0;  // Remove newline
+        if (t->vocab_size == capacity) {
+            capacity *= 2;
+            t->vocab = realloc(t->vocab, capacity * sizeof(char*));
+            t->vocab_lengths = realloc(t->vocab_lengths, capacity * sizeof(int));
+        }
+        t->vocab[t->vocab_size] = strdup(line);
+        t->vocab_lengths[t->vocab_size] = (int)strlen(line);
+        t->vocab_size++;
+    }
+    fclose(file);
+
+    // Power-of-two table at most half full; the first occurrence of a duplicate wins
+    unsigned int table_size = 1;
+    while (table_size < 2u * (unsigned int)t->vocab_size) table_size <<= 1;
+    t->table = malloc(table_size * sizeof(int));
+    memset(t->table, 0xff, table_size * sizeof(int));
+    t->table_mask = table_size - 1;
+
+    for (int id = 0; id < t->vocab_size; id++) {
+        if (lookup_string(t, t->vocab[id]) >= 0) continue;
+        unsigned int slot = hash_bytes(FNV_OFFSET, t->vocab[id], t->vocab_lengths[id]) & t->table_mask;
+        while (t->table[slot] >= 0) slot = (slot + 1) & t->table_mask;
+        t->table[slot] = id;
+    }
+
+    t->pad_id = lookup_string(t, "[PAD]");
+    t->unk_id = lookup_string(t, "[UNK]");
+    t->cls_id = lookup_string(t, "[CLS]");
+    t->sep_id = lookup_string(t, "[SEP]");
+    return t;
+}
+
+// Decodes one UTF-8 sequence; malformed input decodes to U+FFFD one byte at a time
+static int decode_utf8(const unsigned char* s, uint32_t* codepoint) {
+    if (s[0] < 0x80) {
+        *codepoint = s[0];
+        return 1;
+    }
+    int length = s[0] >= 0xF0 ? 4 : s[0] >= 0xE0 ? 3 : s[0] >= 0xC0 ? 2 : 0;
+    uint32_t cp = length == 4 ? s[0] & 0x07 : length == 3 ? s[0] & 0x0F : s[0] & 0x1F;
+    for (int i = 1; i < length; i++) {
+        if ((s[i] & 0xC0) != 0x80) {
+            length = 0;
+            break;
+        }
+        cp = (cp << 6) | (s[i] & 0x3F);
+    }
+    if (length == 0) {
+        *codepoint = 0xFFFD;
+        return 1;
+    }
+    *codepoint = cp;
+    return length;
+}
+
+static int encode_utf8(uint32_t cp, char* out) {
+    if (cp < 0x80) {
+        out[0] = (char)cp;
+        return 1;
+    }
+    if (cp < 0x800) {
+        out[0] = (char)(0xC0 | (cp >> 6));
+        out[1] = (char)(0x80 | (cp & 0x3F));
+        return 2;
+    }
+    if (cp < 0x10000) {
+        out[0] = (char)(0xE0 | (cp >> 12));
+        out[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        out[2] = (char)(0x80 | (cp & 0x3F));
+        return 3;
+    }
+    out[0] = (char)(0xF0 | (cp >> 18));
+    out[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+    out[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+    out[3] = (char)(0x80 | (cp & 0x3F));
+    return 4;
+}
+
+static bool is_whitespace(uint32_t cp) {
+    return cp == ' ' || cp == '\t' || cp == '\n' || cp == '\r' || cp == 0xA0 || cp == 0x1680 ||
+           (cp >= 0x2000 && cp <= 0x200A) || cp == 0x202F || cp == 0x205F || cp == 0x3000;
+}
+
+static bool is_ignored(uint32_t cp) {
+    return cp == 0 || cp == 0xFFFD || cp < 0x20 || (cp >= 0x7F && cp <= 0x9F) ||
+           (cp >= 0x200B && cp <= 0x200F) || cp == 0xFEFF ||
+           (cp >= 0x0300 && cp <= 0x036F) ||  // combining marks left over from decomposed accents
+           cp == 0x3099 || cp == 0x309A;      // and the combining kana voicing marks
+}
+
+static bool is_punctuation(uint32_t cp) {
+    return (cp >= 33 && cp <= 47) || (cp >= 58 && cp <= 64) || (cp >= 91 && cp <= 96) || (cp >= 123 && cp <= 126) ||
+           cp == 0xA1 || cp == 0xA7 || cp == 0xAB || cp == 0xB6 || cp == 0xB7 || cp == 0xBB || cp == 0xBF ||
+           (cp >= 0x2010 && cp <= 0x2027) || (cp >= 0x2030 && cp <= 0x205E) ||
+           (cp >= 0x3001 && cp <= 0x3003) || (cp >= 0x3008 && cp <= 0x3011) ||
+           (cp >= 0xFF01 && cp <= 0xFF0F) || (cp >= 0xFF1A && cp <= 0xFF20);
+}
+
+static bool is_cjk(uint32_t cp) {
+    return (cp >= 0x4E00 && cp <= 0x9FFF) || (cp >= 0x3400 && cp <= 0x4DBF) ||
+           (cp >= 0x20000 && cp <= 0x2CEAF) || (cp >= 0xF900 && cp <= 0xFAFF) ||
+           (cp >= 0x2F800 && cp <= 0x2FA1F);
+}
+
+// Kana with a voicing mark, which NFD splits off, back to the plain kana.
+// Katakana lie 0x60 above the matching hiragana.
+static uint32_t strip_kana_mark(uint32_t cp) {
+    if (cp >= 0x30F7 && cp <= 0x30FA) return cp - 8;  // ヷ..ヺ to ワ..ヲ
+    uint32_t h = cp >= 0x30A0 ? cp - 0x60 : cp;
+    if (h >= 0x304C && h <= 0x3062) return (h - 0x304B) % 2 ? cp - 1 : cp;  // が..ぢ
+    if (h >= 0x3065 && h <= 0x3069) return (h - 0x3064) % 2 ? cp - 1 : cp;  // づ..ど
+    if (h >= 0x3070 && h <= 0x307D) return cp - (h - 0x306F) % 3;           // ば ぱ .. ぼ ぽ
+    if (h == 0x3094) return cp - 0x4E;                                       // ゔ to う
+    if (h == 0x309E) return cp - 1;                                          // ゞ to ゝ
+    return cp;
+}
+
+// Lowercasing and accent stripping, for the scripts the tables cover
+static uint32_t fold(uint32_t cp) {
+    if (cp >= 'A' && cp <= 'Z') return cp + ('a' - 'A');
+    if (cp < 0xC0) return cp;
+    if (cp < 0x180) return latin_fold[cp - 0xC0];
+    if (cp >= 0x386 && cp < 0x3CF) return greek_fold[cp - 0x386];
+    if (cp >= 0x400 && cp < 0x460) return cyrillic_fold[cp - 0x400];
+    if (cp >= 0x304C && cp <= 0x30FE) return strip_kana_mark(cp);
+    return cp;
+}
+
+typedef struct {
+    int* tokens;
+    int count;
+    int limit;
+} TokenOutput;
+
+static void emit(TokenOutput* out, int id) {
+    if (id >= 0 && out->count < out->limit) {
+        out->tokens[out->count++] = id;
+    }
+}
+
+// Greedy longest-match-first split of one normalized word into vocab pieces
+static void wordpiece(const Tokenizer* t, const char* word, int length, int chars, TokenOutput* out) {
+    if (length == 0) return;
+    if (chars > MAX_WORD_CHARS) {
+        emit(out, t->unk_id);
+        return;
+    }
+
+    int first = out->count;
+    int start = 0;
+    while (start < length) {
+        int end = length;
+        int id = -1;
+        while (end > start) {
+            id = lookup(t, start > 0, word + start, end - start);
+            if (id >= 0) break;
+            // Step back one whole UTF-8 character
+            do end--; while (end > start && ((unsigned char)word[end] & 0xC0) == 0x80);
+        }
+        if (id < 0) {
+            // No segmentation: the whole word is unknown
+            out->count = first;
+            emit(out, t->unk_id);
+            return;
+        }
+        emit(out, id);
+        start = end;
+    }
+}
+
+// Python's str.lower(), which BERT applies, turns a capital sigma that ends a
+// word into final sigma: sigma is the offset of the last σ lowered from Σ
+static void final_sigma(char* word, int length, int sigma) {
+    if (sigma > 0 && sigma == length - 2) word[length - 1] = (char)0x82;  // σ CF 83 -> ς CF 82
+}
+
+int tokenize(const Tokenizer* tokenizer, const char* text, int* tokens, int max_tokens) {
+    if (max_tokens < 2) return 0;
+
+    // Leave room for the closing [SEP]
+    TokenOutput out = { tokens, 0, max_tokens - 1 };
+    emit(&out, tokenizer->cls_id);
+
+    char word[MAX_WORD_BYTES];
+    int length = 0;
+    int chars = 0;
+    int sigma = -1;
+
+    const unsigned char* p = (const unsigned char*)text;
+    while (*p && out.count < out.limit) {
+        uint32_t cp;
+        p += decode_utf8(p, &cp);
+
+        if (is_whitespace(cp)) {
+            final_sigma(word, length, sigma);
+            wordpiece(tokenizer, word, length, chars, &out);
+            length = chars = 0;
+            continue;
+        }
+        if (is_ignored(cp)) continue;
+
+        uint32_t folded = fold(cp);
+        if (is_punctuation(folded) || is_cjk(folded)) {
+            // Punctuation and CJK characters are words of their own
+            final_sigma(word, length, sigma);
+            wordpiece(tokenizer, word, length, chars, &out);
+            length = encode_utf8(folded, word);
+            wordpiece(tokenizer, word, length, 1, &out);
+            length = chars = 0;
+            continue;
+        }
+
+        if (chars <= MAX_WORD_CHARS) {
+            sigma = cp == 0x3A3 ? length : -1;
+            length += encode_utf8(folded, word + length);
+        }
+        chars++;
+    }
+    final_sigma(word, length, sigma);
+    wordpiece(tokenizer, word, length, chars, &out);
+
+    if (tokenizer->sep_id >= 0) {
+        tokens[out.count++] = tokenizer->sep_id;
+    }
+    return out.count;
+}
+
+void free_tokenizer(Tokenizer* tokenizer) {
+    for (int i = 0; i < tokenizer->vocab_size; i++) {
+        free(tokenizer->vocab[i]);
+    }
+    free(tokenizer->vocab);
+    free(tokenizer->vocab_lengths);
+    free(tokenizer->table);
+    free(tokenizer);
+}
@@ -0,0 +1,31 @@
+#ifndef TOKENIZER_H
+#define TOKENIZER_H
+
+// BERT uncased tokenizer: lowercasing, accent stripping and punctuation
+// splitting, followed by greedy longest-match WordPiece over the vocab.
+// Lowercasing and accent stripping (BERT's NFD with combining marks removed)
+// cover ASCII, Latin-1, Latin Extended-A, Greek, Cyrillic and the kana voicing
+// marks; letters of other scripts, e.g. Vietnamese or Latin Extended-B, pass
+// through unchanged and may map to [UNK] or other pieces than BERT's.
+typedef struct {
+    char** vocab;
+    int* vocab_lengths;
+    int vocab_size;
+
+    // Open-addressing hash table of vocab ids, built once by load_tokenizer
+    int* table;
+    unsigned int table_mask;
+
+    int pad_id;
+    int unk_id;
+    int cls_id;
+    int sep_id;
+} Tokenizer;
+
+Tokenizer* load_tokenizer(const char* vocab_file);
+// Writes [CLS] wordpieces... [SEP] into tokens, truncating to max_tokens ids.
+// Returns the number of ids written. Does not allocate.
+int tokenize(const Tokenizer* tokenizer, const char* text, int* tokens, int max_tokens);
+void free_tokenizer(Tokenizer* tokenizer);
+
+#endif // TOKENIZER_H
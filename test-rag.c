@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 #include "./vector-store/hnsw.h"
 #include "./vector-store/exhaustive.h"
 #include "./vector-store/document/document.h"
@@ -9,6 +10,7 @@
 
 #define MAX_SENTENCES 30
 #define MAX_TEXT_LENGTH 1000
+#define EMBEDDING_CACHE_CAPACITY 1024
 
 // New function to read sentences from file
 char** read_sentences(const char* filename, int* num_sentences) {
@@ -51,6 +53,17 @@ float calculate_checksum(float* vector, int size) {
     return sum;
 }
 
+// True if hnsw holds exactly the n vectors (n x dim floats), as ids 0..n-1.
+// Another model, weight type, projection or sentence file changes them.
+static int index_matches(const HNSW* hnsw, const float* vectors, int n, int dim) {
+    if (hnsw->dimensions != dim || hnsw->next_label != n) return 0;
+    for (int i = 0; i < n; i++) {
+        const float* stored = hnsw_vector(hnsw, i);
+        if (!stored || memcmp(stored, vectors + (size_t)i * dim, dim * sizeof(float)) != 0) return 0;
+    }
+    return 1;
+}
+
 int main(int argc, char *argv[]) {
     srand(time(NULL));
 
@@ -62,47 +75,99 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
-    DocumentStore doc_store;
-    init_document_store(&doc_store, num_sentences, EMBEDDING_DIM);
+    const char* vocab_file = "./embedding-model/vocab.txt";
+    const char* model_file = "./embedding-model/model.bin";
 
-    HNSW* hnsw = (HNSW*)malloc(sizeof(HNSW));
-    if (!hnsw) {
-        fprintf(stderr, "Failed to allocate memory for HNSW\n");
-        // Clean up and exit
+    EmbeddingContext* embedding_ctx = load_embedding_context(vocab_file, model_file, GEMM_F32);
+    if (!embedding_ctx) {
+        fprintf(stderr, "Failed to load embedding model\n");
         return 1;
     }
+    EmbeddingSession* embedding_session = create_embedding_session(embedding_ctx);
+
+    // A projection written by fit-projection shrinks every vector the indexes store
+    EmbeddingProjection* projection = NULL;
+    const char* projection_file = getenv("EMBED_PROJECTION_FILE");
+    if (projection_file) {
+        projection = load_projection(projection_file);
+        if (!projection || set_embedding_projection(embedding_session, projection) != 0) {
+            fprintf(stderr, "Failed to apply projection %s\n", projection_file);
+            return 1;
+        }
+        printf("Projecting %d-dim embeddings to %d dims\n", embedding_dim(embedding_ctx), projection->output_dim);
+    }
+    int dim = embedding_output_dim(embedding_session);
+
+    DocumentStore doc_store;
+    init_document_store(&doc_store, num_sentences, dim);
+
     ExhaustiveStore exhaustive;
 
-    init_hnsw(hnsw, EMBEDDING_DIM);
-    init_exhaustive_store(&exhaustive, EMBEDDING_DIM);
-    
-    const char* vocab_file = "./embedding-model/vocab.txt";
-    const char* model_file = "./embedding-model/model.bin";
+    init_exhaustive_store(&exhaustive, dim);
 
-    // Embed sentences and insert into indexes
-    for (int i = 0; i < num_sentences; i++) {
-        printf("Embedding document %d: %s\n", i, sentences[i]);
-        float* vector = embed_text(sentences[i], vocab_file, model_file);
-        if (!vector) {
-            fprintf(stderr, "Failed to embed text for document %d\n", i);
-            continue;
+    // Documents embedded by an earlier run are read back from EMBED_CACHE_FILE, if set
+    EmbeddingCache* embedding_cache = create_embedding_cache(EMBEDDING_CACHE_CAPACITY, dim, embedding_fingerprint(embedding_session),
+                                                             getenv("EMBED_CACHE_FILE"));
+    if (!embedding_cache || set_embedding_cache(embedding_session, embedding_cache) != 0) {
+        fprintf(stderr, "Failed to create embedding cache\n");
+        return 1;
+    }
+
+    // Embed all sentences in batched forward passes
+    float* vectors = malloc(num_sentences * dim * sizeof(float));
+    if (embed_batch(embedding_session, (const char**)sentences, num_sentences, vectors) != 0) {
+        fprintf(stderr, "Failed to embed documents\n");
+        return 1;
+    }
+    EmbeddingCacheStats cache_stats = embedding_cache_stats(embedding_cache);
+    printf("Embedded %d documents (%llu read from the cache file)\n", num_sentences, (unsigned long long)cache_stats.disk_hits);
+
+    // An index saved by an earlier run is mapped from HNSW_INDEX_FILE, if set,
+    // and its graph reused when it verifies and holds exactly the vectors just embedded
+    const char* index_file = getenv("HNSW_INDEX_FILE");
+    HNSW* hnsw = index_file && access(index_file, F_OK) == 0 ? hnsw_open(index_file) : NULL;
+    if (hnsw && hnsw_verify(hnsw) != 0) {
+        printf("%s is corrupt, rebuilding it\n", index_file);
+        free_hnsw(hnsw);
+        hnsw = NULL;
+    }
+    if (hnsw && !index_matches(hnsw, vectors, num_sentences, dim)) {
+        printf("%s does not match the documents, rebuilding it\n", index_file);
+        free_hnsw(hnsw);
+        hnsw = NULL;
+    }
+    int build_index = hnsw == NULL;
+    if (build_index) {
+        hnsw = (HNSW*)malloc(sizeof(HNSW));
+        if (!hnsw) {
+            fprintf(stderr, "Failed to allocate memory for HNSW\n");
+            // Clean up and exit
+            return 1;
         }
+        init_hnsw(hnsw, dim);
+    } else {
+        printf("Reusing the HNSW graph mapped from %s\n", index_file);
+    }
 
-        printf("Successfully embedded document %d\n", i);
+    // Insert embeddings into indexes
+    for (int i = 0; i < num_sentences; i++) {
+        float* vector = vectors + i * dim;
 
-        float checksum_before = calculate_checksum(vector, EMBEDDING_DIM);
+        float checksum_before = calculate_checksum(vector, dim);
         printf("Checksum before operations: %.4f\n", checksum_before);
 
         int doc_id = add_document(&doc_store, vector, sentences[i]);
         printf("Added document to store with ID %d\n", doc_id);
 
-        insert(hnsw, vector);
-        printf("Inserted into HNSW index\n");
+        if (build_index) {
+            insert(hnsw, vector);
+            printf("Inserted into HNSW index\n");
+        }
 
         insert_exhaustive(&exhaustive, vector);
         printf("Inserted into exhaustive index\n");
 
-        float checksum_after = calculate_checksum(vector, EMBEDDING_DIM);
+        float checksum_after = calculate_checksum(vector, dim);
         printf("Checksum after operations: %.4f\n", checksum_after);
 
         if (checksum_before != checksum_after) {
@@ -110,7 +175,10 @@ int main(int argc, char *argv[]) {
         }
 
         printf("Added document %d: %s\n", doc_id, sentences[i]);
-        // Remove the free(vector) call
+    }
+
+    if (build_index && index_file && hnsw_save(hnsw, index_file) == 0) {
+        printf("Saved HNSW index to %s\n", index_file);
     }
 
     printf("\nDocument store and indexes populated.\n\n");
@@ -123,8 +191,8 @@ int main(int argc, char *argv[]) {
         query_text = "brazil world cup";
     }
 
-    float* query_vector = embed_text(query_text, vocab_file, model_file);
-    if (!query_vector) {
+    float* query_vector = malloc(dim * sizeof(float));
+    if (embed_text(embedding_session, query_text, query_vector) != 0) {
         fprintf(stderr, "Failed to embed query text\n");
         // Clean up and exit
         // ... (free other resources)
@@ -133,7 +201,7 @@ int main(int argc, char *argv[]) {
 
     printf("Query text: %s\n", query_text);
     printf("Query vector: ");
-    print_vector(query_vector, EMBEDDING_DIM);
+    print_vector(query_vector, dim);
     printf("\n\n");
 
     // Search using HNSW
@@ -177,16 +245,19 @@ int main(int argc, char *argv[]) {
     // Free allocated memory
     free_document_store(&doc_store);
     free_hnsw(hnsw);
-    // free(hnsw);
-    // Ensure exhaustive is freed correctly
-    // free_exhaustive_store(&exhaustive); // Uncomment if you have a function to free exhaustive
+    free_exhaustive_store(&exhaustive);
+    free(vectors);
+    free_embedding_session(embedding_session);
+    free_embedding_cache(embedding_cache);
+    free_projection(projection);
+    free_embedding_context(embedding_ctx);
 
     // for (int i = 0; i < num_sentences; i++) {
     //     free(sentences[i]);  // Ensure each strdup'd string is freed
     // }
     // free(sentences);  // Free the array of pointers
 
-    // free(query_vector);  // Ensure the query vector is freed
+    free(query_vector);
 
     return 0;
 }
@@ -0,0 +1,192 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "hnsw.h"
+#include "exhaustive.h"
+
+#define MAX_SWEEP 16
+#define MAX_K 100
+#define NUM_CLUSTERS 20
+
+// Benchmarks HNSW construction: one serial build with insert, then
+// build_hnsw_parallel at each thread count, over the same clustered vectors.
+// Every build reports its time, speedup over the serial build, and recall@k
+// against exhaustive search, so a faster build that links a worse graph shows.
+//
+// Usage: bench-hnsw [options]
+//   --n N                 vectors to index (default 20000)
+//   --dim N               dimensions (default 384)
+//   --threads 1,2,4,...   parallel builds to run (default 1,2,4 and one per CPU)
+//   --queries N           queries for recall (default 200)
+//   --k N --ef N          recall@k at search ef (defaults 10, HNSW_DEFAULT_EF)
+//   --seed N              data and level seed (default 1)
+//   --json PATH           write results as JSON
+
+typedef struct {
+    int threads;  // 0 for the serial insert loop
+    double seconds;
+    double recall;
+} BuildResult;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int parse_list(const char* text, int* values) {
+    int count = 0;
+    while (*text && count < MAX_SWEEP) {
+        values[count++] = atoi(text);
+        const char* comma = strchr(text, ',');
+        if (!comma) break;
+        text = comma + 1;
+    }
+    return count;
+}
+
+static float random_float(void) {
+    return (float)rand() / (float)RAND_MAX * 2.0f - 1.0f;
+}
+
+// n vectors around NUM_CLUSTERS random centers, like clustered embeddings
+static float* clustered_vectors(int n, int dim) {
+    float* centers = malloc((size_t)NUM_CLUSTERS * dim * sizeof(float));
+    float* vectors = malloc((size_t)n * dim * sizeof(float));
+    if (!centers || !vectors) {
+        fprintf(stderr, "Failed to allocate %d x %d vectors\n", n, dim);
+        exit(1);
+    }
+    for (size_t i = 0; i < (size_t)NUM_CLUSTERS * dim; i++) centers[i] = random_float();
+    for (int i = 0; i < n; i++) {
+        const float* center = centers + (size_t)(rand() % NUM_CLUSTERS) * dim;
+        for (int d = 0; d < dim; d++) vectors[(size_t)i * dim + d] = center[d] + 0.3f * random_float();
+    }
+    free(centers);
+    return vectors;
+}
+
+// Mean fraction of each query's exact k nearest (expected, k per query) returned
+static double recall(HNSW* hnsw, const float* queries, int num_queries, int k, int ef, const int* expected) {
+    int result[MAX_K];
+    float distances[MAX_K];
+    int found = 0;
+    for (int q = 0; q < num_queries; q++) {
+        int num_results = hnsw_search(hnsw, queries + (size_t)q * hnsw->dimensions, k, ef, result, distances);
+        for (int i = 0; i < num_results; i++) {
+            for (int j = 0; j < k; j++) {
+                if (result[i] == expected[(size_t)q * k + j]) {
+                    found++;
+                    break;
+                }
+            }
+        }
+    }
+    return (double)found / ((double)num_queries * k);
+}
+
+// Builds an index over vectors with threads workers, or insert() one by one
+// when threads is 0. The level draws are reseeded so every build sees the same.
+static BuildResult run_build(const float* vectors, int n, int dim, int threads, unsigned seed, const float* queries,
+                             int num_queries, int k, int ef, const int* expected) {
+    HNSW* hnsw = malloc(sizeof(HNSW));
+    init_hnsw(hnsw, dim);
+    srand(seed);
+    double start = now_seconds();
+    if (threads == 0) {
+        for (int i = 0; i < n; i++) insert(hnsw, (float*)vectors + (size_t)i * dim);
+    } else {
+        build_hnsw_parallel(hnsw, vectors, n, threads);
+    }
+    BuildResult result = { threads, now_seconds() - start, 0.0 };
+    result.recall = recall(hnsw, queries, num_queries, k, ef, expected);
+    free_hnsw(hnsw);
+    return result;
+}
+
+static int write_json(const char* path, int n, int dim, int k, int ef, const BuildResult* results, int count) {
+    FILE* f = fopen(path, "w");
+    if (!f) {
+        fprintf(stderr, "Failed to open %s\n", path);
+        return -1;
+    }
+    fprintf(f, "{\"n\": %d, \"dim\": %d, \"k\": %d, \"ef\": %d, \"builds\": [\n", n, dim, k, ef);
+    for (int i = 0; i < count; i++) {
+        fprintf(f, "  {\"threads\": %d, \"serial\": %s, \"seconds\": %.4f, \"speedup\": %.3f, \"recall\": %.4f}%s\n",
+                results[i].threads, results[i].threads == 0 ? "true" : "false", results[i].seconds,
+                results[0].seconds / results[i].seconds, results[i].recall, i + 1 < count ? "," : "");
+    }
+    fprintf(f, "]}\n");
+    if (fclose(f) != 0) {
+        fprintf(stderr, "Failed to write %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    int n = 20000, dim = 384, num_queries = 200, k = 10, ef = HNSW_DEFAULT_EF;
+    unsigned seed = 1;
+    int cpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int threads[MAX_SWEEP] = { 1, 2, 4, cpus }, num_threads = cpus > 4 ? 4 : 3;
+    const char* json_path = NULL;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--n") == 0) n = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "--dim") == 0) dim = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "--threads") == 0) num_threads = parse_list(argv[i + 1], threads);
+        else if (strcmp(argv[i], "--queries") == 0) num_queries = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "--k") == 0) k = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "--ef") == 0) ef = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "--seed") == 0) seed = (unsigned)strtoul(argv[i + 1], NULL, 10);
+        else if (strcmp(argv[i], "--json") == 0) json_path = argv[i + 1];
+        else {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (n < 1 || dim < 1 || num_queries < 1 || k < 1 || k > MAX_K) {
+        fprintf(stderr, "Need n, dim and queries >= 1 and 1 <= k <= %d\n", MAX_K);
+        return 1;
+    }
+    if (k > n) k = n;
+
+    srand(seed);
+    float* vectors = clustered_vectors(n, dim);
+    float* queries = clustered_vectors(num_queries, dim);
+
+    // Ground truth once, shared by every build
+    ExhaustiveStore exact;
+    init_exhaustive_store(&exact, dim);
+    for (int i = 0; i < n; i++) insert_exhaustive(&exact, vectors + (size_t)i * dim);
+    int* expected = malloc((size_t)num_queries * k * sizeof(int));
+    float distances[MAX_K];
+    for (int q = 0; q < num_queries; q++) {
+        search_exhaustive(&exact, queries + (size_t)q * dim, k, expected + (size_t)q * k, distances);
+    }
+
+    printf("%d x %d vectors, %d queries, recall@%d at ef %d, %d CPUs\n", n, dim, num_queries, k, ef, cpus);
+    printf("%-10s %10s %9s %9s\n", "build", "seconds", "speedup", "recall");
+    BuildResult* results = malloc((size_t)(num_threads + 1) * sizeof(BuildResult));
+    int count = 0;
+    for (int t = -1; t < num_threads; t++) {
+        int workers = t < 0 ? 0 : threads[t];
+        if (t >= 0 && workers < 1) continue;
+        results[count] = run_build(vectors, n, dim, workers, seed, queries, num_queries, k, ef, expected);
+        char name[32] = "serial";
+        if (workers > 0) snprintf(name, sizeof(name), "%d threads", workers);
+        printf("%-10s %10.3f %8.2fx %9.4f\n", name, results[count].seconds, results[0].seconds / results[count].seconds,
+               results[count].recall);
+        count++;
+    }
+
+    int status = json_path ? write_json(json_path, n, dim, k, ef, results, count) != 0 : 0;
+    free(results);
+    free(expected);
+    free_exhaustive_store(&exact);
+    free(vectors);
+    free(queries);
+    return status;
+}
@@ -35,20 +35,21 @@ int add_document(DocumentStore* store, float* vector, const char* text) {
     }
 
     doc->vector_dim = store->vector_dim;
+    doc->id = store->count;
 
     store->count++;
     return store->count - 1;
 }
 
 Document* get_document(DocumentStore* store, int id) {
-    if (id < 0 || id >= store->count) {
+    if (id < 0 || id >= store->count || store->documents[id].vector == NULL) {
         return NULL;
     }
     return &store->documents[id];
 }
 
 bool update_document(DocumentStore* store, int id, float* vector, const char* text) {
-    if (id < 0 || id >= store->count) {
+    if (id < 0 || id >= store->count || store->documents[id].vector == NULL) {
         return false;
     }
     
@@ -60,20 +61,17 @@ bool update_document(DocumentStore* store, int id, float* vector, const char* te
     return true;
 }
 
+// Leaves the slot empty rather than moving another document into it, so ids
+// keep matching the ids the vector indexes return (see hnsw_delete)
 bool delete_document(DocumentStore* store, int id) {
-    if (id < 0 || id >= store->count) {
+    if (id < 0 || id >= store->count || store->documents[id].vector == NULL) {
         return false;
     }
     
     free(store->documents[id].vector);
     free(store->documents[id].text);
-    
-    if (id < store->count - 1) {
-        store->documents[id] = store->documents[store->count - 1];
-        // If you need to update the id, ensure the Document struct has an id field
-    }
-    
-    store->count--;
+    store->documents[id].vector = NULL;
+    store->documents[id].text = NULL;
     return true;
 }
 
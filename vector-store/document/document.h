@@ -14,7 +14,7 @@ typedef struct {
 
 typedef struct {
     Document* documents;
-    int count;          // Updated field name to match implementation
+    int count;          // ids handed out; deleted ones stay as empty slots
     int capacity;
     int vector_dim;     // Updated field name to match implementation
 } DocumentStore;
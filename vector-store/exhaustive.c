@@ -3,35 +3,37 @@
 #include <string.h>
 #include <math.h>
 #include <float.h>
+#include "exhaustive.h"
 #include "util.h"
 
-#define MAX_ELEMENTS 10000
-#define MAX_DIMENSIONS 128
-
-typedef struct {
-    float vector[MAX_DIMENSIONS];
-} Element;
-
-typedef struct {
-    Element elements[MAX_ELEMENTS];
-    int num_elements;
-    int dimensions;
-} ExhaustiveStore;
-
 void init_exhaustive_store(ExhaustiveStore* store, int dimensions) {
     store->num_elements = 0;
+    store->capacity = EXHAUSTIVE_INITIAL_CAPACITY;
     store->dimensions = dimensions;
+    store->vectors = malloc((size_t)store->capacity * dimensions * sizeof(float));
+    if (!store->vectors) {
+        fprintf(stderr, "Memory allocation failed in init_exhaustive_store\n");
+        exit(1);
+    }
 }
 
-void insert_exhaustive(ExhaustiveStore* store, float* vector) {
-    if (store->num_elements >= MAX_ELEMENTS) {
-        printf("ExhaustiveStore is full\n");
-        return;
+int insert_exhaustive(ExhaustiveStore* store, float* vector) {
+    if (store->num_elements == store->capacity) {
+        float* vectors = realloc(store->vectors, (size_t)store->capacity * 2 * store->dimensions * sizeof(float));
+        if (!vectors) {
+            fprintf(stderr, "Memory allocation failed in insert_exhaustive\n");
+            exit(1);
+        }
+        store->vectors = vectors;
+        store->capacity *= 2;
     }
 
-    Element* new_element = &store->elements[store->num_elements];
-    memcpy(new_element->vector, vector, store->dimensions * sizeof(float));
-    store->num_elements++;
+    memcpy(store->vectors + (size_t)store->num_elements * store->dimensions, vector, store->dimensions * sizeof(float));
+    return store->num_elements++;
+}
+
+const float* exhaustive_vector(const ExhaustiveStore* store, int id) {
+    return store->vectors + (size_t)id * store->dimensions;
 }
 
 int search_exhaustive(ExhaustiveStore* store, float* query, int k, int* result, float* distances) {
@@ -45,7 +47,7 @@ int search_exhaustive(ExhaustiveStore* store, float* query, int k, int* result,
     }
 
     for (int i = 0; i < store->num_elements; i++) {
-        temp_distances[i] = euclidean_distance(query, store->elements[i].vector, store->dimensions);
+        temp_distances[i] = euclidean_distance(query, exhaustive_vector(store, i), store->dimensions);
         temp_result[i] = i;
     }
 
@@ -82,6 +84,13 @@ void print_exhaustive_stats(ExhaustiveStore* store) {
     printf("Dimensions: %d\n", store->dimensions);
 }
 
+void free_exhaustive_store(ExhaustiveStore* store) {
+    free(store->vectors);
+    store->vectors = NULL;
+    store->num_elements = 0;
+    store->capacity = 0;
+}
+
 // int main() {
 //     ExhaustiveStore store;
 //     init_exhaustive_store(&store, 3);
@@ -111,7 +120,7 @@ void print_exhaustive_stats(ExhaustiveStore* store) {
 //     printf("%-10s %-10s %-s\n", "Index", "Distance", "Vector");
 //     for (int i = 0; i < num_results; i++) {
 //         int index = result[i];
-//         float* vector = store.elements[index].vector;
+//         const float* vector = exhaustive_vector(&store, index);
 //         printf("%-10d %-10.4f [%.2f, %.2f, %.2f]\n", 
 //                index, distances[i], vector[0], vector[1], vector[2]);
 //     }
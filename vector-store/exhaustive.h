@@ -1,22 +1,25 @@
 #ifndef EXHAUSTIVE_H
 #define EXHAUSTIVE_H
 
-#define MAX_ELEMENTS 10000
-#define MAX_DIMENSIONS 128
+#define EXHAUSTIVE_INITIAL_CAPACITY 256
 
+// Brute-force reference index: vectors are stored back to back, dimensions
+// floats each, and the storage doubles as elements are inserted.
 typedef struct {
-    float vector[MAX_DIMENSIONS];
-} Element;
-
-typedef struct {
-    Element elements[MAX_ELEMENTS];
+    float* vectors;  // capacity x dimensions
     int num_elements;
+    int capacity;
     int dimensions;
 } ExhaustiveStore;
 
 void init_exhaustive_store(ExhaustiveStore* store, int dimensions);
-void insert_exhaustive(ExhaustiveStore* store, float* vector);
+// Returns the element's id (insertion order)
+int insert_exhaustive(ExhaustiveStore* store, float* vector);
 int search_exhaustive(ExhaustiveStore* store, float* query, int k, int* result, float* distances);
+// The stored copy of element id
+const float* exhaustive_vector(const ExhaustiveStore* store, int id);
 void print_exhaustive_stats(ExhaustiveStore* store);
+// Frees the vectors; the store itself belongs to the caller
+void free_exhaustive_store(ExhaustiveStore* store);
 
 #endif // EXHAUSTIVE_H
@@ -4,26 +4,20 @@
 #include <float.h>
 #include <stdbool.h>
 #include <string.h>
+#include <sched.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "hnsw.h"
 #include "priority-queue.h"  // Include the priority queue header
 #include "util.h"
+#include "visited.h"
 
-#define MAX_ELEMENTS 10000
-#define MAX_DIMENSIONS 128
-#define MAX_LEVELS 16
-#define M 16 // Maximum number of connections per node at each level
-#define ef_construction 200  // Increase from 100 to 200 or higher
-#define PQ_SIZE 500  // Or any other suitable value
-#define ef_search 150  // Reduce from 50 to 30
-
-// Move contains_priority_queue declaration and implementation here
-bool contains_priority_queue(PriorityQueue* pq, int index) {
-    for (int i = 0; i < pq->size; i++) {
-        if (pq->elements[i].index == index) {
-            return true;
-        }
-    }
-    return false;
-}
+// Ints per adjacency list: the count, then the neighbor ids. A level-0 row
+// starts with the node's seqlock version, which covers all of its lists.
+#define LEVEL0_LINKS (2 + 2 * M)
+#define UPPER_LINKS (1 + M)
 
 // Add this helper function
 bool contains_connection(int* connections, int num_connections, int index) {
@@ -35,192 +29,800 @@ bool contains_connection(int* connections, int num_connections, int index) {
     return false;
 }
 
-typedef struct Node {
-    float vector[MAX_DIMENSIONS];
-    int connections[MAX_LEVELS][M];
-    int num_connections[MAX_LEVELS];  // Track the actual number of connections at each level
-    int level;
-} Node;
+// Level 0 holds twice as many neighbors as the upper levels
+static int max_connections(int level) {
+    return level == 0 ? 2 * M : M;
+}
 
-typedef struct HNSW {
-    Node nodes[MAX_ELEMENTS];
-    int num_elements;
-    int max_level;
-    int dimensions;
-    PriorityQueue* level_pqs;  // Add this line
-} HNSW;
+// The per-node arrays are replaced when the index grows while searches may
+// still be reading the old ones, so every access loads the current pointer
+static float* node_vector(const HNSW* hnsw, int id) {
+    return __atomic_load_n(&hnsw->vectors, __ATOMIC_ACQUIRE) + (size_t)id * hnsw->stride;
+}
 
-void init_hnsw(HNSW* hnsw, int dimensions) {
+static int node_level(const HNSW* hnsw, int id) {
+    return __atomic_load_n(&hnsw->levels, __ATOMIC_ACQUIRE)[id];
+}
+
+static bool is_deleted(const HNSW* hnsw, int id) {
+    return __atomic_load_n(&__atomic_load_n(&hnsw->deleted, __ATOMIC_ACQUIRE)[id], __ATOMIC_RELAXED) != HNSW_LIVE;
+}
+
+static int* node_row(const HNSW* hnsw, int id) {
+    return __atomic_load_n(&hnsw->level0, __ATOMIC_ACQUIRE) + (size_t)id * LEVEL0_LINKS;
+}
+
+// Adjacency list of id at level: [count, ids...], or NULL above the node's top level
+static int* node_links(const HNSW* hnsw, int id, int level) {
+    if (level > node_level(hnsw, id)) return NULL;
+    if (level == 0) return node_row(hnsw, id) + 1;
+    return __atomic_load_n(&hnsw->upper_links, __ATOMIC_ACQUIRE)[id] + (size_t)(level - 1) * UPPER_LINKS;
+}
+
+// Distance from id to each neighbor in node_links(id, level), same order
+static float* node_distances(const HNSW* hnsw, int id, int level) {
+    if (level == 0) return hnsw->level0_distances + (size_t)id * 2 * M;
+    return hnsw->upper_distances[id] + (size_t)(level - 1) * M;
+}
+
+// Appends neighbor to id's list at level; the caller checks there is room.
+// Lists are stored with relaxed atomics since searches copy them unlocked.
+static void add_link(HNSW* hnsw, int id, int level, int neighbor, float distance) {
+    int* links = node_links(hnsw, id, level);
+    int count = links[0];
+    node_distances(hnsw, id, level)[count] = distance;
+    __atomic_store_n(&links[1 + count], neighbor, __ATOMIC_RELAXED);
+    __atomic_store_n(&links[0], count + 1, __ATOMIC_RELAXED);
+}
+
+// Replaces id's list at level with the count selected neighbors
+static void set_links(HNSW* hnsw, int id, int level, const PQElement* selected, int count) {
+    int* links = node_links(hnsw, id, level);
+    float* distances = node_distances(hnsw, id, level);
+    for (int i = 0; i < count; i++) {
+        __atomic_store_n(&links[1 + i], selected[i].index, __ATOMIC_RELAXED);
+        distances[i] = selected[i].distance;
+    }
+    __atomic_store_n(&links[0], count, __ATOMIC_RELAXED);
+}
+
+// Each node's lists are guarded by a seqlock: writers make the version odd
+// for the length of an update, which also excludes other writers, and
+// readers retry a copy that overlapped one. Searches never take a lock.
+static void lock_node(const HNSW* hnsw, int id) {
+    int* version = node_row(hnsw, id);
+    for (;;) {
+        int current = __atomic_load_n(version, __ATOMIC_RELAXED);
+        if (!(current & 1) && __atomic_compare_exchange_n(version, &current, current + 1, false, __ATOMIC_ACQUIRE,
+                                                          __ATOMIC_RELAXED)) {
+            break;
+        }
+        sched_yield();
+    }
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void unlock_node(const HNSW* hnsw, int id) {
+    int* version = node_row(hnsw, id);
+    __atomic_store_n(version, __atomic_load_n(version, __ATOMIC_RELAXED) + 1, __ATOMIC_RELEASE);
+}
+
+// Copies id's neighbors at level into out (room for 2M) and returns how many
+static int read_links(const HNSW* hnsw, int id, int level, int* out) {
+    if (level > node_level(hnsw, id)) return 0;
+    int* row = node_row(hnsw, id);
+    int* links = level == 0 ? row + 1 : node_links(hnsw, id, level);
+    int capacity = max_connections(level);
+    for (;;) {
+        int version = __atomic_load_n(row, __ATOMIC_ACQUIRE);
+        if (version & 1) {
+            sched_yield();
+            continue;
+        }
+        int count = __atomic_load_n(&links[0], __ATOMIC_RELAXED);
+        if (count > capacity) count = capacity;
+        for (int i = 0; i < count; i++) {
+            out[i] = __atomic_load_n(&links[1 + i], __ATOMIC_RELAXED);
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(row, __ATOMIC_RELAXED) == version) return count;
+    }
+}
+
+static void* aligned_array(size_t count, size_t size) {
+    size_t bytes = (count * size + HNSW_ALIGNMENT - 1) / HNSW_ALIGNMENT * HNSW_ALIGNMENT;
+    void* data = aligned_alloc(HNSW_ALIGNMENT, bytes ? bytes : HNSW_ALIGNMENT);
+    if (data == NULL) {
+        fprintf(stderr, "Failed to allocate %zu bytes for HNSW storage\n", bytes);
+        exit(1);
+    }
+    return data;
+}
+
+static bool is_mapped(const HNSW* hnsw, const void* data);
+
+// Empties a slot no search can reach and makes it available to insert
+static void free_slot(HNSW* hnsw, int id) {
+    if (!is_mapped(hnsw, hnsw->upper_links[id])) free(hnsw->upper_links[id]);
+    free(hnsw->upper_distances[id]);
+    hnsw->upper_links[id] = NULL;
+    hnsw->upper_distances[id] = NULL;
+    hnsw->levels[id] = 0;
+    node_row(hnsw, id)[1] = 0;
+    hnsw->free_slots[hnsw->num_free_slots++] = id;
+}
+
+// Frees the arrays replaced by earlier growth, and hands the slots compaction
+// unlinked to insert, once no search can still be reading them. Called by
+// writers only.
+static void free_retired(HNSW* hnsw) {
+    if (hnsw->num_retired == 0 && hnsw->num_pending_slots == 0) return;
+    // Pairs with the increment in hnsw_search: a search that starts after
+    // this check loads the new pointers
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&hnsw->active_searches, __ATOMIC_SEQ_CST) > 0) return;
+    for (int i = 0; i < hnsw->num_retired; i++) free(hnsw->retired[i]);
+    hnsw->num_retired = 0;
+    for (int i = 0; i < hnsw->num_pending_slots; i++) free_slot(hnsw, hnsw->pending_slots[i]);
+    hnsw->num_pending_slots = 0;
+}
+
+// Arrays of an index from hnsw_open point into the file mapping
+static bool is_mapped(const HNSW* hnsw, const void* data) {
+    const char* bytes = data;
+    return hnsw->mapping && bytes >= (const char*)hnsw->mapping && bytes < (const char*)hnsw->mapping + hnsw->mapping_size;
+}
+
+static void retire(HNSW* hnsw, void* data) {
+    if (data == NULL || is_mapped(hnsw, data)) return;
+    if (hnsw->num_retired == hnsw->retired_capacity) {
+        hnsw->retired_capacity = hnsw->retired_capacity ? hnsw->retired_capacity * 2 : 16;
+        hnsw->retired = realloc(hnsw->retired, hnsw->retired_capacity * sizeof(void*));
+        if (hnsw->retired == NULL) {
+            fprintf(stderr, "Failed to grow HNSW storage\n");
+            exit(1);
+        }
+    }
+    hnsw->retired[hnsw->num_retired++] = data;
+}
+
+// Copies the first count elements of data into a new array of capacity
+// elements and retires the old one
+static void* grow_array(HNSW* hnsw, void* data, size_t count, size_t capacity, size_t size) {
+    void* grown = malloc(capacity * size);
+    if (grown == NULL) {
+        fprintf(stderr, "Failed to grow HNSW storage to %zu elements\n", capacity);
+        exit(1);
+    }
+    if (count > 0) memcpy(grown, data, count * size);
+    retire(hnsw, data);
+    return grown;
+}
+
+static float link_distance(const HNSW* hnsw, int a, int b);
+
+// Resizes an array only writers read, copying it off the mapping if needed
+static void* resize_array(HNSW* hnsw, void* data, size_t count, size_t capacity, size_t size) {
+    if (!is_mapped(hnsw, data)) {
+        data = realloc(data, capacity * size);
+        if (data == NULL) {
+            fprintf(stderr, "Failed to grow HNSW storage to %zu elements\n", capacity);
+            exit(1);
+        }
+        return data;
+    }
+    return grow_array(hnsw, data, count, capacity, size);
+}
+
+// Gives the upper lists of a mapped index heap copies and recomputes the
+// cached distances, which the file does not store, so inserts can update them
+static void copy_mapped_links(HNSW* hnsw, int** upper_links) {
+    for (int id = 0; id < hnsw->num_elements; id++) {
+        int level = hnsw->levels[id];
+        if (level > 0) {
+            int* links = malloc((size_t)level * UPPER_LINKS * sizeof(int));
+            hnsw->upper_distances[id] = malloc((size_t)level * M * sizeof(float));
+            if (links == NULL || hnsw->upper_distances[id] == NULL) {
+                fprintf(stderr, "Failed to allocate upper level links\n");
+                exit(1);
+            }
+            memcpy(links, upper_links[id], (size_t)level * UPPER_LINKS * sizeof(int));
+            upper_links[id] = links;
+        }
+        for (int l = 0; l <= level; l++) {
+            const int* list = l == 0 ? hnsw->level0 + (size_t)id * LEVEL0_LINKS + 1 : upper_links[id] + (l - 1) * UPPER_LINKS;
+            float* distances = node_distances(hnsw, id, l);
+            for (int i = 0; i < list[0]; i++) distances[i] = link_distance(hnsw, id, list[1 + i]);
+        }
+    }
+}
+
+// Doubles every per-node array; the vector arena is moved to keep its
+// alignment. Searches may be running: the new arrays are published with
+// release stores and the old ones freed by free_retired. The first growth of
+// a mapped index moves it to the heap; the mapping stays until free_hnsw.
+static void reserve_hnsw(HNSW* hnsw, int capacity) {
+    if (capacity <= hnsw->capacity) return;
+    free_retired(hnsw);
+    size_t old = hnsw->capacity;
+    bool mapped = is_mapped(hnsw, hnsw->level0);
+    float* vectors = aligned_array((size_t)capacity * hnsw->stride, sizeof(float));
+    if (old > 0) memcpy(vectors, hnsw->vectors, old * hnsw->stride * sizeof(float));
+    retire(hnsw, hnsw->vectors);
+    int* level0 = grow_array(hnsw, hnsw->level0, old * LEVEL0_LINKS, (size_t)capacity * LEVEL0_LINKS, sizeof(int));
+    // New rows start with an even (unlocked) version
+    for (size_t i = old; i < (size_t)capacity; i++) level0[i * LEVEL0_LINKS] = 0;
+    int* levels = grow_array(hnsw, hnsw->levels, old, capacity, sizeof(int));
+    int** upper_links = grow_array(hnsw, hnsw->upper_links, old, capacity, sizeof(int*));
+    int* labels = grow_array(hnsw, hnsw->labels, old, capacity, sizeof(int));
+    unsigned char* deleted = grow_array(hnsw, hnsw->deleted, old, capacity, 1);
+    hnsw->free_slots = resize_array(hnsw, hnsw->free_slots, 0, capacity, sizeof(int));
+    hnsw->pending_slots = resize_array(hnsw, hnsw->pending_slots, 0, capacity, sizeof(int));
+    if (mapped) hnsw->slots = resize_array(hnsw, hnsw->slots, hnsw->next_label, hnsw->slots_capacity, sizeof(int));
+    // Only writers read the cached distances
+    hnsw->level0_distances = grow_array(hnsw, hnsw->level0_distances, mapped ? 0 : old * 2 * M,
+                                        (size_t)capacity * 2 * M, sizeof(float));
+    hnsw->upper_distances = grow_array(hnsw, hnsw->upper_distances, old, capacity, sizeof(float*));
+    if (mapped) copy_mapped_links(hnsw, upper_links);
+
+    __atomic_store_n(&hnsw->vectors, vectors, __ATOMIC_RELEASE);
+    __atomic_store_n(&hnsw->level0, level0, __ATOMIC_RELEASE);
+    __atomic_store_n(&hnsw->levels, levels, __ATOMIC_RELEASE);
+    __atomic_store_n(&hnsw->upper_links, upper_links, __ATOMIC_RELEASE);
+    __atomic_store_n(&hnsw->labels, labels, __ATOMIC_RELEASE);
+    __atomic_store_n(&hnsw->deleted, deleted, __ATOMIC_RELEASE);
+    __atomic_store_n(&hnsw->capacity, capacity, __ATOMIC_RELEASE);
+
+    // Slots compacted before the index was saved are free
+    for (int id = 0; mapped && id < hnsw->num_elements; id++) {
+        if (deleted[id] == HNSW_FREED) free_slot(hnsw, id);
+    }
+}
+
+// Deleting writes to the index, so a mapped one moves to the heap first
+static void make_writable(HNSW* hnsw) {
+    if (is_mapped(hnsw, hnsw->level0)) reserve_hnsw(hnsw, hnsw->capacity ? hnsw->capacity * 2 : HNSW_INITIAL_CAPACITY);
+}
+
+// Gives slot id the next caller-visible id and returns it
+static int assign_label(HNSW* hnsw, int id) {
+    if (hnsw->next_label == hnsw->slots_capacity) {
+        int capacity = hnsw->slots_capacity ? hnsw->slots_capacity * 2 : HNSW_INITIAL_CAPACITY;
+        hnsw->slots = resize_array(hnsw, hnsw->slots, hnsw->next_label, capacity, sizeof(int));
+        hnsw->slots_capacity = capacity;
+    }
+    hnsw->slots[hnsw->next_label] = id;
+    hnsw->labels[id] = hnsw->next_label;
+    return hnsw->next_label++;
+}
+
+static void init_hnsw_fields(HNSW* hnsw, int dimensions) {
+    int row = HNSW_ALIGNMENT / sizeof(float);
     hnsw->num_elements = 0;
+    hnsw->capacity = 0;
     hnsw->max_level = 0;
+    hnsw->entry_point = -1;
     hnsw->dimensions = dimensions;
-    
-    hnsw->level_pqs = malloc(MAX_LEVELS * sizeof(PriorityQueue));
-    if (hnsw->level_pqs == NULL) {
-        fprintf(stderr, "Failed to allocate memory for level priority queues\n");
+    hnsw->stride = (dimensions + row - 1) / row * row;
+    hnsw->vectors = NULL;
+    hnsw->level0 = NULL;
+    hnsw->level0_distances = NULL;
+    hnsw->levels = NULL;
+    hnsw->upper_links = NULL;
+    hnsw->upper_distances = NULL;
+    hnsw->extend_candidates = false;
+    hnsw->keep_pruned = false;
+    init_visited_pool(&hnsw->visited_pool);
+    pthread_mutex_init(&hnsw->entry_lock, NULL);
+    pthread_mutex_init(&hnsw->write_lock, NULL);
+    hnsw->active_searches = 0;
+    hnsw->retired = NULL;
+    hnsw->num_retired = 0;
+    hnsw->retired_capacity = 0;
+    hnsw->mapping = NULL;
+    hnsw->mapping_size = 0;
+    hnsw->labels = NULL;
+    hnsw->deleted = NULL;
+    hnsw->slots = NULL;
+    hnsw->slots_capacity = 0;
+    hnsw->next_label = 0;
+    hnsw->num_deleted = 0;
+    hnsw->free_slots = NULL;
+    hnsw->num_free_slots = 0;
+    hnsw->pending_slots = NULL;
+    hnsw->num_pending_slots = 0;
+}
+
+void init_hnsw(HNSW* hnsw, int dimensions) {
+    init_hnsw_fields(hnsw, dimensions);
+    reserve_hnsw(hnsw, HNSW_INITIAL_CAPACITY);
+}
+
+const float* hnsw_vector(const HNSW* hnsw, int id) {
+    if (id < 0 || id >= hnsw->next_label || hnsw->slots[id] < 0) return NULL;
+    return node_vector(hnsw, hnsw->slots[id]);
+}
+
+static float link_distance(const HNSW* hnsw, int a, int b) {
+    return euclidean_distance(node_vector(hnsw, a), node_vector(hnsw, b), hnsw->dimensions);
+}
+
+int get_random_level() {
+    // r = 0 would give an infinite level
+    float r = ((float)rand() + 1.0f) / ((float)RAND_MAX + 1.0f);
+    int level = (int)(-log(r) * (1.0 / log(4)));  // Change base from 2 to 4 to reduce max level
+    return level < MAX_LEVELS - 1 ? level : MAX_LEVELS - 1;
+}
+
+static int compare_elements(const void* a, const void* b) {
+    float x = ((const PQElement*)a)->distance, y = ((const PQElement*)b)->distance;
+    return (x > y) - (x < y);
+}
+
+static int select_diverse(HNSW* hnsw, const float* base, const PQElement* candidates, int count, int level,
+                          int max_neighbors, bool extend_candidates, bool keep_pruned, PQElement* selected) {
+    // extend_candidates adds the candidates' own neighbors to the pool
+    const PQElement* pool = candidates;
+    PQElement* extended = NULL;
+    if (extend_candidates) {
+        extended = malloc((size_t)count * (1 + max_connections(level)) * sizeof(PQElement));
+        if (extended == NULL) {
+            fprintf(stderr, "Failed to allocate neighbor candidates\n");
+            exit(1);
+        }
+        VisitedList* seen = acquire_visited_list(&hnsw->visited_pool, hnsw->capacity);
+        int extended_count = 0;
+        for (int i = 0; i < count; i++) {
+            if (visit(seen, candidates[i].index)) extended[extended_count++] = candidates[i];
+        }
+        int links[2 * M];
+        for (int i = 0; i < count; i++) {
+            int num_links = read_links(hnsw, candidates[i].index, level, links);
+            for (int j = 0; j < num_links; j++) {
+                if (!visit(seen, links[j])) continue;
+                float dist = euclidean_distance(base, node_vector(hnsw, links[j]), hnsw->dimensions);
+                extended[extended_count++] = (PQElement){ links[j], dist };
+            }
+        }
+        release_visited_list(&hnsw->visited_pool, seen);
+        qsort(extended, extended_count, sizeof(PQElement), compare_elements);
+        pool = extended;
+        count = extended_count;
+    }
+
+    // A candidate closer to an already selected neighbor than to base is
+    // reachable through that neighbor; skipping it spreads the links out
+    int num_selected = 0, num_pruned = 0;
+    int* pruned = malloc((size_t)count * sizeof(int));
+    if (pruned == NULL) {
+        fprintf(stderr, "Failed to allocate neighbor candidates\n");
         exit(1);
     }
-    for (int i = 0; i < MAX_LEVELS; i++) {
-        init_priority_queue(&hnsw->level_pqs[i], PQ_SIZE);  // Use PQ_SIZE instead of ef_construction
+    for (int i = 0; i < count && num_selected < max_neighbors; i++) {
+        const float* vector = node_vector(hnsw, pool[i].index);
+        bool diverse = true;
+        for (int j = 0; j < num_selected && diverse; j++) {
+            diverse = euclidean_distance(vector, node_vector(hnsw, selected[j].index), hnsw->dimensions) >= pool[i].distance;
+        }
+        if (diverse) {
+            selected[num_selected++] = pool[i];
+        } else {
+            pruned[num_pruned++] = i;
+        }
+    }
+    // keep_pruned fills the list back up with the closest pruned candidates
+    for (int i = 0; keep_pruned && i < num_pruned && num_selected < max_neighbors; i++) {
+        selected[num_selected++] = pool[pruned[i]];
     }
+
+    free(pruned);
+    free(extended);
+    return num_selected;
 }
 
-int get_random_level() {
-    float r = ((float)rand() / (float)RAND_MAX);
-    return (int)(-log(r) * (1.0 / log(4)));  // Change base from 2 to 4 to reduce max level
+int select_neighbors(HNSW* hnsw, const float* base, const PQElement* candidates, int count, int level,
+                     int max_neighbors, PQElement* selected) {
+    return select_diverse(hnsw, base, candidates, count, level, max_neighbors, hnsw->extend_candidates,
+                          hnsw->keep_pruned, selected);
 }
 
-// New helper function to select neighbors
-void select_neighbors(HNSW* hnsw, int current, PriorityQueue* candidates, int level, int max_connections) {
-    PriorityQueue temp_queue;
-    init_priority_queue(&temp_queue, candidates->size);
+// Moves greedily to the neighbor closest to query until none is closer (ef = 1)
+static int greedy_closest(HNSW* hnsw, const float* query, int entry_point, float* entry_dist, int level) {
+    int links[2 * M];
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        int num_links = read_links(hnsw, entry_point, level, links);
+        for (int i = 0; i < num_links; i++) {
+            int neighbor = links[i];
+            float dist = euclidean_distance(query, node_vector(hnsw, neighbor), hnsw->dimensions);
+            if (dist < *entry_dist) {
+                *entry_dist = dist;
+                entry_point = neighbor;
+                changed = true;
+            }
+        }
+    }
+    return entry_point;
+}
+
+// Best-first search of one level from entry_point. candidates is a min-heap of
+// nodes still to expand; results a max-heap (distances negated) of the ef
+// closest live nodes seen, so its root is the current worst result. The
+// search stops once the closest unexpanded candidate is farther than that.
+// Tombstones are expanded but never kept as results. Writes the results to
+// nearest in ascending distance and returns how many.
+static int search_layer(HNSW* hnsw, const float* query, int entry_point, float entry_dist, int level, int ef,
+                        VisitedList* visited, PriorityQueue* candidates, PriorityQueue* results, PQElement* nearest) {
+    reset_visited_list(visited);
+    candidates->size = 0;
+    results->size = 0;
+    visit(visited, entry_point);
+    push_priority_queue(candidates, entry_point, entry_dist);
+    if (!is_deleted(hnsw, entry_point)) push_priority_queue(results, entry_point, -entry_dist);
 
     while (!is_priority_queue_empty(candidates)) {
-        PQElement element = pop_priority_queue(candidates);
-        push_priority_queue(&temp_queue, element.index, -element.distance);  // Note the negation here
-    }
-
-    int added = 0;
-    while (!is_priority_queue_empty(&temp_queue) && added < max_connections) {
-        PQElement best = pop_priority_queue(&temp_queue);
-        
-        // Check if connection already exists
-        bool exists = false;
-        for (int i = 0; i < hnsw->nodes[current].num_connections[level]; i++) {
-            if (hnsw->nodes[current].connections[level][i] == best.index) {
-                exists = true;
-                break;
+        PQElement current = pop_priority_queue(candidates);
+        if (results->size > 0 && current.distance > -results->elements[0].distance) break;
+
+        int links[2 * M];
+        int num_links = read_links(hnsw, current.index, level, links);
+        for (int i = 0; i < num_links; i++) {
+            int neighbor = links[i];
+            // Nodes added after the index grew past the list's capacity are skipped
+            if (neighbor >= visited->capacity || !visit(visited, neighbor)) continue;
+            float dist = euclidean_distance(query, node_vector(hnsw, neighbor), hnsw->dimensions);
+            if (results->size < ef || dist < -results->elements[0].distance) {
+                push_priority_queue(candidates, neighbor, dist);
+                if (is_deleted(hnsw, neighbor)) continue;
+                push_priority_queue(results, neighbor, -dist);
+                if (results->size > ef) pop_priority_queue(results);
             }
         }
-        
-        if (!exists) {
-            hnsw->nodes[current].connections[level][hnsw->nodes[current].num_connections[level]++] = best.index;
-            added++;
-        }
     }
 
-    clear_priority_queue(&temp_queue);
+    int count = results->size;
+    for (int i = count - 1; i >= 0; i--) {
+        PQElement worst = pop_priority_queue(results);
+        nearest[i] = (PQElement){ worst.index, -worst.distance };
+    }
+    return count;
+}
+
+// Sets node's list at level to the diverse picks among count candidates, with
+// the node's lock held. Pruning an existing list never needs the extended
+// pool, which would read other nodes' links.
+static void relink(HNSW* hnsw, int node, int level, PQElement* candidates, int count) {
+    PQElement selected[2 * M];
+    int capacity = max_connections(level);
+    qsort(candidates, count, sizeof(PQElement), compare_elements);
+    int num_selected = select_diverse(hnsw, node_vector(hnsw, node), candidates, count, level, capacity, false,
+                                      hnsw->keep_pruned, selected);
+    set_links(hnsw, node, level, selected, num_selected);
 }
 
-// Updated insert function
-void insert(HNSW* hnsw, float* vector) {
-    if (hnsw->num_elements >= MAX_ELEMENTS) {
-        printf("HNSW is full\n");
+// Links id to neighbor at level. A full list is shrunk back to capacity by
+// select_neighbors over its cached distances plus the new edge.
+static void add_back_link(HNSW* hnsw, int neighbor, int id, float distance, int level) {
+    int capacity = max_connections(level);
+    lock_node(hnsw, neighbor);
+    int* links = node_links(hnsw, neighbor, level);
+    if (contains_connection(links + 1, links[0], id)) {
+        unlock_node(hnsw, neighbor);
+        return;
+    }
+    if (links[0] < capacity) {
+        add_link(hnsw, neighbor, level, id, distance);
+        unlock_node(hnsw, neighbor);
         return;
     }
 
-    int new_element_index = hnsw->num_elements;
-    Node* new_element = &hnsw->nodes[new_element_index];
-
-    memcpy(new_element->vector, vector, hnsw->dimensions * sizeof(float));
-    memset(new_element->num_connections, 0, sizeof(new_element->num_connections));
+    PQElement candidates[2 * M + 1];
+    const float* distances = node_distances(hnsw, neighbor, level);
+    for (int j = 0; j < capacity; j++) {
+        candidates[j] = (PQElement){ links[1 + j], distances[j] };
+    }
+    candidates[capacity] = (PQElement){ id, distance };
+    relink(hnsw, neighbor, level, candidates, capacity + 1);
+    unlock_node(hnsw, neighbor);
+}
 
-    new_element->level = get_random_level();
-    if (new_element->level > hnsw->max_level) {
-        hnsw->max_level = new_element->level;
+// Replaces node's links at level to tombstones with picks from its other
+// neighbors and the tombstones' live neighbors
+static void repair_links(HNSW* hnsw, int node, int level) {
+    lock_node(hnsw, node);
+    int* links = node_links(hnsw, node, level);
+    const float* distances = node_distances(hnsw, node, level);
+    int count = 0, stale = 0;
+    PQElement candidates[2 * M * (1 + 2 * M)];
+    for (int j = 0; j < links[0]; j++) {
+        if (is_deleted(hnsw, links[1 + j])) {
+            stale++;
+        } else {
+            candidates[count++] = (PQElement){ links[1 + j], distances[j] };
+        }
+    }
+    for (int j = 0; stale && j < links[0]; j++) {
+        if (!is_deleted(hnsw, links[1 + j])) continue;
+        int second[2 * M];
+        int num_second = read_links(hnsw, links[1 + j], level, second);
+        for (int k = 0; k < num_second; k++) {
+            int candidate = second[k];
+            bool known = candidate == node || is_deleted(hnsw, candidate);
+            for (int c = 0; c < count && !known; c++) known = candidates[c].index == candidate;
+            if (!known) candidates[count++] = (PQElement){ candidate, link_distance(hnsw, node, candidate) };
+        }
     }
+    if (stale) relink(hnsw, node, level, candidates, count);
+    unlock_node(hnsw, node);
+}
 
-    if (hnsw->num_elements == 0) {
-        hnsw->num_elements++;
-        return;
+// Buffers one inserting thread reuses from node to node
+typedef struct {
+    VisitedList* visited;
+    PriorityQueue candidates;
+    PriorityQueue results;
+    PQElement* nearest;
+} InsertScratch;
+
+static void init_insert_scratch(HNSW* hnsw, InsertScratch* scratch) {
+    scratch->visited = acquire_visited_list(&hnsw->visited_pool, hnsw->capacity);
+    init_priority_queue(&scratch->candidates, ef_construction);
+    init_priority_queue(&scratch->results, ef_construction + 1);
+    scratch->nearest = malloc((ef_construction + 1) * sizeof(PQElement));
+    if (scratch->nearest == NULL) {
+        fprintf(stderr, "Failed to allocate HNSW insert buffer\n");
+        exit(1);
     }
+}
 
-    int entry_point = 0;  // Start with the first element as entry point
+static void free_insert_scratch(HNSW* hnsw, InsertScratch* scratch) {
+    free(scratch->nearest);
+    free(scratch->results.elements);
+    free(scratch->candidates.elements);
+    release_visited_list(&hnsw->visited_pool, scratch->visited);
+}
 
-    for (int current_level = hnsw->max_level; current_level >= 0; current_level--) {
-        PriorityQueue candidates;
-        init_priority_queue(&candidates, ef_construction);
+// Stores vector as element id with its level and empty adjacency lists
+static void prepare_node(HNSW* hnsw, int id, const float* vector, int level) {
+    float* new_vector = node_vector(hnsw, id);
+    memcpy(new_vector, vector, hnsw->dimensions * sizeof(float));
+    memset(new_vector + hnsw->dimensions, 0, (hnsw->stride - hnsw->dimensions) * sizeof(float));
 
-        float entry_dist = euclidean_distance(vector, hnsw->nodes[entry_point].vector, hnsw->dimensions);
-        push_priority_queue(&candidates, entry_point, entry_dist);
+    hnsw->levels[id] = level;
+    hnsw->level0[(size_t)id * LEVEL0_LINKS + 1] = 0;
+    __atomic_store_n(&hnsw->deleted[id], HNSW_LIVE, __ATOMIC_RELAXED);
+    hnsw->upper_links[id] = NULL;
+    hnsw->upper_distances[id] = NULL;
+    if (level > 0) {
+        hnsw->upper_links[id] = calloc((size_t)level * UPPER_LINKS, sizeof(int));
+        hnsw->upper_distances[id] = malloc((size_t)level * M * sizeof(float));
+        if (hnsw->upper_links[id] == NULL || hnsw->upper_distances[id] == NULL) {
+            fprintf(stderr, "Failed to allocate upper level links\n");
+            exit(1);
+        }
+    }
+}
 
-        // Search for ef_construction nearest neighbors
-        PriorityQueue visited;
-        init_priority_queue(&visited, ef_construction);
+// Links a prepared node into the graph. Safe to run for different nodes at
+// once: lists are updated under their node's lock, and a node that raises
+// max_level holds entry_lock until it has become the entry point. The node's
+// own lists are complete before any back link makes it reachable.
+static void link_node(HNSW* hnsw, int id, InsertScratch* scratch) {
+    const float* vector = node_vector(hnsw, id);
+    int new_level = hnsw->levels[id];
 
-        while (!is_priority_queue_empty(&candidates)) {
-            PQElement current = pop_priority_queue(&candidates);
-            push_priority_queue(&visited, current.index, current.distance);
+    pthread_mutex_lock(&hnsw->entry_lock);
+    int entry_point = hnsw->entry_point;
+    int max_level = hnsw->max_level;
+    bool promote = entry_point < 0 || new_level > max_level;
+    if (!promote) pthread_mutex_unlock(&hnsw->entry_lock);
 
-            if (current.distance > visited.elements[visited.size - 1].distance && visited.size >= ef_construction) break;
+    if (entry_point >= 0) {
+        // Descend greedily to the new node's top level, then gather ef_construction
+        // candidates per level and link to up to M of them picked by select_neighbors
+        float entry_dist = euclidean_distance(vector, node_vector(hnsw, entry_point), hnsw->dimensions);
+        for (int level = max_level; level > new_level; level--) {
+            entry_point = greedy_closest(hnsw, vector, entry_point, &entry_dist, level);
+        }
 
-            for (int i = 0; i < hnsw->nodes[current.index].num_connections[current_level]; i++) {
-                int neighbor = hnsw->nodes[current.index].connections[current_level][i];
-                if (!contains_priority_queue(&visited, neighbor)) {
-                    float dist = euclidean_distance(vector, hnsw->nodes[neighbor].vector, hnsw->dimensions);
-                    if (visited.size < ef_construction || dist < visited.elements[visited.size - 1].distance) {
-                        push_priority_queue(&candidates, neighbor, dist);
-                    }
-                }
+        PQElement selected[MAX_LEVELS][M];
+        int num_selected[MAX_LEVELS];
+        int top = new_level < max_level ? new_level : max_level;
+        for (int level = top; level >= 0; level--) {
+            int count = search_layer(hnsw, vector, entry_point, entry_dist, level, ef_construction, scratch->visited,
+                                     &scratch->candidates, &scratch->results, scratch->nearest);
+            num_selected[level] = select_neighbors(hnsw, vector, scratch->nearest, count, level, M, selected[level]);
+            if (count > 0) {
+                entry_point = scratch->nearest[0].index;
+                entry_dist = scratch->nearest[0].distance;
             }
         }
 
-        // Connect the new element to its nearest neighbors at this level
-        if (current_level <= new_element->level) {
-            while (!is_priority_queue_empty(&visited) && new_element->num_connections[current_level] < M) {
-                PQElement neighbor = pop_priority_queue(&visited);
-                
-                if (!contains_connection(new_element->connections[current_level], new_element->num_connections[current_level], neighbor.index)) {
-                    new_element->connections[current_level][new_element->num_connections[current_level]++] = neighbor.index;
-                
-                    // Add bidirectional connection
-                    if (hnsw->nodes[neighbor.index].num_connections[current_level] < M) {
-                        if (!contains_connection(hnsw->nodes[neighbor.index].connections[current_level], 
-                                                 hnsw->nodes[neighbor.index].num_connections[current_level], 
-                                                 new_element_index)) {
-                            hnsw->nodes[neighbor.index].connections[current_level][hnsw->nodes[neighbor.index].num_connections[current_level]++] = new_element_index;
-                        }
-                    } else {
-                        // Replace the farthest connection if the new element is closer
-                        int farthest_index = -1;
-                        float max_dist = -1;
-                        for (int j = 0; j < M; j++) {
-                            int existing = hnsw->nodes[neighbor.index].connections[current_level][j];
-                            float existing_dist = euclidean_distance(hnsw->nodes[neighbor.index].vector, hnsw->nodes[existing].vector, hnsw->dimensions);
-                            if (existing_dist > max_dist) {
-                                max_dist = existing_dist;
-                                farthest_index = j;
-                            }
-                        }
-                        if (neighbor.distance < max_dist && !contains_connection(hnsw->nodes[neighbor.index].connections[current_level], M, new_element_index)) {
-                            hnsw->nodes[neighbor.index].connections[current_level][farthest_index] = new_element_index;
-                        }
-                    }
-                }
+        lock_node(hnsw, id);
+        for (int level = top; level >= 0; level--) {
+            set_links(hnsw, id, level, selected[level], num_selected[level]);
+        }
+        unlock_node(hnsw, id);
+        for (int level = top; level >= 0; level--) {
+            for (int i = 0; i < num_selected[level]; i++) {
+                add_back_link(hnsw, selected[level][i].index, id, selected[level][i].distance, level);
             }
         }
+    }
+
+    if (promote) {
+        // Searches read only entry_point and take its level as the top
+        hnsw->max_level = new_level;
+        __atomic_store_n(&hnsw->entry_point, id, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&hnsw->entry_lock);
+    }
+}
+
+int insert(HNSW* hnsw, float* vector) {
+    pthread_mutex_lock(&hnsw->write_lock);
+    int id;
+    if (hnsw->num_free_slots > 0) {
+        id = hnsw->free_slots[--hnsw->num_free_slots];
+    } else {
+        if (hnsw->num_elements == hnsw->capacity) {
+            reserve_hnsw(hnsw, hnsw->capacity ? hnsw->capacity * 2 : HNSW_INITIAL_CAPACITY);
+        }
+        id = hnsw->num_elements;
+    }
+
+    prepare_node(hnsw, id, vector, get_random_level());
+    int label = assign_label(hnsw, id);
+    InsertScratch scratch;
+    init_insert_scratch(hnsw, &scratch);
+    link_node(hnsw, id, &scratch);
+    free_insert_scratch(hnsw, &scratch);
+    if (id == hnsw->num_elements) __atomic_store_n(&hnsw->num_elements, id + 1, __ATOMIC_RELEASE);
+    free_retired(hnsw);
+    pthread_mutex_unlock(&hnsw->write_lock);
+    return label;
+}
+
+// Moves the entry point, which was just deleted, to the live node on the
+// highest level; -1 if none is left. A scan, but only one delete in
+// num_elements hits the entry point.
+static void replace_entry_point(HNSW* hnsw) {
+    int replacement = -1;
+    for (int i = 0; i < hnsw->num_elements; i++) {
+        if (!is_deleted(hnsw, i) && (replacement < 0 || hnsw->levels[i] > hnsw->levels[replacement])) replacement = i;
+    }
+    hnsw->max_level = replacement < 0 ? 0 : hnsw->levels[replacement];
+    __atomic_store_n(&hnsw->entry_point, replacement, __ATOMIC_RELEASE);
+}
+
+static void compact_locked(HNSW* hnsw) {
+    if (hnsw->num_deleted == 0) return;
+    // After this no live node links to a tombstone, so searches that start
+    // later cannot reach one; running searches may, until free_retired
+    for (int i = 0; i < hnsw->num_elements; i++) {
+        if (is_deleted(hnsw, i)) continue;
+        for (int level = 0; level <= hnsw->levels[i]; level++) repair_links(hnsw, i, level);
+    }
+    for (int i = 0; i < hnsw->num_elements; i++) {
+        if (hnsw->deleted[i] != HNSW_TOMBSTONE) continue;
+        __atomic_store_n(&hnsw->deleted[i], HNSW_FREED, __ATOMIC_RELAXED);
+        hnsw->pending_slots[hnsw->num_pending_slots++] = i;
+    }
+    hnsw->num_deleted = 0;
+    free_retired(hnsw);
+}
+
+bool hnsw_delete(HNSW* hnsw, int label) {
+    pthread_mutex_lock(&hnsw->write_lock);
+    if (label < 0 || label >= hnsw->next_label || hnsw->slots[label] < 0) {
+        pthread_mutex_unlock(&hnsw->write_lock);
+        return false;
+    }
+    make_writable(hnsw);
+    int id = hnsw->slots[label];
+    hnsw->slots[label] = -1;
+    __atomic_store_n(&hnsw->deleted[id], HNSW_TOMBSTONE, __ATOMIC_RELAXED);
+    hnsw->num_deleted++;
 
-        // Update entry point for the next level
-        if (!is_priority_queue_empty(&visited)) {
-            entry_point = visited.elements[0].index;  // The closest element
+    // The neighbors linked to id reconnect through id's other neighbors
+    for (int level = hnsw->levels[id]; level >= 0; level--) {
+        int neighbors[2 * M];
+        int count = read_links(hnsw, id, level, neighbors);
+        for (int j = 0; j < count; j++) {
+            if (!is_deleted(hnsw, neighbors[j])) repair_links(hnsw, neighbors[j], level);
         }
+    }
+    pthread_mutex_lock(&hnsw->entry_lock);
+    if (hnsw->entry_point == id) replace_entry_point(hnsw);
+    pthread_mutex_unlock(&hnsw->entry_lock);
+
+    int live = hnsw->num_elements - hnsw->num_deleted - hnsw->num_free_slots - hnsw->num_pending_slots;
+    if (hnsw->num_deleted > HNSW_COMPACT_FRACTION * live) compact_locked(hnsw);
+    pthread_mutex_unlock(&hnsw->write_lock);
+    return true;
+}
+
+void compact_hnsw(HNSW* hnsw) {
+    pthread_mutex_lock(&hnsw->write_lock);
+    make_writable(hnsw);
+    compact_locked(hnsw);
+    pthread_mutex_unlock(&hnsw->write_lock);
+}
+
+typedef struct {
+    HNSW* hnsw;
+    int first;  // id of the first new node
+    int count;
+    int next;   // claimed by workers with an atomic increment
+} BuildJob;
+
+static void* build_worker(void* arg) {
+    BuildJob* job = arg;
+    InsertScratch scratch;
+    init_insert_scratch(job->hnsw, &scratch);
+    for (;;) {
+        int i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (i >= job->count) break;
+        link_node(job->hnsw, job->first + i, &scratch);
+    }
+    free_insert_scratch(job->hnsw, &scratch);
+    return NULL;
+}
+
+void build_hnsw_parallel(HNSW* hnsw, const float* vectors, int n, int threads) {
+    if (n <= 0) return;
+    if (threads <= 0) threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads > n) threads = n;
+    pthread_mutex_lock(&hnsw->write_lock);
+
+    // Storage must not move while workers hold pointers into it
+    int capacity = hnsw->capacity ? hnsw->capacity : HNSW_INITIAL_CAPACITY;
+    while (capacity < hnsw->num_elements + n) capacity *= 2;
+    reserve_hnsw(hnsw, capacity);
 
-        clear_priority_queue(&visited);
-        clear_priority_queue(&candidates);
+    // Levels are drawn up front so rand() stays on this thread
+    BuildJob job = { hnsw, hnsw->num_elements, n, 0 };
+    for (int i = 0; i < n; i++) {
+        prepare_node(hnsw, job.first + i, vectors + (size_t)i * hnsw->dimensions, get_random_level());
+        assign_label(hnsw, job.first + i);
     }
 
-    hnsw->num_elements++;
+    pthread_t* workers = malloc((size_t)threads * sizeof(pthread_t));
+    int started = 0;
+    for (int t = 1; workers && t < threads; t++) {
+        if (pthread_create(&workers[started], NULL, build_worker, &job) != 0) break;
+        started++;
+    }
+    build_worker(&job);
+    for (int t = 0; t < started; t++) {
+        pthread_join(workers[t], NULL);
+    }
+    free(workers);
+    __atomic_store_n(&hnsw->num_elements, job.first + n, __ATOMIC_RELEASE);
+    free_retired(hnsw);
+    pthread_mutex_unlock(&hnsw->write_lock);
 }
 
 void print_all_nodes(HNSW* hnsw) {
     printf("HNSW Nodes:\n");
     for (int i = 0; i < hnsw->num_elements; i++) {
-        Node* node = &hnsw->nodes[i];
-        printf("Node %d (Level %d):\n", i, node->level);
-        
+        const float* vector = node_vector(hnsw, i);
+        printf("Node %d (Level %d):\n", i, hnsw->levels[i]);
+
         printf("  Vector: [");
         for (int j = 0; j < hnsw->dimensions; j++) {
-            printf("%.2f", node->vector[j]);
+            printf("%.2f", vector[j]);
             if (j < hnsw->dimensions - 1) printf(", ");
         }
         printf("]\n");
-        
+
         printf("  Connections:\n");
-        for (int level = 0; level <= node->level; level++) {
+        for (int level = 0; level <= hnsw->levels[i]; level++) {
+            int* links = node_links(hnsw, i, level);
             printf("    Level %d: [", level);
-            for (int j = 0; j < node->num_connections[level]; j++) {
-                printf("%d", node->connections[level][j]);
-                if (j < node->num_connections[level] - 1) printf(", ");
+            for (int j = 0; j < links[0]; j++) {
+                printf("%d", links[1 + j]);
+                if (j < links[0] - 1) printf(", ");
             }
             printf("]\n");
         }
@@ -228,152 +830,416 @@ void print_all_nodes(HNSW* hnsw) {
     }
 }
 
-// Declare search_layer right before search function
-void search_layer(HNSW* hnsw, float* query, int* ep, int level, PriorityQueue* candidates);
+int hnsw_search(HNSW* hnsw, const float* query, int k, int ef, int* result, float* distances) {
+    if (k <= 0) return 0;
+    if (ef < k) ef = k;
+    // Keeps storage replaced by a concurrent insert alive until this returns
+    __atomic_fetch_add(&hnsw->active_searches, 1, __ATOMIC_SEQ_CST);
+    int entry_point = __atomic_load_n(&hnsw->entry_point, __ATOMIC_ACQUIRE);
+    if (entry_point < 0) {
+        __atomic_fetch_sub(&hnsw->active_searches, 1, __ATOMIC_RELEASE);
+        return 0;
+    }
 
-int search(HNSW* hnsw, float* query, int k, int* result, float* distances) {
-    PriorityQueue candidates;
-    init_priority_queue(&candidates, ef_search);
+    float entry_dist = euclidean_distance(query, node_vector(hnsw, entry_point), hnsw->dimensions);
+    for (int level = node_level(hnsw, entry_point); level > 0; level--) {
+        entry_point = greedy_closest(hnsw, query, entry_point, &entry_dist, level);
+    }
 
-    // printf("Starting search for query: [");
-    // for (int i = 0; i < hnsw->dimensions; i++) {
-    //     printf("%.2f", query[i]);
-    //     if (i < hnsw->dimensions - 1) printf(", ");
-    // }
-    // printf("]\n");
-    // printf("Number of elements in HNSW: %d\n", hnsw->num_elements);
+    VisitedList* visited = acquire_visited_list(&hnsw->visited_pool, __atomic_load_n(&hnsw->capacity, __ATOMIC_ACQUIRE));
+    PriorityQueue candidates, results;
+    init_priority_queue(&candidates, ef);
+    init_priority_queue(&results, ef + 1);
+    PQElement* nearest = malloc((ef + 1) * sizeof(PQElement));
+    if (nearest == NULL) {
+        fprintf(stderr, "Failed to allocate HNSW search buffer\n");
+        exit(1);
+    }
 
-    int ep = 0;  // entry point
-    for (int level = hnsw->max_level; level >= 0; level--) {
-        // printf("Searching level %d\n", level);
-        search_layer(hnsw, query, &ep, level, &candidates);
+    int count = search_layer(hnsw, query, entry_point, entry_dist, 0, ef, visited, &candidates, &results, nearest);
+    int num_results = count < k ? count : k;
+    const int* labels = __atomic_load_n(&hnsw->labels, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < num_results; i++) {
+        result[i] = labels[nearest[i].index];
+        distances[i] = nearest[i].distance;
     }
 
-    // printf("Candidates after search: %d\n", candidates.size);
+    free(nearest);
+    free(results.elements);
+    free(candidates.elements);
+    release_visited_list(&hnsw->visited_pool, visited);
+    __atomic_fetch_sub(&hnsw->active_searches, 1, __ATOMIC_RELEASE);
+    return num_results;
+}
 
-    // Get top k results
-    PriorityQueue results;
-    init_priority_queue(&results, k);
-
-    while (!is_priority_queue_empty(&candidates)) {
-        PQElement element = pop_priority_queue(&candidates);
-        if (results.size < k) {
-            push_priority_queue(&results, element.index, element.distance);
-        } else if (element.distance < results.elements[0].distance) {
-            pop_priority_queue(&results);
-            push_priority_queue(&results, element.index, element.distance);
-        }
+int search(HNSW* hnsw, float* query, int k, int* result, float* distances) {
+    return hnsw_search(hnsw, query, k, HNSW_DEFAULT_EF, result, distances);
+}
+
+void print_hnsw_stats(HNSW* hnsw) {
+    int upper_nodes = 0;
+    for (int i = 0; i < hnsw->num_elements; i++) {
+        if (hnsw->levels[i] > 0) upper_nodes++;
     }
+    size_t bytes = hnsw_memory_bytes(hnsw);
+    printf("HNSW Stats:\n");
+    printf("Number of elements: %d (capacity %d)\n", hnsw->num_elements, hnsw->capacity);
+    printf("Maximum level: %d (entry point %d)\n", hnsw->max_level, hnsw->entry_point);
+    printf("Dimensions: %d\n", hnsw->dimensions);
+    printf("Nodes above level 0: %d\n", upper_nodes);
+    printf("Deleted: %d tombstones, %d free slots\n", hnsw->num_deleted, hnsw->num_free_slots + hnsw->num_pending_slots);
+    printf("Memory: %zu bytes (%.1f per element)\n", bytes, hnsw->num_elements ? (double)bytes / hnsw->num_elements : 0.0);
+}
 
-    int num_results = results.size;
-    for (int i = 0; i < num_results; i++) {
-        PQElement element = pop_priority_queue(&results);
-        result[i] = element.index;
-        distances[i] = element.distance;
-        // printf("Result %d: index %d, distance %.4f\n", i, result[i], distances[i]);
+size_t hnsw_memory_bytes(const HNSW* hnsw) {
+    size_t bytes = (size_t)hnsw->capacity * (hnsw->stride * sizeof(float) + LEVEL0_LINKS * sizeof(int) +
+                                             2 * M * sizeof(float) + 4 * sizeof(int) + 1 + 2 * sizeof(void*)) +
+                   (size_t)hnsw->slots_capacity * sizeof(int);
+    for (int i = 0; i < hnsw->num_elements; i++) {
+        bytes += (size_t)hnsw->levels[i] * (UPPER_LINKS * sizeof(int) + M * sizeof(float));
     }
+    return bytes;
+}
 
-    clear_priority_queue(&results);
-    clear_priority_queue(&candidates);
-    return num_results;
+// Add a function to free the HNSW structure
+void free_hnsw(HNSW* hnsw) {
+    for (int i = 0; i < hnsw->num_elements; i++) {
+        if (!is_mapped(hnsw, hnsw->upper_links[i])) free(hnsw->upper_links[i]);
+        free(hnsw->upper_distances[i]);
+    }
+    if (!is_mapped(hnsw, hnsw->vectors)) free(hnsw->vectors);
+    if (!is_mapped(hnsw, hnsw->level0)) free(hnsw->level0);
+    if (!is_mapped(hnsw, hnsw->levels)) free(hnsw->levels);
+    if (!is_mapped(hnsw, hnsw->labels)) free(hnsw->labels);
+    if (!is_mapped(hnsw, hnsw->deleted)) free(hnsw->deleted);
+    if (!is_mapped(hnsw, hnsw->slots)) free(hnsw->slots);
+    free(hnsw->free_slots);
+    free(hnsw->pending_slots);
+    free(hnsw->level0_distances);
+    free(hnsw->upper_links);
+    free(hnsw->upper_distances);
+    if (hnsw->mapping) munmap(hnsw->mapping, hnsw->mapping_size);
+    for (int i = 0; i < hnsw->num_retired; i++) free(hnsw->retired[i]);
+    free(hnsw->retired);
+    free_visited_pool(&hnsw->visited_pool);
+    pthread_mutex_destroy(&hnsw->entry_lock);
+    pthread_mutex_destroy(&hnsw->write_lock);
+    free(hnsw);
 }
 
-void search_layer(HNSW* hnsw, float* query, int* ep, int level, PriorityQueue* candidates) {
-    PriorityQueue visited;
-    init_priority_queue(&visited, ef_search);
+// Index file, written by hnsw_save and mapped read-only by hnsw_open:
+//
+// [HNSWFileHeader][vectors][level-0 rows][levels][upper lists][labels][slot states][slots]
+//
+// Every section starts on a HNSW_FILE_ALIGNMENT boundary and is laid out
+// exactly as in memory: num_elements x stride floats, num_elements level-0
+// rows of (2 + 2M) ints, one top level per slot, the upper lists of every
+// slot above level 0 in slot order, levels[i] x (1 + M) ints each, then the
+// label and state byte of each slot and the slot of each of the next_label
+// ids. The cached link distances are not stored. Integers are in host byte
+// order. Version 1 files, from before deletion, had no label or state sections.
+#define HNSW_FILE_MAGIC "HNSW"
+#define HNSW_FILE_VERSION 2
+#define HNSW_FILE_ALIGNMENT 4096
 
-    // Add a boolean array to keep track of visited nodes
-    bool* node_visited = calloc(hnsw->num_elements, sizeof(bool));
-    if (node_visited == NULL) {
-        fprintf(stderr, "Failed to allocate memory for node_visited array\n");
-        exit(1);
+enum { SECTION_VECTORS, SECTION_LEVEL0, SECTION_LEVELS, SECTION_UPPER, SECTION_LABELS, SECTION_DELETED, SECTION_SLOTS,
+       NUM_SECTIONS };
+
+typedef struct {
+    uint64_t offset;
+    uint64_t size;      // bytes, without the padding to the next section
+    uint64_t checksum;  // of those bytes
+} HNSWFileSection;
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t dimensions;
+    uint32_t stride;
+    uint32_t max_connections;  // M the index was built with
+    uint32_t num_elements;
+    int32_t entry_point;
+    uint32_t max_level;
+    uint32_t next_label;
+    uint32_t num_deleted;
+    uint64_t file_size;
+    HNSWFileSection sections[NUM_SECTIONS];
+    uint64_t header_checksum;  // of this header with header_checksum set to 0
+} HNSWFileHeader;
+
+// FNV-1a over 64-bit words with a MurmurHash3 finish; any single changed word changes it
+static uint64_t file_checksum(const void* data, size_t size) {
+    const unsigned char* bytes = data;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, bytes + i, 8);
+        hash = (hash ^ word) * 0x100000001b3ULL;
     }
+    for (; i < size; i++) hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+    hash ^= size;
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    return hash;
+}
 
-    float dist = euclidean_distance(query, hnsw->nodes[*ep].vector, hnsw->dimensions);
-    push_priority_queue(candidates, *ep, dist);
-    push_priority_queue(&visited, *ep, dist);
-    node_visited[*ep] = true;
+static uint64_t header_checksum(HNSWFileHeader header) {
+    header.header_checksum = 0;
+    return file_checksum(&header, sizeof(header));
+}
 
-    int iterations = 0;
-    int max_iterations = hnsw->num_elements * 2;  // Set a reasonable upper limit
+static uint64_t align_offset(uint64_t offset) {
+    return (offset + HNSW_FILE_ALIGNMENT - 1) / HNSW_FILE_ALIGNMENT * HNSW_FILE_ALIGNMENT;
+}
 
-    while (!is_priority_queue_empty(candidates) && iterations < max_iterations) {
-        iterations++;
-        PQElement current = pop_priority_queue(candidates);
-        
-        if (current.distance > visited.elements[visited.size - 1].distance && visited.size >= ef_search) {
-            break;
-        }
+// Writes bytes at offset and zero padding up to the next aligned offset, which it returns
+static bool write_padded(FILE* file, const void* data, size_t size, uint64_t offset) {
+    static const char zeros[HNSW_FILE_ALIGNMENT];
+    size_t padding = align_offset(offset + size) - (offset + size);
+    return (size == 0 || fwrite(data, 1, size, file) == size) && (padding == 0 || fwrite(zeros, 1, padding, file) == padding);
+}
 
-        // printf("Iteration %d: Exploring node %d at level %d (distance: %.4f)\n", iterations, current.index, level, current.distance);
-
-        int neighbors_explored = 0;
-        for (int i = 0; i < hnsw->nodes[current.index].num_connections[level]; i++) {
-            int neighbor = hnsw->nodes[current.index].connections[level][i];
-            if (!node_visited[neighbor]) {
-                node_visited[neighbor] = true;
-                dist = euclidean_distance(query, hnsw->nodes[neighbor].vector, hnsw->dimensions);
-                if (visited.size < ef_search || dist < visited.elements[visited.size - 1].distance) {
-                    push_priority_queue(candidates, neighbor, dist);
-                    push_priority_queue(&visited, neighbor, dist);
-                    if (visited.size > ef_search) {
-                        pop_priority_queue(&visited);
-                    }
-                    neighbors_explored++;
-                }
-            }
-        }
-        // printf("  Explored %d neighbors\n", neighbors_explored);
+int hnsw_save(HNSW* hnsw, const char* path) {
+    // Inserts wait; searches keep running
+    pthread_mutex_lock(&hnsw->write_lock);
+    int n = hnsw->num_elements;
+    size_t upper_ints = 0;
+    for (int i = 0; i < n; i++) upper_ints += (size_t)hnsw->levels[i] * UPPER_LINKS;
+    int* upper = malloc((upper_ints ? upper_ints : 1) * sizeof(int));
+    if (upper == NULL) {
+        fprintf(stderr, "Failed to allocate HNSW upper levels for %s\n", path);
+        pthread_mutex_unlock(&hnsw->write_lock);
+        return -1;
+    }
+    for (size_t i = 0, at = 0; i < (size_t)n; i++) {
+        size_t count = (size_t)hnsw->levels[i] * UPPER_LINKS;
+        if (count) memcpy(upper + at, hnsw->upper_links[i], count * sizeof(int));
+        at += count;
+    }
 
-        // Early exit condition
-        if (iterations > 100 && neighbors_explored == 0) {
-            // printf("Early exit: No new neighbors found after %d iterations\n", iterations);
-            break;
+    const void* data[NUM_SECTIONS] = { hnsw->vectors, hnsw->level0, hnsw->levels, upper, hnsw->labels, hnsw->deleted,
+                                       hnsw->slots };
+    size_t sizes[NUM_SECTIONS] = {
+        (size_t)n * hnsw->stride * sizeof(float), (size_t)n * LEVEL0_LINKS * sizeof(int), (size_t)n * sizeof(int),
+        upper_ints * sizeof(int), (size_t)n * sizeof(int), (size_t)n, (size_t)hnsw->next_label * sizeof(int)
+    };
+    HNSWFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, HNSW_FILE_MAGIC, 4);
+    header.version = HNSW_FILE_VERSION;
+    header.dimensions = hnsw->dimensions;
+    header.stride = hnsw->stride;
+    header.max_connections = M;
+    header.num_elements = n;
+    header.entry_point = hnsw->entry_point;
+    header.max_level = hnsw->max_level;
+    header.next_label = hnsw->next_label;
+    header.num_deleted = hnsw->num_deleted;
+    uint64_t offset = align_offset(sizeof(header));
+    for (int s = 0; s < NUM_SECTIONS; s++) {
+        header.sections[s] = (HNSWFileSection){ offset, sizes[s], file_checksum(data[s], sizes[s]) };
+        offset = align_offset(offset + sizes[s]);
+    }
+    header.file_size = offset;
+    header.header_checksum = header_checksum(header);
+
+    // Written beside path and renamed over it, so processes that have the
+    // old file mapped keep a consistent copy
+    char tmp_path[4096];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE* file = fopen(tmp_path, "wb");
+    bool ok = file != NULL && write_padded(file, &header, sizeof(header), 0);
+    for (int s = 0; ok && s < NUM_SECTIONS; s++) {
+        ok = write_padded(file, data[s], sizes[s], header.sections[s].offset);
+    }
+    if (file && fclose(file) != 0) ok = false;
+    ok = ok && rename(tmp_path, path) == 0;
+    if (!ok) {
+        fprintf(stderr, "Failed to write HNSW index %s\n", path);
+        if (file) remove(tmp_path);
+    }
+    free(upper);
+    pthread_mutex_unlock(&hnsw->write_lock);
+    return ok ? 0 : -1;
+}
+
+// Checks the header describes an index this build can search: matching M
+// and row stride, sections in order inside the file and of the right size
+static bool check_file_header(const HNSWFileHeader* header, size_t size, const char* path) {
+    if (memcmp(header->magic, HNSW_FILE_MAGIC, 4) != 0) {
+        fprintf(stderr, "%s is not an HNSW index file\n", path);
+        return false;
+    }
+    if (header->version != HNSW_FILE_VERSION) {
+        fprintf(stderr, "Unsupported HNSW index file version %u (expected %d)\n", header->version, HNSW_FILE_VERSION);
+        return false;
+    }
+    if (header->header_checksum != header_checksum(*header) || header->file_size != size) {
+        fprintf(stderr, "HNSW index file %s is truncated or corrupt\n", path);
+        return false;
+    }
+    int row = HNSW_ALIGNMENT / sizeof(float);
+    if (header->max_connections != M || header->dimensions == 0 ||
+        header->stride != (header->dimensions + row - 1) / row * row) {
+        fprintf(stderr, "HNSW index file %s was built with M = %u, this build uses M = %d\n", path,
+                header->max_connections, M);
+        return false;
+    }
+    uint64_t n = header->num_elements;
+    uint64_t expected[NUM_SECTIONS] = { n * header->stride * sizeof(float), n * LEVEL0_LINKS * sizeof(int), n * sizeof(int), 0,
+                                        n * sizeof(int), n, (uint64_t)header->next_label * sizeof(int) };
+    uint64_t end = align_offset(sizeof(HNSWFileHeader));
+    for (int s = 0; s < NUM_SECTIONS; s++) {
+        const HNSWFileSection* section = &header->sections[s];
+        if (section->offset != end || section->offset > size || section->size > size - section->offset ||
+            (s != SECTION_UPPER && section->size != expected[s])) {
+            fprintf(stderr, "HNSW index file %s has a bad section table\n", path);
+            return false;
         }
+        end = align_offset(section->offset + section->size);
+    }
+    if (header->max_level >= MAX_LEVELS || header->entry_point < (n ? 0 : -1) || header->entry_point >= (int64_t)n) {
+        fprintf(stderr, "HNSW index file %s has a bad entry point\n", path);
+        return false;
     }
+    return true;
+}
 
-    if (iterations >= max_iterations) {
-        printf("Warning: Search layer reached maximum iterations (%d) at level %d\n", max_iterations, level);
+HNSW* hnsw_open(const char* path) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(HNSWFileHeader)) {
+        fprintf(stderr, "Failed to open HNSW index %s\n", path);
+        if (fd >= 0) close(fd);
+        return NULL;
+    }
+    size_t size = (size_t)st.st_size;
+    // Searches read the file in place, so every process that opens it
+    // shares one page cache copy and pages come in on first use
+    void* mapping = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        fprintf(stderr, "Failed to map HNSW index %s\n", path);
+        return NULL;
+    }
+    const HNSWFileHeader* header = mapping;
+    if (!check_file_header(header, size, path)) {
+        munmap(mapping, size);
+        return NULL;
     }
 
-    clear_priority_queue(candidates);
-    while (!is_priority_queue_empty(&visited)) {
-        push_priority_queue(candidates, visited.elements[0].index, visited.elements[0].distance);
-        pop_priority_queue(&visited);
+    HNSW* hnsw = malloc(sizeof(HNSW));
+    int n = header->num_elements;
+    int** upper_links = malloc((n ? n : 1) * sizeof(int*));
+    float** upper_distances = calloc(n ? n : 1, sizeof(float*));
+    if (hnsw == NULL || upper_links == NULL || upper_distances == NULL) {
+        fprintf(stderr, "Failed to allocate HNSW index for %s\n", path);
+        exit(1);
     }
-    clear_priority_queue(&visited);
+    init_hnsw_fields(hnsw, header->dimensions);
+    hnsw->mapping = mapping;
+    hnsw->mapping_size = size;
+    char* base = mapping;
+    hnsw->vectors = (float*)(base + header->sections[SECTION_VECTORS].offset);
+    hnsw->level0 = (int*)(base + header->sections[SECTION_LEVEL0].offset);
+    hnsw->levels = (int*)(base + header->sections[SECTION_LEVELS].offset);
+    hnsw->upper_links = upper_links;
+    hnsw->upper_distances = upper_distances;
+    hnsw->labels = (int*)(base + header->sections[SECTION_LABELS].offset);
+    hnsw->deleted = (unsigned char*)(base + header->sections[SECTION_DELETED].offset);
+    hnsw->slots = (int*)(base + header->sections[SECTION_SLOTS].offset);
 
-    *ep = candidates->elements[0].index;  // Update to the closest point
-    // printf("Finished search_layer at level %d after %d iterations. New entry point: %d\n", level, iterations, *ep);
+    // The only per-node work: pointers to each node's upper lists
+    int* upper = (int*)(base + header->sections[SECTION_UPPER].offset);
+    size_t upper_ints = header->sections[SECTION_UPPER].size / sizeof(int), at = 0;
+    bool ok = true;
+    for (int i = 0; i < n && ok; i++) {
+        int level = hnsw->levels[i];
+        ok = level >= 0 && level <= (int)header->max_level && at + (size_t)level * UPPER_LINKS <= upper_ints;
+        upper_links[i] = level > 0 && ok ? upper + at : NULL;
+        at += ok ? (size_t)level * UPPER_LINKS : 0;
+    }
+    if (!ok || at != upper_ints) {
+        fprintf(stderr, "HNSW index file %s has inconsistent node levels\n", path);
+        free_hnsw(hnsw);
+        return NULL;
+    }
+    hnsw->num_elements = n;
+    hnsw->capacity = n;
+    hnsw->max_level = header->max_level;
+    hnsw->entry_point = header->entry_point;
+    hnsw->next_label = header->next_label;
+    hnsw->slots_capacity = header->next_label;
+    hnsw->num_deleted = header->num_deleted;
+    return hnsw;
+}
 
-    free(node_visited);
+// Checks that a list read from the file stays inside the graph: a count of
+// at most capacity and every neighbor id a node of the index
+static bool links_in_range(const int* links, int capacity, int n) {
+    if (links[0] < 0 || links[0] > capacity) return false;
+    for (int j = 0; j < links[0]; j++) {
+        if (links[1 + j] < 0 || links[1 + j] >= n) return false;
+    }
+    return true;
 }
 
-void print_hnsw_stats(HNSW* hnsw) {
-    printf("HNSW Stats:\n");
-    printf("Number of elements: %d\n", hnsw->num_elements);
-    printf("Maximum level: %d\n", hnsw->max_level);
-    printf("Dimensions: %d\n", hnsw->dimensions);
+// Checks everything searches and updates index with: link counts and
+// neighbor ids, even seqlock versions, slot states, and labels and slots
+// that point at each other
+static bool file_structure_valid(const HNSW* hnsw) {
+    int n = hnsw->num_elements;
+    for (int i = 0; i < n; i++) {
+        const int* row = hnsw->level0 + (size_t)i * LEVEL0_LINKS;
+        if ((row[0] & 1) || !links_in_range(row + 1, 2 * M, n) || hnsw->deleted[i] > HNSW_FREED) return false;
+        for (int level = 1; level <= hnsw->levels[i]; level++) {
+            if (!links_in_range(hnsw->upper_links[i] + (size_t)(level - 1) * UPPER_LINKS, M, n)) return false;
+        }
+        int label = hnsw->labels[i];
+        if (hnsw->deleted[i] != HNSW_FREED && (label < 0 || label >= hnsw->next_label)) return false;
+        if (hnsw->deleted[i] == HNSW_LIVE && hnsw->slots[label] != i) return false;
+    }
+    int live = 0;
+    for (int label = 0; label < hnsw->next_label; label++) {
+        int id = hnsw->slots[label];
+        if (id < -1 || id >= n || (id >= 0 && (hnsw->labels[id] != label || hnsw->deleted[id] != HNSW_LIVE))) {
+            return false;
+        }
+        live += id >= 0;
+    }
+    return hnsw->num_deleted >= 0 && hnsw->num_deleted <= n - live;
 }
 
-// Add a function to free the HNSW structure
-void free_hnsw(HNSW* hnsw) {
-    for (int i = 0; i < MAX_LEVELS; i++) {
-        free(hnsw->level_pqs[i].elements);
+int hnsw_verify(const HNSW* hnsw) {
+    if (hnsw->mapping == NULL) return 0;
+    const HNSWFileHeader* header = hnsw->mapping;
+    for (int s = 0; s < NUM_SECTIONS; s++) {
+        const HNSWFileSection* section = &header->sections[s];
+        if (file_checksum((const char*)hnsw->mapping + section->offset, section->size) != section->checksum) {
+            fprintf(stderr, "HNSW index file section %d fails its checksum\n", s);
+            return -1;
+        }
     }
-    free(hnsw->level_pqs);
-    free(hnsw);
+    if (!file_structure_valid(hnsw)) {
+        fprintf(stderr, "HNSW index file has out of range links, labels or slots\n");
+        return -1;
+    }
+    return 0;
 }
 
 void verify_graph_structure(HNSW* hnsw) {
     for (int i = 0; i < hnsw->num_elements; i++) {
-        for (int level = 0; level <= hnsw->nodes[i].level; level++) {
-            for (int j = 0; j < hnsw->nodes[i].num_connections[level]; j++) {
-                int neighbor = hnsw->nodes[i].connections[level][j];
+        for (int level = 0; level <= hnsw->levels[i]; level++) {
+            int* links = node_links(hnsw, i, level);
+            for (int j = 0; j < links[0]; j++) {
+                int neighbor = links[1 + j];
                 if (neighbor >= hnsw->num_elements) {
                     printf("Error: Node %d at level %d has invalid connection to %d\n", i, level, neighbor);
                 }
-                if (!contains_connection(hnsw->nodes[neighbor].connections[level], hnsw->nodes[neighbor].num_connections[level], i)) {
+                int* neighbor_links = node_links(hnsw, neighbor, level);
+                if (!neighbor_links || !contains_connection(neighbor_links + 1, neighbor_links[0], i)) {
                     printf("Warning: Bidirectional connection missing between %d and %d at level %d\n", i, neighbor, level);
                 }
             }
@@ -419,7 +1285,7 @@ void verify_graph_structure(HNSW* hnsw) {
 //     printf("%-10s %-10s %-s\n", "Index", "Distance", "Vector");
 //     for (int i = 0; i < num_results; i++) {
 //         int index = result[i];
-//         float* vector = hnsw->nodes[index].vector;
+//         const float* vector = hnsw_vector(hnsw, index);
 //         printf("%-10d %-10.4f [%.2f, %.2f, %.2f]\n", 
 //                index, distances[i], vector[0], vector[1], vector[2]);
 //     }
@@ -2,36 +2,128 @@
 #define HNSW_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
 #include "priority-queue.h"
+#include "visited.h"
 
-#define MAX_ELEMENTS 10000
-#define MAX_DIMENSIONS 128
 #define MAX_LEVELS 16
 #define M 16
 #define ef_construction 200
 #define PQ_SIZE 500
+// Result list size search() uses; hnsw_search takes it per call
+#define HNSW_DEFAULT_EF 64
 
-typedef struct Node {
-    float vector[MAX_DIMENSIONS];
-    int connections[MAX_LEVELS][M];
-    int num_connections[MAX_LEVELS];
-    int level;
-} Node;
+// Vectors start on cache lines and every row is padded to a whole line
+#define HNSW_ALIGNMENT 64
+#define HNSW_INITIAL_CAPACITY 256
+// hnsw_delete compacts once tombstones exceed this fraction of the live elements
+#define HNSW_COMPACT_FRACTION 0.1
 
+// Node storage is split by access pattern. Vectors sit in one aligned arena
+// (capacity x stride floats) and level-0 adjacency, which every node has, is
+// one contiguous block of (2 + 2M) ints per node: a seqlock version over all
+// of the node's lists, the neighbor count, then the ids. The few nodes above
+// level 0 get a separate (1 + M) ints per upper level. Each link's distance is
+// cached alongside so pruning a full list does not recompute it. The arrays
+// double as the index grows.
+//
+// Callers see ids (labels) in insertion order, which stay fixed for the life
+// of an element. Internally each element sits in a slot; a deleted element is
+// a tombstone that searches still walk through but never return, until
+// compaction unlinks it and frees its slot for a later insert.
+//
+// Searches may run on any number of threads while one insert or
+// build_hnsw_parallel runs; inserts are serialized with each other. Searches
+// take no locks: they copy neighbor lists under the node's version and retry
+// a copy that overlapped a write, see a node only once all its lists are set,
+// and start from entry_point, which is published last. Arrays replaced by
+// growth, and slots freed by compaction, are kept until no search is running.
 typedef struct HNSW {
-    Node nodes[MAX_ELEMENTS];
-    int num_elements;
+    int num_elements;    // slots in use, including tombstones and freed slots
+    int capacity;
     int max_level;
+    int entry_point;     // a node on max_level, -1 while empty
     int dimensions;
-    PriorityQueue* level_pqs;
+    int stride;          // floats per vector row, dimensions rounded up to HNSW_ALIGNMENT
+    float* vectors;      // capacity x stride, HNSW_ALIGNMENT aligned
+    int* level0;         // capacity x (2 + 2M)
+    float* level0_distances;  // capacity x 2M
+    int* levels;         // capacity: top level of each node
+    int** upper_links;   // capacity: levels[i] x (1 + M) for levels 1.., NULL on level-0 nodes
+    float** upper_distances;  // capacity: levels[i] x M, NULL on level-0 nodes
+    int* labels;         // capacity: the id callers know each slot by
+    unsigned char* deleted;  // capacity: HNSW_LIVE, HNSW_TOMBSTONE or HNSW_FREED
+    int* slots;          // slots_capacity: slot of each id, -1 once deleted
+    int slots_capacity;
+    int next_label;
+    int num_deleted;     // tombstones not yet compacted
+    int* free_slots;     // capacity: freed slots inserts reuse
+    int num_free_slots;
+    int* pending_slots;  // capacity: compacted slots a running search may still reach
+    int num_pending_slots;
+    pthread_mutex_t entry_lock;  // serializes entry point / max_level promotion
+    pthread_mutex_t write_lock;  // held by insert and build_hnsw_parallel
+    int active_searches;
+    void** retired;      // arrays replaced by growth, freed once active_searches is 0
+    int num_retired;
+    int retired_capacity;
+    void* mapping;       // the file of an index from hnsw_open, NULL otherwise
+    size_t mapping_size;
+    // select_neighbors options, off by default; set before inserting
+    bool extend_candidates;  // also consider the candidates' neighbors
+    bool keep_pruned;        // fill up to M with candidates the heuristic skipped
+    VisitedPool visited_pool;  // one visited list per concurrent search or insert
 } HNSW;
 
+enum { HNSW_LIVE, HNSW_TOMBSTONE, HNSW_FREED };
+
 void init_hnsw(HNSW* hnsw, int dimensions);
-void insert(HNSW* hnsw, float* vector);
+// Copies vector into the index and links it. Returns its id (insertion order).
+int insert(HNSW* hnsw, float* vector);
+// Inserts n vectors (n x dimensions floats) using threads workers, one per
+// CPU if threads <= 0. Ids follow input order, as with insert; the graph
+// differs from a serial build only in link order. Freed slots are not reused.
+void build_hnsw_parallel(HNSW* hnsw, const float* vectors, int n, int threads);
+// Writes the ids and distances of the k nearest elements found, closest
+// first, and returns how many. ef (raised to k if smaller) is the result
+// list size of the level-0 search: larger is slower with higher recall.
+int hnsw_search(HNSW* hnsw, const float* query, int k, int ef, int* result, float* distances);
+// hnsw_search with HNSW_DEFAULT_EF
 int search(HNSW* hnsw, float* query, int k, int* result, float* distances);
+// The stored copy of element id, valid until the next insert. NULL once deleted.
+const float* hnsw_vector(const HNSW* hnsw, int id);
+// Removes element id from search results. Its neighbors are relinked to the
+// node's other neighbors; the node stays traversable until compaction, which
+// runs here once tombstones pass HNSW_COMPACT_FRACTION. Searches may run
+// meanwhile. Returns false if id is unknown or already deleted.
+bool hnsw_delete(HNSW* hnsw, int id);
+// Unlinks every tombstone from the graph and frees its slot for reuse
+void compact_hnsw(HNSW* hnsw);
+// Bytes held by the vector arena and adjacency lists
+size_t hnsw_memory_bytes(const HNSW* hnsw);
 void print_hnsw_stats(HNSW* hnsw);
+// Frees the index storage and hnsw itself
 void free_hnsw(HNSW* hnsw);
+// Writes the index to path (replaced atomically) in the page-aligned layout
+// hnsw_open maps. Searches may run meanwhile. Returns 0 on success.
+int hnsw_save(HNSW* hnsw, const char* path);
+// Maps an index written by hnsw_save and searches it in place, read-only and
+// shared with other processes that open the file. Only the header and node
+// levels are checked and searches trust the links, labels and slots, so call
+// hnsw_verify on any file this process did not just write. The first insert
+// copies the index to the heap. Returns NULL on failure; free with free_hnsw.
+HNSW* hnsw_open(const char* path);
+// Checks every section of an opened index file against its checksum and that
+// every link count, neighbor id, label and slot is in range, which reads the
+// whole file. Returns 0 if it passes (or the index is not mapped).
+int hnsw_verify(const HNSW* hnsw);
 void print_all_nodes(HNSW* hnsw);
-void select_neighbors(HNSW* hnsw, int current, PriorityQueue* candidates, int level, int max_connections);
+// HNSW neighbor heuristic: walks candidates (count entries sorted by distance
+// to base) and keeps one only if it is closer to base than to every neighbor
+// kept so far, up to max_neighbors. Writes the kept ones to selected and
+// returns how many.
+int select_neighbors(HNSW* hnsw, const float* base, const PQElement* candidates, int count, int level,
+                     int max_neighbors, PQElement* selected);
 
 #endif // HNSW_H
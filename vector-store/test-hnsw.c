@@ -0,0 +1,488 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "hnsw.h"
+#include "exhaustive.h"
+
+// Embedding-sized vectors, more than the old fixed 128-dim / 10000-node
+// limits allowed, drawn around a few centers like clustered embeddings
+#define NUM_VECTORS 3000
+#ifndef DIMENSIONS
+#define DIMENSIONS 384
+#endif
+#define NUM_CLUSTERS 20
+#define NUM_QUERIES 100
+#define K 10
+#define MIN_RECALL 0.9
+#define NUM_READERS 3
+#define INDEX_FILE "test-hnsw.index"
+
+static int failures = 0;
+
+static void check(const char* what, double value, double limit, int at_least) {
+    int ok = at_least ? value >= limit : value <= limit;
+    printf("%-4s %-48s %.4g (%s %.4g)\n", ok ? "ok" : "FAIL", what, value, at_least ? "min" : "max", limit);
+    if (!ok) failures++;
+}
+
+static float random_float(void) {
+    return (float)rand() / (float)RAND_MAX * 2.0f - 1.0f;
+}
+
+static void clustered_vectors(float* vectors, int n, int dim, const float* centers) {
+    for (int i = 0; i < n; i++) {
+        const float* center = centers + (size_t)(rand() % NUM_CLUSTERS) * dim;
+        for (int d = 0; d < dim; d++) vectors[(size_t)i * dim + d] = center[d] + 0.3f * random_float();
+    }
+}
+
+// Fraction of the exact k nearest neighbours the index returns, over every query
+static double recall(HNSW* hnsw, ExhaustiveStore* exact, const float* queries, int num_queries, int k, int ef,
+                     double* seconds) {
+    struct timespec start, end;
+    int found = 0;
+    *seconds = 0.0;
+    for (int q = 0; q < num_queries; q++) {
+        float* query = (float*)queries + (size_t)q * exact->dimensions;
+        int expected[K], result[K];
+        float expected_distances[K], distances[K];
+        int num_expected = search_exhaustive(exact, query, k, expected, expected_distances);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        int num_results = hnsw_search(hnsw, query, k, ef, result, distances);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        *seconds += (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+        for (int i = 0; i < num_results; i++) {
+            for (int j = 0; j < num_expected; j++) {
+                if (result[i] == expected[j]) {
+                    found++;
+                    break;
+                }
+            }
+        }
+    }
+    return (double)found / (num_queries * k);
+}
+
+// Counts links from live slots to deleted ones
+static int links_to_deleted(const HNSW* hnsw) {
+    int count = 0;
+    for (int i = 0; i < hnsw->num_elements; i++) {
+        if (hnsw->deleted[i] != HNSW_LIVE) continue;
+        for (int level = 0; level <= hnsw->levels[i]; level++) {
+            const int* links = level == 0 ? hnsw->level0 + (size_t)i * (2 + 2 * M) + 1 : hnsw->upper_links[i] + (level - 1) * (1 + M);
+            for (int j = 0; j < links[0]; j++) count += hnsw->deleted[links[1 + j]] != HNSW_LIVE;
+        }
+    }
+    return count;
+}
+
+// Counts links that break the adjacency invariants: lists over capacity,
+// self or repeated links, and cached distances that differ from the vectors'
+static int bad_links(const HNSW* hnsw) {
+    int bad = 0;
+    for (int i = 0; i < hnsw->num_elements; i++) {
+        for (int level = 0; level <= hnsw->levels[i]; level++) {
+            const int* links = level == 0 ? hnsw->level0 + (size_t)i * (2 + 2 * M) + 1 : hnsw->upper_links[i] + (level - 1) * (1 + M);
+            const float* cached = level == 0 ? hnsw->level0_distances + (size_t)i * 2 * M : hnsw->upper_distances[i] + (level - 1) * M;
+            if (links[0] > (level == 0 ? 2 * M : M)) bad++;
+            for (int j = 0; j < links[0]; j++) {
+                const float* a = hnsw->vectors + (size_t)i * hnsw->stride;
+                const float* b = hnsw->vectors + (size_t)links[1 + j] * hnsw->stride;
+                double dist = 0.0;
+                for (int d = 0; d < hnsw->dimensions; d++) dist += ((double)a[d] - b[d]) * ((double)a[d] - b[d]);
+                if (links[1 + j] == i || fabs(sqrt(dist) - cached[j]) > 1e-4 * (1.0 + sqrt(dist))) bad++;
+                for (int k = 0; k < j; k++) bad += links[1 + k] == links[1 + j];
+            }
+        }
+    }
+    return bad;
+}
+
+// Visited lists must forget every node on reset, including across the epoch wrap
+static void test_visited_list(void) {
+    VisitedPool pool;
+    init_visited_pool(&pool);
+    VisitedList* list = acquire_visited_list(&pool, 100);
+    int stale = 0, fresh = 1;
+    for (int round = 0; round < 70000; round++) {
+        int id = round % 100;
+        fresh &= visit(list, id) && !visit(list, id);
+        reset_visited_list(list);
+        for (int i = 0; i < 100; i++) stale += is_visited(list, i);
+    }
+    release_visited_list(&pool, list);
+    // A released list is reused and grown to the new size
+    VisitedList* grown = acquire_visited_list(&pool, 5000);
+    for (int i = 0; i < 5000; i++) stale += is_visited(grown, i);
+    check("visited list reuses the released list", grown == list, 1, 1);
+    release_visited_list(&pool, grown);
+    free_visited_pool(&pool);
+    check("visited list marks each id once per epoch", fresh, 1, 1);
+    check("visited ids left after reset (70000 epochs)", stale, 0, 0);
+}
+
+typedef struct {
+    HNSW* hnsw;
+    const float* vectors;
+    const float* queries;
+    const float* base_kth;  // per query: exact k-th distance before the writer started
+    int writer_done;
+} StressState;
+
+typedef struct {
+    StressState* state;
+    int first_query;
+    long searches, torn, hits, results;
+} StressReader;
+
+static void* stress_writer(void* arg) {
+    StressState* state = arg;
+    for (int i = state->hnsw->num_elements; i < NUM_VECTORS; i++) {
+        insert(state->hnsw, (float*)state->vectors + (size_t)i * DIMENSIONS);
+    }
+    __atomic_store_n(&state->writer_done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+// Searches until the writer is done. A result is torn if the result count is
+// short, an id is out of range or repeated, distances are out of order, or a
+// distance does not match the input vector. The index only grows, so a good
+// result is at least as close as the k-th neighbor before the writer started.
+static void* stress_reader(void* arg) {
+    StressReader* reader = arg;
+    const StressState* state = reader->state;
+    for (int q = reader->first_query; !__atomic_load_n(&state->writer_done, __ATOMIC_ACQUIRE) || reader->searches < 50;
+         q = (q + 1) % NUM_QUERIES) {
+        const float* query = state->queries + (size_t)q * DIMENSIONS;
+        int result[K];
+        float distances[K];
+        int count = hnsw_search(state->hnsw, query, K, HNSW_DEFAULT_EF, result, distances);
+        reader->searches++;
+        reader->torn += count != K;
+        for (int i = 0; i < count; i++) {
+            int id = result[i];
+            if (id < 0 || id >= NUM_VECTORS || (i > 0 && distances[i] < distances[i - 1])) {
+                reader->torn++;
+                continue;
+            }
+            for (int j = 0; j < i; j++) reader->torn += result[j] == id;
+            const float* v = state->vectors + (size_t)id * DIMENSIONS;
+            double dist = 0.0;
+            for (int d = 0; d < DIMENSIONS; d++) dist += ((double)query[d] - v[d]) * ((double)query[d] - v[d]);
+            reader->torn += fabs(sqrt(dist) - distances[i]) > 1e-4 * (1.0 + sqrt(dist));
+            reader->hits += distances[i] <= state->base_kth[q] * (1.0f + 1e-5f);
+            reader->results++;
+        }
+    }
+    return NULL;
+}
+
+// Streams the second half of the vectors into an index built from the first
+// half, forcing it to grow, while reader threads search it
+static void test_concurrent_search(const float* vectors, const float* queries, ExhaustiveStore* exact) {
+    HNSW* hnsw = malloc(sizeof(HNSW));
+    init_hnsw(hnsw, DIMENSIONS);
+    for (int i = 0; i < NUM_VECTORS / 2; i++) insert(hnsw, (float*)vectors + (size_t)i * DIMENSIONS);
+    int capacity = hnsw->capacity;
+
+    ExhaustiveStore base = *exact;
+    base.num_elements = NUM_VECTORS / 2;
+    float* base_kth = malloc(NUM_QUERIES * sizeof(float));
+    for (int q = 0; q < NUM_QUERIES; q++) {
+        int expected[K];
+        float expected_distances[K];
+        search_exhaustive(&base, (float*)queries + (size_t)q * DIMENSIONS, K, expected, expected_distances);
+        base_kth[q] = expected_distances[K - 1];
+    }
+
+    StressState state = { hnsw, vectors, queries, base_kth, 0 };
+    StressReader readers[NUM_READERS];
+    pthread_t reader_threads[NUM_READERS], writer_thread;
+    for (int r = 0; r < NUM_READERS; r++) {
+        readers[r] = (StressReader){ &state, r * NUM_QUERIES / NUM_READERS, 0, 0, 0, 0 };
+        pthread_create(&reader_threads[r], NULL, stress_reader, &readers[r]);
+    }
+    pthread_create(&writer_thread, NULL, stress_writer, &state);
+    pthread_join(writer_thread, NULL);
+    long searches = 0, torn = 0, hits = 0, results = 0;
+    for (int r = 0; r < NUM_READERS; r++) {
+        pthread_join(reader_threads[r], NULL);
+        searches += readers[r].searches;
+        torn += readers[r].torn;
+        hits += readers[r].hits;
+        results += readers[r].results;
+    }
+
+    printf("%ld searches by %d readers during %d inserts\n", searches, NUM_READERS, NUM_VECTORS - NUM_VECTORS / 2);
+    check("index grew under concurrent searches", hnsw->capacity > capacity, 1, 1);
+    check("torn or invalid results during inserts", torn, 0, 0);
+    check("results as close as the k-th before inserts", results ? (double)hits / results : 0.0, MIN_RECALL, 1);
+    double seconds;
+    check("recall@10 after concurrent inserts", recall(hnsw, exact, queries, NUM_QUERIES, K, HNSW_DEFAULT_EF, &seconds),
+          MIN_RECALL, 1);
+    check("invalid links or cached distances (concurrent)", bad_links(hnsw), 0, 0);
+    free(base_kth);
+    free_hnsw(hnsw);
+}
+
+// Fraction of the exact k nearest vectors among ids [0, n) not in removed that
+// the index returns, over every query; counts returned removed ids in *returned
+static double live_recall(HNSW* hnsw, const float* vectors, int n, const unsigned char* removed, const float* queries,
+                          int* returned) {
+    int found = 0;
+    float* dist = malloc(n * sizeof(float));
+    for (int q = 0; q < NUM_QUERIES; q++) {
+        const float* query = queries + (size_t)q * DIMENSIONS;
+        int expected[K];
+        for (int i = 0; i < n; i++) {
+            dist[i] = INFINITY;
+            if (removed[i]) continue;
+            double sum = 0.0;
+            for (int d = 0; d < DIMENSIONS; d++) sum += ((double)query[d] - vectors[(size_t)i * DIMENSIONS + d]) * ((double)query[d] - vectors[(size_t)i * DIMENSIONS + d]);
+            dist[i] = (float)sum;
+        }
+        for (int k = 0; k < K; k++) {
+            int best = 0;
+            for (int i = 1; i < n; i++) best = dist[i] < dist[best] ? i : best;
+            expected[k] = best;
+            dist[best] = INFINITY;
+        }
+
+        int result[K];
+        float distances[K];
+        int count = hnsw_search(hnsw, query, K, HNSW_DEFAULT_EF, result, distances);
+        for (int i = 0; i < count; i++) {
+            *returned += result[i] < 0 || result[i] >= n || removed[result[i]];
+            for (int j = 0; j < K; j++) found += result[i] == expected[j];
+        }
+    }
+    free(dist);
+    return (double)found / (NUM_QUERIES * K);
+}
+
+// Churns an index: rounds of deleting 5% of the elements (the entry point
+// among them) and inserting as many new ones, which passes the compaction
+// threshold, so later inserts reuse freed slots. Ids must stay put, deleted
+// ones never come back, and recall over the live set must hold.
+static void test_delete(const float* vectors, const float* queries) {
+    HNSW* hnsw = malloc(sizeof(HNSW));
+    init_hnsw(hnsw, DIMENSIONS);
+    int n = NUM_VECTORS / 2, per_round = NUM_VECTORS / 40, rounds = 6;
+    for (int i = 0; i < n; i++) insert(hnsw, (float*)vectors + (size_t)i * DIMENSIONS);
+    unsigned char* removed = calloc(NUM_VECTORS, 1);
+
+    int ids_kept = 1, rejected = 1, compactions = 0, returned = 0;
+    for (int round = 0; round < rounds; round++) {
+        for (int d = 0; d < per_round; d++) {
+            int id = d == 0 ? hnsw->labels[hnsw->entry_point] : rand() % n;
+            while (removed[id]) id = rand() % n;
+            int tombstones = hnsw->num_deleted;
+            ids_kept &= hnsw_delete(hnsw, id);
+            removed[id] = 1;
+            compactions += hnsw->num_deleted < tombstones;
+            rejected &= !hnsw_delete(hnsw, id) && hnsw_vector(hnsw, id) == NULL;
+        }
+        for (int i = 0; i < per_round; i++, n++) {
+            ids_kept &= insert(hnsw, (float*)vectors + (size_t)n * DIMENSIONS) == n;
+        }
+        ids_kept &= memcmp(hnsw_vector(hnsw, n - 1), vectors + (size_t)(n - 1) * DIMENSIONS, DIMENSIONS * sizeof(float)) == 0;
+    }
+    double recall_after = live_recall(hnsw, vectors, n, removed, queries, &returned);
+
+    check("ids survive deletes and slot reuse", ids_kept, 1, 1);
+    check("deleting a deleted id is refused", rejected, 1, 1);
+    check("compactions while deleting 5% per round", compactions, 1, 1);
+    check("slots in use after reuse", hnsw->num_elements, n - per_round * 2, 0);
+    check("deleted ids returned by searches", returned, 0, 0);
+    check("recall@10 over live elements after churn", recall_after, MIN_RECALL, 1);
+    check("invalid links or cached distances (churn)", bad_links(hnsw), 0, 0);
+
+    compact_hnsw(hnsw);
+    check("links to deleted nodes after compaction", links_to_deleted(hnsw), 0, 0);
+    check("tombstones after compaction", hnsw->num_deleted, 0, 0);
+    returned = 0;
+    check("recall@10 over live elements after compaction", live_recall(hnsw, vectors, n, removed, queries, &returned),
+          MIN_RECALL, 1);
+    check("deleted ids returned after compaction", returned, 0, 0);
+    print_hnsw_stats(hnsw);
+    free(removed);
+    free_hnsw(hnsw);
+}
+
+// Saves hnsw, maps it back and checks the copy answers every query the same,
+// that corruption is caught, and that the mapped index still takes inserts
+static void test_save_open(HNSW* hnsw, ExhaustiveStore* exact, const float* queries, const float* vectors) {
+    check("index saved", hnsw_save(hnsw, INDEX_FILE), 0, 0);
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    HNSW* opened = hnsw_open(INDEX_FILE);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    check("index file opened", opened != NULL, 1, 1);
+    if (!opened) return;
+    printf("opened %d-node index in %.3f ms\n", opened->num_elements,
+           ((end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9) * 1e3);
+    check("index file checksums", hnsw_verify(opened), 0, 0);
+
+    int same = opened->num_elements == hnsw->num_elements && opened->entry_point == hnsw->entry_point;
+    for (int q = 0; q < NUM_QUERIES; q++) {
+        int expected[K], result[K];
+        float expected_distances[K], distances[K];
+        int count = hnsw_search(hnsw, queries + (size_t)q * DIMENSIONS, K, HNSW_DEFAULT_EF, expected, expected_distances);
+        same &= hnsw_search(opened, queries + (size_t)q * DIMENSIONS, K, HNSW_DEFAULT_EF, result, distances) == count;
+        same &= memcmp(result, expected, count * sizeof(int)) == 0 && memcmp(distances, expected_distances, count * sizeof(float)) == 0;
+    }
+    check("mapped index gives the same results", same, 1, 1);
+
+    // Inserting copies the mapped index to the heap
+    HNSW* grown = hnsw_open(INDEX_FILE);
+    int n = grown->num_elements;
+    for (int i = 0; i < 100; i++) insert(grown, (float*)vectors + (size_t)i * DIMENSIONS);
+    double seconds;
+    check("recall@10 after inserting into a mapped index",
+          recall(grown, exact, queries, NUM_QUERIES, K, HNSW_DEFAULT_EF, &seconds), MIN_RECALL, 1);
+    check("invalid links or cached distances (mapped)", bad_links(grown), 0, 0);
+    check("elements after inserting into a mapped index", grown->num_elements, n + 100, 1);
+
+    // A neighbor id past the last node, saved with matching checksums, fails
+    // the range checks
+    int* row = grown->level0;  // node 0: version, count, neighbor ids
+    int neighbor = row[2];
+    row[2] = grown->num_elements + 5;
+    check("index with a bad link saved", hnsw_save(grown, INDEX_FILE), 0, 0);
+    row[2] = neighbor;
+    HNSW* bad_link = hnsw_open(INDEX_FILE);
+    check("out of range neighbor id fails verification", bad_link && hnsw_verify(bad_link) != 0, 1, 1);
+    if (bad_link) free_hnsw(bad_link);
+    free_hnsw(grown);
+    free_hnsw(opened);
+
+    // A flipped vector byte fails the checksum; a truncated file does not open
+    FILE* file = fopen(INDEX_FILE, "r+b");
+    fseek(file, HNSW_ALIGNMENT * 100 + 4096, SEEK_SET);
+    int byte = fgetc(file);
+    fseek(file, -1, SEEK_CUR);
+    fputc(byte ^ 1, file);
+    fclose(file);
+    HNSW* corrupt = hnsw_open(INDEX_FILE);
+    check("corrupted index file fails verification", corrupt && hnsw_verify(corrupt) != 0, 1, 1);
+    if (corrupt) free_hnsw(corrupt);
+    if (truncate(INDEX_FILE, 4096 * 3) == 0) {
+        check("truncated index file is rejected", hnsw_open(INDEX_FILE) == NULL, 1, 1);
+    }
+    remove(INDEX_FILE);
+}
+
+// Checks the visited lists, then builds an index over clustered 384-dim
+// vectors, checks the storage (exact copies, aligned rows, growth, bytes per
+// node) and recall@10 against the exhaustive store over a sweep of ef.
+int main(void) {
+    srand(1);
+    test_visited_list();
+
+    float* centers = malloc((size_t)NUM_CLUSTERS * DIMENSIONS * sizeof(float));
+    float* vectors = malloc((size_t)NUM_VECTORS * DIMENSIONS * sizeof(float));
+    float* queries = malloc((size_t)NUM_QUERIES * DIMENSIONS * sizeof(float));
+    for (int i = 0; i < NUM_CLUSTERS * DIMENSIONS; i++) centers[i] = random_float();
+    clustered_vectors(vectors, NUM_VECTORS, DIMENSIONS, centers);
+    clustered_vectors(queries, NUM_QUERIES, DIMENSIONS, centers);
+
+    HNSW* hnsw = malloc(sizeof(HNSW));
+    ExhaustiveStore exact;
+    init_hnsw(hnsw, DIMENSIONS);
+    init_exhaustive_store(&exact, DIMENSIONS);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int ids_in_order = 1;
+    for (int i = 0; i < NUM_VECTORS; i++) {
+        ids_in_order &= insert(hnsw, vectors + (size_t)i * DIMENSIONS) == i;
+        ids_in_order &= insert_exhaustive(&exact, vectors + (size_t)i * DIMENSIONS) == i;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+    printf("built %d x %d index in %.3f s\n", NUM_VECTORS, DIMENSIONS, seconds);
+    check("ids follow insertion order", ids_in_order, 1, 1);
+
+    int copies = 1, aligned = 1;
+    for (int i = 0; i < NUM_VECTORS; i++) {
+        const float* stored = hnsw_vector(hnsw, i);
+        copies &= memcmp(stored, vectors + (size_t)i * DIMENSIONS, DIMENSIONS * sizeof(float)) == 0;
+        copies &= memcmp(exhaustive_vector(&exact, i), vectors + (size_t)i * DIMENSIONS, DIMENSIONS * sizeof(float)) == 0;
+        aligned &= (uintptr_t)stored % HNSW_ALIGNMENT == 0;
+    }
+    check("stored vectors match the inserted ones", copies, 1, 1);
+    check("vector rows are aligned", aligned, 1, 1);
+
+    // Adjacency and cached distances per node against the old fixed MAX_LEVELS x M table and counts
+    double vector_bytes = (double)hnsw->stride * sizeof(float);
+    double graph_bytes = (double)hnsw_memory_bytes(hnsw) / hnsw->capacity - vector_bytes;
+    check("graph bytes per node", graph_bytes, (MAX_LEVELS * M + MAX_LEVELS + 1) * sizeof(int) / 3.0, 0);
+    check("invalid links or cached distances", bad_links(hnsw), 0, 0);
+
+    // Larger ef trades latency for recall
+    static const int efs[] = { 10, 32, HNSW_DEFAULT_EF, 128, 256 };
+    double recalls[5];
+    for (int e = 0; e < 5; e++) {
+        double seconds;
+        recalls[e] = recall(hnsw, &exact, queries, NUM_QUERIES, K, efs[e], &seconds);
+        printf("ef %3d: recall@%d %.3f, %.1f us per query\n", efs[e], K, recalls[e], seconds * 1e6 / NUM_QUERIES);
+    }
+    check("hnsw recall@10 at the default ef", recalls[2], MIN_RECALL, 1);
+    check("recall gained from ef 10 to 256", recalls[4] - recalls[0], 0.0, 1);
+
+    // The optional neighbor selection modes build a usable graph too
+    HNSW* extended = malloc(sizeof(HNSW));
+    init_hnsw(extended, DIMENSIONS);
+    extended->extend_candidates = true;
+    extended->keep_pruned = true;
+    for (int i = 0; i < NUM_VECTORS / 3; i++) insert(extended, vectors + (size_t)i * DIMENSIONS);
+    ExhaustiveStore extended_exact = exact;
+    extended_exact.num_elements = NUM_VECTORS / 3;
+    double search_seconds;
+    check("recall@10 with extend_candidates and keep_pruned",
+          recall(extended, &extended_exact, queries, NUM_QUERIES, K, HNSW_DEFAULT_EF, &search_seconds), MIN_RECALL, 1);
+    check("invalid links or cached distances (extended)", bad_links(extended), 0, 0);
+    free_hnsw(extended);
+
+    // Workers link nodes concurrently; the graph must be as valid and as good
+    HNSW* parallel = malloc(sizeof(HNSW));
+    init_hnsw(parallel, DIMENSIONS);
+    build_hnsw_parallel(parallel, vectors, NUM_VECTORS, 4);
+    check("parallel build element count", parallel->num_elements, NUM_VECTORS, 1);
+    check("stored vectors match the inserted ones (parallel)",
+          memcmp(hnsw_vector(parallel, NUM_VECTORS - 1), vectors + (size_t)(NUM_VECTORS - 1) * DIMENSIONS,
+                 DIMENSIONS * sizeof(float)) == 0, 1, 1);
+    check("recall@10 after a 4-thread build",
+          recall(parallel, &exact, queries, NUM_QUERIES, K, HNSW_DEFAULT_EF, &search_seconds), MIN_RECALL, 1);
+    check("invalid links or cached distances (parallel)", bad_links(parallel), 0, 0);
+    free_hnsw(parallel);
+
+    test_concurrent_search(vectors, queries, &exact);
+    test_save_open(hnsw, &exact, queries, vectors);
+    test_delete(vectors, queries);
+
+    HNSW* empty = malloc(sizeof(HNSW));
+    init_hnsw(empty, DIMENSIONS);
+    int result[K];
+    float distances[K];
+    check("results from an empty index", search(empty, queries, K, result, distances), 0, 0);
+    free_hnsw(empty);
+    print_hnsw_stats(hnsw);
+
+    free_hnsw(hnsw);
+    free_exhaustive_store(&exact);
+    free(centers);
+    free(vectors);
+    free(queries);
+    if (failures) {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    printf("PASS\n");
+    return 0;
+}
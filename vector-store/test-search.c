@@ -20,7 +20,7 @@ void generate_random_vector(float* vector, int dimensions) {
 }
 
 // Update the print_vector function to handle NULL pointers
-void print_vector(float* vector, int dimensions) {
+void print_vector(const float* vector, int dimensions) {
     if (vector == NULL) {
         printf("[NULL]");
         return;
@@ -108,7 +108,7 @@ int main() {
         int index = hnsw_result[i];
         printf("%-10d %-10.4f ", index, hnsw_distances[i]);
         // take vector list from exhaustive store
-        print_vector(exhaustive.elements[index].vector, DIMENSIONS);
+        print_vector(exhaustive_vector(&exhaustive, index), DIMENSIONS);
         printf("\n");
     }
 
@@ -117,12 +117,13 @@ int main() {
     for (int i = 0; i < exhaustive_num_results; i++) {
         int index = exhaustive_result[i];
         printf("%-10d %-10.4f ", index, exhaustive_distances[i]);
-        print_vector(exhaustive.elements[index].vector, DIMENSIONS);
+        print_vector(exhaustive_vector(&exhaustive, index), DIMENSIONS);
         printf("\n");
     }
 
     // Free allocated memory
     free_hnsw(hnsw);
+    free_exhaustive_store(&exhaustive);
 
     return 0;
 }
@@ -1,7 +1,7 @@
 #include <math.h>
 #include "util.h"
 
-float euclidean_distance(float* a, float* b, int dimensions) {
+float euclidean_distance(const float* a, const float* b, int dimensions) {
     float sum = 0.0f;
     for (int i = 0; i < dimensions; i++) {
         float diff = a[i] - b[i];
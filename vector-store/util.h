@@ -1,7 +1,7 @@
 #ifndef UTIL_H
 #define UTIL_H
 
-float euclidean_distance(float* a, float* b, int dimensions);
+float euclidean_distance(const float* a, const float* b, int dimensions);
 
 #endif // UTIL_H
 
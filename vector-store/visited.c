@@ -0,0 +1,78 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "visited.h"
+
+void init_visited_pool(VisitedPool* pool) {
+    pool->free_lists = NULL;
+    pool->num_free = 0;
+    pool->max_free = 0;
+    pthread_mutex_init(&pool->lock, NULL);
+}
+
+void reset_visited_list(VisitedList* list) {
+    if (++list->epoch == 0) {
+        // Tags from 65535 searches ago would read as visited again
+        memset(list->tags, 0, (size_t)list->capacity * sizeof(uint16_t));
+        list->epoch = 1;
+    }
+}
+
+VisitedList* acquire_visited_list(VisitedPool* pool, int num_elements) {
+    VisitedList* list = NULL;
+    pthread_mutex_lock(&pool->lock);
+    if (pool->num_free > 0) list = pool->free_lists[--pool->num_free];
+    pthread_mutex_unlock(&pool->lock);
+
+    if (list == NULL) {
+        list = calloc(1, sizeof(VisitedList));
+        if (list == NULL) {
+            fprintf(stderr, "Failed to allocate visited list\n");
+            exit(1);
+        }
+    }
+    if (list->capacity < num_elements) {
+        // Grow with headroom so an index that is being built does not realloc every insert
+        int capacity = num_elements + num_elements / 2 + 64;
+        uint16_t* tags = realloc(list->tags, (size_t)capacity * sizeof(uint16_t));
+        if (tags == NULL) {
+            fprintf(stderr, "Failed to grow visited list to %d elements\n", capacity);
+            exit(1);
+        }
+        memset(tags + list->capacity, 0, (size_t)(capacity - list->capacity) * sizeof(uint16_t));
+        list->tags = tags;
+        list->capacity = capacity;
+    }
+    reset_visited_list(list);
+    return list;
+}
+
+void release_visited_list(VisitedPool* pool, VisitedList* list) {
+    pthread_mutex_lock(&pool->lock);
+    if (pool->num_free == pool->max_free) {
+        int max_free = pool->max_free ? pool->max_free * 2 : 4;
+        VisitedList** free_lists = realloc(pool->free_lists, max_free * sizeof(VisitedList*));
+        if (free_lists == NULL) {
+            pthread_mutex_unlock(&pool->lock);
+            free(list->tags);
+            free(list);
+            return;
+        }
+        pool->free_lists = free_lists;
+        pool->max_free = max_free;
+    }
+    pool->free_lists[pool->num_free++] = list;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void free_visited_pool(VisitedPool* pool) {
+    for (int i = 0; i < pool->num_free; i++) {
+        free(pool->free_lists[i]->tags);
+        free(pool->free_lists[i]);
+    }
+    free(pool->free_lists);
+    pool->free_lists = NULL;
+    pool->num_free = 0;
+    pool->max_free = 0;
+    pthread_mutex_destroy(&pool->lock);
+}
@@ -0,0 +1,45 @@
+#ifndef VISITED_H
+#define VISITED_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+
+// Visited-node tracking for graph searches without per-search clearing. A
+// node counts as visited when its tag equals the list's current epoch, so
+// starting a new search is one increment; the tags are only zeroed when the
+// 16-bit epoch wraps.
+typedef struct {
+    uint16_t* tags;
+    uint16_t epoch;
+    int capacity;
+} VisitedList;
+
+// Lists are handed out one per concurrent search and returned for reuse
+typedef struct {
+    VisitedList** free_lists;
+    int num_free;
+    int max_free;
+    pthread_mutex_t lock;
+} VisitedPool;
+
+void init_visited_pool(VisitedPool* pool);
+// A list with a fresh epoch covering ids below num_elements
+VisitedList* acquire_visited_list(VisitedPool* pool, int num_elements);
+void release_visited_list(VisitedPool* pool, VisitedList* list);
+void free_visited_pool(VisitedPool* pool);
+// Forgets every visited node, e.g. before searching the next level
+void reset_visited_list(VisitedList* list);
+
+// Marks id visited; true if it was not already
+static inline bool visit(VisitedList* list, int id) {
+    if (list->tags[id] == list->epoch) return false;
+    list->tags[id] = list->epoch;
+    return true;
+}
+
+static inline bool is_visited(const VisitedList* list, int id) {
+    return list->tags[id] == list->epoch;
+}
+
+#endif // VISITED_H